@@ -0,0 +1,62 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+void Benchmark::run(const std::string& name, const std::vector<std::string>& arguments)
+{
+	if (name == "obj")
+	{
+		objParser(arguments);
+	}
+	else if (name == "dedup")
+	{
+		vertexDedup(arguments);
+	}
+	else if (name == "bc")
+	{
+		blockCompression(arguments);
+	}
+	else
+	{
+		throw std::runtime_error("unknown benchmark " + name + "!");
+	}
+}
+
+Benchmark::Timing Benchmark::measure(uint32_t repetitions, const std::function<void()>& work)
+{
+	Timing timing;
+	timing.bestMilliseconds = 1e30;
+
+	for (uint32_t i = 0; i < repetitions; i++)
+	{
+		auto begin = std::chrono::steady_clock::now();
+		work();
+		auto end = std::chrono::steady_clock::now();
+
+		double milliseconds = std::chrono::duration<double, std::milli>(end - begin).count();
+		timing.bestMilliseconds = std::min(timing.bestMilliseconds, milliseconds);
+		timing.meanMilliseconds += milliseconds / repetitions;
+	}
+
+	return timing;
+}
+
+void Benchmark::print(const std::string& label, const Timing& timing, double amount, const std::string& unit)
+{
+	std::streamsize precision = std::cout.precision();
+
+	std::cout << "  " << std::left << std::setw(32) << label << std::right << std::fixed << std::setprecision(2)
+		<< " best " << std::setw(10) << timing.bestMilliseconds << " ms"
+		<< "  mean " << std::setw(10) << timing.meanMilliseconds << " ms";
+
+	if (amount > 0.0)
+	{
+		std::cout << "  " << std::setw(8) << std::setprecision(1) << amount * 1000.0 / timing.bestMilliseconds << " " << unit << "/s";
+	}
+
+	std::cout << std::defaultfloat << std::setprecision(precision) << std::endl;
+}
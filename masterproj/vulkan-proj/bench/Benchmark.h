@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+Offline benchmarks, started with --bench <name> [arguments...] instead of the renderer.
+Each one prints its own results to stdout and throws on failure, including when an optimized
+path produces different output than the path it replaces.
+*/
+class Benchmark
+{
+public:
+	// Throws if there is no benchmark called name
+	static void run(const std::string& name, const std::vector<std::string>& arguments);
+
+	struct Timing
+	{
+		double bestMilliseconds = 0.0;
+		double meanMilliseconds = 0.0;
+	};
+
+	static Timing measure(uint32_t repetitions, const std::function<void()>& work);
+	// Throughput in unit/s is printed as well if amount is not 0
+	static void print(const std::string& label, const Timing& timing, double amount = 0.0, const std::string& unit = "MB");
+
+private:
+	// bench/ObjBenchmark.cpp: tinyobj against ObjParser on a model and a generated OBJ
+	static void objParser(const std::vector<std::string>& arguments);
+	// bench/DedupBenchmark.cpp: VertexDedup against the unordered_map it replaced
+	static void vertexDedup(const std::vector<std::string>& arguments);
+	// bench/TextureBenchmark.cpp: BC1, BC3 and BC7 encoding speed and quality
+	static void blockCompression(const std::vector<std::string>& arguments);
+};
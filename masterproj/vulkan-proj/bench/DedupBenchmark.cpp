@@ -0,0 +1,152 @@
+#include "Benchmark.h"
+
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/hash.hpp>
+
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "../model/ModelLoader.h"
+#include "../model/ObjParser.h"
+#include "../model/VertexDedup.h"
+
+namespace
+{
+	// The std::hash<Vertex> specialization ModelLoader used before VertexDedup
+	struct LegacyVertexHash
+	{
+		size_t operator()(const Vertex& vertex) const
+		{
+			return ((std::hash<glm::vec3>()(vertex.pos) ^
+				(std::hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^
+				(std::hash<glm::vec2>()(vertex.texCoord) << 1);
+		}
+	};
+
+	// One vertex per face corner, the way the importer sees them
+	std::vector<Vertex> loadCorners(const std::string& path)
+	{
+		ObjData obj;
+		ObjParser().parse(path, obj);
+
+		std::vector<Vertex> corners;
+		for (const ObjShape& shape : obj.shapes)
+		{
+			for (const ObjIndex& index : shape.indices)
+			{
+				Vertex vertex = {};
+				vertex.pos = glm::vec3(obj.positions[3 * index.position + 0], obj.positions[3 * index.position + 1], obj.positions[3 * index.position + 2]);
+				if (index.texCoord >= 0)
+				{
+					vertex.texCoord = glm::vec2(obj.texCoords[2 * index.texCoord + 0], 1.0f - obj.texCoords[2 * index.texCoord + 1]);
+				}
+				vertex.color = glm::vec3(1.0f);
+				corners.push_back(vertex);
+			}
+		}
+		return corners;
+	}
+
+	// Two triangles per cell of a side x side grid of vertices on a wavy surface
+	std::vector<Vertex> generateCorners(uint32_t side)
+	{
+		std::vector<Vertex> grid(size_t(side) * side);
+		for (uint32_t y = 0; y < side; y++)
+		{
+			for (uint32_t x = 0; x < side; x++)
+			{
+				Vertex& vertex = grid[size_t(y) * side + x];
+				vertex = {};
+				vertex.texCoord = glm::vec2(x / float(side - 1), y / float(side - 1));
+				vertex.pos = glm::vec3(vertex.texCoord.x * 100.0f, 0.25f * std::sin(x * 0.3f) * std::cos(y * 0.3f), vertex.texCoord.y * 100.0f);
+				vertex.color = glm::vec3(1.0f);
+			}
+		}
+
+		std::vector<Vertex> corners;
+		corners.reserve(size_t(side - 1) * (side - 1) * 6);
+		for (uint32_t y = 0; y + 1 < side; y++)
+		{
+			for (uint32_t x = 0; x + 1 < side; x++)
+			{
+				size_t a = size_t(y) * side + x;
+				size_t b = a + 1;
+				size_t c = a + side + 1;
+				size_t d = a + side;
+				for (size_t corner : { a, b, c, a, c, d })
+				{
+					corners.push_back(grid[corner]);
+				}
+			}
+		}
+		return corners;
+	}
+}
+
+/*
+Arguments: [grid side, default 1024] [model, default resources/models/cottage.obj]
+Deduplicates the face corners of the model and of a generated grid with the unordered_map loop
+the importers used before, and with VertexDedup. Rates are in face corners per second.
+*/
+void Benchmark::vertexDedup(const std::vector<std::string>& arguments)
+{
+	uint32_t side = arguments.size() > 0 ? static_cast<uint32_t>(std::stoul(arguments[0])) : 1024;
+	std::string modelPath = arguments.size() > 1 ? arguments[1] : "resources/models/cottage.obj";
+
+	auto compare = [&](const std::string& label, const std::vector<Vertex>& corners, uint32_t repetitions)
+	{
+		double millions = corners.size() / 1e6;
+		std::cout << label << " (" << corners.size() << " corners)" << std::endl;
+
+		std::vector<Vertex> legacyVertices;
+		std::vector<uint32_t> legacyIndices;
+		Timing legacy = measure(repetitions, [&]()
+		{
+			legacyVertices.clear();
+			legacyIndices.clear();
+
+			std::unordered_map<Vertex, uint32_t, LegacyVertexHash> uniqueVertices = {};
+			for (const Vertex& vertex : corners)
+			{
+				if (uniqueVertices.count(vertex) == 0)
+				{
+					uniqueVertices[vertex] = static_cast<uint32_t>(legacyVertices.size());
+					legacyVertices.push_back(vertex);
+				}
+
+				legacyIndices.push_back(uniqueVertices[vertex]);
+			}
+		});
+		print("unordered_map, legacy hash", legacy, millions, "M corners");
+
+		std::vector<Vertex> vertices;
+		std::vector<uint32_t> indices;
+		Timing flat = measure(repetitions, [&]()
+		{
+			vertices.clear();
+			indices.clear();
+			indices.reserve(corners.size());
+
+			VertexDedup uniqueVertices(corners.size());
+			for (const Vertex& vertex : corners)
+			{
+				indices.push_back(uniqueVertices.insert(vertex, vertices));
+			}
+		});
+		print("VertexDedup", flat, millions, "M corners");
+
+		// Bit-exact comparison can only split vertices the float comparison merged (0.0 and -0.0)
+		if (vertices.size() < legacyVertices.size())
+		{
+			throw std::runtime_error("VertexDedup merged different vertices!");
+		}
+
+		std::cout << "  speedup " << legacy.bestMilliseconds / flat.bestMilliseconds << "x, "
+			<< vertices.size() << " unique vertices" << std::endl;
+	};
+
+	compare(modelPath, loadCorners(modelPath), 20);
+	compare("grid " + std::to_string(side) + "x" + std::to_string(side), generateCorners(side), 3);
+}
@@ -0,0 +1,161 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+
+#include "../model/ModelLoader.h"
+#include "../model/ObjParser.h"
+#include "../util/ThreadPool.h"
+
+namespace
+{
+	// Both parsers turn the same text into the same float except for rounding, so the topology has
+	// to match exactly and the attributes up to a few ulps
+	void checkSameModel(const Model& expected, const Model& actual, const std::string& what)
+	{
+		bool same = expected.getVertexCount() == actual.getVertexCount() && expected.getIndexCount() == actual.getIndexCount()
+			&& memcmp(expected.getIndices(), actual.getIndices(), expected.getIndexCount() * sizeof(uint32_t)) == 0;
+
+		const float* a = reinterpret_cast<const float*>(expected.getVertices());
+		const float* b = reinterpret_cast<const float*>(actual.getVertices());
+		size_t floatCount = same ? expected.getVertexCount() * sizeof(Vertex) / sizeof(float) : 0;
+		for (size_t i = 0; i < floatCount && same; i++)
+		{
+			same = std::fabs(a[i] - b[i]) <= 1e-6f * std::max(1.0f, std::fabs(a[i]));
+		}
+
+		if (!same)
+		{
+			throw std::runtime_error("ObjParser output differs from tinyobj for " + what + "!");
+		}
+	}
+
+	double fileMegabytes(const std::string& path)
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		return static_cast<double>(file.tellg()) / (1024.0 * 1024.0);
+	}
+
+	// Wavy grid of quads with positions, texture coordinates and normals, about megabytes large
+	void writeSyntheticObj(const std::string& path, uint32_t megabytes)
+	{
+		// Roughly 190 bytes of v, vt, vn and f lines per grid vertex
+		uint32_t side = std::max(2u, static_cast<uint32_t>(std::sqrt(megabytes * 1024.0 * 1024.0 / 190.0)));
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			throw std::runtime_error("failed to create " + path + "!");
+		}
+
+		std::vector<char> buffer;
+		buffer.reserve(4 * 1024 * 1024);
+		char line[256];
+
+		auto append = [&](int length)
+		{
+			buffer.insert(buffer.end(), line, line + length);
+			if (buffer.size() > 3 * 1024 * 1024)
+			{
+				file.write(buffer.data(), buffer.size());
+				buffer.clear();
+			}
+		};
+
+		append(snprintf(line, sizeof(line), "# synthetic %ux%u grid\no grid\n", side, side));
+
+		for (uint32_t y = 0; y < side; y++)
+		{
+			for (uint32_t x = 0; x < side; x++)
+			{
+				float u = x / float(side - 1);
+				float v = y / float(side - 1);
+				float height = 0.25f * std::sin(u * 40.0f) * std::cos(v * 40.0f);
+				append(snprintf(line, sizeof(line), "v %.6f %.6f %.6f\nvt %.6f %.6f\nvn %.6f %.6f %.6f\n",
+					u * 100.0f - 50.0f, height, v * 100.0f - 50.0f, u, v, -std::sin(u * 40.0f) * 0.1f, 1.0f, std::cos(v * 40.0f) * 0.1f));
+			}
+		}
+
+		for (uint32_t y = 0; y + 1 < side; y++)
+		{
+			for (uint32_t x = 0; x + 1 < side; x++)
+			{
+				uint32_t a = y * side + x + 1;
+				uint32_t b = a + 1;
+				uint32_t c = a + side + 1;
+				uint32_t d = a + side;
+				append(snprintf(line, sizeof(line), "f %u/%u/%u %u/%u/%u %u/%u/%u %u/%u/%u\n", a, a, a, b, b, b, c, c, c, d, d, d));
+			}
+		}
+
+		file.write(buffer.data(), buffer.size());
+		if (!file.good())
+		{
+			throw std::runtime_error("failed to write " + path + "!");
+		}
+	}
+}
+
+/*
+Arguments: [synthetic size in MB, default 256] [model, default resources/models/cottage.obj]
+Compares the tinyobj import against ObjParser on one thread and on the whole pool, including
+the vertex deduplication both share, and checks that all of them build the same model.
+*/
+void Benchmark::objParser(const std::vector<std::string>& arguments)
+{
+	uint32_t syntheticMegabytes = arguments.size() > 0 ? static_cast<uint32_t>(std::stoul(arguments[0])) : 256;
+	std::string modelPath = arguments.size() > 1 ? arguments[1] : "resources/models/cottage.obj";
+	std::string syntheticPath = "bench_synthetic.obj";
+
+	ThreadPool threadPool;
+
+	auto compare = [&](const std::string& path, uint32_t repetitions)
+	{
+		double megabytes = fileMegabytes(path);
+		std::cout << path << " (" << megabytes << " MB, " << threadPool.getThreadCount() << " threads)" << std::endl;
+
+		Model reference;
+		Timing tinyObj = measure(repetitions, [&]() { reference = ModelLoader::importObjTinyObj(path); });
+		print("tinyobj", tinyObj, megabytes);
+
+		Model serial;
+		Timing serialTiming = measure(repetitions, [&]() { serial = ModelLoader::importObj(path, nullptr); });
+		print("ObjParser, 1 thread", serialTiming, megabytes);
+		checkSameModel(reference, serial, path);
+
+		ObjData obj;
+		Timing parseTiming = measure(repetitions, [&]() { ObjParser(&threadPool).parse(path, obj); });
+		print("ObjParser parse only, pool", parseTiming, megabytes);
+
+		Model parallel;
+		Timing parallelTiming = measure(repetitions, [&]() { parallel = ModelLoader::importObj(path, &threadPool); });
+		print("ObjParser, thread pool", parallelTiming, megabytes);
+		checkSameModel(reference, parallel, path);
+
+		std::cout << "  speedup " << tinyObj.bestMilliseconds / parallelTiming.bestMilliseconds << "x, "
+			<< parallel.getVertexCount() << " vertices, " << parallel.getIndexCount() / 3 << " triangles" << std::endl;
+	};
+
+	compare(modelPath, 10);
+
+	if (syntheticMegabytes > 0)
+	{
+		writeSyntheticObj(syntheticPath, syntheticMegabytes);
+		try
+		{
+			compare(syntheticPath, 2);
+		}
+		catch (...)
+		{
+			std::remove(syntheticPath.c_str());
+			throw;
+		}
+		std::remove(syntheticPath.c_str());
+	}
+}
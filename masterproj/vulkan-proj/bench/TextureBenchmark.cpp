@@ -0,0 +1,149 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+#include "../model/BlockCompressor.h"
+#include "../model/TextureLoader.h"
+#include "../util/ThreadPool.h"
+
+namespace
+{
+	// Gradients, a hard edged pattern and a radial alpha ramp, the cases block compression struggles with
+	std::vector<uint8_t> generateImage(uint32_t side)
+	{
+		std::vector<uint8_t> pixels(size_t(side) * side * 4);
+		for (uint32_t y = 0; y < side; y++)
+		{
+			for (uint32_t x = 0; x < side; x++)
+			{
+				uint8_t* texel = &pixels[(size_t(y) * side + x) * 4];
+				float u = x / float(side - 1);
+				float v = y / float(side - 1);
+				bool checker = x < side / 2 && y < side / 2 && ((x / 8) ^ (y / 8)) & 1;
+				float distance = std::sqrt((u - 0.5f) * (u - 0.5f) + (v - 0.5f) * (v - 0.5f));
+
+				texel[0] = static_cast<uint8_t>(checker ? 230 : u * 255.0f);
+				texel[1] = static_cast<uint8_t>(checker ? 40 : v * 255.0f);
+				texel[2] = static_cast<uint8_t>(127.5f + 127.5f * std::sin((x + y) * 0.05f));
+				texel[3] = static_cast<uint8_t>(std::max(0.0f, 1.0f - distance * 1.5f) * 255.0f);
+			}
+		}
+		return pixels;
+	}
+
+	// Peak signal to noise ratio over the given channels, in dB
+	double computePsnr(const std::vector<uint8_t>& expected, const std::vector<uint8_t>& actual, uint32_t firstChannel, uint32_t channelCount)
+	{
+		double squaredError = 0.0;
+		size_t texelCount = expected.size() / 4;
+		for (size_t i = 0; i < texelCount; i++)
+		{
+			for (uint32_t c = firstChannel; c < firstChannel + channelCount; c++)
+			{
+				double difference = double(expected[i * 4 + c]) - double(actual[i * 4 + c]);
+				squaredError += difference * difference;
+			}
+		}
+
+		double meanSquaredError = squaredError / (double(texelCount) * channelCount);
+		return meanSquaredError > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / meanSquaredError) : INFINITY;
+	}
+}
+
+/*
+Arguments: [generated image side, default 1024] [image, default resources/textures/cottage.png]
+Compresses the image and a generated one with alpha to BC1, BC3 and BC7, on one thread and on the
+whole pool, and prints the PSNR of the decoded blocks against the source. BC1 has no alpha, so it
+is only rated on colour. Rates are in megapixels per second. Runs once per palette search the CPU
+supports, AVX2 and SSE2, and names the one that ran.
+*/
+void Benchmark::blockCompression(const std::vector<std::string>& arguments)
+{
+	uint32_t side = arguments.size() > 0 ? static_cast<uint32_t>(std::stoul(arguments[0])) : 1024;
+	std::string imagePath = arguments.size() > 1 ? arguments[1] : "resources/textures/cottage.png";
+
+	ThreadPool threadPool;
+
+	// Every palette search the CPU can run, AVX2 first
+	std::vector<bool> searches = BlockCompressor::hasAvx2() ? std::vector<bool>{ true, false } : std::vector<bool>{ false };
+
+	auto compare = [&](const std::string& label, const std::vector<uint8_t>& pixels, uint32_t width, uint32_t height)
+	{
+		double megapixels = double(width) * height / 1e6;
+		// Blocks of every format from the first search, the other one is checked against them
+		std::vector<std::vector<uint8_t>> reference;
+
+		for (bool avx2 : searches)
+		{
+			BlockCompressor::setAvx2Enabled(avx2);
+			std::cout << label << " (" << width << "x" << height << ", " << BlockCompressor::getSimdName() << " palette search)" << std::endl;
+
+			size_t formatIndex = 0;
+			for (TextureFormat format : { TextureFormat::Bc1, TextureFormat::Bc3, TextureFormat::Bc7 })
+			{
+				std::string name = TextureLoader::getFormatName(format);
+				size_t size = static_cast<size_t>(TextureLoader::getLevelSize(format, width, height));
+
+				std::vector<uint8_t> single(size);
+				Timing singleTiming = measure(3, [&]()
+				{
+					BlockCompressor::compress(format, pixels.data(), width, height, single.data(), nullptr);
+				});
+				print(name + ", 1 thread", singleTiming, megapixels, "MPixels");
+
+				std::vector<uint8_t> parallel(size);
+				Timing parallelTiming = measure(3, [&]()
+				{
+					BlockCompressor::compress(format, pixels.data(), width, height, parallel.data(), &threadPool);
+				});
+				print(name + ", " + std::to_string(threadPool.getThreadCount()) + " threads", parallelTiming, megapixels, "MPixels");
+
+				// Blocks are independent, the split over threads must not change a single one
+				if (single != parallel)
+				{
+					throw std::runtime_error(name + " blocks differ between one thread and the pool!");
+				}
+
+				// Both searches do the same arithmetic in the same order and have to pick the same indices
+				if (formatIndex < reference.size() && single != reference[formatIndex])
+				{
+					throw std::runtime_error(name + " blocks differ between the AVX2 and the SSE2 search!");
+				}
+				if (formatIndex == reference.size())
+				{
+					reference.push_back(single);
+				}
+				formatIndex++;
+
+				std::vector<uint8_t> decoded(pixels.size());
+				BlockCompressor::decompress(format, single.data(), width, height, decoded.data());
+
+				std::cout << "  " << std::fixed << std::setprecision(2) << "PSNR colour " << computePsnr(pixels, decoded, 0, 3) << " dB";
+				if (format != TextureFormat::Bc1)
+				{
+					std::cout << ", alpha " << computePsnr(pixels, decoded, 3, 1) << " dB";
+				}
+				std::cout << std::defaultfloat << ", " << double(pixels.size()) / size << "x smaller than RGBA8" << std::endl;
+			}
+		}
+
+		BlockCompressor::setAvx2Enabled(true);
+	};
+
+	int width, height, channels;
+	stbi_uc* image = stbi_load(imagePath.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+	if (!image)
+	{
+		throw std::runtime_error("failed to load texture image " + imagePath + "!");
+	}
+	std::vector<uint8_t> imagePixels(image, image + size_t(width) * height * 4);
+	stbi_image_free(image);
+
+	compare(imagePath, imagePixels, static_cast<uint32_t>(width), static_cast<uint32_t>(height));
+	compare("generated " + std::to_string(side) + "x" + std::to_string(side), generateImage(side), side, side);
+}
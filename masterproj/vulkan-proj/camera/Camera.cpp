@@ -4,6 +4,9 @@
 
 Camera::Camera()
 {
+	// Zero until the first frame sets them, so nothing projects onto the screen before
+	ubo.view = glm::mat4(0.0f);
+	ubo.proj = glm::mat4(0.0f);
 }
 
 
@@ -2,9 +2,9 @@
 
 #include <glm/glm.hpp>
 
+// Per-frame constants, per-object transforms are push constants (see scene/Scene.h)
 struct UniformBufferObject
 {
-	glm::mat4 model;
 	glm::mat4 view;
 	glm::mat4 proj;
 };
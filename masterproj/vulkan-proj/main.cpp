@@ -7,8 +7,12 @@
 //#define NDEBUG
 #include "renderer/vulkan/vInitializer.h"
 
+#include "bench/Benchmark.h"
 #include "renderer/VideoInfo.h"
+#include "model/AssetLoader.h"
 #include "model/ModelLoader.h"
+#include "model/TextureLoader.h"
+#include "scene/Scene.h"
 
 class startingApp
 {
@@ -21,12 +25,42 @@ public:
 		cleanup();
 	}
 
+	void setCullingMode(CullingMode mode)
+	{
+		cullingMode = mode;
+	}
+
+	void setMipmapMode(MipmapMode mode)
+	{
+		mipmapMode = mode;
+	}
+
+	void setMipmapBenchmark(bool enabled)
+	{
+		mipmapBenchmark = enabled;
+	}
+
+	void setTextureBudget(VkDeviceSize budget)
+	{
+		textureBudget = budget;
+	}
+
 private:
 	GLFWwindow* window;
 
 	std::shared_ptr<VideoInfo> videoinfo;
 	std::shared_ptr<VulkanInitializer> vInit;
+	// The only one, the render thread and the asset loader's threads all split their work over it
+	std::shared_ptr<ThreadPool> threadPool;
 	std::shared_ptr<ModelLoader> modelLoader;
+	std::shared_ptr<TextureLoader> textureLoader;
+	std::shared_ptr<AssetLoader> assets;
+	std::shared_ptr<Scene> scene;
+	InstanceHandle cottage;
+	CullingMode cullingMode = CullingMode::Gpu;
+	MipmapMode mipmapMode = MipmapMode::Compute;
+	bool mipmapBenchmark = false;
+	VkDeviceSize textureBudget = 256 * 1024 * 1024;
 
 
 	void initWindow()
@@ -57,47 +91,90 @@ private:
 	}
 	void initVulkan()
 	{
+		auto startupBegin = std::chrono::steady_clock::now();
+
 		// TODO temporary to have some data
-		modelLoader = std::make_shared<ModelLoader>();
+		threadPool = std::make_shared<ThreadPool>();
+		modelLoader = std::make_shared<ModelLoader>(threadPool);
+		textureLoader = std::make_shared<TextureLoader>(threadPool);
+		assets = std::make_shared<AssetLoader>(modelLoader, textureLoader);
 		vInit = std::make_shared<VulkanInitializer>();
+		scene = std::make_shared<Scene>();
 
 		vInit->setWindow(window);
-		vInit->setInput(modelLoader);
-		modelLoader->loadModel("resources/models/cottage.obj");
+		vInit->setAssets(assets);
+		vInit->setThreadPool(threadPool);
+		vInit->setScene(scene);
+		vInit->setCullingMode(cullingMode);
+		vInit->setMipmapMode(mipmapMode);
+		vInit->setTextureBudget(textureBudget);
+
+		// Loaded in the background while the device is set up, placeholders are drawn until then
+		uint32_t cottageMesh = assets->requestModel("resources/models/cottage.obj");
+		cottage = scene->addInstance(cottageMesh, glm::mat4(1.0f));
 		vInit->createInstance();
 		vInit->setupDebugCallback();
 		vInit->createSurface();
 		vInit->pickPhysicalDevice();
+
+		// Textures are cooked for the formats this device samples
+		textureLoader->setFormatSupport(vInit->getTextureFormatSupport());
+		scene->setMaterial(cottage, assets->requestTexture("resources/textures/cottage.png"));
+
 		vInit->createLogicalDevice();
+		vInit->createPipelineCache();
 		vInit->createSwapchain();
 		vInit->createImageViews();
 		vInit->createRenderPass();
 		vInit->createDescriptorSetLayout();
 		vInit->createGraphicsPipeline();
 		vInit->createCommandPool();
+		vInit->createUploader();
 		vInit->createColorResources();
 		vInit->createDepthResources();
 		vInit->createFramebuffers();
-		vInit->createTextureImage();
-		vInit->createTextureImageView();
 		vInit->createTextureSampler();
-		vInit->createVertexBuffer();
-		vInit->createIndexBuffer();
+		vInit->createDownsampler();
+		vInit->createPlaceholderTexture();
+		vInit->createTextureTable();
+		vInit->createTextureStreamer();
+		vInit->createMeshArena();
+		vInit->createCuller();
 		vInit->createUniformBuffer();
 		vInit->createDescriptorPool();
 		vInit->createDescriptorSets();
 		vInit->createCommandBuffers();
 		vInit->createSyncObjects();
+		vInit->flushSetupCommands();
+
+		auto startupEnd = std::chrono::steady_clock::now();
+		std::cout << "Startup: " << std::chrono::duration<double, std::milli>(startupEnd - startupBegin).count() << " ms" << std::endl;
+		vInit->printPipelineStatistics();
+
+		if (mipmapBenchmark)
+		{
+			vInit->benchmarkMipmaps();
+		}
+
+		if (enableValidationLayers)
+		{
+			vInit->printMemoryStatistics();
+		}
 	}
 
 	void mainLoop()
 	{
+		auto startTime = std::chrono::steady_clock::now();
+
 		while (!glfwWindowShouldClose(window))
 		{
 			auto frameStart = std::chrono::steady_clock::now();
 
 			glfwPollEvents();
 
+			float time = std::chrono::duration<float, std::chrono::seconds::period>(frameStart - startTime).count();
+			scene->setTransform(cottage, glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+
 			vInit->drawFrame();
 
 			auto frameEnd = std::chrono::steady_clock::now();
@@ -135,10 +212,50 @@ private:
 	}
 };
 
-int main()
+int main(int argc, char** argv)
 {
 	startingApp app;
 
+	// --bench <name> [arguments...] runs one benchmark instead of the renderer
+	if (argc >= 3 && strcmp(argv[1], "--bench") == 0)
+	{
+		try
+		{
+			Benchmark::run(argv[2], std::vector<std::string>(argv + 3, argv + argc));
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	for (int i = 1; i < argc; i++)
+	{
+		// Same indirect draws, culled on the CPU instead of in a compute pass
+		if (strcmp(argv[i], "--cpu-culling") == 0)
+		{
+			app.setCullingMode(CullingMode::Cpu);
+		}
+		// Mip chains made on the GPU by a blit per level instead of the single compute pass, both filter in linear light
+		else if (strcmp(argv[i], "--blit-mipmaps") == 0)
+		{
+			app.setMipmapMode(MipmapMode::Blit);
+		}
+		// Times both ways of making mip chains on the GPU after startup
+		else if (strcmp(argv[i], "--mipmap-benchmark") == 0)
+		{
+			app.setMipmapBenchmark(true);
+		}
+		// MiB of device memory for streamed texture levels, 0 uploads every texture whole
+		else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc)
+		{
+			app.setTextureBudget(VkDeviceSize(strtoull(argv[++i], nullptr, 10)) * 1024 * 1024);
+		}
+	}
+
 	try
 	{
 		app.run();
@@ -0,0 +1,185 @@
+#include "AssetLoader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+	// Reads one byte per page so the OS maps the whole range in
+	void touchPages(const void* data, size_t size)
+	{
+		const size_t PAGE_SIZE = 4096;
+		const volatile char* bytes = static_cast<const volatile char*>(data);
+
+		char sum = 0;
+		for (size_t offset = 0; offset < size; offset += PAGE_SIZE)
+		{
+			sum ^= bytes[offset];
+		}
+		(void)sum;
+	}
+}
+
+AssetLoader::AssetLoader(std::shared_ptr<ModelLoader> modelLoader, std::shared_ptr<TextureLoader> textureLoader, uint32_t workerCount)
+	: modelLoader(std::move(modelLoader)), textureLoader(std::move(textureLoader))
+{
+	for (uint32_t i = 0; i < std::max(workerCount, 1u); i++)
+	{
+		workers.emplace_back(&AssetLoader::workerLoop, this);
+	}
+}
+
+AssetLoader::~AssetLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		requests.clear();
+	}
+	requestAvailable.notify_all();
+
+	// Loads that already started run to the end
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+uint32_t AssetLoader::requestModel(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	uint32_t id = modelCount++;
+	requests.push_back({ AssetKind::Model, id, path });
+	pendingCount++;
+	requestAvailable.notify_one();
+
+	return id;
+}
+
+uint32_t AssetLoader::requestTexture(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	uint32_t id = textureCount++;
+	requests.push_back({ AssetKind::Texture, id, path });
+	pendingCount++;
+	requestAvailable.notify_one();
+
+	return id;
+}
+
+bool AssetLoader::popModel(LoadedModel& out)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (loadedModels.empty())
+	{
+		return false;
+	}
+
+	out = std::move(loadedModels.front());
+	loadedModels.pop_front();
+	pendingCount--;
+
+	return true;
+}
+
+bool AssetLoader::popTexture(LoadedTexture& out)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (loadedTextures.empty())
+	{
+		return false;
+	}
+
+	out = std::move(loadedTextures.front());
+	loadedTextures.pop_front();
+	pendingCount--;
+
+	return true;
+}
+
+uint32_t AssetLoader::getPendingCount() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return pendingCount;
+}
+
+void AssetLoader::workerLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true)
+	{
+		requestAvailable.wait(lock, [this]() { return stopping || !requests.empty(); });
+
+		if (stopping)
+		{
+			return;
+		}
+
+		Request request = std::move(requests.front());
+		requests.pop_front();
+
+		lock.unlock();
+		load(request);
+		lock.lock();
+	}
+}
+
+void AssetLoader::load(const Request& request)
+{
+	auto loadStart = std::chrono::steady_clock::now();
+
+	try
+	{
+		if (request.kind == AssetKind::Model)
+		{
+			LoadedModel loaded;
+			loaded.id = request.id;
+			loaded.model = modelLoader->loadModel(request.path);
+
+			touchPages(loaded.model.getVertices(), loaded.model.getVertexCount() * sizeof(Vertex));
+			touchPages(loaded.model.getIndices(), loaded.model.getIndexCount() * sizeof(uint32_t));
+
+			std::lock_guard<std::mutex> lock(mutex);
+			loadedModels.push_back(std::move(loaded));
+		}
+		else
+		{
+			LoadedTexture loaded;
+			loaded.id = request.id;
+			loaded.texture = textureLoader->load(request.path);
+
+			// Levels come finest first, the tail is the end of the payload
+			const std::vector<TextureLevel>& levels = loaded.texture.levels;
+			uint32_t prefetchSize = texturePrefetchSize;
+			size_t first = 0;
+			while (prefetchSize > 0 && first + 1 < levels.size() && std::max(levels[first].width, levels[first].height) > prefetchSize)
+			{
+				first++;
+			}
+
+			uint64_t offset = levels.empty() ? 0 : levels[first].offset;
+			touchPages(loaded.texture.getData() + offset, static_cast<size_t>(loaded.texture.getSize() - offset));
+
+			std::lock_guard<std::mutex> lock(mutex);
+			loadedTextures.push_back(std::move(loaded));
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "failed to load " << request.path << ": " << e.what() << std::endl;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		pendingCount--;
+		return;
+	}
+
+	auto loadEnd = std::chrono::steady_clock::now();
+	std::cout << "Loaded " << request.path << " in " << std::chrono::duration<double, std::milli>(loadEnd - loadStart).count() << " ms" << std::endl;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ModelLoader.h"
+#include "TextureLoader.h"
+
+struct LoadedModel
+{
+	uint32_t id = 0;
+	Model model;
+};
+
+struct LoadedTexture
+{
+	uint32_t id = 0;
+	TextureData texture;
+};
+
+/*
+Loads models and textures on background threads.
+
+A request returns the id the asset will have right away, so the scene can refer to it before it
+exists; model and texture ids are counted separately from 0 in request order. Worker threads
+read, parse and decode, then queue the result until the render thread takes it with popModel()
+or popTexture() and uploads it. Meshes and textures mapped from their caches are paged in on the
+worker, so the upload does not fault them in from disk.
+
+Loads that fail are reported on stderr and never delivered, whatever stands in for the asset
+stays. Requests still queued when the loader is destroyed are dropped.
+*/
+class AssetLoader
+{
+public:
+	// OBJ imports and texture cooking spread each of them over the thread pool of their loader
+	AssetLoader(std::shared_ptr<ModelLoader> modelLoader, std::shared_ptr<TextureLoader> textureLoader, uint32_t workerCount = DEFAULT_WORKER_COUNT);
+	~AssetLoader();
+
+	static const uint32_t DEFAULT_WORKER_COUNT = 2;
+
+	uint32_t requestModel(const std::string& path);
+	uint32_t requestTexture(const std::string& path);
+
+	// Finished loads in completion order, false if there is none
+	bool popModel(LoadedModel& out);
+	bool popTexture(LoadedTexture& out);
+
+	// Requested but not popped yet, failed loads excluded
+	uint32_t getPendingCount() const;
+
+	// Only texture levels at most this large are paged in, the texture streamer reads the rest once
+	// they are needed. 0, the default, pages in every level
+	void setTexturePrefetchSize(uint32_t size) { texturePrefetchSize = size; }
+
+private:
+	enum class AssetKind
+	{
+		Model,
+		Texture
+	};
+
+	struct Request
+	{
+		AssetKind kind;
+		uint32_t id;
+		std::string path;
+	};
+
+	std::shared_ptr<ModelLoader> modelLoader;
+	std::shared_ptr<TextureLoader> textureLoader;
+	std::vector<std::thread> workers;
+
+	mutable std::mutex mutex;
+	std::condition_variable requestAvailable;
+	// Guarded by mutex
+	std::deque<Request> requests;
+	std::deque<LoadedModel> loadedModels;
+	std::deque<LoadedTexture> loadedTextures;
+	uint32_t modelCount = 0;
+	uint32_t textureCount = 0;
+	uint32_t pendingCount = 0;
+	bool stopping = false;
+	std::atomic<uint32_t> texturePrefetchSize{ 0 };
+
+	void workerLoop();
+	void load(const Request& request);
+};
@@ -0,0 +1,791 @@
+#include "BlockCompressor.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "BlockCompressorAvx2.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLOCK_COMPRESSOR_SSE2
+#endif
+
+#if defined(BLOCK_COMPRESSOR_AVX2) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace
+{
+	const uint32_t TEXELS = 16;
+	// Least squares refits of the endpoints after the first index search
+	const uint32_t REFINE_ITERATIONS = 2;
+	// Power iterations for the principal axis of a block
+	const uint32_t AXIS_ITERATIONS = 8;
+
+	const float BC1_POSITIONS[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+	const uint32_t BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+	const float BC7_POSITIONS[16] = {
+		0.0f / 64.0f, 4.0f / 64.0f, 9.0f / 64.0f, 13.0f / 64.0f, 17.0f / 64.0f, 21.0f / 64.0f, 26.0f / 64.0f, 30.0f / 64.0f,
+		34.0f / 64.0f, 38.0f / 64.0f, 43.0f / 64.0f, 47.0f / 64.0f, 51.0f / 64.0f, 55.0f / 64.0f, 60.0f / 64.0f, 64.0f / 64.0f
+	};
+
+	// Texels of one block by channel, so four or eight texels fill a vector register
+	struct Block
+	{
+		alignas(32) float channels[4][TEXELS];
+	};
+
+	struct Palette
+	{
+		float entries[16][4];
+		uint32_t size;
+	};
+
+	// AVX2 on the CPU and its registers saved by the OS
+	bool detectAvx2()
+	{
+#if defined(BLOCK_COMPRESSOR_AVX2) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+		{
+			return false;
+		}
+
+		__cpuid(info, 1);
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+		if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+		{
+			return false;
+		}
+
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#elif defined(BLOCK_COMPRESSOR_AVX2)
+		return __builtin_cpu_supports("avx2");
+#else
+		return false;
+#endif
+	}
+
+	const bool hasAvx2Support = detectAvx2();
+	bool useAvx2 = hasAvx2Support;
+
+	float clampChannel(float value)
+	{
+		return std::min(std::max(value, 0.0f), 255.0f);
+	}
+
+	void loadBlock(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY, Block& block)
+	{
+		for (uint32_t y = 0; y < 4; y++)
+		{
+			uint32_t sourceY = std::min(blockY * 4 + y, height - 1);
+			for (uint32_t x = 0; x < 4; x++)
+			{
+				uint32_t sourceX = std::min(blockX * 4 + x, width - 1);
+				const uint8_t* texel = pixels + (size_t(sourceY) * width + sourceX) * 4;
+				for (uint32_t c = 0; c < 4; c++)
+				{
+					block.channels[c][y * 4 + x] = texel[c];
+				}
+			}
+		}
+	}
+
+	// Nearest palette entry of every texel under the channel weights, returns the summed weighted squared error
+	float findIndices(const Block& block, const Palette& palette, const float weights[4], uint8_t indices[TEXELS])
+	{
+		float error = 0.0f;
+
+#if defined(BLOCK_COMPRESSOR_AVX2)
+		if (useAvx2)
+		{
+			return findPaletteIndicesAvx2(block.channels, palette.entries, palette.size, weights, indices);
+		}
+#endif
+
+#if defined(BLOCK_COMPRESSOR_SSE2)
+		for (uint32_t first = 0; first < TEXELS; first += 4)
+		{
+			__m128 channels[4];
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				channels[c] = _mm_load_ps(&block.channels[c][first]);
+			}
+
+			__m128 best = _mm_set1_ps(FLT_MAX);
+			__m128 bestIndex = _mm_setzero_ps();
+			for (uint32_t i = 0; i < palette.size; i++)
+			{
+				__m128 distance = _mm_setzero_ps();
+				for (uint32_t c = 0; c < 4; c++)
+				{
+					__m128 difference = _mm_sub_ps(channels[c], _mm_set1_ps(palette.entries[i][c]));
+					distance = _mm_add_ps(distance, _mm_mul_ps(_mm_mul_ps(difference, difference), _mm_set1_ps(weights[c])));
+				}
+
+				// No blendv before SSE4.1
+				__m128 closer = _mm_cmplt_ps(distance, best);
+				best = _mm_min_ps(distance, best);
+				bestIndex = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps(float(i))), _mm_andnot_ps(closer, bestIndex));
+			}
+
+			alignas(16) float bestErrors[4];
+			alignas(16) int32_t bestIndices[4];
+			_mm_store_ps(bestErrors, best);
+			_mm_store_si128(reinterpret_cast<__m128i*>(bestIndices), _mm_cvtps_epi32(bestIndex));
+			for (uint32_t k = 0; k < 4; k++)
+			{
+				indices[first + k] = static_cast<uint8_t>(bestIndices[k]);
+				error += bestErrors[k];
+			}
+		}
+#else
+		for (uint32_t t = 0; t < TEXELS; t++)
+		{
+			float best = FLT_MAX;
+			for (uint32_t i = 0; i < palette.size; i++)
+			{
+				float distance = 0.0f;
+				for (uint32_t c = 0; c < 4; c++)
+				{
+					float difference = block.channels[c][t] - palette.entries[i][c];
+					distance += difference * difference * weights[c];
+				}
+
+				if (distance < best)
+				{
+					best = distance;
+					indices[t] = static_cast<uint8_t>(i);
+				}
+			}
+			error += best;
+		}
+#endif
+
+		return error;
+	}
+
+	// Endpoints at the extremes of the texels along their principal axis, channels from channelCount on are set to 255
+	void fitEndpoints(const Block& block, uint32_t channelCount, float endpoint0[4], float endpoint1[4])
+	{
+		float mean[4] = {};
+		for (uint32_t c = 0; c < channelCount; c++)
+		{
+			for (uint32_t t = 0; t < TEXELS; t++)
+			{
+				mean[c] += block.channels[c][t];
+			}
+			mean[c] /= TEXELS;
+		}
+
+		float covariance[4][4] = {};
+		for (uint32_t t = 0; t < TEXELS; t++)
+		{
+			for (uint32_t a = 0; a < channelCount; a++)
+			{
+				for (uint32_t b = 0; b < channelCount; b++)
+				{
+					covariance[a][b] += (block.channels[a][t] - mean[a]) * (block.channels[b][t] - mean[b]);
+				}
+			}
+		}
+
+		// Starting from the channel that varies most, the axis cannot be orthogonal to the principal one
+		uint32_t widest = 0;
+		for (uint32_t c = 1; c < channelCount; c++)
+		{
+			if (covariance[c][c] > covariance[widest][widest])
+			{
+				widest = c;
+			}
+		}
+
+		float axis[4] = {};
+		axis[widest] = 1.0f;
+		for (uint32_t iteration = 0; iteration < AXIS_ITERATIONS; iteration++)
+		{
+			float next[4] = {};
+			float length = 0.0f;
+			for (uint32_t a = 0; a < channelCount; a++)
+			{
+				for (uint32_t b = 0; b < channelCount; b++)
+				{
+					next[a] += covariance[a][b] * axis[b];
+				}
+				length += next[a] * next[a];
+			}
+
+			// All texels the same, any axis will do
+			if (length < 1e-12f)
+			{
+				break;
+			}
+
+			length = std::sqrt(length);
+			for (uint32_t c = 0; c < channelCount; c++)
+			{
+				axis[c] = next[c] / length;
+			}
+		}
+
+		float minimum = FLT_MAX;
+		float maximum = -FLT_MAX;
+		for (uint32_t t = 0; t < TEXELS; t++)
+		{
+			float projection = 0.0f;
+			for (uint32_t c = 0; c < channelCount; c++)
+			{
+				projection += (block.channels[c][t] - mean[c]) * axis[c];
+			}
+			minimum = std::min(minimum, projection);
+			maximum = std::max(maximum, projection);
+		}
+
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			endpoint0[c] = c < channelCount ? clampChannel(mean[c] + axis[c] * maximum) : 255.0f;
+			endpoint1[c] = c < channelCount ? clampChannel(mean[c] + axis[c] * minimum) : 255.0f;
+		}
+	}
+
+	// Endpoints that fit the texels best for the given indices, false if the indices cannot tell them apart
+	bool refitEndpoints(const Block& block, uint32_t channelCount, const uint8_t indices[TEXELS], const float* positions, float endpoint0[4], float endpoint1[4])
+	{
+		float aa = 0.0f;
+		float ab = 0.0f;
+		float bb = 0.0f;
+		float ax[4] = {};
+		float bx[4] = {};
+
+		for (uint32_t t = 0; t < TEXELS; t++)
+		{
+			float b = positions[indices[t]];
+			float a = 1.0f - b;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (uint32_t c = 0; c < channelCount; c++)
+			{
+				ax[c] += a * block.channels[c][t];
+				bx[c] += b * block.channels[c][t];
+			}
+		}
+
+		float determinant = aa * bb - ab * ab;
+		if (std::fabs(determinant) < 1e-6f)
+		{
+			return false;
+		}
+
+		for (uint32_t c = 0; c < channelCount; c++)
+		{
+			endpoint0[c] = clampChannel((bb * ax[c] - ab * bx[c]) / determinant);
+			endpoint1[c] = clampChannel((aa * bx[c] - ab * ax[c]) / determinant);
+		}
+
+		return true;
+	}
+
+	uint16_t quantize565(const float color[4])
+	{
+		uint32_t r = static_cast<uint32_t>(color[0] * 31.0f / 255.0f + 0.5f);
+		uint32_t g = static_cast<uint32_t>(color[1] * 63.0f / 255.0f + 0.5f);
+		uint32_t b = static_cast<uint32_t>(color[2] * 31.0f / 255.0f + 0.5f);
+		return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+	}
+
+	void expand565(uint16_t packed, uint32_t color[4])
+	{
+		uint32_t r = (packed >> 11) & 31;
+		uint32_t g = (packed >> 5) & 63;
+		uint32_t b = packed & 31;
+		color[0] = (r << 3) | (r >> 2);
+		color[1] = (g << 2) | (g >> 4);
+		color[2] = (b << 3) | (b >> 2);
+		color[3] = 255;
+	}
+
+	// Four colour palette, exact thirds; hardware rounds them slightly differently
+	void buildColorPalette(uint16_t color0, uint16_t color1, Palette& palette)
+	{
+		uint32_t expanded0[4];
+		uint32_t expanded1[4];
+		expand565(color0, expanded0);
+		expand565(color1, expanded1);
+
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			palette.entries[0][c] = float(expanded0[c]);
+			palette.entries[1][c] = float(expanded1[c]);
+			palette.entries[2][c] = (2.0f * expanded0[c] + expanded1[c]) / 3.0f;
+			palette.entries[3][c] = (expanded0[c] + 2.0f * expanded1[c]) / 3.0f;
+		}
+		palette.size = 4;
+	}
+
+	// Colour part of BC1 and BC3, always in four colour mode
+	void encodeColorBlock(const Block& block, uint8_t* output)
+	{
+		const float weights[4] = { 1.0f, 1.0f, 1.0f, 0.0f };
+
+		float endpoint0[4];
+		float endpoint1[4];
+		fitEndpoints(block, 3, endpoint0, endpoint1);
+
+		uint16_t bestColor0 = 0;
+		uint16_t bestColor1 = 0;
+		uint8_t bestIndices[TEXELS] = {};
+		float bestError = FLT_MAX;
+
+		Palette palette;
+		uint8_t indices[TEXELS];
+		for (uint32_t iteration = 0; iteration <= REFINE_ITERATIONS; iteration++)
+		{
+			uint16_t color0 = quantize565(endpoint0);
+			uint16_t color1 = quantize565(endpoint1);
+
+			// BC1 only decodes four colours if color0 is the larger one
+			if (color0 < color1)
+			{
+				std::swap(color0, color1);
+				std::swap(endpoint0, endpoint1);
+			}
+
+			buildColorPalette(color0, color1, palette);
+			float error = findIndices(block, palette, weights, indices);
+			if (error < bestError)
+			{
+				bestError = error;
+				bestColor0 = color0;
+				bestColor1 = color1;
+				memcpy(bestIndices, indices, TEXELS);
+			}
+
+			if (color0 == color1 || !refitEndpoints(block, 3, indices, BC1_POSITIONS, endpoint0, endpoint1))
+			{
+				break;
+			}
+		}
+
+		// Equal endpoints switch BC1 to three colour mode, where index 3 is transparent
+		uint32_t bits = 0;
+		if (bestColor0 != bestColor1)
+		{
+			for (uint32_t t = 0; t < TEXELS; t++)
+			{
+				bits |= uint32_t(bestIndices[t]) << (2 * t);
+			}
+		}
+
+		output[0] = static_cast<uint8_t>(bestColor0);
+		output[1] = static_cast<uint8_t>(bestColor0 >> 8);
+		output[2] = static_cast<uint8_t>(bestColor1);
+		output[3] = static_cast<uint8_t>(bestColor1 >> 8);
+		for (uint32_t b = 0; b < 4; b++)
+		{
+			output[4 + b] = static_cast<uint8_t>(bits >> (8 * b));
+		}
+	}
+
+	// BC4 block of the alpha channel, the eight value mode between the smallest and largest alpha
+	void encodeAlphaBlock(const Block& block, uint8_t* output)
+	{
+		float minimum = 255.0f;
+		float maximum = 0.0f;
+		for (uint32_t t = 0; t < TEXELS; t++)
+		{
+			minimum = std::min(minimum, block.channels[3][t]);
+			maximum = std::max(maximum, block.channels[3][t]);
+		}
+
+		uint8_t alpha0 = static_cast<uint8_t>(maximum);
+		uint8_t alpha1 = static_cast<uint8_t>(minimum);
+
+		uint64_t bits = 0;
+		if (alpha0 > alpha1)
+		{
+			float values[8];
+			values[0] = alpha0;
+			values[1] = alpha1;
+			for (uint32_t k = 2; k < 8; k++)
+			{
+				values[k] = ((8 - k) * float(alpha0) + (k - 1) * float(alpha1)) / 7.0f;
+			}
+
+			for (uint32_t t = 0; t < TEXELS; t++)
+			{
+				uint32_t best = 0;
+				for (uint32_t k = 1; k < 8; k++)
+				{
+					if (std::fabs(block.channels[3][t] - values[k]) < std::fabs(block.channels[3][t] - values[best]))
+					{
+						best = k;
+					}
+				}
+				bits |= uint64_t(best) << (3 * t);
+			}
+		}
+
+		output[0] = alpha0;
+		output[1] = alpha1;
+		for (uint32_t b = 0; b < 6; b++)
+		{
+			output[2 + b] = static_cast<uint8_t>(bits >> (8 * b));
+		}
+	}
+
+	// 7 bit endpoint with whichever p-bit lands closer to the wanted colour
+	void quantizeBc7Endpoint(const float color[4], uint32_t quantized[4], uint32_t& pbit)
+	{
+		float bestError = FLT_MAX;
+		for (uint32_t p = 0; p < 2; p++)
+		{
+			uint32_t candidate[4];
+			float error = 0.0f;
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				float value = std::round((color[c] - p) * 0.5f);
+				candidate[c] = static_cast<uint32_t>(std::min(std::max(value, 0.0f), 127.0f));
+				float decoded = float((candidate[c] << 1) | p);
+				error += (decoded - color[c]) * (decoded - color[c]);
+			}
+
+			if (error < bestError)
+			{
+				bestError = error;
+				pbit = p;
+				memcpy(quantized, candidate, sizeof(candidate));
+			}
+		}
+	}
+
+	void buildBc7Palette(const uint32_t quantized0[4], uint32_t pbit0, const uint32_t quantized1[4], uint32_t pbit1, Palette& palette)
+	{
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			uint32_t value0 = (quantized0[c] << 1) | pbit0;
+			uint32_t value1 = (quantized1[c] << 1) | pbit1;
+			for (uint32_t k = 0; k < 16; k++)
+			{
+				palette.entries[k][c] = float(((64 - BC7_WEIGHTS[k]) * value0 + BC7_WEIGHTS[k] * value1 + 32) >> 6);
+			}
+		}
+		palette.size = 16;
+	}
+
+	// BC7 mode 6
+	void encodeBc7Block(const Block& block, uint8_t* output)
+	{
+		const float weights[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+		float endpoint0[4];
+		float endpoint1[4];
+		fitEndpoints(block, 4, endpoint0, endpoint1);
+
+		uint32_t best0[4] = {};
+		uint32_t best1[4] = {};
+		uint32_t bestPbit0 = 0;
+		uint32_t bestPbit1 = 0;
+		uint8_t bestIndices[TEXELS] = {};
+		float bestError = FLT_MAX;
+
+		Palette palette;
+		uint8_t indices[TEXELS];
+		for (uint32_t iteration = 0; iteration <= REFINE_ITERATIONS; iteration++)
+		{
+			uint32_t quantized0[4];
+			uint32_t quantized1[4];
+			uint32_t pbit0 = 0;
+			uint32_t pbit1 = 0;
+			quantizeBc7Endpoint(endpoint0, quantized0, pbit0);
+			quantizeBc7Endpoint(endpoint1, quantized1, pbit1);
+
+			buildBc7Palette(quantized0, pbit0, quantized1, pbit1, palette);
+			float error = findIndices(block, palette, weights, indices);
+			if (error < bestError)
+			{
+				bestError = error;
+				memcpy(best0, quantized0, sizeof(best0));
+				memcpy(best1, quantized1, sizeof(best1));
+				bestPbit0 = pbit0;
+				bestPbit1 = pbit1;
+				memcpy(bestIndices, indices, TEXELS);
+			}
+
+			if (!refitEndpoints(block, 4, indices, BC7_POSITIONS, endpoint0, endpoint1))
+			{
+				break;
+			}
+		}
+
+		// The first texel stores its index in 3 bits, so its top bit has to be 0
+		if (bestIndices[0] >= 8)
+		{
+			std::swap(best0, best1);
+			std::swap(bestPbit0, bestPbit1);
+			for (uint32_t t = 0; t < TEXELS; t++)
+			{
+				bestIndices[t] = static_cast<uint8_t>(15 - bestIndices[t]);
+			}
+		}
+
+		memset(output, 0, 16);
+		uint32_t position = 0;
+		auto put = [&](uint32_t value, uint32_t count)
+		{
+			for (uint32_t b = 0; b < count; b++, position++)
+			{
+				output[position >> 3] |= static_cast<uint8_t>(((value >> b) & 1) << (position & 7));
+			}
+		};
+
+		put(1 << 6, 7);
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			put(best0[c], 7);
+			put(best1[c], 7);
+		}
+		put(bestPbit0, 1);
+		put(bestPbit1, 1);
+		put(bestIndices[0], 3);
+		for (uint32_t t = 1; t < TEXELS; t++)
+		{
+			put(bestIndices[t], 4);
+		}
+	}
+
+	void decodeColorBlock(const uint8_t* input, bool allowThreeColors, uint8_t texels[TEXELS][4])
+	{
+		uint16_t color0 = static_cast<uint16_t>(input[0] | (input[1] << 8));
+		uint16_t color1 = static_cast<uint16_t>(input[2] | (input[3] << 8));
+		uint32_t bits = uint32_t(input[4]) | (uint32_t(input[5]) << 8) | (uint32_t(input[6]) << 16) | (uint32_t(input[7]) << 24);
+
+		uint32_t palette[4][4];
+		expand565(color0, palette[0]);
+		expand565(color1, palette[1]);
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			if (color0 > color1 || !allowThreeColors)
+			{
+				palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+				palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+			}
+			else
+			{
+				palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+				palette[3][c] = 0;
+			}
+		}
+
+		for (uint32_t t = 0; t < TEXELS; t++)
+		{
+			const uint32_t* color = palette[(bits >> (2 * t)) & 3];
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				texels[t][c] = static_cast<uint8_t>(color[c]);
+			}
+		}
+	}
+
+	void decodeAlphaBlock(const uint8_t* input, uint8_t texels[TEXELS][4])
+	{
+		uint32_t alpha0 = input[0];
+		uint32_t alpha1 = input[1];
+		uint64_t bits = 0;
+		for (uint32_t b = 0; b < 6; b++)
+		{
+			bits |= uint64_t(input[2 + b]) << (8 * b);
+		}
+
+		uint32_t values[8] = { alpha0, alpha1 };
+		for (uint32_t k = 2; k < 8; k++)
+		{
+			if (alpha0 > alpha1)
+			{
+				values[k] = ((8 - k) * alpha0 + (k - 1) * alpha1) / 7;
+			}
+			else
+			{
+				values[k] = k < 6 ? ((6 - k) * alpha0 + (k - 1) * alpha1) / 5 : (k == 6 ? 0 : 255);
+			}
+		}
+
+		for (uint32_t t = 0; t < TEXELS; t++)
+		{
+			texels[t][3] = static_cast<uint8_t>(values[(bits >> (3 * t)) & 7]);
+		}
+	}
+
+	void decodeBc7Block(const uint8_t* input, uint8_t texels[TEXELS][4])
+	{
+		if ((input[0] & 0x7f) != 0x40)
+		{
+			throw std::runtime_error("failed to decode BC7 block in a mode other than 6!");
+		}
+
+		uint32_t position = 7;
+		auto get = [&](uint32_t count)
+		{
+			uint32_t value = 0;
+			for (uint32_t b = 0; b < count; b++, position++)
+			{
+				value |= uint32_t((input[position >> 3] >> (position & 7)) & 1) << b;
+			}
+			return value;
+		};
+
+		uint32_t endpoints[2][4];
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			endpoints[0][c] = get(7);
+			endpoints[1][c] = get(7);
+		}
+		uint32_t pbit0 = get(1);
+		uint32_t pbit1 = get(1);
+
+		for (uint32_t t = 0; t < TEXELS; t++)
+		{
+			uint32_t weight = BC7_WEIGHTS[get(t == 0 ? 3 : 4)];
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				uint32_t value0 = (endpoints[0][c] << 1) | pbit0;
+				uint32_t value1 = (endpoints[1][c] << 1) | pbit1;
+				texels[t][c] = static_cast<uint8_t>(((64 - weight) * value0 + weight * value1 + 32) >> 6);
+			}
+		}
+	}
+}
+
+uint32_t BlockCompressor::getBlockBytes(TextureFormat format)
+{
+	switch (format)
+	{
+	case TextureFormat::Bc1:
+		return 8;
+	case TextureFormat::Bc3:
+	case TextureFormat::Bc7:
+		return 16;
+	default:
+		throw std::runtime_error("texture format is not block compressed!");
+	}
+}
+
+bool BlockCompressor::hasAvx2()
+{
+	return hasAvx2Support;
+}
+
+void BlockCompressor::setAvx2Enabled(bool enabled)
+{
+	useAvx2 = enabled && hasAvx2Support;
+}
+
+const char* BlockCompressor::getSimdName()
+{
+	if (useAvx2)
+	{
+		return "AVX2";
+	}
+
+#if defined(BLOCK_COMPRESSOR_SSE2)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
+
+void BlockCompressor::compress(TextureFormat format, const uint8_t* pixels, uint32_t width, uint32_t height, uint8_t* destination, ThreadPool* threadPool)
+{
+	uint32_t blockRows = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+	if (threadPool)
+	{
+		threadPool->parallelFor(blockRows, [&](uint32_t blockRow)
+		{
+			compressRow(format, pixels, width, height, blockRow, destination);
+		});
+	}
+	else
+	{
+		for (uint32_t blockRow = 0; blockRow < blockRows; blockRow++)
+		{
+			compressRow(format, pixels, width, height, blockRow, destination);
+		}
+	}
+}
+
+void BlockCompressor::compressRow(TextureFormat format, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t blockRow, uint8_t* destination)
+{
+	uint32_t blockColumns = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	uint32_t blockBytes = getBlockBytes(format);
+
+	Block block;
+	for (uint32_t blockColumn = 0; blockColumn < blockColumns; blockColumn++)
+	{
+		loadBlock(pixels, width, height, blockColumn, blockRow, block);
+		uint8_t* output = destination + (size_t(blockRow) * blockColumns + blockColumn) * blockBytes;
+
+		switch (format)
+		{
+		case TextureFormat::Bc1:
+			encodeColorBlock(block, output);
+			break;
+		case TextureFormat::Bc3:
+			encodeAlphaBlock(block, output);
+			encodeColorBlock(block, output + 8);
+			break;
+		case TextureFormat::Bc7:
+			encodeBc7Block(block, output);
+			break;
+		default:
+			throw std::runtime_error("texture format is not block compressed!");
+		}
+	}
+}
+
+void BlockCompressor::decompress(TextureFormat format, const uint8_t* source, uint32_t width, uint32_t height, uint8_t* pixels)
+{
+	uint32_t blockColumns = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	uint32_t blockRows = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	uint32_t blockBytes = getBlockBytes(format);
+
+	uint8_t texels[TEXELS][4];
+	for (uint32_t blockRow = 0; blockRow < blockRows; blockRow++)
+	{
+		for (uint32_t blockColumn = 0; blockColumn < blockColumns; blockColumn++)
+		{
+			const uint8_t* input = source + (size_t(blockRow) * blockColumns + blockColumn) * blockBytes;
+
+			switch (format)
+			{
+			case TextureFormat::Bc1:
+				decodeColorBlock(input, true, texels);
+				break;
+			case TextureFormat::Bc3:
+				decodeColorBlock(input + 8, false, texels);
+				decodeAlphaBlock(input, texels);
+				break;
+			case TextureFormat::Bc7:
+				decodeBc7Block(input, texels);
+				break;
+			default:
+				throw std::runtime_error("texture format is not block compressed!");
+			}
+
+			for (uint32_t y = 0; y < BLOCK_SIZE && blockRow * BLOCK_SIZE + y < height; y++)
+			{
+				for (uint32_t x = 0; x < BLOCK_SIZE && blockColumn * BLOCK_SIZE + x < width; x++)
+				{
+					size_t pixel = size_t(blockRow * BLOCK_SIZE + y) * width + blockColumn * BLOCK_SIZE + x;
+					memcpy(pixels + pixel * 4, texels[y * BLOCK_SIZE + x], 4);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+
+#include "TextureLoader.h"
+#include "../util/ThreadPool.h"
+
+/*
+BC1, BC3 and BC7 encoding of RGBA8 images at cook time.
+
+Every 4x4 block is fitted the same way: the endpoints start at the extremes of the texels along
+their principal axis, every texel takes the nearest palette entry, then the endpoints are solved
+again by least squares for those indices and kept if the error went down. The nearest entry
+search is where the time goes; it runs on four texels at once with SSE2, or on eight with AVX2
+when the CPU has it. The AVX2 search is built for that instruction set in BlockCompressorAvx2.cpp
+and picked at runtime, so one binary runs everywhere.
+
+	BC1		opaque colour, 4 bits per texel. Always in four colour mode, only meant for images
+			without alpha
+	BC3		BC1 colour plus a BC4 alpha block, 8 bits per texel
+	BC7		mode 6 only: one RGBA endpoint pair with 7 bit channels and a p-bit each and 16 weights,
+			8 bits per texel. Much better than BC3 on gradients and on alpha
+
+Blocks past the edge of sizes that are not a multiple of 4 repeat the last row and column.
+*/
+class BlockCompressor
+{
+public:
+	static const uint32_t BLOCK_SIZE = 4;
+
+	// Bytes of one block in a block compressed format
+	static uint32_t getBlockBytes(TextureFormat format);
+	// Whether the CPU can run the AVX2 palette search, which is then used by default
+	static bool hasAvx2();
+	// Not thread safe, only meant for comparing the two searches while nothing is being compressed
+	static void setAvx2Enabled(bool enabled);
+	// Instruction set the palette search runs on
+	static const char* getSimdName();
+
+	// Compresses one level, rows of blocks are spread over the pool if there is one
+	static void compress(TextureFormat format, const uint8_t* pixels, uint32_t width, uint32_t height, uint8_t* destination, ThreadPool* threadPool);
+	// Compresses the blocks of one row, destination points at the first block of the level
+	static void compressRow(TextureFormat format, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t blockRow, uint8_t* destination);
+
+	// Decodes a level back to RGBA8 to measure the encoder, BC7 only in the mode the encoder writes
+	static void decompress(TextureFormat format, const uint8_t* source, uint32_t width, uint32_t height, uint8_t* pixels);
+};
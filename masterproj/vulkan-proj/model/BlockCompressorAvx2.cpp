@@ -0,0 +1,57 @@
+#include "BlockCompressorAvx2.h"
+
+#if defined(BLOCK_COMPRESSOR_AVX2)
+
+#include <cfloat>
+
+#include <immintrin.h>
+
+#if defined(__GNUC__)
+#define AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define AVX2_TARGET
+#endif
+
+AVX2_TARGET float findPaletteIndicesAvx2(const float channels[4][16], const float palette[][4], uint32_t paletteSize, const float weights[4], uint8_t indices[16])
+{
+	float error = 0.0f;
+
+	for (uint32_t first = 0; first < 16; first += 8)
+	{
+		__m256 texels[4];
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			texels[c] = _mm256_load_ps(&channels[c][first]);
+		}
+
+		__m256 best = _mm256_set1_ps(FLT_MAX);
+		__m256 bestIndex = _mm256_setzero_ps();
+		for (uint32_t i = 0; i < paletteSize; i++)
+		{
+			__m256 distance = _mm256_setzero_ps();
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				__m256 difference = _mm256_sub_ps(texels[c], _mm256_set1_ps(palette[i][c]));
+				distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_mul_ps(difference, difference), _mm256_set1_ps(weights[c])));
+			}
+
+			__m256 closer = _mm256_cmp_ps(distance, best, _CMP_LT_OQ);
+			best = _mm256_min_ps(distance, best);
+			bestIndex = _mm256_blendv_ps(bestIndex, _mm256_set1_ps(float(i)), closer);
+		}
+
+		alignas(32) float bestErrors[8];
+		alignas(32) int32_t bestIndices[8];
+		_mm256_store_ps(bestErrors, best);
+		_mm256_store_si256(reinterpret_cast<__m256i*>(bestIndices), _mm256_cvtps_epi32(bestIndex));
+		for (uint32_t k = 0; k < 8; k++)
+		{
+			indices[first + k] = static_cast<uint8_t>(bestIndices[k]);
+			error += bestErrors[k];
+		}
+	}
+
+	return error;
+}
+
+#endif
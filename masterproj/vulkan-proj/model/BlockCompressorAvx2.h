@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+// x86 builds carry the AVX2 palette search in BlockCompressorAvx2.cpp, chosen at runtime
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BLOCK_COMPRESSOR_AVX2
+#endif
+
+/*
+Nearest palette entry of each of the 16 texels of a block under the channel weights, returns the
+summed weighted squared error. channels holds the texels by channel and is 32 byte aligned.
+
+Built for AVX2 in its own translation unit (/arch:AVX2, or the avx2 target attribute on GCC and
+Clang) while the rest of the program sticks to SSE2, so it may only run once BlockCompressor has
+found AVX2 on the CPU.
+*/
+float findPaletteIndicesAvx2(const float channels[4][16], const float palette[][4], uint32_t paletteSize, const float weights[4], uint8_t indices[16]);
@@ -0,0 +1,269 @@
+#include "ClusterBuilder.h"
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+	const uint32_t NONE = UINT32_MAX;
+}
+
+void ClusterBuilder::build(Model& model)
+{
+	if (model.vertices.size() != model.getVertexCount() || !model.lods.empty())
+	{
+		throw std::runtime_error("cluster generation needs an imported model without levels of detail!");
+	}
+
+	uint32_t vertexCount = static_cast<uint32_t>(model.vertices.size());
+	uint32_t triangleCount = static_cast<uint32_t>(model.indices.size() / 3);
+	std::vector<uint32_t>& indices = model.indices;
+
+	// Triangles around each vertex, offsets[v] to offsets[v + 1] in adjacency
+	std::vector<uint32_t> offsets(vertexCount + 1, 0);
+	for (size_t i = 0; i < size_t(triangleCount) * 3; i++)
+	{
+		offsets[indices[i] + 1]++;
+	}
+	for (uint32_t v = 0; v < vertexCount; v++)
+	{
+		offsets[v + 1] += offsets[v];
+	}
+
+	std::vector<uint32_t> adjacency(size_t(triangleCount) * 3);
+	std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < size_t(triangleCount) * 3; i++)
+	{
+		adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+	}
+
+	std::vector<uint8_t> emitted(triangleCount, 0);
+	// Vertices a candidate triangle shares with the current cluster
+	std::vector<uint8_t> shared(triangleCount, 0);
+	std::vector<uint32_t> touched;
+	// Candidates by shared vertex count - 1, stale entries are skipped when popped
+	std::vector<uint32_t> candidates[3];
+
+	std::vector<uint32_t> clusterSlot(vertexCount, NONE);
+	std::vector<uint32_t> clusterVertices;
+	std::vector<uint32_t> reordered;
+	std::vector<uint32_t> localIndices;
+
+	model.clusters.clear();
+
+	for (const Submesh& submesh : model.submeshes)
+	{
+		uint32_t begin = submesh.firstIndex / 3;
+		uint32_t end = begin + submesh.indexCount / 3;
+		uint32_t cursor = begin;
+		reordered.clear();
+
+		auto countNewVertices = [&](uint32_t triangle)
+		{
+			uint32_t a = indices[triangle * 3 + 0];
+			uint32_t b = indices[triangle * 3 + 1];
+			uint32_t c = indices[triangle * 3 + 2];
+			return uint32_t(clusterSlot[a] == NONE) + uint32_t(clusterSlot[b] == NONE && b != a) + uint32_t(clusterSlot[c] == NONE && c != a && c != b);
+		};
+
+		auto addTriangle = [&](uint32_t triangle)
+		{
+			emitted[triangle] = 1;
+
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				uint32_t vertex = indices[triangle * 3 + k];
+				reordered.push_back(vertex);
+
+				if (clusterSlot[vertex] != NONE)
+				{
+					continue;
+				}
+
+				clusterSlot[vertex] = static_cast<uint32_t>(clusterVertices.size());
+				clusterVertices.push_back(vertex);
+
+				for (uint32_t a = offsets[vertex]; a < offsets[vertex + 1]; a++)
+				{
+					uint32_t neighbour = adjacency[a];
+					if (neighbour < begin || neighbour >= end || emitted[neighbour])
+					{
+						continue;
+					}
+
+					if (shared[neighbour] == 0)
+					{
+						touched.push_back(neighbour);
+					}
+					shared[neighbour]++;
+					candidates[std::min<uint32_t>(shared[neighbour], 3) - 1].push_back(neighbour);
+				}
+			}
+		};
+
+		auto nextUnemitted = [&]()
+		{
+			while (cursor < end && emitted[cursor])
+			{
+				cursor++;
+			}
+			return cursor < end ? cursor : NONE;
+		};
+
+		for (uint32_t seed = nextUnemitted(); seed != NONE; seed = nextUnemitted())
+		{
+			uint32_t clusterStart = static_cast<uint32_t>(reordered.size());
+			uint32_t clusterTriangles = 1;
+			addTriangle(seed);
+
+			while (clusterTriangles < MAX_TRIANGLES)
+			{
+				// The neighbour sharing the most vertices, so the fewest new ones
+				uint32_t next = NONE;
+				for (int bucket = 2; bucket >= 0 && next == NONE; bucket--)
+				{
+					while (!candidates[bucket].empty())
+					{
+						uint32_t triangle = candidates[bucket].back();
+						candidates[bucket].pop_back();
+						if (!emitted[triangle] && std::min<uint32_t>(shared[triangle], 3) == uint32_t(bucket) + 1)
+						{
+							next = triangle;
+							break;
+						}
+					}
+				}
+
+				if (next == NONE)
+				{
+					next = nextUnemitted();
+					if (next == NONE)
+					{
+						break;
+					}
+				}
+
+				if (clusterVertices.size() + countNewVertices(next) > MAX_VERTICES)
+				{
+					break;
+				}
+
+				addTriangle(next);
+				clusterTriangles++;
+			}
+
+			// Growing by shared vertices does not make a good cache order, the cluster gets its own
+			uint32_t* clusterIndices = reordered.data() + clusterStart;
+			localIndices.resize(clusterTriangles * 3);
+			for (uint32_t i = 0; i < clusterTriangles * 3; i++)
+			{
+				localIndices[i] = clusterSlot[clusterIndices[i]];
+			}
+			MeshOptimizer::optimizeVertexCache(localIndices.data(), localIndices.size(), static_cast<uint32_t>(clusterVertices.size()), nullptr);
+			for (uint32_t i = 0; i < clusterTriangles * 3; i++)
+			{
+				clusterIndices[i] = clusterVertices[localIndices[i]];
+			}
+
+			MeshCluster cluster = computeBounds(clusterIndices, clusterTriangles * 3, model.vertices.data());
+			cluster.firstIndex = submesh.firstIndex + clusterStart;
+			model.clusters.push_back(cluster);
+
+			for (uint32_t vertex : clusterVertices)
+			{
+				clusterSlot[vertex] = NONE;
+			}
+			clusterVertices.clear();
+			for (uint32_t triangle : touched)
+			{
+				shared[triangle] = 0;
+			}
+			touched.clear();
+			for (std::vector<uint32_t>& bucket : candidates)
+			{
+				bucket.clear();
+			}
+		}
+
+		std::copy(reordered.begin(), reordered.end(), indices.begin() + submesh.firstIndex);
+	}
+}
+
+MeshCluster ClusterBuilder::computeBounds(const uint32_t* indices, uint32_t indexCount, const Vertex* vertices)
+{
+	MeshCluster cluster;
+	cluster.indexCount = indexCount;
+
+	if (indexCount == 0)
+	{
+		return cluster;
+	}
+
+	glm::vec3 minimum = vertices[indices[0]].pos;
+	glm::vec3 maximum = minimum;
+	for (uint32_t i = 0; i < indexCount; i++)
+	{
+		minimum = glm::min(minimum, vertices[indices[i]].pos);
+		maximum = glm::max(maximum, vertices[indices[i]].pos);
+	}
+
+	// Centered on the bounding box like the model bounds
+	glm::vec3 center = (minimum + maximum) * 0.5f;
+	float radiusSquared = 0.0f;
+	for (uint32_t i = 0; i < indexCount; i++)
+	{
+		glm::vec3 offset = vertices[indices[i]].pos - center;
+		radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+	}
+	cluster.boundingSphere = glm::vec4(center, std::sqrt(radiusSquared));
+
+	auto getNormal = [&](uint32_t triangle, glm::vec3& normal)
+	{
+		const glm::vec3& a = vertices[indices[triangle * 3 + 0]].pos;
+		const glm::vec3& b = vertices[indices[triangle * 3 + 1]].pos;
+		const glm::vec3& c = vertices[indices[triangle * 3 + 2]].pos;
+
+		normal = glm::cross(b - a, c - a);
+		float length = glm::length(normal);
+		if (length <= 0.0f)
+		{
+			return false;
+		}
+		normal /= length;
+		return true;
+	};
+
+	glm::vec3 normal;
+	glm::vec3 normalSum(0.0f);
+	for (uint32_t t = 0; t < indexCount / 3; t++)
+	{
+		if (getNormal(t, normal))
+		{
+			normalSum += normal;
+		}
+	}
+
+	float axisLength = glm::length(normalSum);
+	if (axisLength <= 0.0f)
+	{
+		return cluster;
+	}
+	glm::vec3 axis = normalSum / axisLength;
+
+	// The cone has to contain every normal
+	float minDot = 1.0f;
+	for (uint32_t t = 0; t < indexCount / 3; t++)
+	{
+		if (getNormal(t, normal))
+		{
+			minDot = std::min(minDot, glm::dot(normal, axis));
+		}
+	}
+
+	cluster.cone = glm::vec4(axis, minDot < MIN_CONE_DOT ? 1.0f : std::sqrt(1.0f - minDot * minDot));
+
+	return cluster;
+}
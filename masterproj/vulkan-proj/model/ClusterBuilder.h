@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+#include "ModelLoader.h"
+
+/*
+Splits LOD 0 into clusters (meshlets) for culling below the object level.
+
+Clusters grow greedily from a seed triangle, always taking the neighbouring triangle that brings
+the fewest new vertices, until MAX_VERTICES or MAX_TRIANGLES would be exceeded; without neighbours
+left the next triangle in index order is taken. Seeds follow the index order, which after the mesh
+optimizer keeps consecutive clusters close to each other.
+
+Every cluster gets a bounding sphere and a normal cone, which allows culling clusters whose
+triangles all face away from the camera. A cluster is back facing if
+	dot(center - camera, axis) >= cutoff * length(center - camera) + radius
+The triangles of a cluster are put in post-transform cache order among themselves.
+*/
+class ClusterBuilder
+{
+public:
+	// Small enough for a mesh shader workgroup should the renderer ever get one
+	static const uint32_t MAX_VERTICES = 64;
+	static const uint32_t MAX_TRIANGLES = 124;
+
+	// Reorders the triangles of every submesh into clusters and fills model.clusters, needs an imported model without LODs
+	static void build(Model& model);
+
+	static MeshCluster computeBounds(const uint32_t* indices, uint32_t indexCount, const Vertex* vertices);
+
+private:
+	// Below this the normals are too far apart for the cone to ever cull
+	static constexpr float MIN_CONE_DOT = 0.1f;
+};
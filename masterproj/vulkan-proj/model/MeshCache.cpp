@@ -0,0 +1,206 @@
+#include "MeshCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+bool MeshCache::load(const std::string& cachePath, uint64_t sourceHash, Model& model)
+{
+	auto file = std::make_shared<MappedFile>(cachePath);
+	if (!file->isOpen() || file->getSize() < sizeof(MeshCacheHeader))
+	{
+		return false;
+	}
+
+	MeshCacheHeader header;
+	std::memcpy(&header, file->getData(), sizeof(header));
+
+	if (header.magic != MAGIC || header.formatVersion != FORMAT_VERSION || header.importerVersion != IMPORTER_VERSION
+		|| header.vertexStride != sizeof(Vertex) || header.sourceHash != sourceHash || header.fileSize != file->getSize())
+	{
+		return false;
+	}
+
+	// Every block has to lie inside the file, a truncated write must not be read past its end
+	uint64_t vertexEnd = header.vertexOffset + uint64_t(header.vertexCount) * sizeof(Vertex);
+	uint64_t indexEnd = header.indexOffset + uint64_t(header.indexCount) * sizeof(uint32_t);
+	uint64_t submeshEnd = header.submeshOffset + uint64_t(header.submeshCount) * sizeof(MeshCacheSubmesh);
+	uint64_t lodEnd = header.lodOffset + uint64_t(header.lodCount) * sizeof(MeshCacheLod);
+	uint64_t clusterEnd = header.clusterOffset + uint64_t(header.clusterCount) * sizeof(MeshCacheCluster);
+	if (header.vertexOffset % BLOCK_ALIGNMENT != 0 || header.indexOffset % BLOCK_ALIGNMENT != 0 || header.submeshOffset % BLOCK_ALIGNMENT != 0
+		|| header.lodOffset % BLOCK_ALIGNMENT != 0 || header.clusterOffset % BLOCK_ALIGNMENT != 0 || header.vertexOffset < sizeof(MeshCacheHeader)
+		|| vertexEnd > header.indexOffset || indexEnd > header.submeshOffset || submeshEnd > header.lodOffset || lodEnd > header.clusterOffset || clusterEnd > header.fileSize
+		|| header.lodCount > Model::MAX_LOD_COUNT)
+	{
+		return false;
+	}
+
+	const char* data = file->getData();
+
+	std::vector<Submesh> submeshes(header.submeshCount);
+	for (uint32_t i = 0; i < header.submeshCount; i++)
+	{
+		MeshCacheSubmesh entry;
+		std::memcpy(&entry, data + header.submeshOffset + i * sizeof(MeshCacheSubmesh), sizeof(entry));
+
+		if (uint64_t(entry.firstIndex) + entry.indexCount > header.indexCount)
+		{
+			return false;
+		}
+
+		submeshes[i].firstIndex = entry.firstIndex;
+		submeshes[i].indexCount = entry.indexCount;
+		submeshes[i].materialId = entry.materialId;
+	}
+
+	std::vector<MeshLod> lods(header.lodCount);
+	for (uint32_t i = 0; i < header.lodCount; i++)
+	{
+		MeshCacheLod entry;
+		std::memcpy(&entry, data + header.lodOffset + i * sizeof(MeshCacheLod), sizeof(entry));
+
+		if (uint64_t(entry.firstIndex) + entry.indexCount > header.indexCount)
+		{
+			return false;
+		}
+
+		lods[i].firstIndex = entry.firstIndex;
+		lods[i].indexCount = entry.indexCount;
+		lods[i].error = entry.error;
+	}
+
+	std::vector<MeshCluster> clusters(header.clusterCount);
+	for (uint32_t i = 0; i < header.clusterCount; i++)
+	{
+		MeshCacheCluster entry;
+		std::memcpy(&entry, data + header.clusterOffset + i * sizeof(MeshCacheCluster), sizeof(entry));
+
+		if (uint64_t(entry.firstIndex) + entry.indexCount > header.indexCount)
+		{
+			return false;
+		}
+
+		clusters[i].boundingSphere = glm::vec4(entry.boundingSphere[0], entry.boundingSphere[1], entry.boundingSphere[2], entry.boundingSphere[3]);
+		clusters[i].cone = glm::vec4(entry.cone[0], entry.cone[1], entry.cone[2], entry.cone[3]);
+		clusters[i].firstIndex = entry.firstIndex;
+		clusters[i].indexCount = entry.indexCount;
+	}
+
+	model.submeshes = std::move(submeshes);
+	model.lods = std::move(lods);
+	model.clusters = std::move(clusters);
+	model.boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+	model.boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+	model.boundingSphere = glm::vec4(header.boundingSphere[0], header.boundingSphere[1], header.boundingSphere[2], header.boundingSphere[3]);
+
+	const Vertex* vertices = reinterpret_cast<const Vertex*>(data + header.vertexOffset);
+	const uint32_t* indices = reinterpret_cast<const uint32_t*>(data + header.indexOffset);
+	model.setMappedData(file, vertices, header.vertexCount, indices, header.indexCount);
+
+	return true;
+}
+
+bool MeshCache::save(const std::string& cachePath, uint64_t sourceHash, const Model& model)
+{
+	MeshCacheHeader header = {};
+	header.magic = MAGIC;
+	header.formatVersion = FORMAT_VERSION;
+	header.importerVersion = IMPORTER_VERSION;
+	header.vertexStride = sizeof(Vertex);
+	header.sourceHash = sourceHash;
+	header.vertexCount = model.getVertexCount();
+	header.indexCount = model.getIndexCount();
+	header.submeshCount = static_cast<uint32_t>(model.submeshes.size());
+	header.lodCount = static_cast<uint32_t>(model.lods.size());
+	header.clusterCount = static_cast<uint32_t>(model.clusters.size());
+
+	header.vertexOffset = alignUp(sizeof(MeshCacheHeader));
+	header.indexOffset = alignUp(header.vertexOffset + uint64_t(header.vertexCount) * sizeof(Vertex));
+	header.submeshOffset = alignUp(header.indexOffset + uint64_t(header.indexCount) * sizeof(uint32_t));
+	header.lodOffset = alignUp(header.submeshOffset + uint64_t(header.submeshCount) * sizeof(MeshCacheSubmesh));
+	header.clusterOffset = alignUp(header.lodOffset + uint64_t(header.lodCount) * sizeof(MeshCacheLod));
+	header.fileSize = header.clusterOffset + uint64_t(header.clusterCount) * sizeof(MeshCacheCluster);
+
+	for (int i = 0; i < 3; i++)
+	{
+		header.boundsMin[i] = model.boundsMin[i];
+		header.boundsMax[i] = model.boundsMax[i];
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		header.boundingSphere[i] = model.boundingSphere[i];
+	}
+
+	std::vector<MeshCacheSubmesh> submeshes(header.submeshCount);
+	for (uint32_t i = 0; i < header.submeshCount; i++)
+	{
+		submeshes[i] = { model.submeshes[i].firstIndex, model.submeshes[i].indexCount, model.submeshes[i].materialId, 0 };
+	}
+
+	std::vector<MeshCacheLod> lods(header.lodCount);
+	for (uint32_t i = 0; i < header.lodCount; i++)
+	{
+		lods[i] = { model.lods[i].firstIndex, model.lods[i].indexCount, model.lods[i].error, 0 };
+	}
+
+	std::vector<MeshCacheCluster> clusters(header.clusterCount);
+	for (uint32_t i = 0; i < header.clusterCount; i++)
+	{
+		const MeshCluster& cluster = model.clusters[i];
+		MeshCacheCluster& entry = clusters[i];
+		entry = {};
+		for (int k = 0; k < 4; k++)
+		{
+			entry.boundingSphere[k] = cluster.boundingSphere[k];
+			entry.cone[k] = cluster.cone[k];
+		}
+		entry.firstIndex = cluster.firstIndex;
+		entry.indexCount = cluster.indexCount;
+	}
+
+	std::string tmpPath = cachePath + ".tmp";
+	{
+		std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			return false;
+		}
+
+		static const char padding[BLOCK_ALIGNMENT] = {};
+		auto padTo = [&](uint64_t offset)
+		{
+			file.write(padding, static_cast<std::streamsize>(offset - static_cast<uint64_t>(file.tellp())));
+		};
+
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		padTo(header.vertexOffset);
+		file.write(reinterpret_cast<const char*>(model.getVertices()), static_cast<std::streamsize>(header.vertexCount * sizeof(Vertex)));
+		padTo(header.indexOffset);
+		file.write(reinterpret_cast<const char*>(model.getIndices()), static_cast<std::streamsize>(header.indexCount * sizeof(uint32_t)));
+		padTo(header.submeshOffset);
+		file.write(reinterpret_cast<const char*>(submeshes.data()), static_cast<std::streamsize>(submeshes.size() * sizeof(MeshCacheSubmesh)));
+		padTo(header.lodOffset);
+		file.write(reinterpret_cast<const char*>(lods.data()), static_cast<std::streamsize>(lods.size() * sizeof(MeshCacheLod)));
+		padTo(header.clusterOffset);
+		file.write(reinterpret_cast<const char*>(clusters.data()), static_cast<std::streamsize>(clusters.size() * sizeof(MeshCacheCluster)));
+
+		if (!file.good())
+		{
+			file.close();
+			std::remove(tmpPath.c_str());
+			return false;
+		}
+	}
+
+	// rename() does not replace an existing file everywhere
+	std::remove(cachePath.c_str());
+	if (std::rename(tmpPath.c_str(), cachePath.c_str()) != 0)
+	{
+		std::remove(tmpPath.c_str());
+		return false;
+	}
+
+	return true;
+}
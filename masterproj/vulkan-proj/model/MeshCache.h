@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "ModelLoader.h"
+
+/*
+Binary mesh files written after an OBJ import, so later runs skip parsing entirely.
+
+Layout, all blocks 16 byte aligned and in native byte order:
+	MeshCacheHeader
+	vertex block	vertexCount * sizeof(Vertex)
+	index block		indexCount * uint32_t
+	submesh table	submeshCount * MeshCacheSubmesh
+	LOD table		lodCount * MeshCacheLod
+	cluster table	clusterCount * MeshCacheCluster
+
+load() maps the file and points the model straight at the vertex and index blocks, the payload is
+only touched when it is copied into staging memory. A file is used only if it was written from a
+source with the same hash by the same IMPORTER_VERSION; anything else counts as a miss.
+*/
+class MeshCache
+{
+public:
+	// Bump whenever the importer output changes (dedup, attributes, vertex layout, ...)
+	static const uint32_t IMPORTER_VERSION = 6;
+
+	// False on a missing, stale or malformed file, model is left untouched then
+	static bool load(const std::string& cachePath, uint64_t sourceHash, Model& model);
+	// Written to a temporary file and renamed, false if that fails
+	static bool save(const std::string& cachePath, uint64_t sourceHash, const Model& model);
+
+private:
+	static const uint32_t MAGIC = 0x4853454d; // "MESH"
+	static const uint32_t FORMAT_VERSION = 3;
+	static const uint64_t BLOCK_ALIGNMENT = 16;
+
+	struct MeshCacheHeader
+	{
+		uint32_t magic;
+		uint32_t formatVersion;
+		uint32_t importerVersion;
+		uint32_t vertexStride;
+		uint64_t sourceHash;
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		uint32_t submeshCount;
+		uint32_t lodCount;
+		uint32_t clusterCount;
+		uint32_t pad;
+		uint64_t vertexOffset;
+		uint64_t indexOffset;
+		uint64_t submeshOffset;
+		uint64_t lodOffset;
+		uint64_t clusterOffset;
+		uint64_t fileSize;
+		float boundsMin[4];
+		float boundsMax[4];
+		float boundingSphere[4];
+	};
+
+	struct MeshCacheSubmesh
+	{
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		uint32_t materialId;
+		uint32_t pad;
+	};
+
+	struct MeshCacheLod
+	{
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		float error;
+		uint32_t pad;
+	};
+
+	struct MeshCacheCluster
+	{
+		float boundingSphere[4];
+		float cone[4];
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		uint32_t pad[2];
+	};
+
+	static uint64_t alignUp(uint64_t value) { return (value + BLOCK_ALIGNMENT - 1) & ~(BLOCK_ALIGNMENT - 1); }
+};
@@ -0,0 +1,392 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+	const uint32_t UNUSED = UINT32_MAX;
+
+	// FIFO cache as in Tipsify: a vertex is cached if it entered less than CACHE_SIZE misses ago
+	struct CacheModel
+	{
+		std::vector<uint32_t> entered;
+		uint32_t time = MeshOptimizer::CACHE_SIZE + 1;
+
+		explicit CacheModel(uint32_t vertexCount) : entered(vertexCount, 0) {}
+
+		bool contains(uint32_t vertex) const { return time - entered[vertex] <= MeshOptimizer::CACHE_SIZE; }
+
+		// True on a miss
+		bool access(uint32_t vertex)
+		{
+			if (contains(vertex))
+			{
+				return false;
+			}
+			entered[vertex] = time++;
+			return true;
+		}
+
+		void reset() { time += MeshOptimizer::CACHE_SIZE + 1; }
+	};
+}
+
+void MeshOptimizer::optimize(Model& model, VertexCacheStatistics* before, VertexCacheStatistics* after)
+{
+	if (model.vertices.size() != model.getVertexCount())
+	{
+		throw std::runtime_error("mesh optimization needs an imported model!");
+	}
+
+	uint32_t vertexCount = static_cast<uint32_t>(model.vertices.size());
+
+	if (before != nullptr)
+	{
+		*before = analyzeVertexCache(model.indices.data(), model.indices.size(), vertexCount);
+	}
+
+	// Submeshes are optimized in their own dense vertex numbering so the passes stay linear in the
+	// size of the submesh
+	std::vector<uint32_t> toLocal(vertexCount, UNUSED);
+	std::vector<uint32_t> toModel;
+	std::vector<Vertex> localVertices;
+	std::vector<uint32_t> localIndices;
+	std::vector<uint32_t> clusters;
+
+	for (const Submesh& submesh : model.submeshes)
+	{
+		uint32_t* indices = model.indices.data() + submesh.firstIndex;
+
+		toModel.clear();
+		localVertices.clear();
+		localIndices.resize(submesh.indexCount);
+		for (uint32_t i = 0; i < submesh.indexCount; i++)
+		{
+			uint32_t index = indices[i];
+			if (toLocal[index] == UNUSED)
+			{
+				toLocal[index] = static_cast<uint32_t>(toModel.size());
+				toModel.push_back(index);
+				localVertices.push_back(model.vertices[index]);
+			}
+			localIndices[i] = toLocal[index];
+		}
+
+		uint32_t localCount = static_cast<uint32_t>(toModel.size());
+		optimizeVertexCache(localIndices.data(), localIndices.size(), localCount, &clusters);
+		optimizeOverdraw(localIndices.data(), localIndices.size(), localVertices.data(), localCount, clusters, OVERDRAW_THRESHOLD);
+
+		for (uint32_t i = 0; i < submesh.indexCount; i++)
+		{
+			indices[i] = toModel[localIndices[i]];
+		}
+		for (uint32_t index : toModel)
+		{
+			toLocal[index] = UNUSED;
+		}
+	}
+
+	optimizeVertexFetch(model.vertices, model.indices);
+
+	if (after != nullptr)
+	{
+		*after = analyzeVertexCache(model.indices.data(), model.indices.size(), static_cast<uint32_t>(model.vertices.size()));
+	}
+}
+
+void MeshOptimizer::optimizeVertexCache(uint32_t* indices, size_t indexCount, uint32_t vertexCount, std::vector<uint32_t>* clusters)
+{
+	size_t triangleCount = indexCount / 3;
+
+	if (clusters != nullptr)
+	{
+		clusters->clear();
+		clusters->push_back(0);
+	}
+
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	// Triangles around each vertex, offsets[v] to offsets[v + 1] in adjacency
+	std::vector<uint32_t> offsets(vertexCount + 1, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+	{
+		offsets[indices[i] + 1]++;
+	}
+	for (uint32_t v = 0; v < vertexCount; v++)
+	{
+		offsets[v + 1] += offsets[v];
+	}
+
+	std::vector<uint32_t> adjacency(triangleCount * 3);
+	std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+	{
+		adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+	}
+
+	std::vector<uint32_t> liveTriangles(vertexCount);
+	for (uint32_t v = 0; v < vertexCount; v++)
+	{
+		liveTriangles[v] = offsets[v + 1] - offsets[v];
+	}
+
+	CacheModel cache(vertexCount);
+	std::vector<uint8_t> emitted(triangleCount, 0);
+	std::vector<uint32_t> deadEnds;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> output;
+	output.reserve(triangleCount * 3);
+
+	uint32_t cursor = 0;
+	// Next vertex in input order that still has triangles, for when the dead end stack runs dry
+	auto skipDeadEnd = [&]() -> int64_t
+	{
+		while (!deadEnds.empty())
+		{
+			uint32_t vertex = deadEnds.back();
+			deadEnds.pop_back();
+			if (liveTriangles[vertex] > 0)
+			{
+				return vertex;
+			}
+		}
+		while (cursor < vertexCount)
+		{
+			if (liveTriangles[cursor] > 0)
+			{
+				return cursor;
+			}
+			cursor++;
+		}
+		return -1;
+	};
+
+	int64_t fanning = skipDeadEnd();
+	while (fanning >= 0)
+	{
+		candidates.clear();
+
+		for (uint32_t a = offsets[fanning]; a < offsets[fanning + 1]; a++)
+		{
+			uint32_t triangle = adjacency[a];
+			if (emitted[triangle])
+			{
+				continue;
+			}
+
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				uint32_t vertex = indices[triangle * 3 + k];
+				output.push_back(vertex);
+				deadEnds.push_back(vertex);
+				candidates.push_back(vertex);
+				liveTriangles[vertex]--;
+				cache.access(vertex);
+			}
+			emitted[triangle] = 1;
+		}
+
+		// Prefer the candidate that stays in the cache while its remaining triangles are emitted
+		int64_t next = -1;
+		uint32_t bestPriority = 0;
+		for (uint32_t vertex : candidates)
+		{
+			if (liveTriangles[vertex] == 0)
+			{
+				continue;
+			}
+
+			uint32_t age = cache.time - cache.entered[vertex];
+			uint32_t priority = age + 2 * liveTriangles[vertex] <= CACHE_SIZE ? age : 0;
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				next = vertex;
+			}
+		}
+
+		if (next < 0)
+		{
+			next = skipDeadEnd();
+
+			// Jumping away from the cache ends a cluster
+			size_t firstTriangle = output.size() / 3;
+			if (clusters != nullptr && next >= 0 && firstTriangle != clusters->back())
+			{
+				clusters->push_back(static_cast<uint32_t>(firstTriangle));
+			}
+		}
+
+		fanning = next;
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+}
+
+void MeshOptimizer::optimizeOverdraw(uint32_t* indices, size_t indexCount, const Vertex* vertices, uint32_t vertexCount, const std::vector<uint32_t>& hardClusters, float threshold)
+{
+	uint32_t triangleCount = static_cast<uint32_t>(indexCount / 3);
+	if (triangleCount == 0 || hardClusters.empty())
+	{
+		return;
+	}
+
+	// Soft boundaries: inside each hard cluster, start over wherever the part so far already
+	// reaches the cluster's ACMR within threshold, since it then survives being moved on its own
+	std::vector<uint32_t> clusters;
+	CacheModel cache(vertexCount);
+
+	for (size_t c = 0; c < hardClusters.size(); c++)
+	{
+		uint32_t begin = hardClusters[c];
+		uint32_t end = c + 1 < hardClusters.size() ? hardClusters[c + 1] : triangleCount;
+
+		cache.reset();
+		uint32_t clusterMisses = 0;
+		for (uint32_t t = begin; t < end; t++)
+		{
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				clusterMisses += cache.access(indices[t * 3 + k]);
+			}
+		}
+		float clusterAcmr = float(clusterMisses) / float(end - begin);
+
+		cache.reset();
+		clusters.push_back(begin);
+		uint32_t segmentMisses = 0;
+		uint32_t segmentStart = begin;
+		for (uint32_t t = begin; t + 1 < end; t++)
+		{
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				segmentMisses += cache.access(indices[t * 3 + k]);
+			}
+
+			if (float(segmentMisses) / float(t + 1 - segmentStart) <= clusterAcmr * threshold)
+			{
+				clusters.push_back(t + 1);
+				segmentStart = t + 1;
+				segmentMisses = 0;
+				cache.reset();
+			}
+		}
+	}
+
+	struct ClusterKey
+	{
+		uint32_t begin;
+		uint32_t end;
+		float key;
+	};
+
+	std::vector<ClusterKey> keys(clusters.size());
+	std::vector<glm::vec3> centroids(clusters.size());
+	std::vector<glm::vec3> normals(clusters.size());
+
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		keys[c].begin = clusters[c];
+		keys[c].end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+
+		glm::vec3 centroid(0.0f);
+		glm::vec3 normal(0.0f);
+		float area = 0.0f;
+
+		for (uint32_t t = keys[c].begin; t < keys[c].end; t++)
+		{
+			const glm::vec3& a = vertices[indices[t * 3 + 0]].pos;
+			const glm::vec3& b = vertices[indices[t * 3 + 1]].pos;
+			const glm::vec3& d = vertices[indices[t * 3 + 2]].pos;
+
+			// Twice the area, pointing along the face normal
+			glm::vec3 areaNormal = glm::cross(b - a, d - a);
+			float triangleArea = glm::length(areaNormal);
+
+			centroid += (a + b + d) * (triangleArea / 3.0f);
+			normal += areaNormal;
+			area += triangleArea;
+		}
+
+		meshCentroid += centroid;
+		meshArea += area;
+
+		centroids[c] = area > 0.0f ? centroid / area : vertices[indices[keys[c].begin * 3]].pos;
+		float normalLength = glm::length(normal);
+		normals[c] = normalLength > 0.0f ? normal / normalLength : glm::vec3(0.0f);
+	}
+
+	if (meshArea > 0.0f)
+	{
+		meshCentroid /= meshArea;
+	}
+
+	// Clusters far out along their own normal are likely in front of the rest, draw them first
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		keys[c].key = glm::dot(centroids[c] - meshCentroid, normals[c]);
+	}
+
+	std::stable_sort(keys.begin(), keys.end(), [](const ClusterKey& a, const ClusterKey& b) { return a.key > b.key; });
+
+	std::vector<uint32_t> reordered;
+	reordered.reserve(size_t(triangleCount) * 3);
+	for (const ClusterKey& cluster : keys)
+	{
+		reordered.insert(reordered.end(), indices + cluster.begin * 3, indices + cluster.end * 3);
+	}
+
+	std::copy(reordered.begin(), reordered.end(), indices);
+}
+
+void MeshOptimizer::optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	std::vector<uint32_t> remap(vertices.size(), UNUSED);
+	std::vector<Vertex> reordered;
+	reordered.reserve(vertices.size());
+
+	for (uint32_t& index : indices)
+	{
+		if (remap[index] == UNUSED)
+		{
+			remap[index] = static_cast<uint32_t>(reordered.size());
+			reordered.push_back(vertices[index]);
+		}
+		index = remap[index];
+	}
+
+	vertices.swap(reordered);
+}
+
+VertexCacheStatistics MeshOptimizer::analyzeVertexCache(const uint32_t* indices, size_t indexCount, uint32_t vertexCount)
+{
+	VertexCacheStatistics statistics;
+	if (indexCount < 3)
+	{
+		return statistics;
+	}
+
+	CacheModel cache(vertexCount);
+	std::vector<uint8_t> referenced(vertexCount, 0);
+	uint32_t misses = 0;
+	uint32_t referencedCount = 0;
+
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		misses += cache.access(indices[i]);
+		referencedCount += !referenced[indices[i]];
+		referenced[indices[i]] = 1;
+	}
+
+	statistics.acmr = float(misses) / float(indexCount / 3);
+	statistics.atvr = float(misses) / float(referencedCount);
+
+	return statistics;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ModelLoader.h"
+
+struct VertexCacheStatistics
+{
+	// Vertex shader invocations per triangle, 0.5 is the best a regular grid can do
+	float acmr = 0.0f;
+	// Vertex shader invocations per referenced vertex, 1 means every vertex ran once
+	float atvr = 0.0f;
+};
+
+/*
+Import time reordering of triangles and vertices for the GPU.
+
+optimize() runs, per submesh:
+	1. Tipsify (Sander et al. 2007) triangle order for post-transform cache hits, which also cuts
+	   the mesh into clusters wherever it had to jump to a vertex outside the cache
+	2. those clusters split further where the cache does not suffer, then sorted outside-in so that
+	   front faces tend to be drawn first and hide what lies behind them
+and then lays out the vertices of the whole model in the order the indices first use them.
+
+Caches are modelled as a FIFO of CACHE_SIZE vertices, the statistics use the same model.
+*/
+class MeshOptimizer
+{
+public:
+	static const uint32_t CACHE_SIZE = 16;
+	// Clusters may end up with this much of the ACMR of the unsplit cluster
+	static constexpr float OVERDRAW_THRESHOLD = 1.05f;
+
+	// Needs an imported model, not one mapped from the mesh cache
+	static void optimize(Model& model, VertexCacheStatistics* before = nullptr, VertexCacheStatistics* after = nullptr);
+
+	// clusters receives the first triangle of every hard boundary cluster if it is not null
+	static void optimizeVertexCache(uint32_t* indices, size_t indexCount, uint32_t vertexCount, std::vector<uint32_t>* clusters);
+	static void optimizeOverdraw(uint32_t* indices, size_t indexCount, const Vertex* vertices, uint32_t vertexCount, const std::vector<uint32_t>& hardClusters, float threshold);
+	// Unreferenced vertices are dropped
+	static void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+	static VertexCacheStatistics analyzeVertexCache(const uint32_t* indices, size_t indexCount, uint32_t vertexCount);
+};
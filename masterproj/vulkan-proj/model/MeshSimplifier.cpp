@@ -0,0 +1,543 @@
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+namespace
+{
+	const uint32_t NONE = UINT32_MAX;
+	// More than one open edge
+	const uint32_t MANY = UINT32_MAX - 1;
+
+	enum VertexKind : uint8_t
+	{
+		Manifold,
+		Border,
+		Seam,
+		Locked
+	};
+
+	// Sum of squared distances to a set of weighted planes
+	struct Quadric
+	{
+		// Symmetric 3x3 part in xx, yy, zz, xy, xz, yz order
+		double a[6] = {};
+		double b[3] = {};
+		double c = 0.0;
+		double weight = 0.0;
+
+		// normal has to be unit length
+		static Quadric fromPlane(const glm::vec3& normal, const glm::vec3& point, double weight)
+		{
+			double x = normal.x;
+			double y = normal.y;
+			double z = normal.z;
+			double d = -(x * point.x + y * point.y + z * point.z);
+
+			Quadric quadric;
+			quadric.a[0] = weight * x * x;
+			quadric.a[1] = weight * y * y;
+			quadric.a[2] = weight * z * z;
+			quadric.a[3] = weight * x * y;
+			quadric.a[4] = weight * x * z;
+			quadric.a[5] = weight * y * z;
+			quadric.b[0] = weight * d * x;
+			quadric.b[1] = weight * d * y;
+			quadric.b[2] = weight * d * z;
+			quadric.c = weight * d * d;
+			quadric.weight = weight;
+			return quadric;
+		}
+
+		void add(const Quadric& other)
+		{
+			for (int i = 0; i < 6; i++)
+			{
+				a[i] += other.a[i];
+			}
+			for (int i = 0; i < 3; i++)
+			{
+				b[i] += other.b[i];
+			}
+			c += other.c;
+			weight += other.weight;
+		}
+
+		// Weighted mean of the squared plane distances
+		double getError(const glm::vec3& p) const
+		{
+			if (weight <= 0.0)
+			{
+				return 0.0;
+			}
+
+			double x = p.x;
+			double y = p.y;
+			double z = p.z;
+			double sum = a[0] * x * x + a[1] * y * y + a[2] * z * z + 2.0 * (a[3] * x * y + a[4] * x * z + a[5] * y * z)
+				+ 2.0 * (b[0] * x + b[1] * y + b[2] * z) + c;
+
+			// Rounding can push a zero error below zero
+			return std::max(sum, 0.0) / weight;
+		}
+	};
+
+	struct Collapse
+	{
+		uint32_t from;
+		uint32_t to;
+		double error;
+	};
+
+	// Values grouped by vertex, offsets[v] to offsets[v + 1] in data
+	struct Adjacency
+	{
+		std::vector<uint32_t> offsets;
+		std::vector<uint32_t> data;
+
+		template<typename Key, typename Value>
+		void build(uint32_t vertexCount, size_t count, Key key, Value value)
+		{
+			offsets.assign(vertexCount + 1, 0);
+			for (size_t i = 0; i < count; i++)
+			{
+				offsets[key(i) + 1]++;
+			}
+			for (uint32_t v = 0; v < vertexCount; v++)
+			{
+				offsets[v + 1] += offsets[v];
+			}
+
+			data.resize(count);
+			std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < count; i++)
+			{
+				data[fill[key(i)]++] = value(i);
+			}
+		}
+
+		bool contains(uint32_t vertex, uint32_t value) const
+		{
+			for (uint32_t i = offsets[vertex]; i < offsets[vertex + 1]; i++)
+			{
+				if (data[i] == value)
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+	};
+
+	// Corner that ends the half-edge starting at corner i
+	size_t nextCorner(size_t i)
+	{
+		return i - i % 3 + (i + 1) % 3;
+	}
+
+	void setOpenEdge(uint32_t& slot, uint32_t vertex)
+	{
+		slot = slot == NONE || slot == vertex ? vertex : MANY;
+	}
+}
+
+void MeshSimplifier::buildLods(Model& model, const LodSettings& settings)
+{
+	if (model.vertices.size() != model.getVertexCount())
+	{
+		throw std::runtime_error("level of detail generation needs an imported model!");
+	}
+
+	uint32_t vertexCount = static_cast<uint32_t>(model.vertices.size());
+	uint32_t baseIndexCount = static_cast<uint32_t>(model.indices.size());
+
+	model.lods.clear();
+	MeshLod base;
+	base.indexCount = baseIndexCount;
+	model.lods.push_back(base);
+
+	float maxError = settings.maxError * model.boundingSphere.w;
+	std::vector<uint32_t> lodIndices(baseIndexCount);
+
+	// Every LOD starts from the full mesh, so its error is measured against the full mesh
+	for (float ratio : settings.ratios)
+	{
+		if (model.lods.size() >= Model::MAX_LOD_COUNT)
+		{
+			break;
+		}
+
+		size_t target = static_cast<size_t>(double(baseIndexCount / 3) * ratio) * 3;
+		float error = 0.0f;
+		size_t count = simplify(lodIndices.data(), model.indices.data(), baseIndexCount, model.vertices.data(), vertexCount, target, maxError, &error);
+
+		// Stuck on the error limit or on locked vertices, coarser ratios get no further
+		if (count == 0 || float(count) > float(model.lods.back().indexCount) * (1.0f - MIN_REDUCTION))
+		{
+			break;
+		}
+
+		MeshOptimizer::optimizeVertexCache(lodIndices.data(), count, vertexCount, nullptr);
+
+		MeshLod lod;
+		lod.firstIndex = static_cast<uint32_t>(model.indices.size());
+		lod.indexCount = static_cast<uint32_t>(count);
+		// LOD selection relies on errors growing with the level
+		lod.error = std::max(error, model.lods.back().error);
+
+		model.indices.insert(model.indices.end(), lodIndices.begin(), lodIndices.begin() + count);
+		model.lods.push_back(lod);
+	}
+}
+
+size_t MeshSimplifier::simplify(uint32_t* destination, const uint32_t* indices, size_t indexCount, const Vertex* vertices, uint32_t vertexCount, size_t targetIndexCount, float maxError, float* error)
+{
+	std::vector<uint32_t> result(indices, indices + indexCount);
+	size_t count = indexCount - indexCount % 3;
+
+	if (error != nullptr)
+	{
+		*error = 0.0f;
+	}
+
+	// Vertices with bit identical positions share remap[v], wedge[] links them in a ring
+	std::vector<uint32_t> order(vertexCount);
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+	{
+		int difference = memcmp(&vertices[a].pos, &vertices[b].pos, sizeof(glm::vec3));
+		return difference != 0 ? difference < 0 : a < b;
+	});
+
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<uint32_t> wedge(vertexCount);
+	for (uint32_t begin = 0; begin < vertexCount;)
+	{
+		uint32_t end = begin + 1;
+		while (end < vertexCount && memcmp(&vertices[order[begin]].pos, &vertices[order[end]].pos, sizeof(glm::vec3)) == 0)
+		{
+			end++;
+		}
+
+		for (uint32_t i = begin; i < end; i++)
+		{
+			remap[order[i]] = order[begin];
+			wedge[order[i]] = order[i + 1 < end ? i + 1 : begin];
+		}
+		begin = end;
+	}
+
+	// Half-edges by their first vertex, once with attributes and once by position only
+	Adjacency edges;
+	edges.build(vertexCount, count, [&](size_t i) { return result[i]; }, [&](size_t i) { return result[nextCorner(i)]; });
+	Adjacency positionEdges;
+	positionEdges.build(vertexCount, count, [&](size_t i) { return remap[result[i]]; }, [&](size_t i) { return remap[result[nextCorner(i)]]; });
+
+	// Open edges have no opposite half-edge, seams are open with attributes but not by position
+	std::vector<uint32_t> openOut(vertexCount, NONE);
+	std::vector<uint32_t> openIn(vertexCount, NONE);
+	for (size_t i = 0; i < count; i++)
+	{
+		uint32_t a = result[i];
+		uint32_t b = result[nextCorner(i)];
+		if (!edges.contains(b, a))
+		{
+			setOpenEdge(openOut[a], b);
+			setOpenEdge(openIn[b], a);
+		}
+	}
+
+	std::vector<uint8_t> kinds(vertexCount, Locked);
+	for (uint32_t v = 0; v < vertexCount; v++)
+	{
+		if (edges.offsets[v] == edges.offsets[v + 1])
+		{
+			continue;
+		}
+
+		uint32_t twin = wedge[v];
+		if (twin == v)
+		{
+			if (openOut[v] == NONE && openIn[v] == NONE)
+			{
+				kinds[v] = Manifold;
+			}
+			else if (openOut[v] < MANY && openIn[v] < MANY
+				&& !positionEdges.contains(remap[openOut[v]], remap[v]) && !positionEdges.contains(remap[v], remap[openIn[v]]))
+			{
+				kinds[v] = Border;
+			}
+		}
+		else if (wedge[twin] == v)
+		{
+			// Both sides need exactly one open edge in and out, running along each other
+			if (openOut[v] < MANY && openIn[v] < MANY && openOut[twin] < MANY && openIn[twin] < MANY
+				&& remap[openOut[v]] == remap[openIn[twin]] && remap[openIn[v]] == remap[openOut[twin]])
+			{
+				kinds[v] = Seam;
+			}
+		}
+	}
+
+	// Quadrics live on the first vertex of each position
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t t = 0; t < count; t += 3)
+	{
+		const glm::vec3& p0 = vertices[result[t + 0]].pos;
+		const glm::vec3& p1 = vertices[result[t + 1]].pos;
+		const glm::vec3& p2 = vertices[result[t + 2]].pos;
+
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float length = glm::length(normal);
+		if (length <= 0.0f)
+		{
+			continue;
+		}
+		normal /= length;
+
+		Quadric plane = Quadric::fromPlane(normal, p0, length * 0.5);
+		for (size_t k = 0; k < 3; k++)
+		{
+			quadrics[remap[result[t + k]]].add(plane);
+		}
+
+		// Planes standing on the open edges pull borders and seams back onto their outline
+		for (size_t k = 0; k < 3; k++)
+		{
+			uint32_t a = result[t + k];
+			uint32_t b = result[nextCorner(t + k)];
+			if (edges.contains(b, a))
+			{
+				continue;
+			}
+
+			glm::vec3 edge = vertices[b].pos - vertices[a].pos;
+			glm::vec3 edgeNormal = glm::cross(edge, normal);
+			float edgeLength = glm::length(edgeNormal);
+			if (edgeLength <= 0.0f)
+			{
+				continue;
+			}
+
+			Quadric border = Quadric::fromPlane(edgeNormal / edgeLength, vertices[a].pos, glm::dot(edge, edge) * BORDER_WEIGHT);
+			quadrics[remap[a]].add(border);
+			quadrics[remap[b]].add(border);
+		}
+	}
+
+	auto canCollapse = [&](uint32_t from, uint32_t to)
+	{
+		switch (kinds[from])
+		{
+		case Manifold:
+			return true;
+		case Border:
+			return to == openOut[from] || to == openIn[from];
+		case Seam:
+		{
+			if (to != openOut[from] && to != openIn[from])
+			{
+				return false;
+			}
+			uint32_t twin = wedge[from];
+			uint32_t twinTo = to == openOut[from] ? openIn[twin] : openOut[twin];
+			return twinTo < MANY && remap[twinTo] == remap[to];
+		}
+		default:
+			return false;
+		}
+	};
+
+	// Moving position from onto to, would any remaining triangle around it turn over
+	Adjacency triangles;
+	auto flips = [&](uint32_t from, uint32_t to)
+	{
+		const glm::vec3& target = vertices[to].pos;
+
+		for (uint32_t i = triangles.offsets[from]; i < triangles.offsets[from + 1]; i++)
+		{
+			size_t t = size_t(triangles.data[i]) * 3;
+
+			glm::vec3 before[3];
+			glm::vec3 after[3];
+			bool collapses = false;
+			for (size_t k = 0; k < 3; k++)
+			{
+				uint32_t position = remap[result[t + k]];
+				collapses |= position == to;
+				before[k] = vertices[result[t + k]].pos;
+				after[k] = position == from ? target : before[k];
+			}
+
+			// Triangles on the collapsed edge disappear
+			if (collapses)
+			{
+				continue;
+			}
+
+			glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+			glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+			if (glm::dot(normalBefore, normalAfter) <= 0.25f * glm::length(normalBefore) * glm::length(normalAfter))
+			{
+				return true;
+			}
+		}
+
+		return false;
+	};
+
+	double maxErrorSquared = double(maxError) * maxError;
+	double largestError = 0.0;
+
+	std::vector<Collapse> collapses;
+	std::vector<uint32_t> collapseTo(vertexCount);
+	std::vector<uint8_t> locked(vertexCount);
+
+	while (count > targetIndexCount)
+	{
+		collapses.clear();
+		auto addCollapse = [&](uint32_t from, uint32_t to)
+		{
+			if (canCollapse(from, to))
+			{
+				double collapseError = quadrics[remap[from]].getError(vertices[to].pos);
+				if (collapseError <= maxErrorSquared)
+				{
+					collapses.push_back({ from, to, collapseError });
+				}
+			}
+		};
+
+		for (size_t i = 0; i < count; i++)
+		{
+			uint32_t a = result[i];
+			uint32_t b = result[nextCorner(i)];
+			addCollapse(a, b);
+			addCollapse(b, a);
+		}
+
+		if (collapses.empty())
+		{
+			break;
+		}
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+		triangles.build(vertexCount, count, [&](size_t i) { return remap[result[i]]; }, [&](size_t i) { return static_cast<uint32_t>(i / 3); });
+		std::iota(collapseTo.begin(), collapseTo.end(), 0);
+		std::fill(locked.begin(), locked.end(), uint8_t(0));
+
+		// A manifold collapse removes two triangles, stop short of the target and look again
+		size_t goal = (count - targetIndexCount) / 6 + 1;
+		size_t performed = 0;
+
+		for (const Collapse& collapse : collapses)
+		{
+			uint32_t from = remap[collapse.from];
+			uint32_t to = remap[collapse.to];
+			if (locked[from] || locked[to] || flips(from, to))
+			{
+				continue;
+			}
+
+			collapseTo[collapse.from] = collapse.to;
+			bool alongOut = collapse.to == openOut[collapse.from];
+
+			if (kinds[collapse.from] == Seam)
+			{
+				uint32_t twin = wedge[collapse.from];
+				uint32_t twinTo = alongOut ? openIn[twin] : openOut[twin];
+				collapseTo[twin] = twinTo;
+
+				// The twin runs the other way, its target takes over the twin's remaining open edge
+				if (alongOut)
+				{
+					openOut[twinTo] = openOut[twin];
+				}
+				else
+				{
+					openIn[twinTo] = openIn[twin];
+				}
+			}
+
+			// Likewise to takes over the open edge of from that survives
+			if (kinds[collapse.from] != Manifold)
+			{
+				if (alongOut)
+				{
+					openIn[collapse.to] = openIn[collapse.from];
+				}
+				else
+				{
+					openOut[collapse.to] = openOut[collapse.from];
+				}
+			}
+
+			quadrics[to].add(quadrics[from]);
+			largestError = std::max(largestError, collapse.error);
+
+			// Flip tests of this pass assume the neighbours stay where they are
+			for (uint32_t i = triangles.offsets[from]; i < triangles.offsets[from + 1]; i++)
+			{
+				size_t t = size_t(triangles.data[i]) * 3;
+				for (size_t k = 0; k < 3; k++)
+				{
+					locked[remap[result[t + k]]] = 1;
+				}
+			}
+			locked[to] = 1;
+
+			if (++performed >= goal)
+			{
+				break;
+			}
+		}
+
+		if (performed == 0)
+		{
+			break;
+		}
+
+		for (uint32_t v = 0; v < vertexCount; v++)
+		{
+			if (openOut[v] < MANY)
+			{
+				openOut[v] = collapseTo[openOut[v]];
+			}
+			if (openIn[v] < MANY)
+			{
+				openIn[v] = collapseTo[openIn[v]];
+			}
+		}
+
+		size_t written = 0;
+		for (size_t t = 0; t < count; t += 3)
+		{
+			uint32_t a = collapseTo[result[t + 0]];
+			uint32_t b = collapseTo[result[t + 1]];
+			uint32_t c = collapseTo[result[t + 2]];
+			if (remap[a] == remap[b] || remap[b] == remap[c] || remap[c] == remap[a])
+			{
+				continue;
+			}
+
+			result[written++] = a;
+			result[written++] = b;
+			result[written++] = c;
+		}
+		count = written;
+	}
+
+	std::copy(result.begin(), result.begin() + count, destination);
+
+	if (error != nullptr)
+	{
+		*error = static_cast<float>(std::sqrt(largestError));
+	}
+
+	return count;
+}
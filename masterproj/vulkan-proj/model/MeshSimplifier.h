@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ModelLoader.h"
+
+/*
+Level of detail generation by quadric error edge collapse (Garland and Heckbert 1997).
+
+Every vertex position carries the quadric of the triangle planes around it, area weighted, plus
+planes standing on the open edges so borders and seams keep their outline. Collapses move a vertex
+onto a neighbour, cheapest first; each pass collapses vertices that are not next to each other,
+rejects collapses that flip a triangle and then drops the degenerate triangles.
+
+Vertices are classified once up front to keep the mesh intact:
+	manifold	any collapse
+	border		only along its open edge
+	seam		two vertices sharing a position with different attributes, e.g. a UV seam. Only
+				along the seam and together with its twin, so both sides stay welded
+	locked		anything else (corners, seams meeting, more than two twins), never moves
+*/
+class MeshSimplifier
+{
+public:
+	// Appends one LOD per ratio to the index data, LOD 0 becomes the current indices
+	static void buildLods(Model& model, const LodSettings& settings);
+
+	/*
+	Simplifies a triangle list toward targetIndexCount without moving any collapse past maxError
+	(model space). Writes the result to destination, which may be indices, and returns its index
+	count; error receives the largest collapse error if it is not null.
+	*/
+	static size_t simplify(uint32_t* destination, const uint32_t* indices, size_t indexCount, const Vertex* vertices, uint32_t vertexCount, size_t targetIndexCount, float maxError, float* error);
+
+private:
+	// A LOD has to drop at least this much of the previous one to be worth keeping
+	static constexpr float MIN_REDUCTION = 0.1f;
+	// Weight of the planes on open edges against the triangle planes
+	static constexpr double BORDER_WEIGHT = 2.0;
+};
@@ -0,0 +1,359 @@
+#include "MipGenerator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIP_GENERATOR_SSE2
+#endif
+
+namespace
+{
+	const float PI = 3.14159265358979f;
+	const float KAISER_ALPHA = 4.0f;
+	const float KAISER_WIDTH = 3.0f;
+	const float LANCZOS_WIDTH = 3.0f;
+	// Entries of the linear to sRGB table, close enough that neighbours are at most 0.2 of an 8 bit step apart
+	const uint32_t ENCODE_TABLE_SIZE = 16384;
+	// Smaller levels are not worth handing to the pool
+	const size_t MIN_PARALLEL_TEXELS = 1 << 16;
+
+	// Source texels and their weights for every destination texel along one axis, destination i
+	// uses the entries from first[i] to first[i + 1]
+	struct Taps
+	{
+		std::vector<uint32_t> first;
+		std::vector<uint32_t> indices;
+		std::vector<float> weights;
+	};
+
+	float sinc(float x)
+	{
+		if (std::fabs(x) < 1e-6f)
+		{
+			return 1.0f;
+		}
+
+		x *= PI;
+		return std::sin(x) / x;
+	}
+
+	// Zeroth order modified Bessel function of the first kind, by its power series
+	float besselI0(float x)
+	{
+		float sum = 1.0f;
+		float term = 1.0f;
+		for (int k = 1; k < 32 && term > sum * 1e-8f; k++)
+		{
+			float factor = x / (2.0f * k);
+			term *= factor * factor;
+			sum += term;
+		}
+
+		return sum;
+	}
+
+	float getFilterRadius(MipFilter filter)
+	{
+		switch (filter)
+		{
+		case MipFilter::Kaiser:
+			return KAISER_WIDTH;
+		case MipFilter::Lanczos:
+			return LANCZOS_WIDTH;
+		default:
+			return 0.5f;
+		}
+	}
+
+	// Kernel at x destination texels from the centre
+	float evaluateFilter(MipFilter filter, float x)
+	{
+		x = std::fabs(x);
+
+		switch (filter)
+		{
+		case MipFilter::Kaiser:
+		{
+			if (x >= KAISER_WIDTH)
+			{
+				return 0.0f;
+			}
+			float ratio = x / KAISER_WIDTH;
+			return sinc(x) * besselI0(KAISER_ALPHA * std::sqrt(1.0f - ratio * ratio)) / besselI0(KAISER_ALPHA);
+		}
+		case MipFilter::Lanczos:
+			return x < LANCZOS_WIDTH ? sinc(x) * sinc(x / LANCZOS_WIDTH) : 0.0f;
+		default:
+			return x < 0.5f ? 1.0f : 0.0f;
+		}
+	}
+
+	Taps computeTaps(MipFilter filter, uint32_t sourceSize, uint32_t destinationSize)
+	{
+		Taps taps;
+		taps.first.push_back(0);
+
+		double scale = double(sourceSize) / double(destinationSize);
+		double radius = getFilterRadius(filter) * scale;
+
+		for (uint32_t i = 0; i < destinationSize; i++)
+		{
+			double center = (i + 0.5) * scale;
+			int64_t begin = static_cast<int64_t>(std::floor(center - radius));
+			int64_t end = static_cast<int64_t>(std::ceil(center + radius));
+
+			size_t start = taps.weights.size();
+			float sum = 0.0f;
+			for (int64_t s = begin; s < end; s++)
+			{
+				// The box takes texels in by how much of them it covers, the others sample the kernel at texel centres
+				float weight = filter == MipFilter::Box
+					? static_cast<float>(std::max(0.0, std::min(double(s + 1), center + radius) - std::max(double(s), center - radius)))
+					: evaluateFilter(filter, static_cast<float>((s + 0.5 - center) / scale));
+
+				if (weight == 0.0f)
+				{
+					continue;
+				}
+
+				// Clamped at the edges
+				taps.indices.push_back(static_cast<uint32_t>(std::min<int64_t>(std::max<int64_t>(s, 0), sourceSize - 1)));
+				taps.weights.push_back(weight);
+				sum += weight;
+			}
+
+			for (size_t t = start; t < taps.weights.size(); t++)
+			{
+				taps.weights[t] /= sum;
+			}
+			taps.first.push_back(static_cast<uint32_t>(taps.weights.size()));
+		}
+
+		return taps;
+	}
+
+	float srgbToLinear(float value)
+	{
+		return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+	}
+
+	float linearToSrgb(float value)
+	{
+		return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+	}
+
+	const float* getDecodeTable()
+	{
+		static const std::vector<float> table = []()
+		{
+			std::vector<float> values(256);
+			for (uint32_t i = 0; i < 256; i++)
+			{
+				values[i] = srgbToLinear(i / 255.0f);
+			}
+			return values;
+		}();
+
+		return table.data();
+	}
+
+	const uint8_t* getEncodeTable()
+	{
+		static const std::vector<uint8_t> table = []()
+		{
+			std::vector<uint8_t> values(ENCODE_TABLE_SIZE);
+			for (uint32_t i = 0; i < ENCODE_TABLE_SIZE; i++)
+			{
+				values[i] = static_cast<uint8_t>(linearToSrgb(i / float(ENCODE_TABLE_SIZE - 1)) * 255.0f + 0.5f);
+			}
+			return values;
+		}();
+
+		return table.data();
+	}
+
+	void decodeRow(const uint8_t* pixels, size_t texelCount, float* linear)
+	{
+		const float* table = getDecodeTable();
+		for (size_t i = 0; i < texelCount; i++)
+		{
+			linear[i * 4 + 0] = table[pixels[i * 4 + 0]];
+			linear[i * 4 + 1] = table[pixels[i * 4 + 1]];
+			linear[i * 4 + 2] = table[pixels[i * 4 + 2]];
+			linear[i * 4 + 3] = pixels[i * 4 + 3] / 255.0f;
+		}
+	}
+
+	// Sharpening filters overshoot, everything is clamped to [0, 1] first
+	void encodeRow(const float* linear, size_t texelCount, uint8_t* pixels)
+	{
+		const uint8_t* table = getEncodeTable();
+
+#if defined(MIP_GENERATOR_SSE2)
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 scale = _mm_setr_ps(float(ENCODE_TABLE_SIZE - 1), float(ENCODE_TABLE_SIZE - 1), float(ENCODE_TABLE_SIZE - 1), 255.0f);
+		const __m128 half = _mm_set1_ps(0.5f);
+
+		alignas(16) int32_t quantized[4];
+		for (size_t i = 0; i < texelCount; i++)
+		{
+			__m128 texel = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(linear + i * 4), zero), one);
+			_mm_store_si128(reinterpret_cast<__m128i*>(quantized), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(texel, scale), half)));
+
+			pixels[i * 4 + 0] = table[quantized[0]];
+			pixels[i * 4 + 1] = table[quantized[1]];
+			pixels[i * 4 + 2] = table[quantized[2]];
+			pixels[i * 4 + 3] = static_cast<uint8_t>(quantized[3]);
+		}
+#else
+		for (size_t i = 0; i < texelCount; i++)
+		{
+			for (uint32_t c = 0; c < 3; c++)
+			{
+				float value = std::min(std::max(linear[i * 4 + c], 0.0f), 1.0f);
+				pixels[i * 4 + c] = table[static_cast<uint32_t>(value * (ENCODE_TABLE_SIZE - 1) + 0.5f)];
+			}
+			pixels[i * 4 + 3] = static_cast<uint8_t>(std::min(std::max(linear[i * 4 + 3], 0.0f), 1.0f) * 255.0f + 0.5f);
+		}
+#endif
+	}
+
+	// One source row filtered across, one texel per vector
+	void filterRow(const float* source, const Taps& taps, uint32_t width, float* destination)
+	{
+		for (uint32_t x = 0; x < width; x++)
+		{
+#if defined(MIP_GENERATOR_SSE2)
+			__m128 sum = _mm_setzero_ps();
+			for (uint32_t t = taps.first[x]; t < taps.first[x + 1]; t++)
+			{
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(source + size_t(taps.indices[t]) * 4), _mm_set1_ps(taps.weights[t])));
+			}
+			_mm_storeu_ps(destination + size_t(x) * 4, sum);
+#else
+			float sum[4] = {};
+			for (uint32_t t = taps.first[x]; t < taps.first[x + 1]; t++)
+			{
+				for (uint32_t c = 0; c < 4; c++)
+				{
+					sum[c] += source[size_t(taps.indices[t]) * 4 + c] * taps.weights[t];
+				}
+			}
+			memcpy(destination + size_t(x) * 4, sum, sizeof(sum));
+#endif
+		}
+	}
+
+	// Destination row y filtered down from the rows of the horizontal pass
+	void filterColumn(const float* rows, const Taps& taps, uint32_t width, uint32_t y, float* destination)
+	{
+		size_t floatCount = size_t(width) * 4;
+		std::fill(destination, destination + floatCount, 0.0f);
+
+		for (uint32_t t = taps.first[y]; t < taps.first[y + 1]; t++)
+		{
+			const float* row = rows + size_t(taps.indices[t]) * floatCount;
+			float weight = taps.weights[t];
+
+#if defined(MIP_GENERATOR_SSE2)
+			__m128 weights = _mm_set1_ps(weight);
+			for (size_t i = 0; i < floatCount; i += 4)
+			{
+				_mm_storeu_ps(destination + i, _mm_add_ps(_mm_loadu_ps(destination + i), _mm_mul_ps(_mm_loadu_ps(row + i), weights)));
+			}
+#else
+			for (size_t i = 0; i < floatCount; i++)
+			{
+				destination[i] += row[i] * weight;
+			}
+#endif
+		}
+	}
+}
+
+TextureData MipGenerator::generate(const uint8_t* pixels, uint32_t width, uint32_t height, MipFilter filter, ThreadPool* threadPool)
+{
+	if (width == 0 || height == 0)
+	{
+		throw std::runtime_error("failed to generate mipmaps without pixels!");
+	}
+
+	TextureData texture;
+	texture.width = width;
+	texture.height = height;
+	texture.payload.resize(static_cast<size_t>(TextureLoader::layoutLevels(texture, TextureFormat::Rgba8)));
+	memcpy(texture.payload.data(), pixels, static_cast<size_t>(texture.levels[0].size));
+
+	auto forEachRow = [&](uint32_t rowCount, size_t texelCount, const std::function<void(uint32_t)>& row)
+	{
+		if (threadPool && texelCount >= MIN_PARALLEL_TEXELS)
+		{
+			threadPool->parallelFor(rowCount, row);
+			return;
+		}
+
+		for (uint32_t y = 0; y < rowCount; y++)
+		{
+			row(y);
+		}
+	};
+
+	std::vector<float> current(size_t(width) * height * 4);
+	std::vector<float> next;
+	std::vector<float> rows;
+
+	forEachRow(height, size_t(width) * height, [&](uint32_t y)
+	{
+		decodeRow(pixels + size_t(y) * width * 4, width, &current[size_t(y) * width * 4]);
+	});
+
+	for (size_t i = 1; i < texture.levels.size(); i++)
+	{
+		const TextureLevel& above = texture.levels[i - 1];
+		const TextureLevel& level = texture.levels[i];
+
+		Taps columnTaps = computeTaps(filter, above.width, level.width);
+		Taps rowTaps = computeTaps(filter, above.height, level.height);
+
+		rows.resize(size_t(level.width) * above.height * 4);
+		forEachRow(above.height, size_t(level.width) * above.height, [&](uint32_t y)
+		{
+			filterRow(&current[size_t(y) * above.width * 4], columnTaps, level.width, &rows[size_t(y) * level.width * 4]);
+		});
+
+		next.resize(size_t(level.width) * level.height * 4);
+		uint8_t* destination = texture.payload.data() + level.offset;
+		forEachRow(level.height, size_t(level.width) * level.height, [&](uint32_t y)
+		{
+			float* row = &next[size_t(y) * level.width * 4];
+			filterColumn(rows.data(), rowTaps, level.width, y, row);
+			encodeRow(row, level.width, destination + size_t(y) * level.width * 4);
+		});
+
+		current.swap(next);
+	}
+
+	return texture;
+}
+
+const char* MipGenerator::getFilterName(MipFilter filter)
+{
+	switch (filter)
+	{
+	case MipFilter::Box:
+		return "box";
+	case MipFilter::Kaiser:
+		return "Kaiser";
+	case MipFilter::Lanczos:
+		return "Lanczos";
+	}
+
+	return "unknown";
+}
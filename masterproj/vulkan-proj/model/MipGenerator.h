@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+#include "TextureLoader.h"
+#include "../util/ThreadPool.h"
+
+/*
+Builds RGBA8 mip chains on the CPU, for cooking and for textures whose format cannot be blitted.
+
+Every level is filtered from the one above in linear light, kept as floats so the error does not
+add up through the chain: colour goes through the sRGB curve, alpha is filtered as it is. The
+filter is separable, rows first and then columns, with the kernel stretched over the texels a
+destination texel covers and clamped at the edges. Texels are filtered as one SSE vector each,
+RGBA in the four lanes, and rows of a level are spread over the pool if there is one.
+*/
+class MipGenerator
+{
+public:
+	// Chain from level 0 down to 1x1, laid out like TextureLoader lays out every texture
+	static TextureData generate(const uint8_t* pixels, uint32_t width, uint32_t height, MipFilter filter, ThreadPool* threadPool);
+
+	static const char* getFilterName(MipFilter filter);
+};
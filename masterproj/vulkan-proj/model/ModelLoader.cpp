@@ -1,8 +1,20 @@
 #include "ModelLoader.h"
+#include "ClusterBuilder.h"
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "ObjParser.h"
+#include "VertexDedup.h"
+#include "../util/Hash.h"
 
-ModelLoader::ModelLoader()
-{
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
 
+ModelLoader::ModelLoader(std::shared_ptr<ThreadPool> threadPool)
+	: threadPool(threadPool)
+{
 }
 
 ModelLoader::~ModelLoader()
@@ -10,7 +22,153 @@ ModelLoader::~ModelLoader()
 
 }
 
-void ModelLoader::loadModel(std::string path)
+Model ModelLoader::loadModel(const std::string& path)
+{
+	std::string cachePath = path + ".mesh";
+	uint64_t sourceHash = Hash::hashFile(path);
+	if (sourceHash != 0)
+	{
+		// Different LOD settings produce a different mesh from the same source
+		sourceHash = Hash::hashBytes(lodSettings.ratios.data(), lodSettings.ratios.size() * sizeof(float), sourceHash);
+		sourceHash = Hash::hashBytes(&lodSettings.maxError, sizeof(lodSettings.maxError), sourceHash);
+	}
+
+	Model m;
+	if (sourceHash != 0 && MeshCache::load(cachePath, sourceHash, m))
+	{
+		return m;
+	}
+
+	std::lock_guard<std::mutex> lock(importMutex);
+
+	// The same file may have been imported while waiting for the lock
+	if (sourceHash != 0 && MeshCache::load(cachePath, sourceHash, m))
+	{
+		return m;
+	}
+
+	m = importObj(path, threadPool.get());
+
+	VertexCacheStatistics before;
+	VertexCacheStatistics after;
+	MeshOptimizer::optimize(m, &before, &after);
+	std::cout << "Imported " << path << ": " << m.getVertexCount() << " vertices, " << m.getIndexCount() / 3 << " triangles, ACMR "
+		<< before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+
+	// Clusters reorder the triangles inside the submeshes, lay out the vertices again for that order
+	ClusterBuilder::build(m);
+	MeshOptimizer::optimizeVertexFetch(m.vertices, m.indices);
+	std::cout << "  " << m.clusters.size() << " clusters" << std::endl;
+
+	MeshSimplifier::buildLods(m, lodSettings);
+	for (size_t i = 1; i < m.lods.size(); i++)
+	{
+		std::cout << "  LOD " << i << ": " << m.lods[i].indexCount / 3 << " triangles, error " << m.lods[i].error << std::endl;
+	}
+
+	// Not fatal, the next run imports again
+	if (sourceHash != 0 && !MeshCache::save(cachePath, sourceHash, m))
+	{
+		std::cerr << "failed to write mesh cache " << cachePath << std::endl;
+	}
+
+	return m;
+}
+
+Model ModelLoader::createPlaceholder()
+{
+	Model m;
+
+	// Four vertices per face so every face gets the whole texture
+	const glm::vec3 normals[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+	for (const glm::vec3& normal : normals)
+	{
+		// Two axes spanning the face, counter-clockwise seen from outside
+		glm::vec3 u = glm::vec3(normal.y, normal.z, normal.x);
+		glm::vec3 v = glm::cross(normal, u);
+
+		uint32_t first = static_cast<uint32_t>(m.vertices.size());
+		const glm::vec2 corners[4] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+		for (const glm::vec2& corner : corners)
+		{
+			Vertex vertex = {};
+			vertex.pos = normal + u * corner.x + v * corner.y;
+			vertex.color = { 1.0f, 1.0f, 1.0f };
+			vertex.texCoord = (corner + 1.0f) * 0.5f;
+			m.vertices.push_back(vertex);
+		}
+
+		for (uint32_t index : { 0u, 1u, 2u, 0u, 2u, 3u })
+		{
+			m.indices.push_back(first + index);
+		}
+	}
+
+	Submesh submesh;
+	submesh.indexCount = static_cast<uint32_t>(m.indices.size());
+	submesh.materialId = Submesh::NO_MATERIAL;
+	m.submeshes.push_back(submesh);
+
+	m.computeBounds();
+
+	return m;
+}
+
+Model ModelLoader::importObj(const std::string& path, ThreadPool* threadPool)
+{
+	ObjData obj;
+	ObjParser(threadPool).parse(path, obj);
+
+	size_t indexCount = 0;
+	for (const ObjShape& shape : obj.shapes)
+	{
+		indexCount += shape.indices.size();
+	}
+
+	Model m;
+	m.indices.reserve(indexCount);
+	VertexDedup uniqueVertices(indexCount);
+
+	for (const ObjShape& shape : obj.shapes)
+	{
+		Submesh submesh;
+		submesh.firstIndex = static_cast<uint32_t>(m.indices.size());
+		submesh.indexCount = static_cast<uint32_t>(shape.indices.size());
+		submesh.materialId = shape.materialIds[0] < 0 ? Submesh::NO_MATERIAL : static_cast<uint32_t>(shape.materialIds[0]);
+		m.submeshes.push_back(submesh);
+
+		for (const ObjIndex& index : shape.indices)
+		{
+			Vertex vertex = {};
+
+			vertex.pos =
+			{
+				obj.positions[3 * index.position + 0],
+				obj.positions[3 * index.position + 1],
+				obj.positions[3 * index.position + 2]
+			};
+
+			if (index.texCoord >= 0)
+			{
+				vertex.texCoord =
+				{
+					obj.texCoords[2 * index.texCoord + 0],
+					1.0f - obj.texCoords[2 * index.texCoord + 1]
+				};
+			}
+
+			vertex.color = { 1.0f, 1.0f, 1.0f };
+
+			m.indices.push_back(uniqueVertices.insert(vertex, m.vertices));
+		}
+	}
+
+	m.computeBounds();
+
+	return m;
+}
+
+Model ModelLoader::importObjTinyObj(const std::string& path)
 {
 	Model m;
 
@@ -24,10 +182,21 @@ void ModelLoader::loadModel(std::string path)
 		throw std::runtime_error(err);
 	}
 
-	std::unordered_map<Vertex, uint32_t> uniqueVertices = {};
+	size_t indexCount = 0;
+	for (const auto& shape : shapes)
+	{
+		indexCount += shape.mesh.indices.size();
+	}
+
+	m.indices.reserve(indexCount);
+	VertexDedup uniqueVertices(indexCount);
 
 	for (const auto& shape : shapes)
 	{
+		Submesh submesh;
+		submesh.firstIndex = static_cast<uint32_t>(m.indices.size());
+		submesh.materialId = shape.mesh.material_ids.empty() || shape.mesh.material_ids[0] < 0 ? Submesh::NO_MATERIAL : static_cast<uint32_t>(shape.mesh.material_ids[0]);
+
 		for (const auto& index : shape.mesh.indices)
 		{
 			Vertex vertex = {};
@@ -47,17 +216,19 @@ void ModelLoader::loadModel(std::string path)
 
 			vertex.color = { 1.0f, 1.0f, 1.0f };
 
-			if (uniqueVertices.count(vertex) == 0)
-			{
-				uniqueVertices[vertex] = static_cast<uint32_t>(m.vertices.size());
-				m.vertices.push_back(vertex);
-			}
+			m.indices.push_back(uniqueVertices.insert(vertex, m.vertices));
+		}
 
-			m.indices.push_back(uniqueVertices[vertex]);
+		submesh.indexCount = static_cast<uint32_t>(m.indices.size()) - submesh.firstIndex;
+		if (submesh.indexCount > 0)
+		{
+			m.submeshes.push_back(submesh);
 		}
 	}
 
-	models.push_back(m);
+	m.computeBounds();
+
+	return m;
 }
 
 Model::Model()
@@ -69,3 +240,69 @@ Model::~Model()
 {
 
 }
+
+const Vertex* Model::getVertices() const
+{
+	return mapping ? mappedVertices : vertices.data();
+}
+
+uint32_t Model::getVertexCount() const
+{
+	return mapping ? mappedVertexCount : static_cast<uint32_t>(vertices.size());
+}
+
+const uint32_t* Model::getIndices() const
+{
+	return mapping ? mappedIndices : indices.data();
+}
+
+uint32_t Model::getIndexCount() const
+{
+	return mapping ? mappedIndexCount : static_cast<uint32_t>(indices.size());
+}
+
+void Model::setMappedData(std::shared_ptr<MappedFile> file, const Vertex* vertexData, uint32_t vertexCount, const uint32_t* indexData, uint32_t indexCount)
+{
+	vertices.clear();
+	indices.clear();
+
+	mapping = std::move(file);
+	mappedVertices = vertexData;
+	mappedVertexCount = vertexCount;
+	mappedIndices = indexData;
+	mappedIndexCount = indexCount;
+}
+
+void Model::computeBounds()
+{
+	const Vertex* data = getVertices();
+	uint32_t count = getVertexCount();
+
+	if (count == 0)
+	{
+		boundsMin = glm::vec3(0.0f);
+		boundsMax = glm::vec3(0.0f);
+		boundingSphere = glm::vec4(0.0f);
+		return;
+	}
+
+	boundsMin = data[0].pos;
+	boundsMax = data[0].pos;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		boundsMin = glm::min(boundsMin, data[i].pos);
+		boundsMax = glm::max(boundsMax, data[i].pos);
+	}
+
+	// Centered on the bounding box, not minimal but cheap and stable
+	glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+
+	float radiusSquared = 0.0f;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		glm::vec3 offset = data[i].pos - center;
+		radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+	}
+
+	boundingSphere = glm::vec4(center, std::sqrt(radiusSquared));
+}
@@ -1,94 +1,143 @@
 #pragma once
 
-#include <vulkan/vulkan.h>
-
 #include <glm/glm.hpp>
-#define GLM_ENABLE_EXPERIMENTAL
-#include <glm/gtx/hash.hpp>
 
-#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
-#include <unordered_map>
 
 #include <tiny_obj_loader.h>
 
+#include "../util/MappedFile.h"
+#include "../util/ThreadPool.h"
+
 struct Vertex
 {
 	glm::vec3 pos;
 	glm::vec3 color;
 	glm::vec2 texCoord;
 
-	// TODO: loader obv. works only with vulkan now
-	static VkVertexInputBindingDescription getBindingDescription()
+	bool operator==(const Vertex& other) const
 	{
-		VkVertexInputBindingDescription bindingDescription = {};
-		bindingDescription.binding = 0;
-		bindingDescription.stride = sizeof(Vertex);
-		// TODO: VK_VERTEX_INPUT_RATE_INSTANCE: Move to the next data entry after each instance -> instanced rendering
-		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-		return bindingDescription;
+		return pos == other.pos && color == other.color && texCoord == other.texCoord;
 	}
+};
 
-	static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions()
-	{
-		std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions = {};
-
-		attributeDescriptions[0].binding = 0;
-		attributeDescriptions[0].location = 0;
-		attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-		attributeDescriptions[0].offset = offsetof(Vertex, pos);
-
-		attributeDescriptions[1].binding = 0;
-		attributeDescriptions[1].location = 1;
-		attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-		attributeDescriptions[1].offset = offsetof(Vertex, color);
+// Index range of one OBJ shape, indices are relative to the model
+struct Submesh
+{
+	uint32_t firstIndex = 0;
+	uint32_t indexCount = 0;
+	// Index into the OBJ's material list, NO_MATERIAL if the shape has none
+	uint32_t materialId = 0;
 
-		attributeDescriptions[2].binding = 0;
-		attributeDescriptions[2].location = 2;
-		attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-		attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
+	static const uint32_t NO_MATERIAL = UINT32_MAX;
+};
 
-		return attributeDescriptions;
-	}
+// Triangles of one level of detail, the range covers all submeshes
+struct MeshLod
+{
+	uint32_t firstIndex = 0;
+	uint32_t indexCount = 0;
+	// Largest distance the simplified surface strayed from the full mesh, in model space
+	float error = 0.0f;
+};
 
-	bool operator==(const Vertex& other) const
-	{
-		return pos == other.pos && color == other.color && texCoord == other.texCoord;
-	}
+// A few dozen neighbouring triangles of LOD 0 that are culled as a unit
+struct MeshCluster
+{
+	// Model space, xyz center and w radius
+	glm::vec4 boundingSphere = glm::vec4(0.0f);
+	// xyz average normal, w the cutoff of the cone test, 1 if the normals spread too far to cull by
+	glm::vec4 cone = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	uint32_t firstIndex = 0;
+	uint32_t indexCount = 0;
 };
 
-namespace std
+// How ModelLoader builds the levels of detail after LOD 0
+struct LodSettings
 {
-	template<> struct hash<Vertex>
-	{
-		size_t operator()(Vertex const& vertex) const
-		{
-			return ((hash<glm::vec3>()(vertex.pos) ^
-				(hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^
-				(hash<glm::vec2>()(vertex.texCoord) << 1);
-		}
-	};
-}
+	// Target triangle count of each further LOD relative to the full mesh, at most Model::MAX_LOD_COUNT - 1 are used
+	std::vector<float> ratios = { 0.5f, 0.25f, 0.125f };
+	// Simplification stops at this error, relative to the bounding sphere radius
+	float maxError = 0.05f;
+};
 
 class Model
 {
 public:
+	static const uint32_t MAX_LOD_COUNT = 4;
 
 	Model();
 	~Model();
 
+	// Filled by the importer, empty if the model was mapped from the mesh cache
 	std::vector<Vertex> vertices;
 	std::vector<uint32_t> indices;
+
+	// Index ranges of LOD 0
+	std::vector<Submesh> submeshes;
+	// LOD 0 first, the others follow it in the index data and reuse its vertices. Empty if the
+	// importer did not build any, the whole index data is the only LOD then.
+	std::vector<MeshLod> lods;
+	// Cover LOD 0 in index order, each lies within one submesh
+	std::vector<MeshCluster> clusters;
+
+	// Model space bounds, the sphere is xyz center and w radius
+	glm::vec3 boundsMin = glm::vec3(0.0f);
+	glm::vec3 boundsMax = glm::vec3(0.0f);
+	glm::vec4 boundingSphere = glm::vec4(0.0f);
+
+	// Vertex and index data wherever it lives, use these instead of the vectors
+	const Vertex* getVertices() const;
+	uint32_t getVertexCount() const;
+	const uint32_t* getIndices() const;
+	uint32_t getIndexCount() const;
+
+	// Points the model at payload inside a mapped cache file, which stays open as long as the model
+	void setMappedData(std::shared_ptr<MappedFile> file, const Vertex* vertexData, uint32_t vertexCount, const uint32_t* indexData, uint32_t indexCount);
+
+	// Recomputes the bounds from the vertices
+	void computeBounds();
+
+private:
+	std::shared_ptr<MappedFile> mapping;
+	const Vertex* mappedVertices = nullptr;
+	const uint32_t* mappedIndices = nullptr;
+	uint32_t mappedVertexCount = 0;
+	uint32_t mappedIndexCount = 0;
 };
 
 class ModelLoader
 {
 public:
-	ModelLoader();
+	// OBJ imports are spread over threadPool, shared with the rest of the program; without one
+	// they run on the calling thread
+	explicit ModelLoader(std::shared_ptr<ThreadPool> threadPool = nullptr);
 	~ModelLoader();
 
-	void loadModel(std::string path);
+	/*
+	Loads path + ".mesh" if it was written from the same source by the same importer version,
+	otherwise parses the OBJ and writes that cache for the next run. Safe to call from several
+	threads at once, imports take turns on the thread pool.
+	*/
+	Model loadModel(const std::string& path);
+
+	// Part of the cache key, changing it imports again. Not to be changed while loads run
+	LodSettings lodSettings;
+
+	// Unit cube around the origin, stands in for models that are still loading
+	static Model createPlaceholder();
+
+	// Parses with ObjParser, on every thread of threadPool or on the calling thread if it is null
+	static Model importObj(const std::string& path, ThreadPool* threadPool);
+	// The previous single threaded tinyobj import, kept to check and benchmark importObj against
+	static Model importObjTinyObj(const std::string& path);
 
-	std::vector<Model> models;
+private:
+	std::shared_ptr<ThreadPool> threadPool;
+	// Importing writes the mesh cache, two loads of the same file must not write it at once
+	std::mutex importMutex;
 };
\ No newline at end of file
@@ -0,0 +1,542 @@
+#include "ObjParser.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "../util/MappedFile.h"
+
+namespace
+{
+	bool isSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	bool isDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	const char* skipSpace(const char* p, const char* end)
+	{
+		while (p < end && isSpace(*p))
+		{
+			p++;
+		}
+		return p;
+	}
+
+	// End of the line starting at p, not including the newline
+	const char* findLineEnd(const char* p, const char* end)
+	{
+		const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+		return newline != nullptr ? newline : end;
+	}
+
+	bool isKeyword(const char* p, const char* end, const char* keyword, size_t length)
+	{
+		return static_cast<size_t>(end - p) >= length && memcmp(p, keyword, length) == 0 && (p + length == end || isSpace(p[length]));
+	}
+
+	// Rest of the line without surrounding whitespace
+	std::string readName(const char* p, const char* end)
+	{
+		p = skipSpace(p, end);
+		while (end > p && isSpace(end[-1]))
+		{
+			end--;
+		}
+		return std::string(p, end);
+	}
+
+	const char* parseInt(const char* p, const char* end, int32_t& value)
+	{
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negative = *p == '-';
+			p++;
+		}
+
+		if (p == end || !isDigit(*p))
+		{
+			return nullptr;
+		}
+
+		int64_t result = 0;
+		while (p < end && isDigit(*p))
+		{
+			result = std::min<int64_t>(result * 10 + (*p - '0'), INT32_MAX);
+			p++;
+		}
+
+		value = static_cast<int32_t>(negative ? -result : result);
+		return p;
+	}
+
+	// OBJ indices are one based, negative ones count back from the last attribute read so far
+	int32_t resolveIndex(int32_t index, uint32_t readSoFar, uint32_t total)
+	{
+		int64_t resolved = index > 0 ? int64_t(index) - 1 : int64_t(readSoFar) + index;
+		if (index == 0 || resolved < 0 || resolved >= total)
+		{
+			throw std::runtime_error("OBJ face references a missing attribute!");
+		}
+		return static_cast<int32_t>(resolved);
+	}
+
+	// Fills the components a line provides, missing trailing ones stay 0
+	const char* parseFloats(const char* p, const char* end, float* values, uint32_t count)
+	{
+		for (uint32_t i = 0; i < count; i++)
+		{
+			p = skipSpace(p, end);
+			const char* next = ObjParser::parseFloat(p, end, values[i]);
+			if (next == nullptr)
+			{
+				for (; i < count; i++)
+				{
+					values[i] = 0.0f;
+				}
+				break;
+			}
+			p = next;
+		}
+		return p;
+	}
+}
+
+ObjParser::ObjParser(ThreadPool* threadPool)
+	: threadPool(threadPool)
+{
+
+}
+
+void ObjParser::parse(const std::string& path, ObjData& out)
+{
+	MappedFile file(path);
+	if (!file.isOpen())
+	{
+		throw std::runtime_error("failed to open " + path + "!");
+	}
+
+	out = ObjData();
+
+	const char* data = file.getData();
+	size_t size = file.getSize();
+
+	uint32_t threadCount = threadPool != nullptr ? threadPool->getThreadCount() : 1;
+	size_t chunkCount = std::max<size_t>(1, std::min<size_t>(size / MIN_CHUNK_SIZE, threadCount * CHUNKS_PER_THREAD));
+
+	// Cut points move forward to the next line start, so a chunk can end up empty
+	std::vector<Chunk> chunks(chunkCount);
+	const char* previous = data;
+	for (size_t i = 0; i < chunkCount; i++)
+	{
+		const char* cut = i + 1 == chunkCount ? data + size : data + size * (i + 1) / chunkCount;
+		if (cut > previous && cut < data + size)
+		{
+			cut = std::min(findLineEnd(cut - 1, data + size) + 1, data + size);
+		}
+		cut = std::max(cut, previous);
+
+		chunks[i].begin = previous;
+		chunks[i].end = cut;
+		previous = cut;
+	}
+
+	forEachChunk(chunks, [this](Chunk& chunk) { countChunk(chunk); });
+
+	uint32_t positionCount = 0;
+	uint32_t texCoordCount = 0;
+	uint32_t normalCount = 0;
+	for (Chunk& chunk : chunks)
+	{
+		chunk.firstPosition = positionCount;
+		chunk.firstTexCoord = texCoordCount;
+		chunk.firstNormal = normalCount;
+		positionCount += chunk.positionCount;
+		texCoordCount += chunk.texCoordCount;
+		normalCount += chunk.normalCount;
+	}
+
+	out.positions.resize(size_t(positionCount) * 3);
+	out.texCoords.resize(size_t(texCoordCount) * 2);
+	out.normals.resize(size_t(normalCount) * 3);
+
+	forEachChunk(chunks, [this, &out](Chunk& chunk) { parseChunk(chunk, out); });
+
+	merge(path, chunks, out);
+}
+
+const char* ObjParser::parseFloat(const char* begin, const char* end, float& value)
+{
+	static const double POWERS_OF_TEN[] =
+	{
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	const char* p = begin;
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+
+	uint64_t mantissa = 0;
+	int32_t significantDigits = 0;
+	int32_t exponent = 0;
+	bool anyDigits = false;
+	bool truncated = false;
+
+	while (p < end && isDigit(*p))
+	{
+		if (significantDigits < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			significantDigits += mantissa != 0;
+		}
+		else
+		{
+			exponent++;
+			truncated |= *p != '0';
+		}
+		anyDigits = true;
+		p++;
+	}
+
+	if (p < end && *p == '.')
+	{
+		p++;
+		while (p < end && isDigit(*p))
+		{
+			if (significantDigits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				significantDigits += mantissa != 0;
+				exponent--;
+			}
+			else
+			{
+				truncated |= *p != '0';
+			}
+			anyDigits = true;
+			p++;
+		}
+	}
+
+	if (!anyDigits)
+	{
+		// inf, nan and hex floats are left to the C library
+		char* parsedEnd = nullptr;
+		std::string token(begin, std::find_if(begin, end, isSpace));
+		double parsed = strtod(token.c_str(), &parsedEnd);
+		if (parsedEnd == token.c_str())
+		{
+			return nullptr;
+		}
+		value = static_cast<float>(parsed);
+		return begin + (parsedEnd - token.c_str());
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		int32_t exponentValue = 0;
+		const char* exponentEnd = parseInt(p + 1, end, exponentValue);
+		if (exponentEnd != nullptr)
+		{
+			exponent += std::max(-100000, std::min(exponentValue, 100000));
+			p = exponentEnd;
+		}
+	}
+
+	// The mantissa and the power of ten are exact floats, so one operation rounds correctly
+	if (!truncated && mantissa <= (1ull << 24) && exponent >= -10 && exponent <= 10)
+	{
+		float result = static_cast<float>(mantissa);
+		result = exponent < 0 ? result / static_cast<float>(POWERS_OF_TEN[-exponent]) : result * static_cast<float>(POWERS_OF_TEN[exponent]);
+		value = negative ? -result : result;
+		return p;
+	}
+
+	// Same in double precision, the conversion to float can be off by one ulp for long mantissas
+	if (!truncated && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22)
+	{
+		double result = static_cast<double>(mantissa);
+		result = exponent < 0 ? result / POWERS_OF_TEN[-exponent] : result * POWERS_OF_TEN[exponent];
+		value = static_cast<float>(negative ? -result : result);
+		return p;
+	}
+
+	std::string token(begin, p);
+	value = static_cast<float>(strtod(token.c_str(), nullptr));
+	return p;
+}
+
+void ObjParser::forEachChunk(std::vector<Chunk>& chunks, const std::function<void(Chunk&)>& pass)
+{
+	if (threadPool == nullptr)
+	{
+		for (Chunk& chunk : chunks)
+		{
+			pass(chunk);
+		}
+		return;
+	}
+
+	threadPool->parallelFor(static_cast<uint32_t>(chunks.size()), [&](uint32_t index)
+	{
+		pass(chunks[index]);
+	});
+}
+
+void ObjParser::countChunk(Chunk& chunk)
+{
+	const char* p = chunk.begin;
+	while (p < chunk.end)
+	{
+		const char* lineEnd = findLineEnd(p, chunk.end);
+		const char* line = skipSpace(p, lineEnd);
+
+		// Same tests as parseChunk, which writes into exactly the counted range
+		if (isKeyword(line, lineEnd, "v", 1))
+		{
+			chunk.positionCount++;
+		}
+		else if (isKeyword(line, lineEnd, "vt", 2))
+		{
+			chunk.texCoordCount++;
+		}
+		else if (isKeyword(line, lineEnd, "vn", 2))
+		{
+			chunk.normalCount++;
+		}
+
+		p = lineEnd + 1;
+	}
+}
+
+void ObjParser::parseChunk(Chunk& chunk, ObjData& out)
+{
+	uint32_t totalPositions = static_cast<uint32_t>(out.positions.size() / 3);
+	uint32_t totalTexCoords = static_cast<uint32_t>(out.texCoords.size() / 2);
+	uint32_t totalNormals = static_cast<uint32_t>(out.normals.size() / 3);
+
+	float* positions = out.positions.data() + size_t(chunk.firstPosition) * 3;
+	float* texCoords = out.texCoords.data() + size_t(chunk.firstTexCoord) * 2;
+	float* normals = out.normals.data() + size_t(chunk.firstNormal) * 3;
+
+	// Read so far, including earlier chunks, for relative indices
+	uint32_t positionCount = chunk.firstPosition;
+	uint32_t texCoordCount = chunk.firstTexCoord;
+	uint32_t normalCount = chunk.firstNormal;
+
+	chunk.segments.emplace_back();
+	int32_t materialSlot = -1;
+	std::vector<ObjIndex> polygon;
+
+	const char* p = chunk.begin;
+	while (p < chunk.end)
+	{
+		const char* lineEnd = findLineEnd(p, chunk.end);
+		const char* line = skipSpace(p, lineEnd);
+		p = lineEnd + 1;
+
+		if (line == lineEnd || *line == '#')
+		{
+			continue;
+		}
+
+		if (isKeyword(line, lineEnd, "v", 1))
+		{
+			parseFloats(line + 1, lineEnd, positions, 3);
+			positions += 3;
+			positionCount++;
+		}
+		else if (isKeyword(line, lineEnd, "vt", 2))
+		{
+			parseFloats(line + 2, lineEnd, texCoords, 2);
+			texCoords += 2;
+			texCoordCount++;
+		}
+		else if (isKeyword(line, lineEnd, "vn", 2))
+		{
+			parseFloats(line + 2, lineEnd, normals, 3);
+			normals += 3;
+			normalCount++;
+		}
+		else if (isKeyword(line, lineEnd, "f", 1))
+		{
+			polygon.clear();
+
+			const char* corner = skipSpace(line + 1, lineEnd);
+			while (corner < lineEnd)
+			{
+				ObjIndex index;
+				int32_t value = 0;
+
+				corner = parseInt(corner, lineEnd, value);
+				if (corner == nullptr)
+				{
+					throw std::runtime_error("malformed OBJ face!");
+				}
+				index.position = resolveIndex(value, positionCount, totalPositions);
+
+				// v, v/vt, v//vn or v/vt/vn
+				if (corner < lineEnd && *corner == '/')
+				{
+					corner++;
+					if (corner < lineEnd && *corner != '/')
+					{
+						corner = parseInt(corner, lineEnd, value);
+						if (corner == nullptr)
+						{
+							throw std::runtime_error("malformed OBJ face!");
+						}
+						index.texCoord = resolveIndex(value, texCoordCount, totalTexCoords);
+					}
+					if (corner < lineEnd && *corner == '/')
+					{
+						corner = parseInt(corner + 1, lineEnd, value);
+						if (corner == nullptr)
+						{
+							throw std::runtime_error("malformed OBJ face!");
+						}
+						index.normal = resolveIndex(value, normalCount, totalNormals);
+					}
+				}
+
+				polygon.push_back(index);
+				corner = skipSpace(corner, lineEnd);
+			}
+
+			Segment& segment = chunk.segments.back();
+			for (size_t i = 2; i < polygon.size(); i++)
+			{
+				segment.indices.push_back(polygon[0]);
+				segment.indices.push_back(polygon[i - 1]);
+				segment.indices.push_back(polygon[i]);
+				segment.materialSlots.push_back(materialSlot);
+			}
+		}
+		else if (isKeyword(line, lineEnd, "o", 1) || isKeyword(line, lineEnd, "g", 1))
+		{
+			if (!chunk.segments.back().indices.empty())
+			{
+				chunk.segments.emplace_back();
+			}
+
+			Segment& segment = chunk.segments.back();
+			segment.startsShape = true;
+			segment.name = readName(line + 1, lineEnd);
+		}
+		else if (isKeyword(line, lineEnd, "usemtl", 6))
+		{
+			std::string name = readName(line + 6, lineEnd);
+			auto found = std::find(chunk.materialNames.begin(), chunk.materialNames.end(), name);
+			materialSlot = static_cast<int32_t>(found - chunk.materialNames.begin());
+			if (found == chunk.materialNames.end())
+			{
+				chunk.materialNames.push_back(name);
+			}
+			chunk.finalMaterialSlot = materialSlot;
+		}
+		else if (isKeyword(line, lineEnd, "mtllib", 6))
+		{
+			chunk.materialLibraries.push_back(readName(line + 6, lineEnd));
+		}
+	}
+}
+
+void ObjParser::merge(const std::string& path, std::vector<Chunk>& chunks, ObjData& out)
+{
+	std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+
+	std::vector<std::string> libraries;
+	for (const Chunk& chunk : chunks)
+	{
+		for (const std::string& library : chunk.materialLibraries)
+		{
+			if (std::find(libraries.begin(), libraries.end(), library) == libraries.end())
+			{
+				libraries.push_back(library);
+				loadMaterialNames(directory + library, out.materials);
+			}
+		}
+	}
+
+	std::unordered_map<std::string, int32_t> materialIds;
+	for (size_t i = 0; i < out.materials.size(); i++)
+	{
+		materialIds.emplace(out.materials[i], static_cast<int32_t>(i));
+	}
+
+	ObjShape shape;
+	int32_t currentMaterial = -1;
+
+	for (Chunk& chunk : chunks)
+	{
+		std::vector<int32_t> slotMaterials(chunk.materialNames.size());
+		for (size_t i = 0; i < chunk.materialNames.size(); i++)
+		{
+			auto found = materialIds.find(chunk.materialNames[i]);
+			slotMaterials[i] = found != materialIds.end() ? found->second : -1;
+		}
+
+		for (Segment& segment : chunk.segments)
+		{
+			if (segment.startsShape)
+			{
+				if (!shape.indices.empty())
+				{
+					out.shapes.push_back(std::move(shape));
+					shape = ObjShape();
+				}
+				shape.name = segment.name;
+			}
+
+			shape.indices.insert(shape.indices.end(), segment.indices.begin(), segment.indices.end());
+			for (int32_t slot : segment.materialSlots)
+			{
+				shape.materialIds.push_back(slot >= 0 ? slotMaterials[slot] : currentMaterial);
+			}
+		}
+
+		if (chunk.finalMaterialSlot >= 0)
+		{
+			currentMaterial = slotMaterials[chunk.finalMaterialSlot];
+		}
+
+		// The faces are copied, release them before the next chunk
+		chunk.segments.clear();
+		chunk.segments.shrink_to_fit();
+	}
+
+	if (!shape.indices.empty())
+	{
+		out.shapes.push_back(std::move(shape));
+	}
+}
+
+void ObjParser::loadMaterialNames(const std::string& path, std::vector<std::string>& names)
+{
+	// A missing library only leaves its materials unresolved, like in tinyobj
+	std::ifstream file(path);
+	std::string line;
+	while (std::getline(file, line))
+	{
+		const char* begin = skipSpace(line.data(), line.data() + line.size());
+		const char* end = line.data() + line.size();
+		if (isKeyword(begin, end, "newmtl", 6))
+		{
+			names.push_back(readName(begin + 6, end));
+		}
+	}
+}
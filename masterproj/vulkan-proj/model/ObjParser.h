@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "../util/ThreadPool.h"
+
+// Zero based attribute indices of one face corner, -1 if the corner has no such attribute
+struct ObjIndex
+{
+	int32_t position = -1;
+	int32_t texCoord = -1;
+	int32_t normal = -1;
+};
+
+// Faces between two "o"/"g" lines
+struct ObjShape
+{
+	std::string name;
+	// Three per triangle, polygons are triangulated as fans
+	std::vector<ObjIndex> indices;
+	// One per triangle, index into ObjData::materials, -1 without a known material
+	std::vector<int32_t> materialIds;
+};
+
+struct ObjData
+{
+	// xyz per position and normal, uv per texture coordinate
+	std::vector<float> positions;
+	std::vector<float> texCoords;
+	std::vector<float> normals;
+
+	std::vector<ObjShape> shapes;
+	// "newmtl" names of the material libraries, in file order
+	std::vector<std::string> materials;
+};
+
+/*
+Wavefront OBJ reader that parses on every thread of a pool.
+
+The file is mapped and cut into line aligned chunks. A first pass counts the v/vt/vn lines of each
+chunk, so every chunk knows where its attributes go in the output and how to resolve relative
+(negative) indices. The second pass parses the chunks independently, writing attributes straight
+into their final place and faces into per-chunk lists, which are then concatenated in file order.
+The result does not depend on the number of threads.
+
+Shapes and materials follow tinyobj: "o" and "g" start a new shape once the current one has faces,
+"usemtl" only changes the material of the following faces.
+*/
+class ObjParser
+{
+public:
+	// Runs on the calling thread only without a pool
+	explicit ObjParser(ThreadPool* threadPool = nullptr);
+
+	// Throws if the file cannot be read or a face references a missing attribute
+	void parse(const std::string& path, ObjData& out);
+
+	/*
+	Parses a decimal float starting at begin, returns the end of the number or nullptr if there is
+	none. Numbers with up to 19 significant digits and a small exponent are converted exactly with
+	a single multiplication or division, everything else falls back to strtod.
+	*/
+	static const char* parseFloat(const char* begin, const char* end, float& value);
+
+private:
+	// Cuts below this size cost more in scheduling than they save
+	static const size_t MIN_CHUNK_SIZE = 256 * 1024;
+	// Chunks per thread, evens out chunks that take longer than others
+	static const uint32_t CHUNKS_PER_THREAD = 4;
+
+	struct Segment
+	{
+		// False for the faces at the start of a chunk, which continue the previous chunk's shape
+		bool startsShape = false;
+		std::string name;
+		std::vector<ObjIndex> indices;
+		// Per triangle, index into Chunk::materialNames, -1 for the material active at the chunk start
+		std::vector<int32_t> materialSlots;
+	};
+
+	struct Chunk
+	{
+		const char* begin = nullptr;
+		const char* end = nullptr;
+
+		// Attributes before this chunk, filled between the two passes
+		uint32_t firstPosition = 0;
+		uint32_t firstTexCoord = 0;
+		uint32_t firstNormal = 0;
+
+		uint32_t positionCount = 0;
+		uint32_t texCoordCount = 0;
+		uint32_t normalCount = 0;
+
+		std::vector<Segment> segments;
+		std::vector<std::string> materialNames;
+		std::vector<std::string> materialLibraries;
+		// Local slot of the last "usemtl" in the chunk, -1 if there is none
+		int32_t finalMaterialSlot = -1;
+	};
+
+	ThreadPool* threadPool;
+
+	void forEachChunk(std::vector<Chunk>& chunks, const std::function<void(Chunk&)>& pass);
+	// Only fills in the chunk's counts
+	void countChunk(Chunk& chunk);
+	void parseChunk(Chunk& chunk, ObjData& out);
+	void merge(const std::string& path, std::vector<Chunk>& chunks, ObjData& out);
+
+	static void loadMaterialNames(const std::string& path, std::vector<std::string>& names);
+};
@@ -0,0 +1,134 @@
+#include "TextureCache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+bool TextureCache::load(const std::string& cachePath, uint64_t sourceHash, TextureData& texture)
+{
+	auto file = std::make_shared<MappedFile>(cachePath);
+	if (!file->isOpen() || file->getSize() < sizeof(TextureCacheHeader))
+	{
+		return false;
+	}
+
+	TextureCacheHeader header;
+	std::memcpy(&header, file->getData(), sizeof(header));
+
+	if (header.magic != MAGIC || header.formatVersion != FORMAT_VERSION || header.cookerVersion != COOKER_VERSION
+		|| header.sourceHash != sourceHash || header.fileSize != file->getSize())
+	{
+		return false;
+	}
+
+	if (header.format > static_cast<uint32_t>(TextureFormat::Bc7) || header.width == 0 || header.height == 0
+		|| header.levelCount != TextureLoader::getMipCount(header.width, header.height) || header.levelCount > MAX_LEVEL_COUNT)
+	{
+		return false;
+	}
+
+	// Every block has to lie inside the file, a truncated write must not be read past its end
+	uint64_t levelEnd = header.levelOffset + uint64_t(header.levelCount) * sizeof(TextureCacheLevel);
+	if (header.levelOffset % BLOCK_ALIGNMENT != 0 || header.payloadOffset % BLOCK_ALIGNMENT != 0 || header.levelOffset < sizeof(TextureCacheHeader)
+		|| levelEnd > header.payloadOffset || header.payloadOffset + header.payloadSize > header.fileSize)
+	{
+		return false;
+	}
+
+	const char* data = file->getData();
+	TextureFormat format = static_cast<TextureFormat>(header.format);
+
+	std::vector<TextureLevel> levels(header.levelCount);
+	for (uint32_t i = 0; i < header.levelCount; i++)
+	{
+		TextureCacheLevel entry;
+		std::memcpy(&entry, data + header.levelOffset + i * sizeof(TextureCacheLevel), sizeof(entry));
+
+		// Levels have to match the chain the image is created with, a copy outside it would be invalid
+		if (entry.width != std::max(header.width >> i, 1u) || entry.height != std::max(header.height >> i, 1u)
+			|| entry.size != TextureLoader::getLevelSize(format, entry.width, entry.height)
+			|| entry.offset % BLOCK_ALIGNMENT != 0 || entry.offset + entry.size > header.payloadSize)
+		{
+			return false;
+		}
+
+		levels[i].width = entry.width;
+		levels[i].height = entry.height;
+		levels[i].offset = entry.offset;
+		levels[i].size = entry.size;
+	}
+
+	texture.format = format;
+	texture.width = header.width;
+	texture.height = header.height;
+	texture.levels = std::move(levels);
+	texture.setMappedData(file, reinterpret_cast<const uint8_t*>(data + header.payloadOffset), header.payloadSize);
+
+	return true;
+}
+
+bool TextureCache::save(const std::string& cachePath, uint64_t sourceHash, const TextureData& texture)
+{
+	TextureCacheHeader header = {};
+	header.magic = MAGIC;
+	header.formatVersion = FORMAT_VERSION;
+	header.cookerVersion = COOKER_VERSION;
+	header.format = static_cast<uint32_t>(texture.format);
+	header.sourceHash = sourceHash;
+	header.width = texture.width;
+	header.height = texture.height;
+	header.levelCount = static_cast<uint32_t>(texture.levels.size());
+
+	header.levelOffset = alignUp(sizeof(TextureCacheHeader));
+	header.payloadOffset = alignUp(header.levelOffset + uint64_t(header.levelCount) * sizeof(TextureCacheLevel));
+	header.payloadSize = texture.getSize();
+	header.fileSize = header.payloadOffset + header.payloadSize;
+
+	std::vector<TextureCacheLevel> levels(header.levelCount);
+	for (uint32_t i = 0; i < header.levelCount; i++)
+	{
+		const TextureLevel& level = texture.levels[i];
+		levels[i] = { level.width, level.height, level.offset, level.size, 0 };
+	}
+
+	std::string tmpPath = cachePath + ".tmp";
+	{
+		std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			return false;
+		}
+
+		static const char padding[BLOCK_ALIGNMENT] = {};
+		auto padTo = [&](uint64_t offset)
+		{
+			file.write(padding, static_cast<std::streamsize>(offset - static_cast<uint64_t>(file.tellp())));
+		};
+
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		padTo(header.levelOffset);
+		file.write(reinterpret_cast<const char*>(levels.data()), static_cast<std::streamsize>(levels.size() * sizeof(TextureCacheLevel)));
+		padTo(header.payloadOffset);
+		file.write(reinterpret_cast<const char*>(texture.getData()), static_cast<std::streamsize>(header.payloadSize));
+
+		if (!file.good())
+		{
+			file.close();
+			std::remove(tmpPath.c_str());
+			return false;
+		}
+	}
+
+	// rename() does not replace an existing file everywhere
+	std::remove(cachePath.c_str());
+	if (std::rename(tmpPath.c_str(), cachePath.c_str()) != 0)
+	{
+		std::remove(tmpPath.c_str());
+		return false;
+	}
+
+	return true;
+}
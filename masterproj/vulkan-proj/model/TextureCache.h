@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "TextureLoader.h"
+
+/*
+Cooked texture container, a simplified KTX2: the whole mip chain in its GPU format, so loading is
+a mapping and one copy into staging memory.
+
+Layout, all blocks 16 byte aligned and in native byte order:
+	TextureCacheHeader
+	level table		levelCount * TextureCacheLevel, level 0 first
+	payload			every level, offsets in the table are relative to the payload
+
+A file is used only if it was cooked from a source with the same hash by the same COOKER_VERSION;
+anything else counts as a miss.
+*/
+class TextureCache
+{
+public:
+	// Bump whenever the cooker output changes (filter, formats, ...)
+	static const uint32_t COOKER_VERSION = 3;
+
+	// False on a missing, stale or malformed file, texture is left untouched then
+	static bool load(const std::string& cachePath, uint64_t sourceHash, TextureData& texture);
+	// Written to a temporary file and renamed, false if that fails
+	static bool save(const std::string& cachePath, uint64_t sourceHash, const TextureData& texture);
+
+private:
+	static const uint32_t MAGIC = 0x52584554; // "TEXR"
+	static const uint32_t FORMAT_VERSION = 1;
+	static const uint64_t BLOCK_ALIGNMENT = 16;
+	// 16384 x 16384 has 15 levels
+	static const uint32_t MAX_LEVEL_COUNT = 16;
+
+	struct TextureCacheHeader
+	{
+		uint32_t magic;
+		uint32_t formatVersion;
+		uint32_t cookerVersion;
+		uint32_t format;
+		uint64_t sourceHash;
+		uint32_t width;
+		uint32_t height;
+		uint32_t levelCount;
+		uint32_t pad;
+		uint64_t levelOffset;
+		uint64_t payloadOffset;
+		uint64_t payloadSize;
+		uint64_t fileSize;
+	};
+
+	struct TextureCacheLevel
+	{
+		uint32_t width;
+		uint32_t height;
+		uint64_t offset;
+		uint64_t size;
+		uint64_t pad;
+	};
+
+	static uint64_t alignUp(uint64_t value) { return (value + BLOCK_ALIGNMENT - 1) & ~(BLOCK_ALIGNMENT - 1); }
+};
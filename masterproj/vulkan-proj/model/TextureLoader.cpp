@@ -1,6 +1,37 @@
 #include "TextureLoader.h"
+#include "BlockCompressor.h"
+#include "MipGenerator.h"
+#include "TextureCache.h"
+#include "../util/Hash.h"
 
-TextureLoader::TextureLoader()
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+const uint8_t* TextureData::getData() const
+{
+	return mapping ? mappedData : payload.data();
+}
+
+uint64_t TextureData::getSize() const
+{
+	return mapping ? mappedSize : payload.size();
+}
+
+void TextureData::setMappedData(std::shared_ptr<MappedFile> file, const uint8_t* data, uint64_t size)
+{
+	payload.clear();
+
+	mapping = std::move(file);
+	mappedData = data;
+	mappedSize = size;
+}
+
+TextureLoader::TextureLoader(std::shared_ptr<ThreadPool> threadPool)
+	: threadPool(threadPool)
 {
 }
 
@@ -8,3 +39,213 @@ TextureLoader::TextureLoader()
 TextureLoader::~TextureLoader()
 {
 }
+
+TextureFormat TextureLoader::chooseFormat(bool hasAlpha) const
+{
+	if (!hasAlpha && formatSupport.bc1)
+	{
+		return TextureFormat::Bc1;
+	}
+	if (formatSupport.bc7)
+	{
+		return TextureFormat::Bc7;
+	}
+	if (formatSupport.bc3)
+	{
+		return TextureFormat::Bc3;
+	}
+
+	return TextureFormat::Rgba8;
+}
+
+TextureData TextureLoader::load(const std::string& path)
+{
+	std::string cachePath = path + ".tex";
+	uint64_t sourceHash = Hash::hashFile(path);
+	if (sourceHash != 0)
+	{
+		// Other formats or another filter cook the same source differently
+		const uint8_t support[3] = { formatSupport.bc1, formatSupport.bc3, formatSupport.bc7 };
+		sourceHash = Hash::hashBytes(support, sizeof(support), sourceHash);
+		sourceHash = Hash::hashBytes(&mipFilter, sizeof(mipFilter), sourceHash);
+	}
+
+	TextureData texture;
+	if (sourceHash != 0 && TextureCache::load(cachePath, sourceHash, texture))
+	{
+		return texture;
+	}
+
+	std::lock_guard<std::mutex> lock(cookMutex);
+
+	// The same file may have been cooked while waiting for the lock
+	if (sourceHash != 0 && TextureCache::load(cachePath, sourceHash, texture))
+	{
+		return texture;
+	}
+
+	int width, height, channels;
+	stbi_uc* pixels = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+
+	if (!pixels)
+	{
+		throw std::runtime_error("failed to load texture image " + path + "!");
+	}
+
+	size_t texelCount = size_t(width) * height;
+	bool hasAlpha = false;
+	for (size_t i = 0; i < texelCount && !hasAlpha; i++)
+	{
+		hasAlpha = pixels[i * 4 + 3] != 255;
+	}
+
+	TextureFormat format = chooseFormat(hasAlpha);
+
+	auto cookStart = std::chrono::steady_clock::now();
+	texture = cook(pixels, static_cast<uint32_t>(width), static_cast<uint32_t>(height), format, mipFilter, threadPool.get());
+	stbi_image_free(pixels);
+	auto cookEnd = std::chrono::steady_clock::now();
+
+	std::cout << "Cooked " << path << ": " << texture.width << "x" << texture.height << " " << getFormatName(format) << ", "
+		<< texture.levels.size() << " mip levels (" << MipGenerator::getFilterName(mipFilter) << ") in " << std::chrono::duration<double, std::milli>(cookEnd - cookStart).count() << " ms" << std::endl;
+
+	// Not fatal, the next run cooks again
+	if (sourceHash != 0 && !TextureCache::save(cachePath, sourceHash, texture))
+	{
+		std::cerr << "failed to write texture cache " << cachePath << std::endl;
+	}
+
+	return texture;
+}
+
+TextureData TextureLoader::cook(const uint8_t* pixels, uint32_t width, uint32_t height, TextureFormat format, MipFilter filter, ThreadPool* threadPool)
+{
+	TextureData texture = MipGenerator::generate(pixels, width, height, filter, threadPool);
+
+	if (format == TextureFormat::Rgba8)
+	{
+		return texture;
+	}
+
+	TextureData compressed;
+	compressed.width = width;
+	compressed.height = height;
+	compressed.payload.resize(static_cast<size_t>(layoutLevels(compressed, format)));
+
+	// Rows of blocks of all levels in one go, the small levels alone would leave most threads idle
+	std::vector<uint32_t> firstRows(texture.levels.size() + 1, 0);
+	for (size_t i = 0; i < texture.levels.size(); i++)
+	{
+		firstRows[i + 1] = firstRows[i] + (texture.levels[i].height + BlockCompressor::BLOCK_SIZE - 1) / BlockCompressor::BLOCK_SIZE;
+	}
+
+	auto compressRow = [&](uint32_t row)
+	{
+		size_t i = std::upper_bound(firstRows.begin(), firstRows.end(), row) - firstRows.begin() - 1;
+		const TextureLevel& source = texture.levels[i];
+		BlockCompressor::compressRow(format, texture.payload.data() + source.offset, source.width, source.height, row - firstRows[i],
+			compressed.payload.data() + compressed.levels[i].offset);
+	};
+
+	if (threadPool)
+	{
+		threadPool->parallelFor(firstRows.back(), compressRow);
+	}
+	else
+	{
+		for (uint32_t row = 0; row < firstRows.back(); row++)
+		{
+			compressRow(row);
+		}
+	}
+
+	return compressed;
+}
+
+TextureData TextureLoader::createPlaceholder()
+{
+	const uint32_t size = 8;
+	const uint8_t light[4] = { 200, 200, 200, 255 };
+	const uint8_t dark[4] = { 120, 120, 120, 255 };
+
+	TextureData texture;
+	texture.format = TextureFormat::Rgba8;
+	texture.width = size;
+	texture.height = size;
+	texture.payload.resize(size * size * 4);
+	texture.levels.push_back({ size, size, 0, texture.payload.size() });
+
+	for (uint32_t y = 0; y < size; y++)
+	{
+		for (uint32_t x = 0; x < size; x++)
+		{
+			memcpy(&texture.payload[(y * size + x) * 4], ((x ^ y) & 1) ? dark : light, 4);
+		}
+	}
+
+	return texture;
+}
+
+uint32_t TextureLoader::getMipCount(uint32_t width, uint32_t height)
+{
+	// floor(log2(max)) + 1, so the largest dimension reaches 1
+	uint32_t count = 1;
+	for (uint32_t size = std::max(width, height); size > 1; size >>= 1)
+	{
+		count++;
+	}
+
+	return count;
+}
+
+uint64_t TextureLoader::getLevelSize(TextureFormat format, uint32_t width, uint32_t height)
+{
+	switch (format)
+	{
+	case TextureFormat::Rgba8:
+		return uint64_t(width) * height * 4;
+	case TextureFormat::Bc1:
+	case TextureFormat::Bc3:
+	case TextureFormat::Bc7:
+		return uint64_t((width + BlockCompressor::BLOCK_SIZE - 1) / BlockCompressor::BLOCK_SIZE)
+			* ((height + BlockCompressor::BLOCK_SIZE - 1) / BlockCompressor::BLOCK_SIZE) * BlockCompressor::getBlockBytes(format);
+	}
+
+	throw std::runtime_error("unknown texture format!");
+}
+
+const char* TextureLoader::getFormatName(TextureFormat format)
+{
+	switch (format)
+	{
+	case TextureFormat::Rgba8:
+		return "RGBA8";
+	case TextureFormat::Bc1:
+		return "BC1";
+	case TextureFormat::Bc3:
+		return "BC3";
+	case TextureFormat::Bc7:
+		return "BC7";
+	}
+
+	return "unknown";
+}
+
+uint64_t TextureLoader::layoutLevels(TextureData& texture, TextureFormat format)
+{
+	texture.format = format;
+	texture.levels.resize(getMipCount(texture.width, texture.height));
+
+	uint64_t offset = 0;
+	for (size_t i = 0; i < texture.levels.size(); i++)
+	{
+		TextureLevel& level = texture.levels[i];
+		level.width = std::max(texture.width >> i, 1u);
+		level.height = std::max(texture.height >> i, 1u);
+		level.offset = (offset + LEVEL_ALIGNMENT - 1) & ~(LEVEL_ALIGNMENT - 1);
+		level.size = getLevelSize(format, level.width, level.height);
+		offset = level.offset + level.size;
+	}
+
+	return offset;
+}
@@ -1,11 +1,132 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include <stb_image.h>
 
+#include "../util/MappedFile.h"
+#include "../util/ThreadPool.h"
+
+enum class TextureFormat : uint32_t
+{
+	// 8 bit RGBA, sRGB encoded colour stored as UNORM like the block compressed formats
+	Rgba8 = 0,
+	// 4x4 blocks, see BlockCompressor
+	Bc1 = 1,
+	Bc3 = 2,
+	Bc7 = 3,
+};
+
+enum class MipFilter : uint32_t
+{
+	// Area average, the cheapest and the softest
+	Box = 0,
+	// Kaiser windowed sinc, 3 texels wide with alpha 4. Sharp without much ringing
+	Kaiser = 1,
+	// Lanczos 3, the sharpest, rings a little on hard edges
+	Lanczos = 2,
+};
+
+// Block compressed formats the device can sample, cooking falls back to Rgba8 without them
+struct TextureFormatSupport
+{
+	bool bc1 = false;
+	bool bc3 = false;
+	bool bc7 = false;
+};
+
+// One mip level inside the payload of a TextureData
+struct TextureLevel
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint64_t offset = 0;
+	uint64_t size = 0;
+};
+
+// Complete mip chain in its GPU format, ready to be copied into an image as it is
+class TextureData
+{
+public:
+	TextureFormat format = TextureFormat::Rgba8;
+	uint32_t width = 0;
+	uint32_t height = 0;
+
+	// Level 0 first, down to 1x1 unless only the first levels are given. Offsets are relative to getData()
+	std::vector<TextureLevel> levels;
+
+	// Filled by the cooker, empty if the texture was mapped from its container
+	std::vector<uint8_t> payload;
+
+	// Payload wherever it lives, use these instead of the vector
+	const uint8_t* getData() const;
+	uint64_t getSize() const;
+
+	// Points the texture at payload inside a mapped container, which stays open as long as the texture
+	void setMappedData(std::shared_ptr<MappedFile> file, const uint8_t* data, uint64_t size);
+
+private:
+	std::shared_ptr<MappedFile> mapping;
+	const uint8_t* mappedData = nullptr;
+	uint64_t mappedSize = 0;
+};
+
+/*
+Textures are cooked once into a container next to the source (see TextureCache) and only mapped on
+later runs, so loading does no decoding and no mip generation at all.
+
+Cooking decodes the source with stb_image and builds every mip level with MipGenerator, by
+default with the Kaiser filter.
+
+Then all levels are block compressed if the device supports it, spread over the thread pool by rows
+of blocks. Opaque images become BC1; images with alpha become BC7, or BC3 if only that is there.
+The supported formats are hashed with the source, a container cooked for other formats is stale.
+*/
 class TextureLoader
 {
 public:
-	TextureLoader();
+	// Mip generation and block compression are spread over threadPool, shared with the rest of the
+	// program; without one they run on the calling thread
+	explicit TextureLoader(std::shared_ptr<ThreadPool> threadPool = nullptr);
 	~TextureLoader();
-};
 
+	// Set before the first load, formats the device does not support are never cooked
+	void setFormatSupport(const TextureFormatSupport& support) { formatSupport = support; }
+	// Format an image is cooked to under the current support
+	TextureFormat chooseFormat(bool hasAlpha) const;
+	// Set before the first load like the formats
+	void setMipFilter(MipFilter filter) { mipFilter = filter; }
+
+	// Cooked container of any format stb_image reads, cooked first if it is missing or stale. Safe to call from several threads at once
+	TextureData load(const std::string& path);
+
+	// Builds the whole mip chain of tightly packed RGBA rows, block compression runs on the pool if there is one
+	static TextureData cook(const uint8_t* pixels, uint32_t width, uint32_t height, TextureFormat format = TextureFormat::Rgba8,
+		MipFilter filter = MipFilter::Kaiser, ThreadPool* threadPool = nullptr);
+
+	// Two-tone checkerboard shown while textures are loading. Level 0 only, the renderer makes the
+	// rest of the chain like for any texture made at runtime
+	static TextureData createPlaceholder();
+
+	static uint32_t getMipCount(uint32_t width, uint32_t height);
+	// Bytes of one tightly packed level
+	static uint64_t getLevelSize(TextureFormat format, uint32_t width, uint32_t height);
+	static const char* getFormatName(TextureFormat format);
+	// Lays out the levels of a full chain in format, back to back at LEVEL_ALIGNMENT, returns the payload size
+	static uint64_t layoutLevels(TextureData& texture, TextureFormat format);
+
+private:
+	// Offset alignment of the levels in the payload, enough for any texel block size
+	static const uint64_t LEVEL_ALIGNMENT = 16;
+
+	TextureFormatSupport formatSupport;
+	MipFilter mipFilter = MipFilter::Kaiser;
+
+	std::shared_ptr<ThreadPool> threadPool;
+	// Cooking writes the container, two loads of the same file must not write it at once
+	std::mutex cookMutex;
+};
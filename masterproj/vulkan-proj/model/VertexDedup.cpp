@@ -0,0 +1,113 @@
+#include "VertexDedup.h"
+
+#include <cstring>
+
+static_assert(sizeof(Vertex) % sizeof(uint64_t) == 0, "Vertex is hashed as 64 bit words");
+
+namespace
+{
+	uint64_t rotateLeft(uint64_t value, int bits)
+	{
+		return (value << bits) | (value >> (64 - bits));
+	}
+
+	size_t slotCountFor(size_t vertices)
+	{
+		// At most 3/4 full
+		size_t minimum = vertices + vertices / 3 + 1;
+		size_t slotCount = 16;
+		while (slotCount < minimum)
+		{
+			slotCount *= 2;
+		}
+		return slotCount;
+	}
+}
+
+VertexDedup::VertexDedup(size_t expectedVertices)
+{
+	slots.resize(slotCountFor(expectedVertices));
+	mask = slots.size() - 1;
+}
+
+uint32_t VertexDedup::insert(const Vertex& vertex, std::vector<Vertex>& vertices)
+{
+	uint64_t fullHash = hash(vertex);
+	uint32_t tag = static_cast<uint32_t>(fullHash);
+
+	// The high bits pick the slot, the low bits are the tag, so both are used
+	for (size_t slot = static_cast<size_t>(fullHash >> 32) & mask; ; slot = (slot + 1) & mask)
+	{
+		Slot& entry = slots[slot];
+
+		if (entry.index == EMPTY)
+		{
+			uint32_t index = static_cast<uint32_t>(vertices.size());
+			vertices.push_back(vertex);
+
+			entry.hash = tag;
+			entry.index = index;
+
+			if (++count * 4 > slots.size() * 3)
+			{
+				grow(vertices);
+			}
+
+			return index;
+		}
+
+		if (entry.hash == tag && memcmp(&vertices[entry.index], &vertex, sizeof(Vertex)) == 0)
+		{
+			return entry.index;
+		}
+	}
+}
+
+uint64_t VertexDedup::hash(const Vertex& vertex)
+{
+	const uint64_t PRIME1 = 0x9e3779b185ebca87ull;
+	const uint64_t PRIME2 = 0xc2b2ae3d27d4eb4full;
+
+	uint64_t words[sizeof(Vertex) / sizeof(uint64_t)];
+	memcpy(words, &vertex, sizeof(Vertex));
+
+	// xxHash64 style rounds over the packed bytes, then the murmur3 finalizer
+	uint64_t h = PRIME1 ^ sizeof(Vertex);
+	for (uint64_t word : words)
+	{
+		h ^= rotateLeft(word * PRIME2, 31) * PRIME1;
+		h = rotateLeft(h, 27) * PRIME1 + 0x85ebca77c2b2ae63ull;
+	}
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+
+	return h;
+}
+
+void VertexDedup::grow(const std::vector<Vertex>& vertices)
+{
+	std::vector<Slot> old;
+	old.swap(slots);
+
+	slots.resize(old.size() * 2);
+	mask = slots.size() - 1;
+
+	for (const Slot& entry : old)
+	{
+		if (entry.index == EMPTY)
+		{
+			continue;
+		}
+
+		size_t slot = static_cast<size_t>(hash(vertices[entry.index]) >> 32) & mask;
+		while (slots[slot].index != EMPTY)
+		{
+			slot = (slot + 1) & mask;
+		}
+		slots[slot] = entry;
+	}
+}
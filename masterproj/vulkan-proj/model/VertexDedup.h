@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ModelLoader.h"
+
+/*
+Maps vertices to their index in a vertex list while a mesh is imported.
+
+Flat open addressing table with linear probing. A slot is the low 32 bits of the vertex hash next
+to the vertex index, so most mismatches are rejected without touching the vertex list. Vertices
+are compared and hashed as raw bytes: two vertices are the same only if they are bit-identical,
+which also means 0.0 and -0.0 stay apart.
+*/
+class VertexDedup
+{
+public:
+	// Sized so that expectedVertices insertions never rehash, the index count of the mesh is a safe bound
+	explicit VertexDedup(size_t expectedVertices);
+
+	// Index of vertex in vertices, appended if it is not there yet
+	uint32_t insert(const Vertex& vertex, std::vector<Vertex>& vertices);
+
+	static uint64_t hash(const Vertex& vertex);
+
+private:
+	static const uint32_t EMPTY = UINT32_MAX;
+
+	struct Slot
+	{
+		uint32_t hash = 0;
+		uint32_t index = EMPTY;
+	};
+
+	std::vector<Slot> slots;
+	size_t mask = 0;
+	size_t count = 0;
+
+	void grow(const std::vector<Vertex>& vertices);
+};
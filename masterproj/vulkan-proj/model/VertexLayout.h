@@ -0,0 +1,232 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "ModelLoader.h"
+
+// Maps stored positions and texture coordinates back to model values: value = offset + stored * scale
+struct MeshQuantization
+{
+	glm::vec3 positionOffset = glm::vec3(0.0f);
+	glm::vec3 positionScale = glm::vec3(1.0f);
+	glm::vec2 texCoordOffset = glm::vec2(0.0f);
+	glm::vec2 texCoordScale = glm::vec2(1.0f);
+};
+
+/*
+Encodings of one vertex attribute: the shader location it feeds, its Vulkan format, the packed
+type and the conversion from the imported Vertex. fits() rejects values the encoding cannot hold.
+*/
+struct PositionFloat3
+{
+	typedef glm::vec3 Packed;
+	static const uint32_t LOCATION = 0;
+	static const VkFormat FORMAT = VK_FORMAT_R32G32B32_SFLOAT;
+	static const bool QUANTIZES_POSITION = false;
+	static const bool QUANTIZES_TEXCOORD = false;
+
+	static bool fits(const Vertex&) { return true; }
+	static Packed pack(const Vertex& vertex, const MeshQuantization&) { return vertex.pos; }
+};
+
+// Quantized to the mesh bounds, w is padding
+struct PositionUnorm16
+{
+	typedef std::array<uint16_t, 4> Packed;
+	static const uint32_t LOCATION = 0;
+	static const VkFormat FORMAT = VK_FORMAT_R16G16B16A16_UNORM;
+	static const bool QUANTIZES_POSITION = true;
+	static const bool QUANTIZES_TEXCOORD = false;
+
+	static bool fits(const Vertex&) { return true; }
+	static Packed pack(const Vertex& vertex, const MeshQuantization& quantization)
+	{
+		Packed packed = {};
+		for (int i = 0; i < 3; i++)
+		{
+			packed[i] = toUnorm16(vertex.pos[i], quantization.positionOffset[i], quantization.positionScale[i]);
+		}
+		return packed;
+	}
+
+	// value relative to the range [offset, offset + scale]
+	static uint16_t toUnorm16(float value, float offset, float scale)
+	{
+		float normalized = scale > 0.0f ? (value - offset) / scale : 0.0f;
+		return static_cast<uint16_t>(std::min(std::max(normalized, 0.0f), 1.0f) * 65535.0f + 0.5f);
+	}
+};
+
+struct ColorFloat3
+{
+	typedef glm::vec3 Packed;
+	static const uint32_t LOCATION = 1;
+	static const VkFormat FORMAT = VK_FORMAT_R32G32B32_SFLOAT;
+	static const bool QUANTIZES_POSITION = false;
+	static const bool QUANTIZES_TEXCOORD = false;
+
+	static bool fits(const Vertex&) { return true; }
+	static Packed pack(const Vertex& vertex, const MeshQuantization&) { return vertex.color; }
+};
+
+// Alpha is padding
+struct ColorUnorm8
+{
+	typedef std::array<uint8_t, 4> Packed;
+	static const uint32_t LOCATION = 1;
+	static const VkFormat FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+	static const bool QUANTIZES_POSITION = false;
+	static const bool QUANTIZES_TEXCOORD = false;
+
+	static bool fits(const Vertex&) { return true; }
+	static Packed pack(const Vertex& vertex, const MeshQuantization&)
+	{
+		Packed packed = {};
+		for (int i = 0; i < 3; i++)
+		{
+			packed[i] = static_cast<uint8_t>(std::min(std::max(vertex.color[i], 0.0f), 1.0f) * 255.0f + 0.5f);
+		}
+		packed[3] = 255;
+		return packed;
+	}
+};
+
+struct TexCoordFloat2
+{
+	typedef glm::vec2 Packed;
+	static const uint32_t LOCATION = 2;
+	static const VkFormat FORMAT = VK_FORMAT_R32G32_SFLOAT;
+	static const bool QUANTIZES_POSITION = false;
+	static const bool QUANTIZES_TEXCOORD = false;
+
+	static bool fits(const Vertex&) { return true; }
+	static Packed pack(const Vertex& vertex, const MeshQuantization&) { return vertex.texCoord; }
+};
+
+// Quantized to the texture coordinate bounds of the mesh, so repeating ones fit too
+struct TexCoordUnorm16
+{
+	typedef std::array<uint16_t, 2> Packed;
+	static const uint32_t LOCATION = 2;
+	static const VkFormat FORMAT = VK_FORMAT_R16G16_UNORM;
+	static const bool QUANTIZES_POSITION = false;
+	static const bool QUANTIZES_TEXCOORD = true;
+
+	static bool fits(const Vertex&) { return true; }
+	static Packed pack(const Vertex& vertex, const MeshQuantization& quantization)
+	{
+		return {
+			PositionUnorm16::toUnorm16(vertex.texCoord.x, quantization.texCoordOffset.x, quantization.texCoordScale.x),
+			PositionUnorm16::toUnorm16(vertex.texCoord.y, quantization.texCoordOffset.y, quantization.texCoordScale.y)
+		};
+	}
+};
+
+/*
+Vertex buffer layout built from a list of attribute encodings at compile time.
+Attributes are packed back to back in list order; the stride, the Vulkan vertex input
+descriptions and the packing loop all come from the same list, so they cannot disagree.
+*/
+template<typename... Attributes>
+struct VertexLayout
+{
+	static constexpr uint32_t ATTRIBUTE_COUNT = sizeof...(Attributes);
+	static constexpr uint32_t STRIDE = (0 + ... + static_cast<uint32_t>(sizeof(typename Attributes::Packed)));
+	static constexpr bool QUANTIZES_POSITION = (false || ... || Attributes::QUANTIZES_POSITION);
+	static constexpr bool QUANTIZES_TEXCOORD = (false || ... || Attributes::QUANTIZES_TEXCOORD);
+
+	static VkVertexInputBindingDescription getBindingDescription(uint32_t binding)
+	{
+		VkVertexInputBindingDescription bindingDescription = {};
+		bindingDescription.binding = binding;
+		bindingDescription.stride = STRIDE;
+		// Per-instance data comes from a second binding, see InstanceData in scene/Scene.h
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+		return bindingDescription;
+	}
+
+	static std::array<VkVertexInputAttributeDescription, ATTRIBUTE_COUNT> getAttributeDescriptions(uint32_t binding)
+	{
+		std::array<VkVertexInputAttributeDescription, ATTRIBUTE_COUNT> attributeDescriptions = {};
+
+		uint32_t index = 0;
+		uint32_t offset = 0;
+		((attributeDescriptions[index].binding = binding,
+			attributeDescriptions[index].location = Attributes::LOCATION,
+			attributeDescriptions[index].format = Attributes::FORMAT,
+			attributeDescriptions[index].offset = offset,
+			offset += static_cast<uint32_t>(sizeof(typename Attributes::Packed)),
+			index++), ...);
+
+		return attributeDescriptions;
+	}
+
+	// Positions are stored relative to the model bounds if any attribute quantizes them, texture
+	// coordinates relative to their own bounds, which the model does not keep
+	static MeshQuantization getQuantization(const Model& model)
+	{
+		MeshQuantization quantization;
+		if (QUANTIZES_POSITION)
+		{
+			quantization.positionOffset = model.boundsMin;
+			quantization.positionScale = model.boundsMax - model.boundsMin;
+		}
+		if (QUANTIZES_TEXCOORD && model.getVertexCount() > 0)
+		{
+			const Vertex* vertices = model.getVertices();
+			glm::vec2 texCoordMin = vertices[0].texCoord;
+			glm::vec2 texCoordMax = vertices[0].texCoord;
+			for (uint32_t i = 1; i < model.getVertexCount(); i++)
+			{
+				texCoordMin = glm::min(texCoordMin, vertices[i].texCoord);
+				texCoordMax = glm::max(texCoordMax, vertices[i].texCoord);
+			}
+			quantization.texCoordOffset = texCoordMin;
+			quantization.texCoordScale = texCoordMax - texCoordMin;
+		}
+		return quantization;
+	}
+
+	// Writes count * STRIDE bytes to out, throws if a vertex does not fit the layout
+	static void pack(const Vertex* vertices, uint32_t count, const MeshQuantization& quantization, void* out)
+	{
+		char* destination = static_cast<char*>(out);
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const Vertex& vertex = vertices[i];
+			if (!(true && ... && Attributes::fits(vertex)))
+			{
+				throw std::runtime_error("vertex does not fit the vertex layout!");
+			}
+
+			((packAttribute<Attributes>(vertex, quantization, destination)), ...);
+		}
+	}
+
+private:
+	template<typename Attribute>
+	static void packAttribute(const Vertex& vertex, const MeshQuantization& quantization, char*& destination)
+	{
+		typename Attribute::Packed packed = Attribute::pack(vertex, quantization);
+		memcpy(destination, &packed, sizeof(packed));
+		destination += sizeof(packed);
+	}
+};
+
+// Full precision, 32 bytes like Vertex
+typedef VertexLayout<PositionFloat3, ColorFloat3, TexCoordFloat2> StandardVertexLayout;
+// 16 bytes: positions and texture coordinates quantized to their bounds in the mesh
+typedef VertexLayout<PositionUnorm16, ColorUnorm8, TexCoordUnorm16> CompactVertexLayout;
+
+// What the mesh arena stores and the graphics pipeline reads
+typedef CompactVertexLayout RenderVertexLayout;
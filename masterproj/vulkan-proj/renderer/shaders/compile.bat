@@ -1,3 +1,6 @@
 E:/Ressources/Libs/Vulkan/1.1.82.1/Bin/glslangValidator.exe -V shader.vert
 E:/Ressources/Libs/Vulkan/1.1.82.1/Bin/glslangValidator.exe -V shader.frag
+E:/Ressources/Libs/Vulkan/1.1.82.1/Bin/glslangValidator.exe -V -DTEXTURE_ARRAY shader.frag -o frag_array.spv
+E:/Ressources/Libs/Vulkan/1.1.82.1/Bin/glslangValidator.exe -V cull.comp -o cull.spv
+E:/Ressources/Libs/Vulkan/1.1.82.1/Bin/glslangValidator.exe -V downsample.comp -o downsample.spv
 pause
\ No newline at end of file
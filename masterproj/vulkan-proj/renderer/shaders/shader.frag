@@ -1,13 +1,34 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(binding = 1) uniform sampler2D texSampler;
+// Binding 1 is the texture table of renderer/vulkan/vTextureTable.h, fragMaterial picks the texture
+
+#ifdef TEXTURE_ARRAY
+// Built as frag_array.spv for devices without descriptor indexing, one layer per texture
+layout(binding = 1) uniform texture2DArray textureLayers;
+#else
+#extension GL_EXT_nonuniform_qualifier : require
+
+// VulkanTextureTable::getDescriptorCount
+layout(constant_id = 0) const uint TEXTURE_COUNT = 1;
+layout(binding = 1) uniform texture2D textures[TEXTURE_COUNT];
+#endif
+
+layout(binding = 2) uniform sampler texSampler;
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in uint fragMaterial;
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = texture(texSampler, fragTexCoord);
-}
\ No newline at end of file
+#ifdef TEXTURE_ARRAY
+    vec4 texel = texture(sampler2DArray(textureLayers, texSampler), vec3(fragTexCoord, float(fragMaterial)));
+#else
+    // Texels of one draw may come from different textures. Indices past the table sample texture 0
+    uint material = fragMaterial < TEXTURE_COUNT ? fragMaterial : 0;
+    vec4 texel = texture(sampler2D(textures[nonuniformEXT(material)], texSampler), fragTexCoord);
+#endif
+    outColor = texel * vec4(fragColor, 1.0);
+}
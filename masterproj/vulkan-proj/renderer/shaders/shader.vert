@@ -2,24 +2,37 @@
 #extension GL_ARB_separate_shader_objects : enable
 
 layout(binding = 0) uniform UniformBufferObject {
-    mat4 model;
     mat4 view;
     mat4 proj;
 } ubo;
 
+layout(push_constant) uniform DrawConstants {
+    mat4 model;
+    uint drawId;
+} draw;
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
 
+// Per-instance stream, a mat4 takes locations 3 to 6
+layout(location = 3) in mat4 instanceTransform;
+layout(location = 7) in vec4 instanceTint;
+layout(location = 8) in uint instanceMaterial;
+// xy scale and zw offset of the quantized texture coordinates
+layout(location = 9) in vec4 instanceTexCoordTransform;
+
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragMaterial;
 
 out gl_PerVertex {
     vec4 gl_Position;
 };
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
-    fragColor = inColor;
-    fragTexCoord = inTexCoord;
+    gl_Position = ubo.proj * ubo.view * draw.model * instanceTransform * vec4(inPosition, 1.0);
+    fragColor = inColor * instanceTint.rgb;
+    fragTexCoord = instanceTexCoordTransform.zw + inTexCoord * instanceTexCoordTransform.xy;
+    fragMaterial = instanceMaterial;
 }
\ No newline at end of file
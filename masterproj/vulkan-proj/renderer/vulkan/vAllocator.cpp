@@ -0,0 +1,542 @@
+#include "vAllocator.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+	uint32_t findMSB(uint64_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		return static_cast<uint32_t>(index);
+#else
+		return 63 - static_cast<uint32_t>(__builtin_clzll(value));
+#endif
+	}
+
+	uint32_t findLSB(uint64_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward64(&index, value);
+		return static_cast<uint32_t>(index);
+#else
+		return static_cast<uint32_t>(__builtin_ctzll(value));
+#endif
+	}
+
+	VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	const VkDeviceSize LARGE_HEAP_THRESHOLD = 1024ull * 1024 * 1024;
+	const VkDeviceSize LARGE_HEAP_BLOCK_SIZE = 256ull * 1024 * 1024;
+}
+
+MemoryBlock::MemoryBlock(VkDeviceMemory memory, VkDeviceSize size, void* mapped) :
+	memory{ memory },
+	mappedData{ mapped },
+	size{ size }
+{
+	firstPhysical = new TlsfNode();
+	firstPhysical->offset = 0;
+	firstPhysical->size = size;
+	insertFree(firstPhysical);
+}
+
+MemoryBlock::~MemoryBlock()
+{
+	TlsfNode* node = firstPhysical;
+	while (node)
+	{
+		TlsfNode* next = node->nextPhysical;
+		delete node;
+		node = next;
+	}
+}
+
+/*
+Sizes below SMALL_SIZE share first level 0 and are split linearly into SL_INDEX_COUNT classes.
+Above that the first level is the power of two and the second level splits it linearly.
+*/
+void MemoryBlock::mapping(VkDeviceSize size, uint32_t& fl, uint32_t& sl)
+{
+	if (size < SMALL_SIZE)
+	{
+		fl = 0;
+		sl = static_cast<uint32_t>(size / (SMALL_SIZE / SL_INDEX_COUNT));
+	}
+	else
+	{
+		uint32_t msb = findMSB(size);
+		sl = static_cast<uint32_t>(size >> (msb - SL_INDEX_COUNT_LOG2)) ^ SL_INDEX_COUNT;
+		fl = msb - SMALL_SIZE_LOG2 + 1;
+	}
+}
+
+TlsfNode* MemoryBlock::findSuitable(VkDeviceSize size)
+{
+	// Round up to the next size class so every range in the found list is large enough
+	if (size < SMALL_SIZE)
+	{
+		size += (SMALL_SIZE / SL_INDEX_COUNT) - 1;
+	}
+	else
+	{
+		size += (1ull << (findMSB(size) - SL_INDEX_COUNT_LOG2)) - 1;
+	}
+
+	uint32_t fl, sl;
+	mapping(size, fl, sl);
+	if (fl >= FL_INDEX_COUNT)
+	{
+		return nullptr;
+	}
+
+	uint32_t slMap = slBitmap[fl] & (~0u << sl);
+	if (slMap == 0)
+	{
+		uint64_t flMap = (fl + 1 < 64) ? flBitmap & (~0ull << (fl + 1)) : 0;
+		if (flMap == 0)
+		{
+			return nullptr;
+		}
+
+		fl = findLSB(flMap);
+		slMap = slBitmap[fl];
+	}
+
+	sl = findLSB(slMap);
+	return freeLists[fl][sl];
+}
+
+void MemoryBlock::insertFree(TlsfNode* node)
+{
+	uint32_t fl, sl;
+	mapping(node->size, fl, sl);
+
+	node->free = true;
+	node->prevFree = nullptr;
+	node->nextFree = freeLists[fl][sl];
+	if (node->nextFree)
+	{
+		node->nextFree->prevFree = node;
+	}
+	freeLists[fl][sl] = node;
+
+	flBitmap |= 1ull << fl;
+	slBitmap[fl] |= 1u << sl;
+}
+
+void MemoryBlock::removeFree(TlsfNode* node)
+{
+	uint32_t fl, sl;
+	mapping(node->size, fl, sl);
+
+	if (node->prevFree)
+	{
+		node->prevFree->nextFree = node->nextFree;
+	}
+	if (node->nextFree)
+	{
+		node->nextFree->prevFree = node->prevFree;
+	}
+
+	if (freeLists[fl][sl] == node)
+	{
+		freeLists[fl][sl] = node->nextFree;
+
+		if (freeLists[fl][sl] == nullptr)
+		{
+			slBitmap[fl] &= ~(1u << sl);
+			if (slBitmap[fl] == 0)
+			{
+				flBitmap &= ~(1ull << fl);
+			}
+		}
+	}
+
+	node->prevFree = nullptr;
+	node->nextFree = nullptr;
+	node->free = false;
+}
+
+// Shrinks node to size and returns a new node covering the remainder
+TlsfNode* MemoryBlock::split(TlsfNode* node, VkDeviceSize size)
+{
+	TlsfNode* remainder = new TlsfNode();
+	remainder->offset = node->offset + size;
+	remainder->size = node->size - size;
+	remainder->prevPhysical = node;
+	remainder->nextPhysical = node->nextPhysical;
+
+	if (node->nextPhysical)
+	{
+		node->nextPhysical->prevPhysical = remainder;
+	}
+
+	node->nextPhysical = remainder;
+	node->size = size;
+
+	return remainder;
+}
+
+void MemoryBlock::merge(TlsfNode* left, TlsfNode* right)
+{
+	left->size += right->size;
+	left->nextPhysical = right->nextPhysical;
+
+	if (right->nextPhysical)
+	{
+		right->nextPhysical->prevPhysical = left;
+	}
+
+	delete right;
+}
+
+TlsfNode* MemoryBlock::allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& alignedOffset)
+{
+	alignment = std::max<VkDeviceSize>(alignment, 1);
+	size = std::max<VkDeviceSize>(size, 1);
+
+	TlsfNode* node = findSuitable(size + alignment - 1);
+	if (node == nullptr)
+	{
+		return nullptr;
+	}
+
+	removeFree(node);
+
+	VkDeviceSize padding = alignUp(node->offset, alignment) - node->offset;
+	if (padding > 0)
+	{
+		// The alignment gap stays free and is coalesced again once a neighbour is released
+		TlsfNode* front = node;
+		node = split(front, padding);
+		insertFree(front);
+	}
+
+	if (node->size - size >= MIN_SPLIT_SIZE)
+	{
+		insertFree(split(node, size));
+	}
+
+	node->free = false;
+	usedBytes += node->size;
+	allocationCount++;
+
+	alignedOffset = node->offset;
+	return node;
+}
+
+void MemoryBlock::free(TlsfNode* node)
+{
+	usedBytes -= node->size;
+	allocationCount--;
+
+	if (node->prevPhysical && node->prevPhysical->free)
+	{
+		TlsfNode* prev = node->prevPhysical;
+		removeFree(prev);
+		merge(prev, node);
+		node = prev;
+	}
+
+	if (node->nextPhysical && node->nextPhysical->free)
+	{
+		TlsfNode* next = node->nextPhysical;
+		removeFree(next);
+		merge(node, next);
+	}
+
+	insertFree(node);
+}
+
+VulkanAllocator::VulkanAllocator(VkPhysicalDevice physicalDevice, VkDevice device) :
+	physicalDevice{ physicalDevice },
+	device{ device }
+{
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	bufferImageGranularity = properties.limits.bufferImageGranularity;
+	maxMemoryAllocationCount = properties.limits.maxMemoryAllocationCount;
+}
+
+VulkanAllocator::~VulkanAllocator()
+{
+	for (uint32_t type = 0; type < memProperties.memoryTypeCount; type++)
+	{
+		for (auto& pool : pools[type])
+		{
+			for (auto& block : pool.blocks)
+			{
+				if (!block->isEmpty())
+				{
+					std::cerr << "allocator: " << block->getAllocationCount() << " allocation(s) leaked in memory type " << type << std::endl;
+				}
+
+				freeDeviceMemory(block->memory);
+			}
+			pool.blocks.clear();
+		}
+
+		if (dedicatedStats[type].dedicatedCount > 0)
+		{
+			std::cerr << "allocator: " << dedicatedStats[type].dedicatedCount << " dedicated allocation(s) leaked in memory type " << type << std::endl;
+		}
+	}
+}
+
+MemoryAllocation VulkanAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, AllocationKind kind)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	MemoryAllocation allocation;
+	allocation.memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, properties);
+	allocation.size = requirements.size;
+
+	VkDeviceSize blockSize = preferredBlockSize(allocation.memoryTypeIndex);
+
+	// Large resources would waste most of a shared block, give them their own memory object
+	if (requirements.size > blockSize / 2)
+	{
+		allocation.memory = allocateDeviceMemory(requirements.size, allocation.memoryTypeIndex, &allocation.mappedData);
+		allocation.offset = 0;
+
+		MemoryTypeStats& stats = dedicatedStats[allocation.memoryTypeIndex];
+		stats.dedicatedCount++;
+		stats.allocationCount++;
+		stats.bytesReserved += requirements.size;
+		stats.bytesUsed += requirements.size;
+
+		return allocation;
+	}
+
+	MemoryPool& pool = getPool(allocation.memoryTypeIndex, kind);
+
+	for (auto& block : pool.blocks)
+	{
+		VkDeviceSize offset;
+		TlsfNode* node = block->allocate(requirements.size, requirements.alignment, offset);
+		if (node)
+		{
+			allocation.memory = block->memory;
+			allocation.offset = offset;
+			allocation.mappedData = block->mappedData ? static_cast<char*>(block->mappedData) + offset : nullptr;
+			allocation.block = block.get();
+			allocation.node = node;
+			subAllocationCalls++;
+
+			return allocation;
+		}
+	}
+
+	void* mapped = nullptr;
+	VkDeviceMemory memory = allocateDeviceMemory(blockSize, allocation.memoryTypeIndex, &mapped);
+	pool.blocks.push_back(std::make_unique<MemoryBlock>(memory, blockSize, mapped));
+	MemoryBlock* block = pool.blocks.back().get();
+
+	VkDeviceSize offset;
+	TlsfNode* node = block->allocate(requirements.size, requirements.alignment, offset);
+	if (node == nullptr)
+	{
+		throw std::runtime_error("failed to sub-allocate from a new memory block!");
+	}
+
+	allocation.memory = block->memory;
+	allocation.offset = offset;
+	allocation.mappedData = mapped ? static_cast<char*>(mapped) + offset : nullptr;
+	allocation.block = block;
+	allocation.node = node;
+	subAllocationCalls++;
+
+	return allocation;
+}
+
+void VulkanAllocator::free(MemoryAllocation& allocation)
+{
+	if (allocation.memory == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (allocation.block == nullptr)
+	{
+		MemoryTypeStats& stats = dedicatedStats[allocation.memoryTypeIndex];
+		stats.dedicatedCount--;
+		stats.allocationCount--;
+		stats.bytesReserved -= allocation.size;
+		stats.bytesUsed -= allocation.size;
+
+		freeDeviceMemory(allocation.memory);
+		allocation = {};
+		return;
+	}
+
+	allocation.block->free(allocation.node);
+
+	// Keep one empty block per pool around so a free/allocate pattern does not thrash vkAllocateMemory
+	if (allocation.block->isEmpty())
+	{
+		for (auto& pool : pools[allocation.memoryTypeIndex])
+		{
+			auto it = std::find_if(pool.blocks.begin(), pool.blocks.end(),
+				[&](const std::unique_ptr<MemoryBlock>& b) { return b.get() == allocation.block; });
+
+			if (it == pool.blocks.end())
+			{
+				continue;
+			}
+
+			size_t emptyBlocks = std::count_if(pool.blocks.begin(), pool.blocks.end(),
+				[](const std::unique_ptr<MemoryBlock>& b) { return b->isEmpty(); });
+
+			if (emptyBlocks > 1)
+			{
+				freeDeviceMemory((*it)->memory);
+				pool.blocks.erase(it);
+			}
+			break;
+		}
+	}
+
+	allocation = {};
+}
+
+uint32_t VulkanAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+{
+	for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+	{
+		if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+		{
+			return i;
+		}
+	}
+
+	throw std::runtime_error("failed to find suitable memory type!");
+}
+
+AllocatorStats VulkanAllocator::getStats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	AllocatorStats stats;
+	stats.deviceMemoryCount = deviceMemoryCount;
+	stats.vkAllocateMemoryCalls = vkAllocateMemoryCalls;
+	stats.subAllocationCalls = subAllocationCalls;
+
+	for (uint32_t type = 0; type < memProperties.memoryTypeCount; type++)
+	{
+		MemoryTypeStats& typeStats = stats.memoryTypes[type];
+		typeStats = dedicatedStats[type];
+
+		for (auto& pool : pools[type])
+		{
+			for (auto& block : pool.blocks)
+			{
+				typeStats.blockCount++;
+				typeStats.allocationCount += block->getAllocationCount();
+				typeStats.bytesReserved += block->getSize();
+				typeStats.bytesUsed += block->getUsedBytes();
+			}
+		}
+
+		stats.total.blockCount += typeStats.blockCount;
+		stats.total.dedicatedCount += typeStats.dedicatedCount;
+		stats.total.allocationCount += typeStats.allocationCount;
+		stats.total.bytesReserved += typeStats.bytesReserved;
+		stats.total.bytesUsed += typeStats.bytesUsed;
+	}
+
+	return stats;
+}
+
+void VulkanAllocator::printStats(std::ostream& out)
+{
+	AllocatorStats stats = getStats();
+	const double MiB = 1024.0 * 1024.0;
+
+	out << "device memory: " << stats.total.allocationCount << " allocations in "
+		<< stats.deviceMemoryCount << " VkDeviceMemory objects (limit " << maxMemoryAllocationCount << "), "
+		<< stats.total.bytesUsed / MiB << " / " << stats.total.bytesReserved / MiB << " MiB used" << std::endl;
+
+	for (uint32_t type = 0; type < memProperties.memoryTypeCount; type++)
+	{
+		const MemoryTypeStats& typeStats = stats.memoryTypes[type];
+		if (typeStats.blockCount == 0 && typeStats.dedicatedCount == 0)
+		{
+			continue;
+		}
+
+		out << "  type " << type << " (heap " << memProperties.memoryTypes[type].heapIndex << "): "
+			<< typeStats.blockCount << " blocks, " << typeStats.dedicatedCount << " dedicated, "
+			<< typeStats.allocationCount << " allocations, "
+			<< typeStats.bytesUsed / MiB << " / " << typeStats.bytesReserved / MiB << " MiB" << std::endl;
+	}
+
+	out << "  vkAllocateMemory calls: " << stats.vkAllocateMemoryCalls << ", sub-allocations: " << stats.subAllocationCalls << std::endl;
+}
+
+VkDeviceSize VulkanAllocator::preferredBlockSize(uint32_t memoryTypeIndex) const
+{
+	VkDeviceSize heapSize = memProperties.memoryHeaps[memProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+
+	return heapSize <= LARGE_HEAP_THRESHOLD ? heapSize / 8 : LARGE_HEAP_BLOCK_SIZE;
+}
+
+VkDeviceMemory VulkanAllocator::allocateDeviceMemory(VkDeviceSize size, uint32_t memoryTypeIndex, void** mapped)
+{
+	if (deviceMemoryCount >= maxMemoryAllocationCount)
+	{
+		throw std::runtime_error("exceeded maxMemoryAllocationCount!");
+	}
+
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+	VkDeviceMemory memory;
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate device memory!");
+	}
+
+	deviceMemoryCount++;
+	vkAllocateMemoryCalls++;
+
+	*mapped = nullptr;
+	if (memProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		if (vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to map device memory!");
+		}
+	}
+
+	return memory;
+}
+
+void VulkanAllocator::freeDeviceMemory(VkDeviceMemory memory)
+{
+	// Freeing implicitly unmaps persistently mapped blocks
+	vkFreeMemory(device, memory, nullptr);
+	deviceMemoryCount--;
+}
+
+VulkanAllocator::MemoryPool& VulkanAllocator::getPool(uint32_t memoryTypeIndex, AllocationKind kind)
+{
+	size_t kindIndex = (bufferImageGranularity > 1 && kind == AllocationKind::Optimal) ? 1 : 0;
+	return pools[memoryTypeIndex][kindIndex];
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+Buffers and linear images never share a block with optimal-tiling images, so two neighbouring
+sub-allocations can never violate bufferImageGranularity. If the device reports a granularity
+of 1 both kinds are placed into the same pools.
+*/
+enum class AllocationKind
+{
+	Linear,
+	Optimal
+};
+
+class MemoryBlock;
+struct TlsfNode;
+
+struct MemoryAllocation
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	// Host visible memory is mapped once per block and stays mapped
+	void* mappedData = nullptr;
+
+	uint32_t memoryTypeIndex = 0;
+	MemoryBlock* block = nullptr; // nullptr for dedicated allocations
+	TlsfNode* node = nullptr;
+};
+
+struct MemoryTypeStats
+{
+	uint32_t blockCount = 0;
+	uint32_t dedicatedCount = 0;
+	uint32_t allocationCount = 0;
+	VkDeviceSize bytesReserved = 0;
+	VkDeviceSize bytesUsed = 0;
+};
+
+struct AllocatorStats
+{
+	std::array<MemoryTypeStats, VK_MAX_MEMORY_TYPES> memoryTypes = {};
+	MemoryTypeStats total;
+	uint32_t deviceMemoryCount = 0; // live VkDeviceMemory objects, bounded by maxMemoryAllocationCount
+	uint64_t vkAllocateMemoryCalls = 0;
+	uint64_t subAllocationCalls = 0;
+};
+
+/*
+Two level segregated fit (TLSF) sub-allocator for a single VkDeviceMemory block.
+Allocation and free are O(1): free ranges are bucketed by size class, a pair of bitmaps finds
+the first non-empty bucket that is guaranteed to fit, and physically adjacent free ranges are
+coalesced on free.
+*/
+struct TlsfNode
+{
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	bool free = true;
+
+	TlsfNode* prevPhysical = nullptr;
+	TlsfNode* nextPhysical = nullptr;
+	TlsfNode* prevFree = nullptr;
+	TlsfNode* nextFree = nullptr;
+};
+
+class MemoryBlock
+{
+public:
+	MemoryBlock(VkDeviceMemory memory, VkDeviceSize size, void* mapped);
+	~MemoryBlock();
+
+	TlsfNode* allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& alignedOffset);
+	void free(TlsfNode* node);
+
+	bool isEmpty() const { return usedBytes == 0; }
+	VkDeviceSize getSize() const { return size; }
+	VkDeviceSize getUsedBytes() const { return usedBytes; }
+	uint32_t getAllocationCount() const { return allocationCount; }
+
+	VkDeviceMemory memory;
+	void* mappedData;
+
+private:
+	static const uint32_t SL_INDEX_COUNT_LOG2 = 5;
+	static const uint32_t SL_INDEX_COUNT = 1 << SL_INDEX_COUNT_LOG2;
+	static const uint32_t SMALL_SIZE_LOG2 = 8;
+	static const VkDeviceSize SMALL_SIZE = 1 << SMALL_SIZE_LOG2;
+	static const uint32_t FL_INDEX_COUNT = 64 - SMALL_SIZE_LOG2 + 1;
+	// Splitting off a remainder smaller than this is not worth a node
+	static const VkDeviceSize MIN_SPLIT_SIZE = 64;
+
+	VkDeviceSize size;
+	VkDeviceSize usedBytes = 0;
+	uint32_t allocationCount = 0;
+
+	uint64_t flBitmap = 0;
+	std::array<uint32_t, FL_INDEX_COUNT> slBitmap = {};
+	std::array<std::array<TlsfNode*, SL_INDEX_COUNT>, FL_INDEX_COUNT> freeLists = {};
+
+	TlsfNode* firstPhysical = nullptr;
+
+	static void mapping(VkDeviceSize size, uint32_t& fl, uint32_t& sl);
+	TlsfNode* findSuitable(VkDeviceSize size);
+	void insertFree(TlsfNode* node);
+	void removeFree(TlsfNode* node);
+	TlsfNode* split(TlsfNode* node, VkDeviceSize size);
+	void merge(TlsfNode* left, TlsfNode* right);
+};
+
+/*
+Device memory allocator replacing one vkAllocateMemory per resource.
+Memory is reserved in large blocks per memory type and sub-allocated with TLSF. Resources that
+are too big to share a block get a dedicated VkDeviceMemory.
+*/
+class VulkanAllocator
+{
+public:
+	VulkanAllocator(VkPhysicalDevice physicalDevice, VkDevice device);
+	~VulkanAllocator();
+
+	MemoryAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, AllocationKind kind);
+	void free(MemoryAllocation& allocation);
+
+	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+
+	AllocatorStats getStats();
+	void printStats(std::ostream& out);
+
+private:
+	struct MemoryPool
+	{
+		std::vector<std::unique_ptr<MemoryBlock>> blocks;
+	};
+
+	VkPhysicalDevice physicalDevice;
+	VkDevice device;
+	VkPhysicalDeviceMemoryProperties memProperties;
+	VkDeviceSize bufferImageGranularity;
+	uint32_t maxMemoryAllocationCount;
+
+	// [memoryTypeIndex][kind]
+	std::array<std::array<MemoryPool, 2>, VK_MAX_MEMORY_TYPES> pools;
+
+	uint32_t deviceMemoryCount = 0;
+	uint64_t vkAllocateMemoryCalls = 0;
+	uint64_t subAllocationCalls = 0;
+	std::array<MemoryTypeStats, VK_MAX_MEMORY_TYPES> dedicatedStats = {};
+
+	std::mutex mutex;
+
+	VkDeviceSize preferredBlockSize(uint32_t memoryTypeIndex) const;
+	VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryTypeIndex, void** mapped);
+	void freeDeviceMemory(VkDeviceMemory memory);
+	MemoryPool& getPool(uint32_t memoryTypeIndex, AllocationKind kind);
+};
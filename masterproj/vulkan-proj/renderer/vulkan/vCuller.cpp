@@ -0,0 +1,868 @@
+#include "vCuller.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+	bool isSphereVisible(const glm::vec4 planes[6], const glm::vec3& center, float radius)
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// world * translate(offset) * scale(scale), moves the stored positions into world space
+	glm::mat4 applyDequantization(const glm::mat4& world, const glm::vec4& scale, const glm::vec4& offset)
+	{
+		glm::mat4 transform = world;
+		transform[0] *= scale.x;
+		transform[1] *= scale.y;
+		transform[2] *= scale.z;
+		transform[3] = world * glm::vec4(glm::vec3(offset), 1.0f);
+		return transform;
+	}
+
+	// Coarsest level whose error projects below the limit, levels up to the previous one get the wide side of the dead band
+	uint32_t selectLod(const CullBatch& batch, const glm::vec3& center, float radius, float scale, uint32_t previous, const glm::vec4& lodCamera, float hysteresis)
+	{
+		// Distance to the bounding sphere, inside it everything is close
+		float distance = std::max(glm::length(center - glm::vec3(lodCamera)) - radius, 0.0f);
+
+		uint32_t lod = 0;
+		for (uint32_t i = 1; i < batch.lodCount; i++)
+		{
+			float projected = batch.lodErrors[i] * scale * lodCamera.w;
+			float limit = distance * (i <= previous ? 1.0f + hysteresis : 1.0f - hysteresis);
+			if (projected > limit)
+			{
+				break;
+			}
+			lod = i;
+		}
+
+		return lod;
+	}
+
+	// Rotation and uniform scale keep the normal cones, anything else skips the cone test
+	bool keepsCones(const glm::mat4& world)
+	{
+		glm::vec3 x = glm::vec3(world[0]);
+		glm::vec3 y = glm::vec3(world[1]);
+		glm::vec3 z = glm::vec3(world[2]);
+
+		float lengthSquared = glm::dot(x, x);
+		float tolerance = lengthSquared * 0.01f;
+		return glm::dot(glm::cross(x, y), z) > 0.0f
+			&& std::abs(glm::dot(y, y) - lengthSquared) <= tolerance && std::abs(glm::dot(z, z) - lengthSquared) <= tolerance
+			&& std::abs(glm::dot(x, y)) <= tolerance && std::abs(glm::dot(x, z)) <= tolerance && std::abs(glm::dot(y, z)) <= tolerance;
+	}
+
+	bool isClusterVisible(const glm::vec4 planes[6], const glm::mat4& world, float scale, bool cones, const ClusterData& cluster, const glm::vec3& camera)
+	{
+		glm::vec3 center = glm::vec3(world * glm::vec4(glm::vec3(cluster.boundingSphere), 1.0f));
+		float radius = cluster.boundingSphere.w * scale;
+
+		if (!isSphereVisible(planes, center, radius))
+		{
+			return false;
+		}
+
+		if (!cones || cluster.cone.w >= 1.0f)
+		{
+			return true;
+		}
+
+		// Back facing when every triangle faces away from the camera
+		glm::vec3 view = center - camera;
+		glm::vec3 axis = glm::normalize(glm::vec3(world * glm::vec4(glm::vec3(cluster.cone), 0.0f)));
+		return glm::dot(view, axis) < cluster.cone.w * glm::length(view) + radius;
+	}
+}
+
+const VkIndexType VulkanCuller::INDEX_GROUP_TYPES[VulkanCuller::INDEX_GROUP_COUNT] = { VK_INDEX_TYPE_UINT16, VK_INDEX_TYPE_UINT32 };
+
+VulkanCuller::VulkanCuller(VkPhysicalDevice physicalDevice, VkDevice device, VulkanAllocator& allocator, VulkanDeletionQueue& deletionQueue, VulkanPipelineCache& pipelineCache, uint32_t framesInFlight, VkShaderModule cullShader, const IndirectDrawSupport& support)
+	: device(device), allocator(allocator), deletionQueue(deletionQueue), support(support), frames(framesInFlight)
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	storageAlignment = std::max<VkDeviceSize>(properties.limits.minStorageBufferOffsetAlignment, 4);
+
+	createPipeline(pipelineCache, cullShader);
+
+	std::vector<VkDescriptorSetLayout> layouts(framesInFlight, descriptorSetLayout);
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = framesInFlight;
+	allocInfo.pSetLayouts = layouts.data();
+
+	std::vector<VkDescriptorSet> sets(framesInFlight);
+	if (vkAllocateDescriptorSets(device, &allocInfo, sets.data()) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate culling descriptor sets!");
+	}
+
+	for (uint32_t i = 0; i < framesInFlight; i++)
+	{
+		frames[i].descriptorSet = sets[i];
+	}
+}
+
+VulkanCuller::~VulkanCuller()
+{
+	for (FrameResources& frame : frames)
+	{
+		destroy(frame.batches);
+		destroy(frame.cpuVisible);
+		destroy(frame.cpuDraws);
+		destroy(frame.cpuClusterDraws);
+	}
+
+	destroy(visibleBuffer);
+	destroy(drawBuffer);
+	destroy(lodBuffer);
+	destroy(clusterWorkBuffer);
+	destroy(clusterDrawBuffer);
+
+	vkDestroyPipeline(device, pipeline, nullptr);
+	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+}
+
+void VulkanCuller::extractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6])
+{
+	// glm is column major, row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++)
+	{
+		rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+	}
+
+	planes[0] = rows[3] + rows[0]; // left
+	planes[1] = rows[3] - rows[0]; // right
+	planes[2] = rows[3] + rows[1]; // bottom
+	planes[3] = rows[3] - rows[1]; // top
+	planes[4] = rows[2];           // near, clip z starts at 0
+	planes[5] = rows[3] - rows[2]; // far
+
+	// Normalized so the distance can be compared against a radius
+	for (int i = 0; i < 6; i++)
+	{
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+}
+
+void VulkanCuller::cull(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint64_t frameNumber, const Scene& scene, const VulkanInstanceBuffer& instances, const VulkanMeshArena& meshes, const glm::mat4& view, const glm::mat4& projection, float viewportHeight, CullingMode mode)
+{
+	FrameResources& frame = frames[frameIndex];
+
+	glm::vec4 planes[6];
+	extractFrustumPlanes(projection * view, planes);
+
+	// A length of 1 at distance 1 covers this many pixels
+	float pixelsPerUnit = 0.5f * viewportHeight * std::abs(projection[1][1]);
+	glm::vec4 lodCamera = glm::vec4(glm::vec3(glm::inverse(view)[3]), pixelsPerUnit / LOD_PIXEL_ERROR);
+
+	std::vector<CullBatch> batches;
+	writeBatches(scene, instances, meshes, batches);
+
+	drawSlots = groupFirstSlots[INDEX_GROUP_COUNT - 1] + groupSlotCounts[INDEX_GROUP_COUNT - 1];
+	drawVisible = VK_NULL_HANDLE;
+	drawCommands = VK_NULL_HANDLE;
+	drawClusterCommands = VK_NULL_HANDLE;
+
+	if (batches.empty())
+	{
+		return;
+	}
+
+	if (mode == CullingMode::Gpu)
+	{
+		cullGpu(commandBuffer, frame, frameNumber, batches, instances, meshes, planes, lodCamera);
+	}
+	else
+	{
+		cullCpu(frame, frameNumber, scene, batches, instances, meshes, planes, lodCamera);
+	}
+
+	// Without firstInstance in indirect commands every draw rebinds the stream at its region
+	drawFirstInstances.clear();
+	if (!support.firstInstance)
+	{
+		drawFirstInstances.resize(drawSlots);
+		for (const CullBatch& batch : batches)
+		{
+			for (uint32_t lod = 0; lod < batch.lodCount; lod++)
+			{
+				drawFirstInstances[batch.drawSlot + lod] = batch.lodFirstVisible[lod];
+			}
+		}
+	}
+}
+
+void VulkanCuller::draw(VkCommandBuffer commandBuffer, const VulkanMeshArena& meshes, uint32_t firstSlot, uint32_t slotCount) const
+{
+	if (drawVisible == VK_NULL_HANDLE || slotCount == 0)
+	{
+		return;
+	}
+
+	const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	uint32_t endSlot = firstSlot + slotCount;
+
+	if (support.firstInstance)
+	{
+		VkDeviceSize offset = 0;
+		vkCmdBindVertexBuffers(commandBuffer, InstanceData::BINDING, 1, &drawVisible, &offset);
+	}
+
+	for (uint32_t group = 0; group < INDEX_GROUP_COUNT; group++)
+	{
+		uint32_t groupBegin = std::max(firstSlot, groupFirstSlots[group]);
+		uint32_t groupEnd = std::min(endSlot, groupFirstSlots[group] + groupSlotCounts[group]);
+		if (groupBegin >= groupEnd)
+		{
+			continue;
+		}
+
+		meshes.bindIndices(commandBuffer, INDEX_GROUP_TYPES[group]);
+
+		if (!support.firstInstance)
+		{
+			for (uint32_t i = groupBegin; i < groupEnd; i++)
+			{
+				VkDeviceSize offset = drawFirstInstances[i] * sizeof(InstanceData);
+				vkCmdBindVertexBuffers(commandBuffer, InstanceData::BINDING, 1, &drawVisible, &offset);
+				vkCmdDrawIndexedIndirect(commandBuffer, drawCommands, DRAWS_OFFSET + i * stride, 1, stride);
+			}
+		}
+		else if (compact())
+		{
+			// The group's count sits in front of the commands, its slot count is only the upper bound
+			support.drawIndexedIndirectCount(commandBuffer, drawCommands, DRAWS_OFFSET + groupBegin * stride, drawCommands, group * sizeof(uint32_t), groupEnd - groupBegin, stride);
+		}
+		else if (support.multiDraw)
+		{
+			vkCmdDrawIndexedIndirect(commandBuffer, drawCommands, DRAWS_OFFSET + groupBegin * stride, groupEnd - groupBegin, stride);
+		}
+		else
+		{
+			for (uint32_t i = groupBegin; i < groupEnd; i++)
+			{
+				vkCmdDrawIndexedIndirect(commandBuffer, drawCommands, DRAWS_OFFSET + i * stride, 1, stride);
+			}
+		}
+
+		if (drawClusterCommands == VK_NULL_HANDLE || clusterGroupDrawCounts[group] == 0)
+		{
+			continue;
+		}
+
+		// Compaction keeps the range whole
+		if (compact())
+		{
+			support.drawIndexedIndirectCount(commandBuffer, drawClusterCommands, DRAWS_OFFSET + clusterGroupFirstDraws[group] * stride, drawClusterCommands, group * sizeof(uint32_t), clusterGroupDrawCounts[group], stride);
+			continue;
+		}
+
+		// The fixed cluster slots follow the batch order like the draw slots, so the batches of
+		// this range own one contiguous run of them
+		uint32_t clusterBegin = UINT32_MAX;
+		uint32_t clusterEnd = 0;
+		for (const ClusterRange& range : clusterRanges)
+		{
+			if (range.drawSlot < groupBegin || range.drawSlot >= groupEnd)
+			{
+				continue;
+			}
+
+			if (!support.firstInstance)
+			{
+				for (uint32_t i = 0; i < range.instanceCount; i++)
+				{
+					VkDeviceSize offset = (range.firstVisible + i) * sizeof(InstanceData);
+					vkCmdBindVertexBuffers(commandBuffer, InstanceData::BINDING, 1, &drawVisible, &offset);
+					vkCmdDrawIndexedIndirect(commandBuffer, drawClusterCommands, DRAWS_OFFSET + (range.firstDraw + i * range.clusterCount) * stride, range.clusterCount, stride);
+				}
+				continue;
+			}
+
+			clusterBegin = std::min(clusterBegin, range.firstDraw);
+			clusterEnd = std::max(clusterEnd, range.firstDraw + range.instanceCount * range.clusterCount);
+		}
+
+		if (clusterBegin < clusterEnd)
+		{
+			vkCmdDrawIndexedIndirect(commandBuffer, drawClusterCommands, DRAWS_OFFSET + clusterBegin * stride, clusterEnd - clusterBegin, stride);
+		}
+	}
+}
+
+VkDeviceSize VulkanCuller::getCountersOffset(uint32_t slots) const
+{
+	VkDeviceSize end = DRAWS_OFFSET + slots * sizeof(VkDrawIndexedIndirectCommand);
+	return (end + storageAlignment - 1) / storageAlignment * storageAlignment;
+}
+
+void VulkanCuller::writeBatches(const Scene& scene, const VulkanInstanceBuffer& instances, const VulkanMeshArena& meshes, std::vector<CullBatch>& out)
+{
+	out.resize(scene.batches.size());
+
+	// Each level gets a region as large as the instance buffer, at the batch's offset within it
+	uint32_t visibleStride = std::max(instances.getCapacity(), 1u);
+
+	for (uint32_t group = 0; group < INDEX_GROUP_COUNT; group++)
+	{
+		groupSlotCounts[group] = 0;
+		clusterGroupDrawCounts[group] = 0;
+	}
+	uint32_t clusterDraws = 0;
+	clusterRanges.clear();
+
+	for (size_t i = 0; i < scene.batches.size(); i++)
+	{
+		const InstanceBatch& batch = scene.batches[i];
+		CullBatch& cullBatch = out[i];
+		cullBatch = {};
+
+		cullBatch.transform = batch.transform;
+		cullBatch.positionScale = glm::vec4(1.0f);
+		cullBatch.texCoordTransform = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f);
+		cullBatch.firstInstance = instances.getRegion(i).firstInstance;
+		// Batches without a mesh, not even the placeholder, stay in their slot with nothing to draw
+		cullBatch.lodCount = 1;
+		cullBatch.indexGroup = INDEX_GROUP_COUNT - 1;
+
+		for (uint32_t lod = 0; lod < Model::MAX_LOD_COUNT; lod++)
+		{
+			cullBatch.lodFirstVisible[lod] = lod * visibleStride + cullBatch.firstInstance;
+		}
+
+		if (const MeshRange* found = meshes.findMesh(batch.meshIndex))
+		{
+			const MeshRange& mesh = *found;
+			cullBatch.boundingSphere = mesh.boundingSphere;
+			cullBatch.positionScale = glm::vec4(mesh.quantization.positionScale, 0.0f);
+			cullBatch.positionOffset = glm::vec4(mesh.quantization.positionOffset, 0.0f);
+			cullBatch.texCoordTransform = glm::vec4(mesh.quantization.texCoordScale, mesh.quantization.texCoordOffset);
+			cullBatch.instanceCount = static_cast<uint32_t>(batch.instances.size());
+			cullBatch.lodCount = mesh.lodCount;
+			for (uint32_t lod = 0; lod < mesh.lodCount; lod++)
+			{
+				cullBatch.lodErrors[lod] = mesh.lods[lod].error;
+				cullBatch.lodFirstIndices[lod] = mesh.lods[lod].firstIndex;
+				cullBatch.lodIndexCounts[lod] = mesh.lods[lod].indexCount;
+			}
+			cullBatch.vertexOffset = mesh.vertexOffset;
+			cullBatch.indexGroup = mesh.indexType == VK_INDEX_TYPE_UINT16 ? 0 : 1;
+
+			// A group's cluster draws go out in one indirect call, which maxDrawCount limits too
+			uint64_t batchClusterDraws = uint64_t(cullBatch.instanceCount) * mesh.clusterCount;
+			uint64_t groupClusterDraws = clusterGroupDrawCounts[cullBatch.indexGroup] + batchClusterDraws;
+			if (drawsClusters() && mesh.clusterCount >= MIN_CLUSTER_COUNT && clusterDraws + batchClusterDraws <= MAX_CLUSTER_DRAWS && groupClusterDraws <= support.maxDrawCount)
+			{
+				cullBatch.firstCluster = mesh.firstCluster;
+				cullBatch.clusterCount = mesh.clusterCount;
+				// Numbered within the group like drawSlot
+				cullBatch.clusterDrawSlot = clusterGroupDrawCounts[cullBatch.indexGroup];
+				clusterDraws += static_cast<uint32_t>(batchClusterDraws);
+				clusterGroupDrawCounts[cullBatch.indexGroup] += static_cast<uint32_t>(batchClusterDraws);
+			}
+		}
+
+		// Numbered within the group for now, offset below once all group sizes are known
+		cullBatch.drawSlot = groupSlotCounts[cullBatch.indexGroup];
+		groupSlotCounts[cullBatch.indexGroup] += cullBatch.lodCount;
+	}
+
+	uint32_t firstSlot = 0;
+	uint32_t firstClusterDraw = 0;
+	for (uint32_t group = 0; group < INDEX_GROUP_COUNT; group++)
+	{
+		groupFirstSlots[group] = firstSlot;
+		firstSlot += groupSlotCounts[group];
+		clusterGroupFirstDraws[group] = firstClusterDraw;
+		firstClusterDraw += clusterGroupDrawCounts[group];
+	}
+
+	for (CullBatch& cullBatch : out)
+	{
+		cullBatch.groupFirstSlot = groupFirstSlots[cullBatch.indexGroup];
+		cullBatch.drawSlot += cullBatch.groupFirstSlot;
+		cullBatch.clusterDrawFirst = clusterGroupFirstDraws[cullBatch.indexGroup];
+		cullBatch.clusterDrawSlot += cullBatch.clusterDrawFirst;
+
+		if (cullBatch.clusterCount > 0 && cullBatch.instanceCount > 0)
+		{
+			clusterRanges.push_back({ cullBatch.drawSlot, cullBatch.clusterDrawSlot, cullBatch.clusterCount, cullBatch.instanceCount, cullBatch.lodFirstVisible[0] });
+		}
+	}
+}
+
+void VulkanCuller::cullGpu(VkCommandBuffer commandBuffer, FrameResources& frame, uint64_t frameNumber, const std::vector<CullBatch>& batches, const VulkanInstanceBuffer& instances, const VulkanMeshArena& meshes, const glm::vec4 planes[6], const glm::vec4& lodCamera)
+{
+	uint32_t batchCount = static_cast<uint32_t>(batches.size());
+
+	if (batchCount > batchCapacity)
+	{
+		batchCapacity = batchCapacity > 0 ? batchCapacity : 16;
+		while (batchCapacity < batchCount)
+		{
+			batchCapacity *= 2;
+		}
+	}
+	uint32_t instanceCapacity = std::max(instances.getCapacity(), 1u);
+	uint32_t slotCapacity = batchCapacity * Model::MAX_LOD_COUNT;
+	uint32_t clusterDrawCount = clusterGroupFirstDraws[INDEX_GROUP_COUNT - 1] + clusterGroupDrawCounts[INDEX_GROUP_COUNT - 1];
+	uint32_t clusterDrawCapacity = 16;
+	while (clusterDrawCapacity < clusterDrawCount)
+	{
+		clusterDrawCapacity *= 2;
+	}
+
+	// The visible stream mirrors the region layout of the instance buffer once per level
+	bool outputsChanged = reserve(visibleBuffer, VkDeviceSize(instanceCapacity) * Model::MAX_LOD_COUNT * sizeof(InstanceData), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frameNumber);
+	outputsChanged |= reserve(drawBuffer, getCountersOffset(slotCapacity) + slotCapacity * sizeof(uint32_t), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frameNumber);
+	bool lodsReset = reserve(lodBuffer, instanceCapacity * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frameNumber);
+	outputsChanged |= lodsReset;
+	// Every instance picks LOD 0 at most once, so the instance capacity bounds the work items
+	outputsChanged |= reserve(clusterWorkBuffer, (VkDeviceSize(instanceCapacity) + 1) * 4 * sizeof(uint32_t), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frameNumber);
+	outputsChanged |= reserve(clusterDrawBuffer, DRAWS_OFFSET + VkDeviceSize(clusterDrawCapacity) * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frameNumber);
+	if (outputsChanged)
+	{
+		outputGeneration++;
+	}
+
+	if (reserve(frame.batches, batchCapacity * sizeof(CullBatch), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frameNumber))
+	{
+		frame.batchesChanged = true;
+	}
+	memcpy(frame.batches.memory.mappedData, batches.data(), batches.size() * sizeof(CullBatch));
+
+	updateDescriptorSet(frame, instances, meshes);
+
+	// Earlier frames may still be reading the outputs as draws and vertex input, and the levels
+	// they wrote have to be visible to this pass
+	VkMemoryBarrier previousBarrier = {};
+	previousBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	previousBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	previousBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0,
+		1, &previousBarrier,
+		0, nullptr,
+		0, nullptr
+	);
+
+	// Draw count and visible counters start at zero
+	vkCmdFillBuffer(commandBuffer, drawBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+	// So are the cluster work and draw counts, both in front of their items
+	vkCmdFillBuffer(commandBuffer, clusterWorkBuffer.buffer, 0, 4 * sizeof(uint32_t), 0);
+	// Fixed cluster slots of instances that are hidden or at a coarser level get no work item
+	VkDeviceSize clusterClearSize = compact() ? DRAWS_OFFSET : DRAWS_OFFSET + VkDeviceSize(clusterDrawCount) * sizeof(VkDrawIndexedIndirectCommand);
+	vkCmdFillBuffer(commandBuffer, clusterDrawBuffer.buffer, 0, clusterClearSize, 0);
+	if (lodsReset)
+	{
+		// Every instance starts at LOD 0
+		vkCmdFillBuffer(commandBuffer, lodBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+	}
+
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0,
+		1, &barrier,
+		0, nullptr,
+		0, nullptr
+	);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+
+	CullConstants constants = {};
+	std::copy(planes, planes + 6, constants.planes);
+	constants.lodCamera = lodCamera;
+	constants.lodHysteresis = LOD_HYSTERESIS;
+	constants.batchCount = batchCount;
+	constants.flags = (compact() ? FLAG_COMPACT : 0) | (support.firstInstance ? 0 : FLAG_ZERO_FIRST_INSTANCE);
+
+	uint32_t maxInstances = 0;
+	for (const CullBatch& batch : batches)
+	{
+		maxInstances = std::max(maxInstances, batch.instanceCount);
+	}
+
+	// Pass 0: one invocation per instance, workgroup y is the batch
+	if (maxInstances > 0)
+	{
+		constants.pass = 0;
+		vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+		vkCmdDispatch(commandBuffer, (maxInstances + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, batchCount, 1);
+
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0,
+			1, &barrier,
+			0, nullptr,
+			0, nullptr
+		);
+	}
+
+	// Pass 1: one invocation per batch turns the visible counts into draw commands, and the
+	// cluster work count into the dispatch of pass 2
+	constants.pass = 1;
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+	vkCmdDispatch(commandBuffer, (batchCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+
+	// Pass 2: one workgroup per clustered instance
+	if (clusterDrawCount > 0)
+	{
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0,
+			1, &barrier,
+			0, nullptr,
+			0, nullptr
+		);
+
+		constants.pass = 2;
+		vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+		vkCmdDispatchIndirect(commandBuffer, clusterWorkBuffer.buffer, 0);
+	}
+
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+		0,
+		1, &barrier,
+		0, nullptr,
+		0, nullptr
+	);
+
+	drawVisible = visibleBuffer.buffer;
+	drawCommands = drawBuffer.buffer;
+	drawClusterCommands = clusterDrawCount > 0 ? clusterDrawBuffer.buffer : VK_NULL_HANDLE;
+}
+
+void VulkanCuller::cullCpu(FrameResources& frame, uint64_t frameNumber, const Scene& scene, const std::vector<CullBatch>& batches, const VulkanInstanceBuffer& instances, const VulkanMeshArena& meshes, const glm::vec4 planes[6], const glm::vec4& lodCamera)
+{
+	uint32_t batchCount = static_cast<uint32_t>(batches.size());
+	uint32_t instanceCapacity = std::max(instances.getCapacity(), 1u);
+	uint32_t clusterDrawCount = clusterGroupFirstDraws[INDEX_GROUP_COUNT - 1] + clusterGroupDrawCounts[INDEX_GROUP_COUNT - 1];
+
+	// Per frame in flight, so nothing has to wait for the GPU before writing
+	reserve(frame.cpuVisible, VkDeviceSize(instanceCapacity) * Model::MAX_LOD_COUNT * sizeof(InstanceData), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frameNumber);
+	reserve(frame.cpuDraws, DRAWS_OFFSET + drawSlots * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frameNumber);
+	if (clusterDrawCount > 0)
+	{
+		reserve(frame.cpuClusterDraws, DRAWS_OFFSET + clusterDrawCount * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, frameNumber);
+	}
+
+	if (cpuLods.size() < instanceCapacity)
+	{
+		cpuLods.resize(instanceCapacity, 0);
+	}
+
+	InstanceData* visible = static_cast<InstanceData*>(frame.cpuVisible.memory.mappedData);
+	char* drawData = static_cast<char*>(frame.cpuDraws.memory.mappedData);
+	VkDrawIndexedIndirectCommand* draws = reinterpret_cast<VkDrawIndexedIndirectCommand*>(drawData + DRAWS_OFFSET);
+
+	char* clusterDrawData = static_cast<char*>(frame.cpuClusterDraws.memory.mappedData);
+	VkDrawIndexedIndirectCommand* clusterDraws = clusterDrawCount > 0 ? reinterpret_cast<VkDrawIndexedIndirectCommand*>(clusterDrawData + DRAWS_OFFSET) : nullptr;
+	if (clusterDrawCount > 0 && !compact())
+	{
+		memset(clusterDraws, 0, clusterDrawCount * sizeof(VkDrawIndexedIndirectCommand));
+	}
+	const std::vector<ClusterData>& clusters = meshes.getClusters();
+	glm::vec3 camera = glm::vec3(lodCamera);
+
+	uint32_t drawCounts[INDEX_GROUP_COUNT] = {};
+	uint32_t clusterDrawCounts[INDEX_GROUP_COUNT] = {};
+	for (uint32_t i = 0; i < batchCount; i++)
+	{
+		const CullBatch& batch = batches[i];
+		const std::vector<InstanceData>& source = scene.batches[i].instances;
+
+		uint32_t counts[Model::MAX_LOD_COUNT] = {};
+		for (uint32_t j = 0; j < batch.instanceCount; j++)
+		{
+			glm::mat4 world = batch.transform * source[j].transform;
+			glm::vec3 center = glm::vec3(world * glm::vec4(glm::vec3(batch.boundingSphere), 1.0f));
+			float scale = std::max(glm::length(glm::vec3(world[0])), std::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+			float radius = batch.boundingSphere.w * scale;
+
+			if (isSphereVisible(planes, center, radius))
+			{
+				uint8_t& lod = cpuLods[batch.firstInstance + j];
+				lod = static_cast<uint8_t>(selectLod(batch, center, radius, scale, lod, lodCamera, LOD_HYSTERESIS));
+
+				// Clustered instances keep their own slot, their draws do not depend on the packing
+				bool clustered = lod == 0 && batch.clusterCount > 0;
+				uint32_t visibleSlot = batch.lodFirstVisible[lod] + (clustered ? j : counts[lod]++);
+				InstanceData& out = visible[visibleSlot];
+				out.transform = applyDequantization(world, batch.positionScale, batch.positionOffset);
+				out.tint = source[j].tint;
+				out.texCoordTransform = batch.texCoordTransform;
+				out.material = source[j].material;
+
+				if (!clustered)
+				{
+					continue;
+				}
+
+				bool cones = keepsCones(world);
+				for (uint32_t c = 0; c < batch.clusterCount; c++)
+				{
+					const ClusterData& cluster = clusters[batch.firstCluster + c];
+					bool drawn = isClusterVisible(planes, world, scale, cones, cluster, camera);
+
+					uint32_t slot = batch.clusterDrawSlot + j * batch.clusterCount + c;
+					if (compact())
+					{
+						if (!drawn)
+						{
+							continue;
+						}
+						slot = batch.clusterDrawFirst + clusterDrawCounts[batch.indexGroup]++;
+					}
+
+					VkDrawIndexedIndirectCommand& command = clusterDraws[slot];
+					command.indexCount = cluster.indexCount;
+					command.instanceCount = drawn ? 1 : 0;
+					command.firstIndex = cluster.firstIndex;
+					command.vertexOffset = batch.vertexOffset;
+					command.firstInstance = support.firstInstance ? visibleSlot : 0;
+				}
+			}
+		}
+
+		for (uint32_t lod = 0; lod < batch.lodCount; lod++)
+		{
+			// Drawn cluster by cluster instead
+			if (lod == 0 && batch.clusterCount > 0)
+			{
+				continue;
+			}
+
+			if (compact() && counts[lod] == 0)
+			{
+				continue;
+			}
+
+			uint32_t slot = compact() ? batch.groupFirstSlot + drawCounts[batch.indexGroup]++ : batch.drawSlot + lod;
+
+			VkDrawIndexedIndirectCommand command = {};
+			command.indexCount = batch.lodIndexCounts[lod];
+			command.instanceCount = counts[lod];
+			command.firstIndex = batch.lodFirstIndices[lod];
+			command.vertexOffset = batch.vertexOffset;
+			command.firstInstance = support.firstInstance ? batch.lodFirstVisible[lod] : 0;
+			draws[slot] = command;
+		}
+	}
+
+	// Only read with compaction
+	memcpy(drawData, drawCounts, sizeof(drawCounts));
+	if (clusterDrawCount > 0)
+	{
+		memcpy(clusterDrawData, clusterDrawCounts, sizeof(clusterDrawCounts));
+	}
+
+	drawVisible = frame.cpuVisible.buffer;
+	drawCommands = frame.cpuDraws.buffer;
+	drawClusterCommands = clusterDrawCount > 0 ? frame.cpuClusterDraws.buffer : VK_NULL_HANDLE;
+}
+
+void VulkanCuller::createPipeline(VulkanPipelineCache& pipelineCache, VkShaderModule cullShader)
+{
+	std::array<VkDescriptorSetLayoutBinding, 9> bindings = {};
+	for (uint32_t i = 0; i < bindings.size(); i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create culling descriptor set layout!");
+	}
+
+	VkDescriptorPoolSize poolSize = {};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = static_cast<uint32_t>(bindings.size() * frames.size());
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	poolInfo.maxSets = static_cast<uint32_t>(frames.size());
+
+	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create culling descriptor pool!");
+	}
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(CullConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create culling pipeline layout!");
+	}
+
+	VkPipelineShaderStageCreateInfo stageInfo = {};
+	stageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	stageInfo.module = cullShader;
+	stageInfo.pName = "main";
+
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage = stageInfo;
+	pipelineInfo.layout = pipelineLayout;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineInfo.basePipelineIndex = -1;
+
+	pipeline = pipelineCache.createComputePipeline(pipelineInfo);
+}
+
+void VulkanCuller::updateDescriptorSet(FrameResources& frame, const VulkanInstanceBuffer& instances, const VulkanMeshArena& meshes)
+{
+	if (frame.instanceGeneration == instances.getGeneration() && frame.outputGeneration == outputGeneration && frame.clusters == meshes.getClusterBuffer() && !frame.batchesChanged)
+	{
+		return;
+	}
+
+	// The fence of this frame has been waited on, so its set is not in use
+	uint32_t slotCapacity = batchCapacity * Model::MAX_LOD_COUNT;
+	VkDeviceSize countersOffset = getCountersOffset(slotCapacity);
+
+	std::array<VkDescriptorBufferInfo, 9> bufferInfos = {};
+	bufferInfos[0] = { instances.getBuffer(), 0, VK_WHOLE_SIZE };
+	bufferInfos[1] = { frame.batches.buffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[2] = { visibleBuffer.buffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[3] = { drawBuffer.buffer, 0, countersOffset };
+	bufferInfos[4] = { drawBuffer.buffer, countersOffset, slotCapacity * sizeof(uint32_t) };
+	bufferInfos[5] = { lodBuffer.buffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[6] = { meshes.getClusterBuffer(), 0, VK_WHOLE_SIZE };
+	bufferInfos[7] = { clusterWorkBuffer.buffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[8] = { clusterDrawBuffer.buffer, 0, VK_WHOLE_SIZE };
+
+	std::array<VkWriteDescriptorSet, 9> descriptorWrites = {};
+	for (uint32_t i = 0; i < descriptorWrites.size(); i++)
+	{
+		descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[i].dstSet = frame.descriptorSet;
+		descriptorWrites[i].dstBinding = i;
+		descriptorWrites[i].dstArrayElement = 0;
+		descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[i].descriptorCount = 1;
+		descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+	}
+
+	vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+	frame.instanceGeneration = instances.getGeneration();
+	frame.outputGeneration = outputGeneration;
+	frame.clusters = meshes.getClusterBuffer();
+	frame.batchesChanged = false;
+}
+
+bool VulkanCuller::reserve(Buffer& buffer, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, uint64_t frameNumber)
+{
+	if (buffer.buffer != VK_NULL_HANDLE && buffer.size >= size)
+	{
+		return false;
+	}
+
+	if (buffer.buffer != VK_NULL_HANDLE)
+	{
+		VkDevice device = this->device;
+		VulkanAllocator& allocator = this->allocator;
+		Buffer old = buffer;
+		deletionQueue.push(frameNumber, [device, &allocator, old]() mutable
+		{
+			vkDestroyBuffer(device, old.buffer, nullptr);
+			allocator.free(old.memory);
+		});
+	}
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer.buffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create culling buffer!");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, buffer.buffer, &memRequirements);
+
+	buffer.memory = allocator.allocate(memRequirements, properties, AllocationKind::Linear);
+	buffer.size = size;
+
+	vkBindBufferMemory(device, buffer.buffer, buffer.memory.memory, buffer.memory.offset);
+
+	return true;
+}
+
+void VulkanCuller::destroy(Buffer& buffer)
+{
+	if (buffer.buffer != VK_NULL_HANDLE)
+	{
+		vkDestroyBuffer(device, buffer.buffer, nullptr);
+		allocator.free(buffer.memory);
+		buffer = Buffer();
+	}
+}
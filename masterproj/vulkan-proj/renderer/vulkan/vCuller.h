@@ -0,0 +1,247 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "vAllocator.h"
+#include "vDeletionQueue.h"
+#include "vInstanceBuffer.h"
+#include "vMeshArena.h"
+#include "vPipelineCache.h"
+#include "../../scene/Scene.h"
+
+enum class CullingMode
+{
+	// Compute pass on the graphics queue
+	Gpu,
+	// Same output written from the CPU into host visible buffers
+	Cpu
+};
+
+// What the device allows for indirect draws, decides how draws are emitted
+struct IndirectDrawSupport
+{
+	// More than one draw per vkCmdDrawIndexedIndirect
+	bool multiDraw = false;
+	// firstInstance other than 0 in indirect commands
+	bool firstInstance = false;
+	// maxDrawIndirectCount, 1 without multiDraw
+	uint32_t maxDrawCount = 1;
+	// VK_KHR_draw_indirect_count, draws are compacted and their count read from the buffer
+	PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCount = nullptr;
+};
+
+// Per-batch input of the culling pass, has to match CullBatch in cull.comp
+struct CullBatch
+{
+	glm::mat4 transform;
+	glm::vec4 boundingSphere;
+	// Mesh dequantization, applied to the positions before the instance transform
+	glm::vec4 positionScale;
+	glm::vec4 positionOffset;
+	// Texture coordinate dequantization, xy scale and zw offset, passed on to the visible instances
+	glm::vec4 texCoordTransform;
+	// Model space error of each level of detail
+	glm::vec4 lodErrors;
+	uint32_t lodFirstIndices[Model::MAX_LOD_COUNT];
+	uint32_t lodIndexCounts[Model::MAX_LOD_COUNT];
+	// Where the visible instances of each level go in the visible instance buffer
+	uint32_t lodFirstVisible[Model::MAX_LOD_COUNT];
+	uint32_t firstInstance;
+	uint32_t instanceCount;
+	uint32_t lodCount;
+	int32_t vertexOffset;
+	// First of the lodCount slots of the batch without compaction
+	uint32_t drawSlot;
+	// With compaction the draws go to the next free slots of their index group
+	uint32_t indexGroup;
+	uint32_t groupFirstSlot;
+	// Clusters of LOD 0 in the mesh arena, none when LOD 0 is drawn whole
+	uint32_t firstCluster;
+	uint32_t clusterCount;
+	// Cluster draws are compacted per index group too, this is where the batch's group starts
+	uint32_t clusterDrawFirst;
+	// First of the instanceCount * clusterCount cluster slots of the batch without compaction
+	uint32_t clusterDrawSlot;
+	uint32_t pad;
+};
+
+// Has to match CullConstants in cull.comp
+struct CullConstants
+{
+	glm::vec4 planes[6];
+	// xyz camera position, w pixels per unit at distance 1 over the allowed pixel error
+	glm::vec4 lodCamera;
+	uint32_t batchCount;
+	uint32_t pass;
+	uint32_t flags;
+	float lodHysteresis;
+};
+
+/*
+Frustum culling and LOD selection of every instance in the scene, producing the indirect draws of
+the frame. Each instance's bounding sphere (the mesh bounds moved by batch and instance transform)
+is tested against the camera frustum. Survivors pick the coarsest level of detail whose error
+projects to at most LOD_PIXEL_ERROR pixels, and are packed to the front of that level's region in
+a visible instance buffer, which replaces the instance buffer as the per-instance vertex stream.
+One VkDrawIndexedIndirectCommand per batch and level is written with the surviving count. With
+VK_KHR_draw_indirect_count empty draws are dropped and the draw count is written too; otherwise
+every level keeps its slot and draws zero instances when nothing picked it.
+
+The level each instance used last frame is kept per instance slot; moving to a coarser level needs
+the error to fall LOD_HYSTERESIS below the limit, moving back needs it to rise as far above, so
+objects near a threshold do not flicker between two levels.
+
+Draw slots are grouped by the index type of the mesh, 16 bit meshes first, because each group
+needs its own index buffer binding. Compacted draws have a count per group.
+
+Instances that pick LOD 0 of a mesh with enough clusters are not drawn as one instanced draw. They
+keep a visible slot of their own instead of a packed one, and a third pass, dispatched indirectly
+with one workgroup per such instance, tests each cluster's bounding sphere against the frustum and
+its normal cone against the camera. With compaction the surviving clusters are appended as
+single-instance draws to a separate command buffer. Without it every cluster of every instance has
+a fixed slot there, the whole buffer starts zeroed and hidden clusters draw zero instances, so the
+clusters go out as one vkCmdDrawIndexedIndirect per group. Without firstInstance that becomes one
+per instance, with the instance stream bound at the instance's slot. Devices without multiDraw
+would need a command per cluster and draw LOD 0 whole.
+
+The GPU path runs cull.comp between the instance upload and the render pass; the outputs are
+device local and shared by all frames, ordered by barriers. The CPU path writes the same layout
+into host visible buffers per frame in flight, so draw() does not care which one ran.
+*/
+class VulkanCuller
+{
+public:
+	VulkanCuller(VkPhysicalDevice physicalDevice, VkDevice device, VulkanAllocator& allocator, VulkanDeletionQueue& deletionQueue, VulkanPipelineCache& pipelineCache, uint32_t framesInFlight, VkShaderModule cullShader, const IndirectDrawSupport& support);
+	~VulkanCuller();
+
+	// Outside of a render pass, after the instance buffer update of the frame
+	void cull(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint64_t frameNumber, const Scene& scene, const VulkanInstanceBuffer& instances, const VulkanMeshArena& meshes, const glm::mat4& view, const glm::mat4& projection, float viewportHeight, CullingMode mode);
+
+	/*
+	Inside the render pass, with the pipeline and the mesh arena's vertices bound, the index
+	buffers are bound here. Draws slots [firstSlot, firstSlot + slotCount) of this frame's
+	commands; the ranges can be recorded into different command buffers at the same time unless
+	the draws are compacted.
+	*/
+	void draw(VkCommandBuffer commandBuffer, const VulkanMeshArena& meshes, uint32_t firstSlot, uint32_t slotCount) const;
+
+	uint32_t getDrawSlotCount() const { return drawVisible != VK_NULL_HANDLE ? drawSlots : 0; }
+	// Compacted draws only know their count on the GPU and have to be drawn as one range
+	bool canSplitDraws() const { return !compact(); }
+
+	// Gribb/Hartmann plane extraction for a [0, 1] depth range, normals point inwards
+	static void extractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]);
+
+private:
+	struct Buffer
+	{
+		VkBuffer buffer = VK_NULL_HANDLE;
+		MemoryAllocation memory;
+		VkDeviceSize size = 0;
+	};
+
+	struct FrameResources
+	{
+		Buffer batches;
+		Buffer cpuVisible;
+		Buffer cpuDraws;
+		Buffer cpuClusterDraws;
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		// What the descriptor set currently points at
+		uint64_t instanceGeneration = UINT64_MAX;
+		uint64_t outputGeneration = UINT64_MAX;
+		VkBuffer clusters = VK_NULL_HANDLE;
+		bool batchesChanged = true;
+	};
+
+	// A clustered batch's fixed cluster slots, for drawing them without compaction
+	struct ClusterRange
+	{
+		uint32_t drawSlot;
+		uint32_t firstDraw;
+		uint32_t clusterCount;
+		uint32_t instanceCount;
+		// LOD 0 region of the visible stream, clustered instances are not packed
+		uint32_t firstVisible;
+	};
+
+	static const uint32_t WORKGROUP_SIZE = 64;
+	static const uint32_t FLAG_COMPACT = 1;
+	static const uint32_t FLAG_ZERO_FIRST_INSTANCE = 2;
+	// One draw count per index group, padded to 16 bytes, the commands follow
+	static const VkDeviceSize DRAWS_OFFSET = 16;
+	static const uint32_t INDEX_GROUP_COUNT = 2;
+	static const VkIndexType INDEX_GROUP_TYPES[INDEX_GROUP_COUNT];
+	// Largest simplification error allowed on screen, in pixels
+	static constexpr float LOD_PIXEL_ERROR = 1.0f;
+	// Fraction of the pixel error around the threshold in which an instance keeps its level
+	static constexpr float LOD_HYSTERESIS = 0.25f;
+	// Fewer clusters than this are not worth giving up the instanced draw for
+	static const uint32_t MIN_CLUSTER_COUNT = 4;
+	// Upper bound of instanceCount * clusterCount over all clustered batches, the rest draw LOD 0 whole
+	static const uint32_t MAX_CLUSTER_DRAWS = 1 << 20;
+	// maxComputeWorkGroupCount guaranteed by the spec, the cluster pass loops over the rest
+	static const uint32_t MAX_CLUSTER_WORKGROUPS = 65535;
+
+	VkDevice device;
+	VulkanAllocator& allocator;
+	VulkanDeletionQueue& deletionQueue;
+	IndirectDrawSupport support;
+	VkDeviceSize storageAlignment;
+
+	VkDescriptorSetLayout descriptorSetLayout;
+	VkDescriptorPool descriptorPool;
+	VkPipelineLayout pipelineLayout;
+	VkPipeline pipeline;
+
+	std::vector<FrameResources> frames;
+
+	// GPU path outputs
+	Buffer visibleBuffer;
+	Buffer drawBuffer;
+	// Level of detail per instance slot from the last frame
+	Buffer lodBuffer;
+	// Dispatch arguments of the cluster pass and one work item per clustered instance
+	Buffer clusterWorkBuffer;
+	// Laid out like drawBuffer
+	Buffer clusterDrawBuffer;
+	uint32_t batchCapacity = 0;
+	uint64_t outputGeneration = 0;
+
+	// Set by cull() for draw()
+	VkBuffer drawVisible = VK_NULL_HANDLE;
+	VkBuffer drawCommands = VK_NULL_HANDLE;
+	uint32_t drawSlots = 0;
+	uint32_t groupFirstSlots[INDEX_GROUP_COUNT] = {};
+	uint32_t groupSlotCounts[INDEX_GROUP_COUNT] = {};
+	VkBuffer drawClusterCommands = VK_NULL_HANDLE;
+	// Cluster draws of each group, with compaction the counts are upper bounds
+	uint32_t clusterGroupFirstDraws[INDEX_GROUP_COUNT] = {};
+	uint32_t clusterGroupDrawCounts[INDEX_GROUP_COUNT] = {};
+	// Indexed by slot
+	std::vector<uint32_t> drawFirstInstances;
+	std::vector<ClusterRange> clusterRanges;
+	// CPU path counterpart of lodBuffer
+	std::vector<uint8_t> cpuLods;
+
+	bool compact() const { return support.drawIndexedIndirectCount != nullptr && support.firstInstance; }
+	// Without compaction each cluster needs a slot, which only multiDraw submits in bulk
+	bool drawsClusters() const { return compact() || support.multiDraw; }
+	VkDeviceSize getCountersOffset(uint32_t slots) const;
+
+	// Also assigns the draw slots and index groups
+	void writeBatches(const Scene& scene, const VulkanInstanceBuffer& instances, const VulkanMeshArena& meshes, std::vector<CullBatch>& out);
+	void cullGpu(VkCommandBuffer commandBuffer, FrameResources& frame, uint64_t frameNumber, const std::vector<CullBatch>& batches, const VulkanInstanceBuffer& instances, const VulkanMeshArena& meshes, const glm::vec4 planes[6], const glm::vec4& lodCamera);
+	void cullCpu(FrameResources& frame, uint64_t frameNumber, const Scene& scene, const std::vector<CullBatch>& batches, const VulkanInstanceBuffer& instances, const VulkanMeshArena& meshes, const glm::vec4 planes[6], const glm::vec4& lodCamera);
+
+	void createPipeline(VulkanPipelineCache& pipelineCache, VkShaderModule cullShader);
+	void updateDescriptorSet(FrameResources& frame, const VulkanInstanceBuffer& instances, const VulkanMeshArena& meshes);
+	// Grows buffer to at least size, the old one is released through the deletion queue
+	bool reserve(Buffer& buffer, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, uint64_t frameNumber);
+	void destroy(Buffer& buffer);
+};
@@ -0,0 +1,38 @@
+#include "vDeletionQueue.h"
+
+VulkanDeletionQueue::VulkanDeletionQueue(uint32_t framesInFlight)
+	: framesInFlight(framesInFlight)
+{
+}
+
+VulkanDeletionQueue::~VulkanDeletionQueue()
+{
+	flush();
+}
+
+void VulkanDeletionQueue::push(uint64_t frameNumber, std::function<void()> destroy)
+{
+	pending.push_back({ frameNumber, std::move(destroy) });
+}
+
+void VulkanDeletionQueue::collect(uint64_t frameNumber)
+{
+	size_t done = 0;
+	while (done < pending.size() && pending[done].frameNumber + framesInFlight <= frameNumber)
+	{
+		pending[done].destroy();
+		done++;
+	}
+
+	pending.erase(pending.begin(), pending.begin() + done);
+}
+
+void VulkanDeletionQueue::flush()
+{
+	for (PendingDeletion& deletion : pending)
+	{
+		deletion.destroy();
+	}
+
+	pending.clear();
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/*
+Destroys resources once no frame in flight can still reference them.
+Whatever replaces a buffer while frames are queued pushes the destruction of the old one here,
+tagged with the frame being recorded; collect() is called after the in-flight fence of the
+current frame has been waited on and runs everything older than the frames still in flight.
+*/
+class VulkanDeletionQueue
+{
+public:
+	explicit VulkanDeletionQueue(uint32_t framesInFlight);
+	// Runs everything still queued, the device has to be idle
+	~VulkanDeletionQueue();
+
+	void push(uint64_t frameNumber, std::function<void()> destroy);
+	void collect(uint64_t frameNumber);
+	void flush();
+
+private:
+	struct PendingDeletion
+	{
+		uint64_t frameNumber;
+		std::function<void()> destroy;
+	};
+
+	uint32_t framesInFlight;
+	// Pushed in frame order, so the oldest entries are at the front
+	std::vector<PendingDeletion> pending;
+};
@@ -0,0 +1,351 @@
+#include "vDownsampler.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+VulkanDownsampler::VulkanDownsampler(VkPhysicalDevice physicalDevice, VkDevice device, VulkanAllocator& allocator, VulkanUploader& uploader, VulkanPipelineCache& pipelineCache, VkShaderModule downsampleShader)
+	: device(device), allocator(allocator), uploader(uploader)
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, FORMAT, &formatProperties);
+
+	// Level 0 and every generated level are bound at once
+	supported = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT) != 0
+		&& properties.limits.maxPerStageDescriptorStorageImages >= MAX_GENERATED_LEVELS + 1;
+
+	createPipeline(pipelineCache, downsampleShader);
+	descriptorPools.push_back(createDescriptorPool());
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = sizeof(uint32_t);
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &counterBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create downsample counter buffer!");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, counterBuffer, &memRequirements);
+
+	counterMemory = allocator.allocate(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, AllocationKind::Linear);
+	vkBindBufferMemory(device, counterBuffer, counterMemory.memory, counterMemory.offset);
+}
+
+VulkanDownsampler::~VulkanDownsampler()
+{
+	vkDestroyBuffer(device, counterBuffer, nullptr);
+	allocator.free(counterMemory);
+
+	// Sets still queued for deletion go with their pool, the queue must have been flushed before
+	for (VkDescriptorPool pool : descriptorPools)
+	{
+		vkDestroyDescriptorPool(device, pool, nullptr);
+	}
+
+	vkDestroyPipeline(device, pipeline, nullptr);
+	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+}
+
+bool VulkanDownsampler::canGenerate(VkFormat format, uint32_t width, uint32_t height) const
+{
+	return supported && format == FORMAT && std::max(width, height) <= MAX_SIZE;
+}
+
+void VulkanDownsampler::generate(VkCommandBuffer commandBuffer, VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels, bool srgb,
+	VkImageLayout oldLayout, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess)
+{
+	if (!canGenerate(FORMAT, width, height) || mipLevels > MAX_GENERATED_LEVELS + 1)
+	{
+		throw std::runtime_error("failed to generate mipmaps in a compute pass!");
+	}
+
+	if (mipLevels <= 1)
+	{
+		return;
+	}
+
+	// One view per level, slots past the end of the chain repeat the last one
+	std::vector<VkImageView> views(mipLevels);
+	for (uint32_t level = 0; level < mipLevels; level++)
+	{
+		views[level] = createLevelView(image, level);
+	}
+
+	VkDescriptorPool pool;
+	VkDescriptorSet descriptorSet = allocateDescriptorSet(pool);
+
+	std::array<VkDescriptorImageInfo, MAX_GENERATED_LEVELS + 1> imageInfos = {};
+	for (uint32_t i = 0; i < imageInfos.size(); i++)
+	{
+		imageInfos[i].imageView = views[std::min(i, mipLevels - 1)];
+		imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+	}
+
+	VkDescriptorBufferInfo counterInfo = { counterBuffer, 0, sizeof(uint32_t) };
+
+	std::array<VkWriteDescriptorSet, 3> descriptorWrites = {};
+	for (VkWriteDescriptorSet& write : descriptorWrites)
+	{
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = descriptorSet;
+		write.dstArrayElement = 0;
+	}
+
+	descriptorWrites[0].dstBinding = 0;
+	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	descriptorWrites[0].descriptorCount = 1;
+	descriptorWrites[0].pImageInfo = &imageInfos[0];
+
+	descriptorWrites[1].dstBinding = 1;
+	descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	descriptorWrites[1].descriptorCount = MAX_GENERATED_LEVELS;
+	descriptorWrites[1].pImageInfo = &imageInfos[1];
+
+	descriptorWrites[2].dstBinding = 2;
+	descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	descriptorWrites[2].descriptorCount = 1;
+	descriptorWrites[2].pBufferInfo = &counterInfo;
+
+	vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+	// The previous dispatch has to be done with the counter before it is cleared
+	VkBufferMemoryBarrier counterBarrier = {};
+	counterBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	counterBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	counterBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	counterBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	counterBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	counterBarrier.buffer = counterBuffer;
+	counterBarrier.offset = 0;
+	counterBarrier.size = VK_WHOLE_SIZE;
+
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+		0, nullptr,
+		1, &counterBarrier,
+		0, nullptr);
+
+	vkCmdFillBuffer(commandBuffer, counterBuffer, 0, sizeof(uint32_t), 0);
+
+	counterBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	counterBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	// Level 0 is read where it is, the rest of the chain is about to be overwritten
+	std::array<VkImageMemoryBarrier, 2> imageBarriers = {};
+	for (VkImageMemoryBarrier& barrier : imageBarriers)
+	{
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+	}
+
+	imageBarriers[0].srcAccessMask = srcAccess;
+	imageBarriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	imageBarriers[0].oldLayout = oldLayout;
+	imageBarriers[0].subresourceRange.baseMipLevel = 0;
+	imageBarriers[0].subresourceRange.levelCount = 1;
+
+	imageBarriers[1].srcAccessMask = 0;
+	imageBarriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	imageBarriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageBarriers[1].subresourceRange.baseMipLevel = 1;
+	imageBarriers[1].subresourceRange.levelCount = mipLevels - 1;
+
+	vkCmdPipelineBarrier(commandBuffer,
+		srcStage | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+		0, nullptr,
+		1, &counterBarrier,
+		static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+
+	uint32_t groupsX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	uint32_t groupsY = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+	DownsampleConstants constants = {};
+	constants.width = static_cast<int32_t>(width);
+	constants.height = static_cast<int32_t>(height);
+	constants.levelCount = mipLevels - 1;
+	constants.groupCount = groupsX * groupsY;
+	constants.srgb = srgb ? 1 : 0;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+	vkCmdDispatch(commandBuffer, groupsX, groupsY, 1);
+
+	VkImageMemoryBarrier barrier = imageBarriers[0];
+	barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.subresourceRange.levelCount = mipLevels;
+
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+		0, nullptr,
+		0, nullptr,
+		1, &barrier);
+
+	VkDevice device = this->device;
+	uploader.releaseWithBatch([device, pool, descriptorSet, views]()
+	{
+		vkFreeDescriptorSets(device, pool, 1, &descriptorSet);
+		for (VkImageView view : views)
+		{
+			vkDestroyImageView(device, view, nullptr);
+		}
+	});
+}
+
+void VulkanDownsampler::createPipeline(VulkanPipelineCache& pipelineCache, VkShaderModule downsampleShader)
+{
+	std::array<VkDescriptorSetLayoutBinding, 3> bindings = {};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	bindings[1].descriptorCount = MAX_GENERATED_LEVELS;
+	bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	bindings[2].binding = 2;
+	bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[2].descriptorCount = 1;
+	bindings[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create downsample descriptor set layout!");
+	}
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(DownsampleConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create downsample pipeline layout!");
+	}
+
+	VkPipelineShaderStageCreateInfo stageInfo = {};
+	stageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	stageInfo.module = downsampleShader;
+	stageInfo.pName = "main";
+
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage = stageInfo;
+	pipelineInfo.layout = pipelineLayout;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineInfo.basePipelineIndex = -1;
+
+	pipeline = pipelineCache.createComputePipeline(pipelineInfo);
+}
+
+VkDescriptorPool VulkanDownsampler::createDescriptorPool()
+{
+	std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	poolSizes[0].descriptorCount = (MAX_GENERATED_LEVELS + 1) * SETS_PER_POOL;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[1].descriptorCount = SETS_PER_POOL;
+
+	// Sets live until the frames that may use them are done, so they are freed one by one
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = SETS_PER_POOL;
+
+	VkDescriptorPool pool;
+	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create downsample descriptor pool!");
+	}
+
+	return pool;
+}
+
+VkDescriptorSet VulkanDownsampler::allocateDescriptorSet(VkDescriptorPool& pool)
+{
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &descriptorSetLayout;
+
+	VkDescriptorSet descriptorSet;
+
+	// All sets have the same layout, so a pool with a free set never fails from fragmentation
+	for (VkDescriptorPool candidate : descriptorPools)
+	{
+		allocInfo.descriptorPool = candidate;
+		if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) == VK_SUCCESS)
+		{
+			pool = candidate;
+			return descriptorSet;
+		}
+	}
+
+	// More textures generated in the last frames in flight than the pools hold
+	descriptorPools.push_back(createDescriptorPool());
+
+	allocInfo.descriptorPool = descriptorPools.back();
+	if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate downsample descriptor set!");
+	}
+
+	pool = descriptorPools.back();
+	return descriptorSet;
+}
+
+VkImageView VulkanDownsampler::createLevelView(VkImage image, uint32_t level)
+{
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = FORMAT;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.baseMipLevel = level;
+	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = 1;
+
+	VkImageView view;
+	if (vkCreateImageView(device, &viewInfo, nullptr, &view) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create downsample image view!");
+	}
+
+	return view;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "vAllocator.h"
+#include "vPipelineCache.h"
+#include "vUploader.h"
+
+enum class MipmapMode
+{
+	// One compute dispatch for the whole chain
+	Compute,
+	// vkCmdBlitImage per level, each waiting on the one before, on an sRGB image so the blits average in linear light too
+	Blit
+};
+
+// Has to match Constants in downsample.comp
+struct DownsampleConstants
+{
+	int32_t width;
+	int32_t height;
+	uint32_t levelCount;
+	uint32_t groupCount;
+	uint32_t srgb;
+};
+
+/*
+Single pass mip chain generation for images made on the GPU or uploaded without their chain.
+
+downsample.comp runs one workgroup of 256 threads per 64x64 tile of level 0. A workgroup reads its
+tile once, writes the four texels of level 1 each thread covers, reduces them to one texel of level
+2 and goes down to level 6 through shared memory, a barrier per level instead of one per level over
+the whole image. Every workgroup then bumps a counter in a storage buffer; the one that brings it to
+the workgroup count knows level 6 is complete and reduces it down to level 12 alone. A texel is the
+box average of the 2x2 texels above it, so levels of odd size drop their last row or column.
+
+Only RGBA8 images up to MAX_SIZE are handled, anything else has to go through the blits. Storage
+images in this format cannot be sRGB, sRGB encoded texels are converted in the shader so they are
+averaged in linear light, which the blits on the UNORM images do not do.
+*/
+class VulkanDownsampler
+{
+public:
+	VulkanDownsampler(VkPhysicalDevice physicalDevice, VkDevice device, VulkanAllocator& allocator, VulkanUploader& uploader, VulkanPipelineCache& pipelineCache, VkShaderModule downsampleShader);
+	~VulkanDownsampler();
+
+	static const uint32_t MAX_GENERATED_LEVELS = 12;
+	// Level 6 has to fit into the tile of the last workgroup
+	static const uint32_t MAX_SIZE = 4096;
+	static const VkFormat FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+
+	// The image also needs VK_IMAGE_USAGE_STORAGE_BIT
+	bool canGenerate(VkFormat format, uint32_t width, uint32_t height) const;
+
+	/*
+	Fills levels 1 to mipLevels - 1 from level 0, which is in oldLayout and was last written in
+	srcStage with srcAccess. The other levels are discarded. Leaves the whole image in
+	SHADER_READ_ONLY layout for the fragment shader. commandBuffer is the graphics side of the
+	current uploader batch, the image views and the descriptor set used are released with it.
+	*/
+	void generate(VkCommandBuffer commandBuffer, VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels, bool srgb,
+		VkImageLayout oldLayout, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess);
+
+private:
+	static const uint32_t TILE_SIZE = 64;
+	// Descriptor sets per pool, another pool is added when they run out
+	static const uint32_t SETS_PER_POOL = 64;
+
+	VkDevice device;
+	VulkanAllocator& allocator;
+	VulkanUploader& uploader;
+	bool supported = false;
+
+	VkDescriptorSetLayout descriptorSetLayout;
+	VkPipelineLayout pipelineLayout;
+	VkPipeline pipeline;
+	std::vector<VkDescriptorPool> descriptorPools;
+
+	// Workgroups finished so far, cleared before every dispatch
+	VkBuffer counterBuffer;
+	MemoryAllocation counterMemory;
+
+	void createPipeline(VulkanPipelineCache& pipelineCache, VkShaderModule downsampleShader);
+	VkDescriptorPool createDescriptorPool();
+	VkDescriptorSet allocateDescriptorSet(VkDescriptorPool& pool);
+	VkImageView createLevelView(VkImage image, uint32_t level);
+};
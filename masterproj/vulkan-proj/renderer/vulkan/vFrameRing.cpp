@@ -0,0 +1,64 @@
+#include "vFrameRing.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+VulkanFrameRing::VulkanFrameRing(VkPhysicalDevice physicalDevice, VkDevice device, VulkanAllocator& allocator, uint32_t frameCount, VkDeviceSize frameSize, VkBufferUsageFlags usage)
+	: device(device), allocator(allocator), frameCount(frameCount)
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	// Dynamic offsets have to be multiples of the offset alignment of the descriptor type
+	alignment = std::max(properties.limits.minUniformBufferOffsetAlignment, properties.limits.minStorageBufferOffsetAlignment);
+	alignment = std::max<VkDeviceSize>(alignment, 16);
+	this->frameSize = (frameSize + alignment - 1) / alignment * alignment;
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = this->frameSize * frameCount;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create frame ring buffer!");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+	memory = allocator.allocate(memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, AllocationKind::Linear);
+
+	vkBindBufferMemory(device, buffer, memory.memory, memory.offset);
+}
+
+VulkanFrameRing::~VulkanFrameRing()
+{
+	vkDestroyBuffer(device, buffer, nullptr);
+	allocator.free(memory);
+}
+
+void VulkanFrameRing::beginFrame(uint32_t frameIndex)
+{
+	frameBegin = frameSize * (frameIndex % frameCount);
+	head = frameBegin;
+}
+
+FrameAllocation VulkanFrameRing::allocate(VkDeviceSize size)
+{
+	VkDeviceSize offset = head;
+	VkDeviceSize end = offset + (size + alignment - 1) / alignment * alignment;
+
+	if (end > frameBegin + frameSize)
+	{
+		throw std::runtime_error("frame ring is out of space!");
+	}
+
+	head = end;
+
+	FrameAllocation allocation;
+	allocation.offset = static_cast<uint32_t>(offset);
+	allocation.data = static_cast<char*>(memory.mappedData) + offset;
+	return allocation;
+}
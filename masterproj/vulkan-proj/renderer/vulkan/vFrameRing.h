@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <cstring>
+
+#include "vAllocator.h"
+
+struct FrameAllocation
+{
+	// From the start of the buffer, usable directly as a dynamic descriptor offset
+	uint32_t offset = 0;
+	void* data = nullptr;
+};
+
+/*
+One persistently mapped host coherent buffer split into a region per frame in flight.
+Per-frame and per-object constants are bump allocated from the region of the current frame and
+written with plain stores; shaders see them through UNIFORM_BUFFER_DYNAMIC (or STORAGE_BUFFER_DYNAMIC)
+descriptors that point at the start of the buffer plus the returned dynamic offset.
+A region is only reused after the in-flight fence of its frame has been waited on.
+*/
+class VulkanFrameRing
+{
+public:
+	VulkanFrameRing(VkPhysicalDevice physicalDevice, VkDevice device, VulkanAllocator& allocator, uint32_t frameCount, VkDeviceSize frameSize, VkBufferUsageFlags usage);
+	~VulkanFrameRing();
+
+	// The GPU must be done with the previous use of this frame's region
+	void beginFrame(uint32_t frameIndex);
+
+	FrameAllocation allocate(VkDeviceSize size);
+
+	template<typename T>
+	FrameAllocation push(const T& value)
+	{
+		FrameAllocation allocation = allocate(sizeof(T));
+		memcpy(allocation.data, &value, sizeof(T));
+		return allocation;
+	}
+
+	VkBuffer getBuffer() const { return buffer; }
+	VkDeviceSize getFrameSize() const { return frameSize; }
+	VkDeviceSize getFrameUsed() const { return head - frameBegin; }
+
+private:
+	VkDevice device;
+	VulkanAllocator& allocator;
+
+	VkBuffer buffer;
+	MemoryAllocation memory;
+
+	uint32_t frameCount;
+	VkDeviceSize frameSize;
+	VkDeviceSize alignment;
+
+	VkDeviceSize frameBegin = 0;
+	VkDeviceSize head = 0;
+};
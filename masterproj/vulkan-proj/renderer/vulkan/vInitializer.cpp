@@ -18,9 +18,34 @@ void VulkanInitializer::setWindow(GLFWwindow * w)
 	window = w;
 }
 
-void VulkanInitializer::setInput(std::shared_ptr<ModelLoader> ml)
+void VulkanInitializer::setAssets(std::shared_ptr<AssetLoader> loader)
 {
-	modelLoader = ml;
+	assets = loader;
+}
+
+void VulkanInitializer::setScene(std::shared_ptr<Scene> s)
+{
+	scene = s;
+}
+
+void VulkanInitializer::setCullingMode(CullingMode mode)
+{
+	cullingMode = mode;
+}
+
+void VulkanInitializer::setMipmapMode(MipmapMode mode)
+{
+	mipmapMode = mode;
+}
+
+void VulkanInitializer::setThreadPool(std::shared_ptr<ThreadPool> pool)
+{
+	threadPool = pool;
+}
+
+void VulkanInitializer::setTextureBudget(VkDeviceSize budget)
+{
+	textureBudget = budget;
 }
 
 void VulkanInitializer::createInstance()
@@ -100,6 +125,7 @@ void VulkanInitializer::pickPhysicalDevice()
 		{
 			physicalDevice = device;
 			msaaSamples = getMaxUsableSampleCount();
+			queryTextureFormatSupport();
 			break;
 		}
 	}
@@ -116,7 +142,7 @@ void VulkanInitializer::createLogicalDevice()
 	QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-	std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value() };
+	std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value(), indices.transferFamily.value() };
 
 	float queuePriority = 1.0f;
 	for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -129,22 +155,89 @@ void VulkanInitializer::createLogicalDevice()
 	}
 
 	// Specifying used device features
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
 	VkPhysicalDeviceFeatures deviceFeatures = {};
 	deviceFeatures.samplerAnisotropy = VK_TRUE;
 	// TODO: enable sample shading feature for the device
 	//deviceFeatures.sampleRateShading = VK_TRUE;
+	// Indirect draws work without them, just with more commands
+	deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+	// Textures are cooked to RGBA8 without it
+	deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+
+	std::vector<const char*> enabledExtensions(deviceExtensions.begin(), deviceExtensions.end());
+
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, availableExtensions.data());
+
+	bool drawIndirectCount = false;
+	bool descriptorIndexing = false;
+	bool maintenance3 = false;
+	for (const auto& extension : availableExtensions)
+	{
+		if (strcmp(extension.extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0)
+		{
+			drawIndirectCount = true;
+			enabledExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		}
+		else if (strcmp(extension.extensionName, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) == 0)
+		{
+			descriptorIndexing = true;
+		}
+		else if (strcmp(extension.extensionName, VK_KHR_MAINTENANCE3_EXTENSION_NAME) == 0)
+		{
+			maintenance3 = true;
+		}
+	}
+
+	// The texture table indexes an array of sampled images per instance if it can, otherwise it
+	// falls back to a texture array
+	auto getFeatures2 = physicalDeviceProperties2 ? (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR") : nullptr;
+	if (descriptorIndexing && maintenance3 && getFeatures2 != nullptr && supportedFeatures.shaderSampledImageArrayDynamicIndexing)
+	{
+		VkPhysicalDeviceDescriptorIndexingFeaturesEXT supportedIndexing = {};
+		supportedIndexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+		VkPhysicalDeviceFeatures2KHR features2 = {};
+		features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+		features2.pNext = &supportedIndexing;
+		getFeatures2(physicalDevice, &features2);
+
+		descriptorIndexing = supportedIndexing.shaderSampledImageArrayNonUniformIndexing == VK_TRUE;
+	}
+	else
+	{
+		descriptorIndexing = false;
+	}
+
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
+	indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+	if (descriptorIndexing)
+	{
+		enabledExtensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+		enabledExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+		indexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+		deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+	}
 
 	// Creating the logical device
 	VkDeviceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	createInfo.pNext = descriptorIndexing ? &indexingFeatures : nullptr;
 
 	createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 	createInfo.pQueueCreateInfos = queueCreateInfos.data();
 
 	createInfo.pEnabledFeatures = &deviceFeatures;
 
-	createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-	createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+	createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+	createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
 	if (enableValidationLayers)
 	{
@@ -163,6 +256,27 @@ void VulkanInitializer::createLogicalDevice()
 
 	vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
 	vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+	vkGetDeviceQueue(device, indices.transferFamily.value(), 0, &transferQueue);
+
+	indirectDrawSupport.multiDraw = deviceFeatures.multiDrawIndirect == VK_TRUE;
+	indirectDrawSupport.firstInstance = deviceFeatures.drawIndirectFirstInstance == VK_TRUE;
+	if (drawIndirectCount)
+	{
+		indirectDrawSupport.drawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR");
+	}
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	indirectDrawSupport.maxDrawCount = indirectDrawSupport.multiDraw ? properties.limits.maxDrawIndirectCount : 1;
+
+	textureTableSupport.descriptorIndexing = descriptorIndexing;
+	// Only the table's images count against these, the sampler is a separate binding
+	textureTableSupport.maxSampledImages = std::min(properties.limits.maxPerStageDescriptorSampledImages, properties.limits.maxDescriptorSetSampledImages);
+	textureTableSupport.maxLayers = properties.limits.maxImageArrayLayers;
+
+	allocator = std::make_unique<VulkanAllocator>(physicalDevice, device);
+	deletionQueue = std::make_unique<VulkanDeletionQueue>(static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT));
 }
 
 void VulkanInitializer::createSurface()
@@ -219,13 +333,25 @@ void VulkanInitializer::createSwapchain()
 	createInfo.presentMode = presentMode;
 	createInfo.clipped = VK_TRUE;
 
-	createInfo.oldSwapchain = VK_NULL_HANDLE;
+	// Handing over the old swap chain lets the driver reuse its resources and keeps presenting it until the switch
+	VkSwapchainKHR oldSwapchain = swapChain;
+	createInfo.oldSwapchain = oldSwapchain;
 
 	if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS)
 	{
 		throw std::runtime_error("failed to create swap chain!");
 	}
 
+	if (oldSwapchain != VK_NULL_HANDLE)
+	{
+		// Retired by the call above, it is destroyed once the frames that presented from it are done
+		VkDevice device = this->device;
+		deletionQueue->push(frameNumber, [device, oldSwapchain]()
+		{
+			vkDestroySwapchainKHR(device, oldSwapchain, nullptr);
+		});
+	}
+
 	vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
 	swapChainImages.resize(imageCount);
 	vkGetSwapchainImagesKHR(device, swapChain, &imageCount, swapChainImages.data());
@@ -244,10 +370,21 @@ void VulkanInitializer::createImageViews()
 	}
 }
 
+void VulkanInitializer::createPipelineCache()
+{
+	pipelineCache = std::make_unique<VulkanPipelineCache>(physicalDevice, device, PIPELINE_CACHE_PATH);
+}
+
+void VulkanInitializer::printPipelineStatistics()
+{
+	pipelineCache->printReport(std::cout);
+}
+
 void VulkanInitializer::createGraphicsPipeline()
 {
 	auto vertShaderCode = loadShaderFromFile("renderer/shaders/vert.spv");
-	auto fragShaderCode = loadShaderFromFile("renderer/shaders/frag.spv");
+	// frag_array.spv is shader.frag built for the texture array fallback of the texture table
+	auto fragShaderCode = loadShaderFromFile(textureTableSupport.descriptorIndexing ? "renderer/shaders/frag.spv" : "renderer/shaders/frag_array.spv");
 
 	VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
 	VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
@@ -264,18 +401,47 @@ void VulkanInitializer::createGraphicsPipeline()
 	fragShaderStageInfo.module = fragShaderModule;
 	fragShaderStageInfo.pName = "main";
 
+	// Size of the texture array in shader.frag
+	uint32_t textureCount = VulkanTextureTable::getDescriptorCount(textureTableSupport);
+
+	VkSpecializationMapEntry textureCountEntry = {};
+	textureCountEntry.constantID = 0;
+	textureCountEntry.offset = 0;
+	textureCountEntry.size = sizeof(textureCount);
+
+	VkSpecializationInfo specializationInfo = {};
+	specializationInfo.mapEntryCount = 1;
+	specializationInfo.pMapEntries = &textureCountEntry;
+	specializationInfo.dataSize = sizeof(textureCount);
+	specializationInfo.pData = &textureCount;
+
+	if (textureTableSupport.descriptorIndexing)
+	{
+		fragShaderStageInfo.pSpecializationInfo = &specializationInfo;
+	}
+
 	VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
 
 	/* fixed functions */
 	// Vertex input
-	auto bindingDescription = Vertex::getBindingDescription();
-	auto attributeDescriptions = Vertex::getAttributeDescriptions();
+	// Binding 0 advances per vertex, binding 1 per instance
+	std::array<VkVertexInputBindingDescription, 2> bindingDescriptions = { RenderVertexLayout::getBindingDescription(0), InstanceData::getBindingDescription() };
+
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+	for (const auto& attribute : RenderVertexLayout::getAttributeDescriptions(0))
+	{
+		attributeDescriptions.push_back(attribute);
+	}
+	for (const auto& attribute : InstanceData::getAttributeDescriptions())
+	{
+		attributeDescriptions.push_back(attribute);
+	}
 
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
 	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputInfo.vertexBindingDescriptionCount = 1;
+	vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
 	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-	vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+	vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
 	vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
 	// Input assembly
@@ -285,24 +451,13 @@ void VulkanInitializer::createGraphicsPipeline()
 	inputAssembly.primitiveRestartEnable = VK_FALSE;
 
 	// Viewports and scissors
-	VkViewport viewport = {};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = static_cast<float>(swapChainExtent.width);
-	viewport.height = static_cast<float>(swapChainExtent.height);
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-
-	VkRect2D scissor = {};
-	scissor.offset = { 0, 0 };
-	scissor.extent = swapChainExtent;
-
+	// Both are dynamic state set while recording, so the pipeline does not depend on the swap chain extent
 	VkPipelineViewportStateCreateInfo viewportState = {};
 	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 	viewportState.viewportCount = 1;
-	viewportState.pViewports = &viewport;
+	viewportState.pViewports = nullptr;
 	viewportState.scissorCount = 1;
-	viewportState.pScissors = &scissor;
+	viewportState.pScissors = nullptr;
 
 	// Rasterizer
 	VkPipelineRasterizationStateCreateInfo rasterizer = {};
@@ -365,13 +520,31 @@ void VulkanInitializer::createGraphicsPipeline()
 	colorBlending.blendConstants[2] = 0.0f; // Optional
 	colorBlending.blendConstants[3] = 0.0f; // Optional
 
+	// Dynamic state
+	std::array<VkDynamicState, 2> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+	VkPipelineDynamicStateCreateInfo dynamicState = {};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+	dynamicState.pDynamicStates = dynamicStates.data();
+
 	// Pipeline layout
 	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
 	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineLayoutInfo.setLayoutCount = 1;
 	pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
-	pipelineLayoutInfo.pushConstantRangeCount = 0; // Optional
-	pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
+
+	/*
+	Per-draw transforms and IDs are push constants, so drawing N objects needs neither N descriptor
+	sets nor N buffer writes. 68 bytes fit into the 128 bytes every implementation guarantees.
+	*/
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(DrawPushConstants);
+
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
 	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
 	{
@@ -392,7 +565,7 @@ void VulkanInitializer::createGraphicsPipeline()
 	pipelineInfo.pMultisampleState = &multisampling;
 	pipelineInfo.pDepthStencilState = &depthStencil;
 	pipelineInfo.pColorBlendState = &colorBlending;
-	pipelineInfo.pDynamicState = nullptr; // Optional
+	pipelineInfo.pDynamicState = &dynamicState;
 	// pipeline layout
 	pipelineInfo.layout = pipelineLayout;
 	// render pass
@@ -401,10 +574,7 @@ void VulkanInitializer::createGraphicsPipeline()
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
 	pipelineInfo.basePipelineIndex = -1; // Optional
 
-	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS)
-	{
-		throw std::runtime_error("failed to create graphics pipeline!");
-	}
+	graphicsPipeline = pipelineCache->createGraphicsPipeline(pipelineInfo);
 
 	vkDestroyShaderModule(device, fragShaderModule, nullptr);
 	vkDestroyShaderModule(device, vertShaderModule, nullptr);
@@ -524,7 +694,8 @@ void VulkanInitializer::createCommandPool()
 	VkCommandPoolCreateInfo poolInfo = {};
 	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-	poolInfo.flags = 0; // Optional
+	// Command buffers are re-recorded every frame
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
 	if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
 	{
@@ -534,7 +705,7 @@ void VulkanInitializer::createCommandPool()
 
 void VulkanInitializer::createCommandBuffers()
 {
-	commandBuffers.resize(swapChainFramebuffers.size());
+	commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
 
 	VkCommandBufferAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -547,64 +718,204 @@ void VulkanInitializer::createCommandBuffers()
 		throw std::runtime_error("failed to allocate command buffers!");
 	}
 
-	// Starting command buffer recording
-	for (size_t i = 0; i < commandBuffers.size(); i++)
+	/*
+	Draws are recorded into secondary command buffers by the worker threads. Every thread gets its
+	own pool per frame in flight, since pools must not be used from two threads at once, and the
+	whole pool is reset at the start of the frame instead of freeing its buffers.
+	*/
+	if (!threadPool)
 	{
-		
-		VkCommandBufferBeginInfo beginInfo = {};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-		beginInfo.pInheritanceInfo = nullptr; // Optional
+		threadPool = std::make_shared<ThreadPool>();
+	}
+
+	QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
 
-		if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) != VK_SUCCESS)
+	secondaryRecorders.resize(MAX_FRAMES_IN_FLIGHT);
+	for (std::vector<SecondaryRecorder>& frameRecorders : secondaryRecorders)
+	{
+		frameRecorders.resize(threadPool->getThreadCount());
+
+		for (SecondaryRecorder& recorder : frameRecorders)
 		{
-			throw std::runtime_error("failed to begin recording command buffer!");
+			VkCommandPoolCreateInfo poolInfo = {};
+			poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+			poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+			if (vkCreateCommandPool(device, &poolInfo, nullptr, &recorder.commandPool) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create command pool!");
+			}
+
+			VkCommandBufferAllocateInfo secondaryInfo = {};
+			secondaryInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			secondaryInfo.commandPool = recorder.commandPool;
+			secondaryInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			secondaryInfo.commandBufferCount = 1;
+
+			if (vkAllocateCommandBuffers(device, &secondaryInfo, &recorder.commandBuffer) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to allocate command buffers!");
+			}
 		}
+	}
+}
 
-		// Starting a render pass
-		VkRenderPassBeginInfo renderPassInfo = {};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		renderPassInfo.renderPass = renderPass;
-		renderPassInfo.framebuffer = swapChainFramebuffers[i];
+void VulkanInitializer::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t uniformOffset)
+{
+	// Starting command buffer recording
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = nullptr; // Optional
 
-		renderPassInfo.renderArea.offset = { 0, 0 };
-		renderPassInfo.renderArea.extent = swapChainExtent;
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to begin recording command buffer!");
+	}
 
-		std::array<VkClearValue, 2> clearValues = {};
-		clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-		clearValues[1].depthStencil = { 1.0f, 0 };
+	updateInstanceBuffer(commandBuffer);
 
-		renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-		renderPassInfo.pClearValues = clearValues.data();
+	// Fills the indirect draws of this frame, before the render pass begins
+	culler->cull(commandBuffer, static_cast<uint32_t>(currentFrame), frameNumber, *scene, *instanceBuffer, *meshArena, camera.ubo.view, camera.ubo.proj, static_cast<float>(swapChainExtent.height), cullingMode);
 
-		vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	// Starting a render pass
+	VkRenderPassBeginInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = renderPass;
+	renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
 
-		// Basic drawing commands
-		vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-		
-		VkBuffer vertexBuffers[] = { vertexBuffer };
-		VkDeviceSize offsets[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
+	renderPassInfo.renderArea.offset = { 0, 0 };
+	renderPassInfo.renderArea.extent = swapChainExtent;
 
-		vkCmdBindIndexBuffer(commandBuffers[i], indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+	std::array<VkClearValue, 2> clearValues = {};
+	clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
+	clearValues[1].depthStencil = { 1.0f, 0 };
 
-		vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[i], 0, nullptr);
+	renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+	renderPassInfo.pClearValues = clearValues.data();
 
-		vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(modelLoader->models[0].indices.size()), 1, 0, 0, 0);
+	// The contents of the render pass come from secondary command buffers only
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
-		vkCmdEndRenderPass(commandBuffers[i]);
+	// Draw slots are split into one contiguous range per thread, small scenes stay on one
+	uint32_t slotCount = culler->getDrawSlotCount();
+	uint32_t rangeCount = 1;
+	if (culler->canSplitDraws())
+	{
+		rangeCount = std::max(1u, std::min(threadPool->getThreadCount(), slotCount / MIN_DRAWS_PER_THREAD));
+	}
+	uint32_t rangeSize = (slotCount + rangeCount - 1) / rangeCount;
 
-		if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS)
-		{
-			throw std::runtime_error("failed to record command buffer!");
-		}
+	std::vector<SecondaryRecorder>& recorders = secondaryRecorders[currentFrame];
+
+	threadPool->parallelFor(rangeCount, [&](uint32_t range)
+	{
+		uint32_t firstSlot = std::min(range * rangeSize, slotCount);
+		uint32_t count = std::min(rangeSize, slotCount - firstSlot);
+		recordDraws(recorders[range], imageIndex, uniformOffset, firstSlot, count);
+	});
+
+	std::vector<VkCommandBuffer> secondaryBuffers(rangeCount);
+	for (uint32_t i = 0; i < rangeCount; i++)
+	{
+		secondaryBuffers[i] = recorders[i].commandBuffer;
+	}
+
+	vkCmdExecuteCommands(commandBuffer, rangeCount, secondaryBuffers.data());
+
+	vkCmdEndRenderPass(commandBuffer);
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to record command buffer!");
+	}
+}
+
+void VulkanInitializer::recordDraws(SecondaryRecorder& recorder, uint32_t imageIndex, uint32_t uniformOffset, uint32_t firstSlot, uint32_t slotCount)
+{
+	// The frame's fence has been waited on, nothing recorded from this pool is pending
+	vkResetCommandPool(device, recorder.commandPool, 0);
+
+	VkCommandBufferInheritanceInfo inheritanceInfo = {};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = renderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = swapChainFramebuffers[imageIndex];
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	VkCommandBuffer commandBuffer = recorder.commandBuffer;
+
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to begin recording command buffer!");
+	}
+
+	// State is not inherited from the primary, every secondary binds everything it uses
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+
+	VkViewport viewport = {};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = static_cast<float>(swapChainExtent.width);
+	viewport.height = static_cast<float>(swapChainExtent.height);
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+	VkRect2D scissor = {};
+	scissor.offset = { 0, 0 };
+	scissor.extent = swapChainExtent;
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+	// All meshes share the arena, so it is bound once for the whole scene
+	meshArena->bind(commandBuffer);
+
+	// The dynamic offset selects this frame's constants inside the frame ring
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 1, &uniformOffset);
+
+	// Batch transforms are already part of the culled instance transforms
+	DrawPushConstants constants = {};
+	constants.model = glm::mat4(1.0f);
+	vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(constants), &constants);
+
+	// One indirect draw per batch, the instance counts were written by the culling pass
+	culler->draw(commandBuffer, *meshArena, firstSlot, slotCount);
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to record command buffer!");
 	}
 }
 
 void VulkanInitializer::drawFrame()
 {
 	vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
-	
+
+	deletionQueue->collect(frameNumber);
+
+	// Uploads whose copies have finished are handed to the graphics queue, this frame draws them
+	uploader->update();
+	meshArena->update(frameNumber);
+
+	// Recorded into the uploader batch flushed at the end of the frame, drawn once it is complete
+	streamAssets();
+	if (textureStreamer)
+	{
+		// With the camera of the last frame, this one's is set while recording
+		textureStreamer->gatherFeedback(*scene, *meshArena, camera.ubo.view, camera.ubo.proj, swapChainExtent.height, frameNumber);
+		textureStreamer->update(frameNumber);
+	}
+	textureTable->update(frameNumber);
+	if (descriptorGenerations[currentFrame] != textureTable->getGeneration())
+	{
+		updateDescriptorSet(static_cast<uint32_t>(currentFrame));
+	}
+
 	uint32_t imageIndex;
 	VkResult result = vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
 
@@ -618,7 +929,11 @@ void VulkanInitializer::drawFrame()
 		throw std::runtime_error("failed to acquire swap chain image!");
 	}
 
-	updateUniformBuffer(imageIndex);
+	// The fence wait above guarantees the GPU is done with this frame's region and command buffer
+	frameRing->beginFrame(static_cast<uint32_t>(currentFrame));
+	uint32_t uniformOffset = updateUniformBuffer();
+
+	recordCommandBuffer(commandBuffers[currentFrame], imageIndex, uniformOffset);
 
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -630,12 +945,17 @@ void VulkanInitializer::drawFrame()
 	submitInfo.pWaitDstStageMask = waitStages;
 
 	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+	submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
 
 	VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame] };
 	submitInfo.signalSemaphoreCount = 1;
 	submitInfo.pSignalSemaphores = signalSemaphores;
 
+	// Uploads recorded since the last frame go to the transfer queue. Only a reallocated instance
+	// buffer is read by this frame, its batch is handed over ahead of it
+	uploader->flush();
+	uploader->acquire(instanceBuffer->getUploadTicket());
+
 	vkResetFences(device, 1, &inFlightFences[currentFrame]);
 
 	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS)
@@ -668,6 +988,7 @@ void VulkanInitializer::drawFrame()
 	}
 
 	currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+	frameNumber++;
 }
 
 void VulkanInitializer::createSyncObjects()
@@ -705,85 +1026,157 @@ void VulkanInitializer::recreateSwapChain()
 		glfwWaitEvents();
 	}
 
-	vkDeviceWaitIdle(device);
-
+	/*
+	No vkDeviceWaitIdle: frames in flight keep rendering into the old images, which go to the deletion
+	queue together with the old swap chain and are destroyed once those frames have finished.
+	*/
 	cleanupSwapChain();
 
+	VkFormat oldFormat = swapChainImageFormat;
+
 	createSwapchain();
 	createImageViews();
-	createRenderPass();
-	// Viewport and scissor rectangle size is specified during graphics pipeline creation, so the pipeline also needs to be rebuilt.
-	// It is possible to avoid this by using dynamic state for the viewports and scissor rectangles.
-	createGraphicsPipeline();
+
+	// Viewport and scissor are dynamic, so the render pass and the pipeline only depend on the format
+	if (swapChainImageFormat != oldFormat)
+	{
+		VkDevice device = this->device;
+		VkPipeline oldPipeline = graphicsPipeline;
+		VkPipelineLayout oldLayout = pipelineLayout;
+		VkRenderPass oldRenderPass = renderPass;
+		deletionQueue->push(frameNumber, [device, oldPipeline, oldLayout, oldRenderPass]()
+		{
+			vkDestroyPipeline(device, oldPipeline, nullptr);
+			vkDestroyPipelineLayout(device, oldLayout, nullptr);
+			vkDestroyRenderPass(device, oldRenderPass, nullptr);
+		});
+
+		createRenderPass();
+		createGraphicsPipeline();
+	}
+
 	createColorResources();
 	createDepthResources();
 	createFramebuffers();
-	createCommandBuffers();
+
+	// The next frame renders into the new attachments, their transitions are handed over right away
+	uploader->acquire(uploader->flush());
 }
 
-// TODO: support multiple models
-void VulkanInitializer::createVertexBuffer()
+void VulkanInitializer::createMeshArena()
 {
-	VkDeviceSize bufferSize = sizeof(modelLoader->models[0].vertices[0]) * modelLoader->models[0].vertices.size();
+	meshArena = std::make_unique<VulkanMeshArena>(device, *allocator, *uploader, *deletionQueue, VERTEX_ARENA_SIZE, INDEX16_ARENA_SIZE, INDEX32_ARENA_SIZE, CLUSTER_ARENA_SIZE);
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+	// Drawn at the instances of every model that is still loading
+	meshArena->setPlaceholder(ModelLoader::createPlaceholder());
+}
 
-	void* data;
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, modelLoader->models[0].vertices.data(), (size_t)bufferSize);
-	vkUnmapMemory(device, stagingBufferMemory);
+void VulkanInitializer::streamAssets()
+{
+	if (!assets)
+	{
+		return;
+	}
 
-	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+	VkDeviceSize uploaded = 0;
 
-	copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+	LoadedModel model;
+	while (uploaded < ASSET_UPLOAD_BUDGET && assets->popModel(model))
+	{
+		try
+		{
+			meshArena->addMesh(model.id, model.model);
+		}
+		catch (const std::exception& e)
+		{
+			// Its instances keep drawing the placeholder
+			std::cerr << "failed to add model " << model.id << " to the mesh arena: " << e.what() << std::endl;
+		}
 
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
-}
+		uploaded += VkDeviceSize(model.model.getVertexCount()) * RenderVertexLayout::STRIDE + VkDeviceSize(model.model.getIndexCount()) * sizeof(uint32_t);
+	}
 
-// TODO: support multiple models
-void VulkanInitializer::createIndexBuffer()
-{
-	VkDeviceSize bufferSize = sizeof(modelLoader->models[0].indices[0]) * modelLoader->models[0].indices.size();
+	LoadedTexture texture;
+	while (uploaded < ASSET_UPLOAD_BUDGET && assets->popTexture(texture))
+	{
+		try
+		{
+			// Only the tail now, the rest follows as the streamer finds it is needed
+			if (textureStreamer && VulkanTextureStreamer::canStream(texture.texture))
+			{
+				VkFormat format = getTextureFormat(texture.texture.format);
+				uploaded += textureStreamer->addTexture(texture.id, std::move(texture.texture), format, frameNumber);
+				continue;
+			}
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+			if (texture.id >= textures.size())
+			{
+				textures.resize(texture.id + 1);
+			}
 
-	void* data;
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, modelLoader->models[0].indices.data(), (size_t)bufferSize);
-	vkUnmapMemory(device, stagingBufferMemory);
+			Texture created = createTexture(texture.texture);
+			if (textureTable->setTexture(texture.id, created.image, created.view, getTextureFormat(texture.texture.format), texture.texture.width, texture.texture.height,
+				TextureLoader::getMipCount(texture.texture.width, texture.texture.height)))
+			{
+				textures[texture.id] = created;
+			}
+			else
+			{
+				// Copied into the texture array or left out of the table, either way only the batch uses it
+				VkDevice device = this->device;
+				VulkanAllocator& allocator = *this->allocator;
+				uploader->releaseWithBatch([device, &allocator, created]() mutable
+				{
+					vkDestroyImageView(device, created.view, nullptr);
+					vkDestroyImage(device, created.image, nullptr);
+					allocator.free(created.memory);
+				});
+			}
+
+			uploaded += texture.texture.getSize();
+		}
+		catch (const std::exception& e)
+		{
+			// Its slot in the texture table stays empty, instances sample the placeholder
+			std::cerr << "failed to add texture " << texture.id << " to the texture table: " << e.what() << std::endl;
+		}
+	}
+}
 
-	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+void VulkanInitializer::createCuller()
+{
+	instanceBuffer = std::make_unique<VulkanInstanceBuffer>(device, *allocator, *uploader, *deletionQueue);
 
-	copyBuffer(stagingBuffer, indexBuffer, bufferSize);
+	auto cullShaderCode = loadShaderFromFile("renderer/shaders/cull.spv");
+	VkShaderModule cullShaderModule = createShaderModule(cullShaderCode);
 
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+	culler = std::make_unique<VulkanCuller>(physicalDevice, device, *allocator, *deletionQueue, *pipelineCache, static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT), cullShaderModule, indirectDrawSupport);
 
+	vkDestroyShaderModule(device, cullShaderModule, nullptr);
 }
 
 void VulkanInitializer::createDescriptorSetLayout()
 {
 	VkDescriptorSetLayoutBinding uboLayoutBinding = {};
 	uboLayoutBinding.binding = 0;
-	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	uboLayoutBinding.descriptorCount = 1;
 	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 	uboLayoutBinding.pImmutableSamplers = nullptr; // Optional
 
+	// Every texture of the scene, the instance picks one
+	VkDescriptorSetLayoutBinding textureLayoutBinding = VulkanTextureTable::getLayoutBinding(textureTableSupport, 1);
+
+	// One sampler for all of them
 	VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
-	samplerLayoutBinding.binding = 1;
+	samplerLayoutBinding.binding = 2;
 	samplerLayoutBinding.descriptorCount = 1;
-	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
 	samplerLayoutBinding.pImmutableSamplers = nullptr;
 	// TODO: It is possible to use texture sampling in the vertex shader, for example to dynamically deform a grid of vertices by a heightmap.
 	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-	std::array<VkDescriptorSetLayoutBinding, 2> bindings = { uboLayoutBinding, samplerLayoutBinding };
+	std::array<VkDescriptorSetLayoutBinding, 3> bindings = { uboLayoutBinding, textureLayoutBinding, samplerLayoutBinding };
 	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
 	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
@@ -797,27 +1190,59 @@ void VulkanInitializer::createDescriptorSetLayout()
 
 void VulkanInitializer::createUniformBuffer()
 {
-	VkDeviceSize bufferSize = sizeof(UniformBufferObject);
+	/*
+	Instead of one small buffer per swap chain image, a single persistently mapped buffer holds a
+	region per frame in flight. The region of a frame is only rewritten after its fence signaled.
+	*/
+	frameRing = std::make_unique<VulkanFrameRing>(physicalDevice, device, *allocator, static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT), FRAME_RING_SIZE, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+}
 
-	uniformBuffers.resize(swapChainImages.size());
-	uniformBuffersMemory.resize(swapChainImages.size());
+void VulkanInitializer::updateInstanceBuffer(VkCommandBuffer commandBuffer)
+{
+	bool dirty = false;
+	for (const InstanceBatch& batch : scene->batches)
+	{
+		dirty = dirty || batch.isDirty();
+	}
 
-	for (size_t i = 0; i < swapChainImages.size(); i++)
+	if (!dirty)
 	{
-		createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers[i], uniformBuffersMemory[i]);
+		return;
 	}
-}
 
-void VulkanInitializer::updateUniformBuffer(uint32_t currentImage)
-{
-	static auto startTime = std::chrono::high_resolution_clock::now();
+	// Earlier frames may still be reading the instance buffer in the culling pass
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0,
+		0, nullptr,
+		0, nullptr,
+		0, nullptr
+	);
 
-	auto currentTime = std::chrono::high_resolution_clock::now();
-	float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+	// Only the changed instance ranges are copied
+	instanceBuffer->update(commandBuffer, *frameRing, *scene, frameNumber);
 
-	// TODO: move to separate classes: model, camera
-	UniformBufferObject ubo = {};
-	ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	// The CPU culling path reads the scene itself, only the compute pass reads the buffer
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0,
+		1, &barrier,
+		0, nullptr,
+		0, nullptr
+	);
+}
+
+uint32_t VulkanInitializer::updateUniformBuffer()
+{
+	// TODO: move to separate class: camera
+	UniformBufferObject& ubo = camera.ubo;
 	ubo.view = glm::lookAt(glm::vec3(120.0f, 120.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 	ubo.proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 1000.0f);
 	/*
@@ -827,29 +1252,25 @@ void VulkanInitializer::updateUniformBuffer(uint32_t currentImage)
 	*/
 	ubo.proj[1][1] *= -1;
 
-	/*
-	TODO: Using a UBO this way is not the most efficient way to pass frequently changing values to the shader.
-	A more efficient way to pass a small buffer of data to shaders are push constants. We may look at these in a future chapter.
-	*/
-	void* data;
-	vkMapMemory(device, uniformBuffersMemory[currentImage], 0, sizeof(ubo), 0, &data);
-	memcpy(data, &ubo, sizeof(ubo));
-	vkUnmapMemory(device, uniformBuffersMemory[currentImage]);
+	// Kept in the camera for culling, stored once into the mapped frame region
+	return frameRing->push(ubo).offset;
 }
 
 void VulkanInitializer::createDescriptorPool()
 {
-	std::array<VkDescriptorPoolSize, 2> poolSizes = {};
-	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSizes[0].descriptorCount = static_cast<uint32_t>(swapChainImages.size());
-	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	poolSizes[1].descriptorCount = static_cast<uint32_t>(swapChainImages.size());
+	std::array<VkDescriptorPoolSize, 3> poolSizes = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	poolSizes[1].descriptorCount = VulkanTextureTable::getDescriptorCount(textureTableSupport) * static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+	poolSizes[2].type = VK_DESCRIPTOR_TYPE_SAMPLER;
+	poolSizes[2].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 
 	VkDescriptorPoolCreateInfo poolInfo = {};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
 	poolInfo.pPoolSizes = poolSizes.data();
-	poolInfo.maxSets = static_cast<uint32_t>(swapChainImages.size());
+	poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 
 	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
 	{
@@ -871,105 +1292,333 @@ draw calls which is potentially more efficient.
 */
 void VulkanInitializer::createDescriptorSets()
 {
-	std::vector<VkDescriptorSetLayout> layouts(swapChainImages.size(), descriptorSetLayout);
+	// The uniform binding is dynamic and would do with one set, the texture table can change under frames in flight
+	std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, descriptorSetLayout);
+
 	VkDescriptorSetAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = descriptorPool;
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(swapChainImages.size());
+	allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 	allocInfo.pSetLayouts = layouts.data();
 
-	descriptorSets.resize(swapChainImages.size());
+	descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+	descriptorGenerations.resize(MAX_FRAMES_IN_FLIGHT);
 	if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) != VK_SUCCESS)
 	{
 		throw std::runtime_error("failed to allocate descriptor sets!");
 	}
 
-	for (size_t i = 0; i < swapChainImages.size(); i++)
+	for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
 	{
-		VkDescriptorBufferInfo bufferInfo = {};
-		bufferInfo.buffer = uniformBuffers[i];
-		bufferInfo.offset = 0;
-		bufferInfo.range = sizeof(UniformBufferObject);
+		updateDescriptorSet(i);
+	}
+}
 
-		VkDescriptorImageInfo imageInfo = {};
-		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		imageInfo.imageView = textureImageView;
-		imageInfo.sampler = textureSampler;
+void VulkanInitializer::updateDescriptorSet(uint32_t frame)
+{
+	VkDescriptorSet descriptorSet = descriptorSets[frame];
+
+	VkDescriptorBufferInfo bufferInfo = {};
+	bufferInfo.buffer = frameRing->getBuffer();
+	bufferInfo.offset = 0;
+	bufferInfo.range = sizeof(UniformBufferObject);
+
+	VkDescriptorImageInfo samplerInfo = {};
+	samplerInfo.sampler = textureSampler;
+
+	std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+
+	descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrites[0].dstSet = descriptorSet;
+	descriptorWrites[0].dstBinding = 0;
+	descriptorWrites[0].dstArrayElement = 0;
+	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	descriptorWrites[0].descriptorCount = 1;
+	descriptorWrites[0].pBufferInfo = &bufferInfo;
+
+	descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrites[1].dstSet = descriptorSet;
+	descriptorWrites[1].dstBinding = 2;
+	descriptorWrites[1].dstArrayElement = 0;
+	descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+	descriptorWrites[1].descriptorCount = 1;
+	descriptorWrites[1].pImageInfo = &samplerInfo;
+
+	vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+	textureTable->writeDescriptorSet(descriptorSet, 1);
+	descriptorGenerations[frame] = textureTable->getGeneration();
+}
+
+void VulkanInitializer::createDownsampler()
+{
+	auto downsampleShaderCode = loadShaderFromFile("renderer/shaders/downsample.spv");
+	VkShaderModule downsampleShaderModule = createShaderModule(downsampleShaderCode);
 
-		std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+	downsampler = std::make_unique<VulkanDownsampler>(physicalDevice, device, *allocator, *uploader, *pipelineCache, downsampleShaderModule);
 
-		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[0].dstSet = descriptorSets[i];
-		descriptorWrites[0].dstBinding = 0;
-		descriptorWrites[0].dstArrayElement = 0;
-		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		descriptorWrites[0].descriptorCount = 1;
-		descriptorWrites[0].pBufferInfo = &bufferInfo;
+	vkDestroyShaderModule(device, downsampleShaderModule, nullptr);
+}
+
+void VulkanInitializer::createPlaceholderTexture()
+{
+	placeholderTexture = createTexture(TextureLoader::createPlaceholder());
+}
 
-		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[1].dstSet = descriptorSets[i];
-		descriptorWrites[1].dstBinding = 1;
-		descriptorWrites[1].dstArrayElement = 0;
-		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		descriptorWrites[1].descriptorCount = 1;
-		descriptorWrites[1].pImageInfo = &imageInfo;
+void VulkanInitializer::createTextureTable()
+{
+	textureTable = std::make_unique<VulkanTextureTable>(physicalDevice, device, *allocator, *uploader, *deletionQueue, textureTableSupport, placeholderTexture.view);
+}
 
-		vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+void VulkanInitializer::createTextureStreamer()
+{
+	// The texture array keeps its own fixed size copy of every texture
+	if (textureBudget == 0 || !textureTableSupport.descriptorIndexing)
+	{
+		return;
+	}
+
+	textureStreamer = std::make_unique<VulkanTextureStreamer>(device, *allocator, *uploader, *deletionQueue, *textureTable, textureBudget);
+
+	// Loads still to come leave the levels above the tail on disk
+	if (assets)
+	{
+		assets->setTexturePrefetchSize(VulkanTextureStreamer::RESIDENT_TAIL_SIZE);
 	}
 }
 
-// TODO: support multiple models
-// TODO: path parameter
-void VulkanInitializer::createTextureImage()
+void VulkanInitializer::benchmarkMipmaps()
 {
-	int texWidth, texHeight, texChannels;
-	stbi_uc* pixels = stbi_load("resources/textures/cottage.png", &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-	VkDeviceSize imageSize = texWidth * texHeight * 4;
-	/*
-	The log2 function calculates how many times that dimension can be divided by 2.
-	The floor function handles cases where the largest dimension is not a power of 2. 1 is added so that the original image has a mip level.
-	*/
-	m_mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
+	QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+	uint32_t timestampBits = queueFamilies[indices.graphicsFamily.value()].timestampValidBits;
+	if (timestampBits == 0)
+	{
+		std::cout << "Mipmap benchmark: the graphics queue has no timestamps" << std::endl;
+		return;
+	}
+
+	uint64_t timestampMask = timestampBits >= 64 ? ~0ull : (1ull << timestampBits) - 1;
 
-	if (!pixels)
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	VkQueryPoolCreateInfo queryPoolInfo = {};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = 2;
+
+	VkQueryPool queryPool;
+	if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS)
 	{
-		throw std::runtime_error("failed to load texture image!");
+		throw std::runtime_error("failed to create timestamp query pool!");
+	}
+
+	const VkFormat format = VulkanDownsampler::FORMAT;
+
+	for (uint32_t size : { 256u, 1024u, 4096u })
+	{
+		uint32_t mipLevels = TextureLoader::getMipCount(size, size);
+
+		std::cout << "Mipmaps " << size << "x" << size << ", " << mipLevels << " levels, averaged in linear light:";
+
+		for (MipmapMode mode : { MipmapMode::Blit, MipmapMode::Compute })
+		{
+			// Like createTexture, the blits run on an sRGB image and the shader decodes the texels itself
+			const char* name = mode == MipmapMode::Blit ? "blit" : "compute";
+			VkFormat modeFormat = mode == MipmapMode::Blit ? getSrgbFormat(format) : format;
+			if (mode == MipmapMode::Blit ? !canBlitMipmaps(modeFormat) : !downsampler->canGenerate(format, size, size))
+			{
+				std::cout << " " << name << " unsupported";
+				continue;
+			}
+
+			VkImage image;
+			MemoryAllocation imageMemory;
+			createImage(size, size, mipLevels, VK_SAMPLE_COUNT_1_BIT, modeFormat, VK_IMAGE_TILING_OPTIMAL,
+				VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | (mode == MipmapMode::Blit ? 0 : VK_IMAGE_USAGE_STORAGE_BIT) | VK_IMAGE_USAGE_SAMPLED_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory);
+
+			// The first run only warms up
+			double totalMilliseconds = 0.0;
+			for (uint32_t run = 0; run <= MIPMAP_BENCHMARK_RUNS; run++)
+			{
+				VkCommandBuffer commandBuffer = uploader->getGraphicsCommandBuffer();
+
+				VkImageMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				barrier.srcAccessMask = 0;
+				barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+				barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.image = image;
+				barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 };
+
+				vkCmdPipelineBarrier(commandBuffer,
+					VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+					0, nullptr,
+					0, nullptr,
+					1, &barrier);
+
+				VkClearColorValue color = { { 0.25f, 0.5f, 0.75f, 1.0f } };
+				VkImageSubresourceRange levelZero = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+				vkCmdClearColorImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &levelZero);
+
+				// Written once everything before has completed, so the clear is not measured
+				vkCmdResetQueryPool(commandBuffer, queryPool, 0, 2);
+				vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 0);
+
+				if (mode == MipmapMode::Blit)
+				{
+					generateMipmaps(image, modeFormat, static_cast<int32_t>(size), static_cast<int32_t>(size), mipLevels);
+				}
+				else
+				{
+					downsampler->generate(commandBuffer, image, size, size, mipLevels, true,
+						VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+				}
+
+				vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 1);
+
+				uploader->wait(uploader->flush());
+
+				uint64_t timestamps[2];
+				if (vkGetQueryPoolResults(device, queryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) != VK_SUCCESS)
+				{
+					throw std::runtime_error("failed to read mipmap benchmark timestamps!");
+				}
+
+				if (run > 0)
+				{
+					uint64_t ticks = (timestamps[1] - timestamps[0]) & timestampMask;
+					totalMilliseconds += static_cast<double>(ticks) * properties.limits.timestampPeriod / 1000000.0;
+				}
+			}
+
+			std::cout << " " << name << " " << totalMilliseconds / MIPMAP_BENCHMARK_RUNS << " ms";
+
+			// The image views of the compute pass went with the batch it waited for
+			VkDevice device = this->device;
+			deletionQueue->push(frameNumber, [=]() mutable
+			{
+				vkDestroyImage(device, image, nullptr);
+				allocator->free(imageMemory);
+			});
+		}
+
+		std::cout << std::endl;
 	}
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
+	vkDestroyQueryPool(device, queryPool, nullptr);
+}
 
-	createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+VulkanInitializer::Texture VulkanInitializer::createTexture(const TextureData& data)
+{
+	VkFormat format = getTextureFormat(data.format);
+	uint32_t mipLevels = TextureLoader::getMipCount(data.width, data.height);
+	bool completeChain = data.levels.size() == mipLevels;
+	bool computeMipmaps = !completeChain && mipmapMode == MipmapMode::Compute && downsampler->canGenerate(format, data.width, data.height);
+
+	// The blits run on the image created in the sRGB format and sampled through a view in the
+	// texture's own format. The texture array copies textures by blits as well, which would decode
+	// such an image, so there the CPU makes the chain instead
+	VkFormat blitFormat = getSrgbFormat(format);
+	bool blitMipmaps = !completeChain && !computeMipmaps && textureTableSupport.descriptorIndexing && blitFormat != VK_FORMAT_UNDEFINED && canBlitMipmaps(blitFormat);
+
+	// Textures made at runtime may come with level 0 only. The GPU generates the rest in a compute
+	// pass or by blits where the format allows it, anything else gets its chain on the CPU and is
+	// uploaded like a cooked texture. All three average in linear light
+	if (!completeChain && (data.levels.size() != 1 || (!computeMipmaps && !blitMipmaps)))
+	{
+		if (data.format != TextureFormat::Rgba8)
+		{
+			throw std::runtime_error("failed to create texture without mipmaps in a compressed format!");
+		}
 
-	void* data;
-	vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-	memcpy(data, pixels, static_cast<size_t>(imageSize));
-	vkUnmapMemory(device, stagingBufferMemory);
+		return createTexture(MipGenerator::generate(data.getData(), data.width, data.height, MipFilter::Box, threadPool.get()));
+	}
 
-	stbi_image_free(pixels);
+	// The whole payload goes into staging as it is. Levels are 16 byte aligned in it, which covers
+	// the texel block alignment of the copies
+	StagingRegion staging = uploader->allocateStaging(data.getSize(), 16);
+	memcpy(staging.data, data.getData(), static_cast<size_t>(data.getSize()));
 
-	createImage(texWidth, texHeight, m_mipLevels,
+	Texture texture;
+	createImage(data.width, data.height, mipLevels,
 		VK_SAMPLE_COUNT_1_BIT,
-		VK_FORMAT_R8G8B8A8_UNORM,
+		blitMipmaps ? blitFormat : format,
 		VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		(completeChain ? 0 : computeMipmaps ? VK_IMAGE_USAGE_STORAGE_BIT : VK_IMAGE_USAGE_TRANSFER_SRC_BIT) | VulkanTextureTable::getTextureUsage(textureTableSupport) | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		textureImage,
-		textureImageMemory);
+		texture.image,
+		texture.memory,
+		blitMipmaps ? VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT : 0);
 
-	transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, m_mipLevels);
-	copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-	//transitioned to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL while generating mipmaps
+	transitionImageLayout(texture.image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
+	copyLevelsToImage(staging.buffer, staging.offset, texture.image, data.levels);
 
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+	// The graphics queue takes the image over and moves it to its shader layout
+	VkImageSubresourceRange range = {};
+	range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	range.baseMipLevel = 0;
+	range.levelCount = mipLevels;
+	range.baseArrayLayer = 0;
+	range.layerCount = 1;
 
-	generateMipmaps(textureImage, VK_FORMAT_R8G8B8A8_UNORM, texWidth, texHeight, m_mipLevels);
+	if (completeChain)
+	{
+		uploader->releaseImage(texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, range, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+		transitionImageLayout(texture.image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels);
+	}
+	else
+	{
+		// Transitioned to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL while generating mipmaps
+		uploader->releaseImage(texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, range, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+
+		if (computeMipmaps)
+		{
+			// Colour textures are sRGB encoded, like MipGenerator the shader averages in linear light
+			downsampler->generate(uploader->getGraphicsCommandBuffer(), texture.image, data.width, data.height, mipLevels, true,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+		}
+		else
+		{
+			generateMipmaps(texture.image, blitFormat, static_cast<int32_t>(data.width), static_cast<int32_t>(data.height), mipLevels);
+		}
+	}
+
+	texture.view = createImageView(texture.image, format, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+
+	return texture;
 }
 
-void VulkanInitializer::createTextureImageView()
+VkFormat VulkanInitializer::getSrgbFormat(VkFormat format)
 {
-	textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, m_mipLevels);
+	switch (format)
+	{
+	case VK_FORMAT_R8G8B8A8_UNORM:
+		return VK_FORMAT_R8G8B8A8_SRGB;
+	case VK_FORMAT_B8G8R8A8_UNORM:
+		return VK_FORMAT_B8G8R8A8_SRGB;
+	default:
+		return VK_FORMAT_UNDEFINED;
+	}
+}
+
+bool VulkanInitializer::canBlitMipmaps(VkFormat format)
+{
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+
+	VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	return (properties.optimalTilingFeatures & required) == required;
 }
 
 void VulkanInitializer::createTextureSampler()
@@ -990,7 +1639,8 @@ void VulkanInitializer::createTextureSampler()
 	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 	samplerInfo.mipLodBias = 0.0f;
 	samplerInfo.minLod = 0.0f;
-	samplerInfo.maxLod = static_cast<float>(m_mipLevels);
+	// Textures have different mip counts, each is limited by its view
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
 	
 	if (vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS)
 	{
@@ -1038,33 +1688,57 @@ void VulkanInitializer::createColorResources()
 	transitionImageLayout(colorImage, colorFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 1);
 }
 
+void VulkanInitializer::printMemoryStatistics()
+{
+	allocator->printStats(std::cout);
+
+	if (textureStreamer)
+	{
+		std::cout << "Streamed textures: " << textureStreamer->getResidentSize() / (1024 * 1024) << " of " << textureBudget / (1024 * 1024) << " MiB resident" << std::endl;
+	}
+}
+
 void VulkanInitializer::cleanUp()
 {
+	// Hands over and retires the uploads still in flight, what they release needs the downsampler's pools
+	uploader->waitIdle();
 	vkDeviceWaitIdle(device);
 
 	cleanupSwapChain();
+	vkDestroySwapchainKHR(device, swapChain, nullptr);
+
+	vkDestroyPipeline(device, graphicsPipeline, nullptr);
+	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	vkDestroyRenderPass(device, renderPass, nullptr);
 
 	vkDestroySampler(device, textureSampler, nullptr);
-	vkDestroyImageView(device, textureImageView, nullptr);
 
-	vkDestroyImage(device, textureImage, nullptr);
-	vkFreeMemory(device, textureImageMemory, nullptr);
+	textures.push_back(placeholderTexture);
+	for (Texture& texture : textures)
+	{
+		if (texture.image != VK_NULL_HANDLE)
+		{
+			vkDestroyImageView(device, texture.view, nullptr);
+			vkDestroyImage(device, texture.image, nullptr);
+			allocator->free(texture.memory);
+		}
+	}
+	textures.clear();
+	textureStreamer.reset();
+	textureTable.reset();
 
 	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
 
 	vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 
-	for (size_t i = 0; i < swapChainImages.size(); i++)
-	{
-		vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-		vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
-	}
-
-	vkDestroyBuffer(device, indexBuffer, nullptr);
-	vkFreeMemory(device, indexBufferMemory, nullptr);
+	culler.reset();
+	instanceBuffer.reset();
+	deletionQueue.reset();
+	// Its descriptor sets were freed with the upload batches
+	downsampler.reset();
+	frameRing.reset();
 
-	vkDestroyBuffer(device, vertexBuffer, nullptr);
-	vkFreeMemory(device, vertexBufferMemory, nullptr);
+	meshArena.reset();
 
 	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
 	{
@@ -1073,8 +1747,23 @@ void VulkanInitializer::cleanUp()
 		vkDestroyFence(device, inFlightFences[i], nullptr);
 	}
 
+	for (std::vector<SecondaryRecorder>& frameRecorders : secondaryRecorders)
+	{
+		for (SecondaryRecorder& recorder : frameRecorders)
+		{
+			vkDestroyCommandPool(device, recorder.commandPool, nullptr);
+		}
+	}
+	threadPool.reset();
+
 	vkDestroyCommandPool(device, commandPool, nullptr);
 
+	uploader.reset();
+	allocator.reset();
+
+	pipelineCache->save();
+	pipelineCache.reset();
+
 	vkDestroyDevice(device, nullptr);
 
 	if (enableValidationLayers)
@@ -1121,6 +1810,20 @@ std::vector<const char*> VulkanInitializer::getRequiredExtensions()
 		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 	}
 
+	uint32_t extensionCount = 0;
+	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, availableExtensions.data());
+
+	for (const auto& extension : availableExtensions)
+	{
+		if (strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0)
+		{
+			physicalDeviceProperties2 = true;
+			extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+		}
+	}
+
 	return extensions;
 }
 
@@ -1214,6 +1917,42 @@ QueueFamilyIndices VulkanInitializer::findQueueFamilies(VkPhysicalDevice device)
 		i++;
 	}
 
+	if (!indices.graphicsFamily.has_value())
+	{
+		return indices;
+	}
+
+	/*
+	A family with only the transfer bit is usually backed by the copy engines and can run uploads
+	concurrently with rendering. Otherwise any other family works (graphics and compute families
+	implicitly support transfers), and as a last resort uploads share the graphics queue.
+	*/
+	for (uint32_t j = 0; j < queueFamilyCount; j++)
+	{
+		VkQueueFlags flags = queueFamilies[j].queueFlags;
+
+		if (queueFamilies[j].queueCount == 0 || j == indices.graphicsFamily.value())
+		{
+			continue;
+		}
+
+		if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+		{
+			indices.transferFamily = j;
+			break;
+		}
+
+		if (!indices.transferFamily.has_value() && (flags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+		{
+			indices.transferFamily = j;
+		}
+	}
+
+	if (!indices.transferFamily.has_value())
+	{
+		indices.transferFamily = indices.graphicsFamily;
+	}
+
 	return indices;
 }
 
@@ -1357,50 +2096,46 @@ VkShaderModule VulkanInitializer::createShaderModule(const std::vector<char>& co
 
 void VulkanInitializer::cleanupSwapChain()
 {
-	vkDestroyImageView(device, colorImageView, nullptr);
-	vkDestroyImage(device, colorImage, nullptr);
-	vkFreeMemory(device, colorImageMemory, nullptr);
+	// Everything sized to the swap chain, the swap chain itself is retired by createSwapchain
+	VkDevice device = this->device;
+	VulkanAllocator* allocator = this->allocator.get();
 
-	vkDestroyImageView(device, depthImageView, nullptr);
-	vkDestroyImage(device, depthImage, nullptr);
-	vkFreeMemory(device, depthImageMemory, nullptr);
+	VkImageView colorView = colorImageView;
+	VkImage color = colorImage;
+	MemoryAllocation colorMemory = colorImageMemory;
 
-	for (size_t i = 0; i < swapChainFramebuffers.size(); i++)
-	{
-		vkDestroyFramebuffer(device, swapChainFramebuffers[i], nullptr);
-	}
+	VkImageView depthView = depthImageView;
+	VkImage depth = depthImage;
+	MemoryAllocation depthMemory = depthImageMemory;
 
-	vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+	std::vector<VkFramebuffer> framebuffers = std::move(swapChainFramebuffers);
+	std::vector<VkImageView> imageViews = std::move(swapChainImageViews);
+	swapChainFramebuffers.clear();
+	swapChainImageViews.clear();
 
-	vkDestroyPipeline(device, graphicsPipeline, nullptr);
-	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-	vkDestroyRenderPass(device, renderPass, nullptr);
-
-	for (size_t i = 0; i < swapChainImageViews.size(); i++)
+	deletionQueue->push(frameNumber, [=]() mutable
 	{
-		vkDestroyImageView(device, swapChainImageViews[i], nullptr);
-	}
+		vkDestroyImageView(device, colorView, nullptr);
+		vkDestroyImage(device, color, nullptr);
+		allocator->free(colorMemory);
 
-	vkDestroySwapchainKHR(device, swapChain, nullptr);
-}
+		vkDestroyImageView(device, depthView, nullptr);
+		vkDestroyImage(device, depth, nullptr);
+		allocator->free(depthMemory);
 
-uint32_t VulkanInitializer::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
-{
-	VkPhysicalDeviceMemoryProperties memProperties;
-	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-	
-	for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
-	{
-		if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+		for (size_t i = 0; i < framebuffers.size(); i++)
 		{
-			return i;
+			vkDestroyFramebuffer(device, framebuffers[i], nullptr);
 		}
-	}
 
-	throw std::runtime_error("failed to find suitable memory type!");
+		for (size_t i = 0; i < imageViews.size(); i++)
+		{
+			vkDestroyImageView(device, imageViews[i], nullptr);
+		}
+	});
 }
 
-void VulkanInitializer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer & buffer, VkDeviceMemory & bufferMemory)
+void VulkanInitializer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer & buffer, MemoryAllocation & bufferMemory)
 {
 	VkBufferCreateInfo bufferInfo = {};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -1416,71 +2151,43 @@ void VulkanInitializer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage
 	VkMemoryRequirements memRequirements;
 	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
 	/*
-	TODO: Memory allocation note
-	It should be noted that in a real world application, you're not supposed to actually call
-	vkAllocateMemory for every individual buffer. The maximum number of simultaneous memory 
-	allocations is limited by the maxMemoryAllocationCount physical device limit, which may 
-	be as low as 4096 even on high end hardware like an NVIDIA GTX 1080. The right way to 
-	allocate memory for a large number of objects at the same time is to create a custom 
-	allocator that splits up a single allocation among many different objects by using the 
-	offset parameters that we've seen in many functions.
-
-	You can either implement such an allocator yourself, or use the VulkanMemoryAllocator 
-	library provided by the GPUOpen initiative. However, for this tutorial it's okay to use
-	a separate allocation for every resource, because we won't come close to hitting any of 
-	these limits for now.
+	Memory is sub-allocated from large per memory type blocks instead of calling vkAllocateMemory
+	for every buffer, which would quickly run into the maxMemoryAllocationCount limit.
 	*/
+	bufferMemory = allocator->allocate(memRequirements, properties, AllocationKind::Linear);
 
-	if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS)
-	{
-		throw std::runtime_error("failed to allocate vertex buffer memory!");
-	}
-
-	vkBindBufferMemory(device, buffer, bufferMemory, 0);
+	vkBindBufferMemory(device, buffer, bufferMemory.memory, bufferMemory.offset);
 }
 
-void VulkanInitializer::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+/*
+All of the helper functions that used to submit commands waited for the queue to become idle.
+They now record into the setup command buffer of the uploader instead, and flushSetupCommands
+executes everything that has been recorded so far in a single asynchronous submission, handed
+over to the graphics queue right away since the first frame needs all of it.
+*/
+void VulkanInitializer::createUploader()
 {
-	/*
-	Memory transfer operations are executed using command buffers, just like drawing commands.
-	Therefore we must first allocate a temporary command buffer.
-	You may wish to create a separate command pool for these kinds of short-lived buffers,
-	because the implementation may be able to apply memory allocation optimizations.
-	You should use the VK_COMMAND_POOL_CREATE_TRANSIENT_BIT flag during command pool generation in that case.
-	*/
-	
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+	QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
 
-	VkBufferCopy copyRegion = {};
-	copyRegion.srcOffset = 0; // Optional
-	copyRegion.dstOffset = 0; // Optional
-	copyRegion.size = size;
-	vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+	uploader = std::make_unique<VulkanUploader>(device,
+		graphicsQueue, queueFamilyIndices.graphicsFamily.value(),
+		transferQueue, queueFamilyIndices.transferFamily.value(),
+		*allocator);
+}
 
-	endSingleTimeCommands(commandBuffer);
+UploadTicket VulkanInitializer::flushSetupCommands()
+{
+	UploadTicket ticket = uploader->flush();
+	uploader->acquire(ticket);
+	return ticket;
 }
 
-/*
-TODO: All of the helper functions that submit commands so far have been set up 
-to execute synchronously by waiting for the queue to become idle. For 
-practical applications it is recommended to combine these operations in 
-a single command buffer and execute them asynchronously for higher throughput,
-especially the transitions and copy in the createTextureImage function. Try to
-experiment with this by creating a setupCommandBuffer that the helper functions
-record commands into, and add a flushSetupCommands to execute the commands that
-have been recorded so far. It's best to do this after the texture mapping works
-to check if the texture resources are still set up correctly.
-*/
-void VulkanInitializer::createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory)
+void VulkanInitializer::createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, MemoryAllocation& imageMemory, VkImageCreateFlags flags)
 {
 	VkImageCreateInfo imageInfo = {};
 	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.flags = flags;
 	imageInfo.imageType = VK_IMAGE_TYPE_2D;
 	imageInfo.extent.width = width;
 	imageInfo.extent.height = height;
@@ -1501,40 +2208,20 @@ void VulkanInitializer::createImage(uint32_t width, uint32_t height, uint32_t mi
 	VkMemoryRequirements memRequirements;
 	vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-	if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate image memory!");
-	}
+	imageMemory = allocator->allocate(memRequirements, properties, tiling == VK_IMAGE_TILING_OPTIMAL ? AllocationKind::Optimal : AllocationKind::Linear);
 
-	vkBindImageMemory(device, image, imageMemory, 0);
+	vkBindImageMemory(device, image, imageMemory.memory, imageMemory.offset);
 }
 
 void VulkanInitializer::generateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
 {
-	// Check if image format supports linear blitting
-	VkFormatProperties formatProperties;
-	vkGetPhysicalDeviceFormatProperties(physicalDevice, imageFormat, &formatProperties);
-
-	/*
-	There are two alternatives in this case. You could implement a function that searches
-	common texture image formats for one that does support linear blitting, or you could
-	implement the mipmap generation in software with a library like stb_image_resize.
-	Each mip level can then be loaded into the image in the same way that you loaded the original image.
-
-	TODO: It should be noted that it is uncommon in practice to generate the mipmap levels at runtime anyway.
-	Usually they are pregenerated and stored in the texture file alongside the base level to improve loading speed.
-	Implementing resizing in software and loading multiple levels from a file is left as an exercise to the reader.
-	*/
-	if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT))
+	// createTexture makes the chain on the CPU instead for formats that cannot be blitted
+	if (!canBlitMipmaps(imageFormat))
 	{
 		throw std::runtime_error("texture image format does not support linear blitting!");
 	}
 
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+	VkCommandBuffer commandBuffer = uploader->getGraphicsCommandBuffer();
 
 	VkImageMemoryBarrier barrier = {};
 	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -1615,52 +2302,12 @@ void VulkanInitializer::generateMipmaps(VkImage image, VkFormat imageFormat, int
 		0, nullptr,
 		0, nullptr,
 		1, &barrier);
-
-	endSingleTimeCommands(commandBuffer);
-}
-
-VkCommandBuffer VulkanInitializer::beginSingleTimeCommands()
-{
-	VkCommandBufferAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandPool = commandPool;
-	allocInfo.commandBufferCount = 1;
-
-	VkCommandBuffer commandBuffer;
-	vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
-
-	VkCommandBufferBeginInfo beginInfo = {};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-	vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-	return commandBuffer;
-}
-
-void VulkanInitializer::endSingleTimeCommands(VkCommandBuffer commandBuffer)
-{
-	vkEndCommandBuffer(commandBuffer);
-
-	VkSubmitInfo submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
-
-	vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-	/*
-	A fence would allow you to schedule multiple transfers simultaneously and wait for all of them complete,
-	instead of executing one at a time. That may give the driver more opportunities to optimize.
-	*/
-	vkQueueWaitIdle(graphicsQueue);
-	
-	vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
 }
 
 void VulkanInitializer::transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels)
 {
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+	// Preparing an image for a copy can happen on the transfer queue, attachment transitions cannot
+	VkCommandBuffer commandBuffer = newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL ? uploader->getTransferCommandBuffer() : uploader->getGraphicsCommandBuffer();
 
 	VkImageMemoryBarrier barrier = {};
 	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -1736,34 +2383,36 @@ void VulkanInitializer::transitionImageLayout(VkImage image, VkFormat format, Vk
 		0, nullptr,
 		1, &barrier
 	);
-
-	endSingleTimeCommands(commandBuffer);
 }
 
-void VulkanInitializer::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+void VulkanInitializer::copyLevelsToImage(VkBuffer buffer, VkDeviceSize bufferOffset, VkImage image, const std::vector<TextureLevel>& levels)
 {
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-	VkBufferImageCopy region = {};
-	region.bufferOffset = 0;
-	region.bufferRowLength = 0;
-	region.bufferImageHeight = 0;
-
-	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	region.imageSubresource.mipLevel = 0;
-	region.imageSubresource.baseArrayLayer = 0;
-	region.imageSubresource.layerCount = 1;
-
-	region.imageOffset = { 0, 0, 0 };
-	region.imageExtent = {
-		width,
-		height,
-		1
-	};
-
-	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	VkCommandBuffer commandBuffer = uploader->getTransferCommandBuffer();
+
+	// One region per level, all in a single copy
+	std::vector<VkBufferImageCopy> regions(levels.size());
+	for (size_t i = 0; i < levels.size(); i++)
+	{
+		VkBufferImageCopy& region = regions[i];
+		region = {};
+		region.bufferOffset = bufferOffset + levels[i].offset;
+		region.bufferRowLength = 0;
+		region.bufferImageHeight = 0;
+
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = static_cast<uint32_t>(i);
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+
+		region.imageOffset = { 0, 0, 0 };
+		region.imageExtent = {
+			levels[i].width,
+			levels[i].height,
+			1
+		};
+	}
 
-	endSingleTimeCommands(commandBuffer);
+	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
 }
 
 VkImageView VulkanInitializer::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels)
@@ -1838,3 +2487,47 @@ VkSampleCountFlagBits VulkanInitializer::getMaxUsableSampleCount()
 
 	return VK_SAMPLE_COUNT_1_BIT;
 }
+
+void VulkanInitializer::queryTextureFormatSupport()
+{
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
+	textureFormatSupport = {};
+	if (!supportedFeatures.textureCompressionBC)
+	{
+		return;
+	}
+
+	// The feature promises all BC formats, the format properties still say how they can be used
+	auto isSupported = [&](TextureFormat format)
+	{
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, getTextureFormat(format), &properties);
+
+		VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+		return (properties.optimalTilingFeatures & required) == required;
+	};
+
+	textureFormatSupport.bc1 = isSupported(TextureFormat::Bc1);
+	textureFormatSupport.bc3 = isSupported(TextureFormat::Bc3);
+	textureFormatSupport.bc7 = isSupported(TextureFormat::Bc7);
+}
+
+VkFormat VulkanInitializer::getTextureFormat(TextureFormat format)
+{
+	switch (format)
+	{
+	case TextureFormat::Rgba8:
+		return VK_FORMAT_R8G8B8A8_UNORM;
+	case TextureFormat::Bc1:
+		// Only opaque images are cooked to BC1
+		return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+	case TextureFormat::Bc3:
+		return VK_FORMAT_BC3_UNORM_BLOCK;
+	case TextureFormat::Bc7:
+		return VK_FORMAT_BC7_UNORM_BLOCK;
+	}
+
+	throw std::runtime_error("unknown texture format!");
+}
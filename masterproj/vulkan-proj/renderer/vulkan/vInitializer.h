@@ -21,10 +21,25 @@
 #include <chrono>
 #include <thread>
 
+#include "vAllocator.h"
+#include "vCuller.h"
+#include "vDeletionQueue.h"
+#include "vDownsampler.h"
+#include "vFrameRing.h"
+#include "vInstanceBuffer.h"
+#include "vMeshArena.h"
+#include "vPipelineCache.h"
+#include "vTextureStreamer.h"
+#include "vTextureTable.h"
+#include "vUploader.h"
+
 #include "../VideoInfo.h"
+#include "../../model/AssetLoader.h"
+#include "../../model/MipGenerator.h"
 #include "../../model/ModelLoader.h"
 #include "../../camera/Camera.h"
-#include "../../model/TextureLoader.h"
+#include "../../scene/Scene.h"
+#include "../../util/ThreadPool.h"
 
 #ifdef NDEBUG
 const bool enableValidationLayers = false;
@@ -36,6 +51,8 @@ struct QueueFamilyIndices
 {
 	std::optional<uint32_t> graphicsFamily;
 	std::optional<uint32_t> presentFamily;
+	// Falls back to the graphics family if the device has no separate transfer family
+	std::optional<uint32_t> transferFamily;
 
 	bool isComplete()
 	{
@@ -58,7 +75,15 @@ public:
 	~VulkanInitializer();
 
 	void setWindow(GLFWwindow* w);
-	void setInput(std::shared_ptr<ModelLoader> ml);
+	void setAssets(std::shared_ptr<AssetLoader> loader);
+	void setScene(std::shared_ptr<Scene> s);
+	void setCullingMode(CullingMode mode);
+	void setMipmapMode(MipmapMode mode);
+	// Device memory for the levels of streamed textures, 0 uploads every texture whole
+	void setTextureBudget(VkDeviceSize budget);
+	// Shared with the asset loaders, set before createCommandBuffers. Without one the renderer
+	// makes its own
+	void setThreadPool(std::shared_ptr<ThreadPool> pool);
 
 	/* Instance */
 	void createInstance();
@@ -68,6 +93,8 @@ public:
 
 	/* Physical devices and queue families */
 	void pickPhysicalDevice();
+	// Block compressed formats the picked device samples with linear filtering
+	TextureFormatSupport getTextureFormatSupport() const { return textureFormatSupport; }
 
 	/* Logical devices and queues */
 	void createLogicalDevice();
@@ -81,6 +108,10 @@ public:
 	/* Image views */
 	void createImageViews();
 
+	/* Pipeline cache */
+	void createPipelineCache();
+	void printPipelineStatistics();
+
 	/* Graphics pipeline */
 	/* Fixed functions */
 	void createGraphicsPipeline();
@@ -104,24 +135,32 @@ public:
 	bool framebufferResized = false;
 
 	/* Vertex buffer creation */
-	void createVertexBuffer();
-	void createIndexBuffer();
+	void createMeshArena();
+
+	/* Culling */
+	void createCuller();
 
 	/* Uniform buffers */
 	/* Descriptor layout and buffer */
 	void createDescriptorSetLayout();
 	void createUniformBuffer();
-	void updateUniformBuffer(uint32_t currentImage);
+	uint32_t updateUniformBuffer();
 
 	/* Descriptor pool and sets */
 	void createDescriptorPool();
 	void createDescriptorSets();
 
 	/* Images */
-	void createTextureImage();
+	void createDownsampler();
+	void createPlaceholderTexture();
+	// Needs the placeholder texture
+	void createTextureTable();
+	// Needs the texture table, streams only with descriptor indexing
+	void createTextureStreamer();
+	// GPU time of the blit chain against the compute pass for a few sizes, printed to stdout
+	void benchmarkMipmaps();
 
 	/* Image view and sampler */
-	void createTextureImageView();
 	void createTextureSampler();
 
 	/* Depth buffering */
@@ -130,6 +169,13 @@ public:
 	/* Multisampling */
 	void createColorResources();
 
+	/* Memory allocation */
+	void printMemoryStatistics();
+
+	/* Setup commands */
+	void createUploader();
+	UploadTicket flushSetupCommands();
+
 	/* Clean up */
 	void cleanUp();
 
@@ -137,10 +183,13 @@ private:
 
 	/* Custom */
 	GLFWwindow* window;
-	std::shared_ptr<ModelLoader> modelLoader;
+	std::shared_ptr<Scene> scene;
+	Camera camera;
 
 	/* Instance */
 	VkInstance instance;
+	// VK_KHR_get_physical_device_properties2 is enabled, needed to query descriptor indexing
+	bool physicalDeviceProperties2 = false;
 
 	/* Validation Layers */
 	VkDebugUtilsMessengerEXT callback;
@@ -161,13 +210,27 @@ private:
 	/* Logical devices and queues */
 	VkDevice device;
 	VkQueue graphicsQueue;
+	VkQueue transferQueue;
+
+	// Optional features the culling pass can use, filled in createLogicalDevice
+	IndirectDrawSupport indirectDrawSupport;
+	// How the fragment shader picks a texture per instance, filled in createLogicalDevice
+	TextureTableSupport textureTableSupport;
+
+	/* Memory allocation */
+	std::unique_ptr<VulkanAllocator> allocator;
+	// Resources replaced while frames are in flight
+	std::unique_ptr<VulkanDeletionQueue> deletionQueue;
+
+	/* Setup commands */
+	std::unique_ptr<VulkanUploader> uploader;
 
 	/* Window surface */
 	VkSurfaceKHR surface;
 	VkQueue presentQueue;
 
 	/* Swap chain */
-	VkSwapchainKHR swapChain;
+	VkSwapchainKHR swapChain = VK_NULL_HANDLE;
 	std::vector<VkImage> swapChainImages;
 	VkFormat swapChainImageFormat;
 	VkExtent2D swapChainExtent;
@@ -182,6 +245,11 @@ private:
 	/* Image views */
 	std::vector<VkImageView> swapChainImageViews;
 
+	/* Pipeline cache */
+	// Every pipeline is created through it, written back to PIPELINE_CACHE_PATH in cleanUp
+	std::unique_ptr<VulkanPipelineCache> pipelineCache;
+	const std::string PIPELINE_CACHE_PATH = "pipeline.cache";
+
 	/* Graphics pipeline */
 	VkPipeline graphicsPipeline;
 
@@ -200,62 +268,129 @@ private:
 
 	/* Command buffers */
 	VkCommandPool commandPool;
+	// One per frame in flight, re-recorded every frame
 	std::vector<VkCommandBuffer> commandBuffers;
 
+	void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t uniformOffset);
+
+	// One per thread and frame in flight
+	struct SecondaryRecorder
+	{
+		VkCommandPool commandPool = VK_NULL_HANDLE;
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	};
+
+	std::shared_ptr<ThreadPool> threadPool;
+	std::vector<std::vector<SecondaryRecorder>> secondaryRecorders;
+	// Below this many draws per thread the extra secondary costs more than it saves
+	const uint32_t MIN_DRAWS_PER_THREAD = 64;
+
+	void recordDraws(SecondaryRecorder& recorder, uint32_t imageIndex, uint32_t uniformOffset, uint32_t firstSlot, uint32_t slotCount);
+
 	/* Rendering and presentation */
 	std::vector<VkSemaphore> imageAvailableSemaphores;
 	std::vector<VkSemaphore> renderFinishedSemaphores;
 	std::vector<VkFence> inFlightFences;
 	const size_t MAX_FRAMES_IN_FLIGHT = 2;
 	size_t currentFrame = 0;
+	uint64_t frameNumber = 0;
 
 	/* Swap chain recreation */
+	// Hands the resources sized to the swap chain to the deletion queue
 	void cleanupSwapChain();
 
 	/* Vertex buffer creation */
-	VkBuffer vertexBuffer;
-	VkDeviceMemory vertexBufferMemory;
-	VkBuffer indexBuffer;
-	VkDeviceMemory indexBufferMemory;
-	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+	// Every model in one vertex and one index buffer, mesh ids are the asset loader's model ids
+	std::unique_ptr<VulkanMeshArena> meshArena;
+	// Models are streamed in after startup, their total size is not known up front. Initial sizes,
+	// the arena grows when a model does not fit
+	const VkDeviceSize VERTEX_ARENA_SIZE = 16 * 1024 * 1024;
+	const VkDeviceSize INDEX16_ARENA_SIZE = 8 * 1024 * 1024;
+	const VkDeviceSize INDEX32_ARENA_SIZE = 16 * 1024 * 1024;
+	const VkDeviceSize CLUSTER_ARENA_SIZE = 1024 * 1024;
+
+	/* Instancing */
+	// Every batch of the scene, one region each
+	std::unique_ptr<VulkanInstanceBuffer> instanceBuffer;
+
+	void updateInstanceBuffer(VkCommandBuffer commandBuffer);
+
+	/* Culling */
+	std::unique_ptr<VulkanCuller> culler;
+	CullingMode cullingMode = CullingMode::Gpu;
 
 	/* Staging buffer */
-	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
-	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, MemoryAllocation& bufferMemory);
 
 	/* Uniform buffers */
 	/* Descriptor layout and buffer */
 	VkDescriptorSetLayout descriptorSetLayout;
 
-	std::vector<VkBuffer> uniformBuffers;
-	std::vector<VkDeviceMemory> uniformBuffersMemory;
+	// Per-frame constants, bound through a dynamic offset
+	std::unique_ptr<VulkanFrameRing> frameRing;
+	const VkDeviceSize FRAME_RING_SIZE = 1024 * 1024;
 
 	/* Descriptor pool and sets */
 	VkDescriptorPool descriptorPool;
+	// One per frame in flight, so the texture table can change while earlier frames still use theirs
 	std::vector<VkDescriptorSet> descriptorSets;
+	// Texture table generation each set was written with
+	std::vector<uint64_t> descriptorGenerations;
 
-	/* Images */
-	uint32_t m_mipLevels;
-	VkImage textureImage;
-	VkDeviceMemory textureImageMemory;
+	void updateDescriptorSet(uint32_t frame);
+
+	/* Asset streaming */
+	std::shared_ptr<AssetLoader> assets;
+	// Bytes of finished loads uploaded per frame, the first asset of a frame goes regardless
+	const VkDeviceSize ASSET_UPLOAD_BUDGET = 32 * 1024 * 1024;
 
-	void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
+	// Uploads what the loader finished, called once per frame before recording
+	void streamAssets();
+
+	/* Images */
+	struct Texture
+	{
+		VkImage image = VK_NULL_HANDLE;
+		MemoryAllocation memory;
+		VkImageView view = VK_NULL_HANDLE;
+	};
+
+	// Sampled in place of textures that have not been uploaded yet
+	Texture placeholderTexture;
+	// Indexed by the asset loader's texture id, empty until uploaded or if the table keeps a copy
+	std::vector<Texture> textures;
+	// Every texture behind binding 1, indexed by InstanceData::material
+	std::unique_ptr<VulkanTextureTable> textureTable;
+	// Cooked textures are handed to it instead of being uploaded whole, null if streaming is off
+	std::unique_ptr<VulkanTextureStreamer> textureStreamer;
+	VkDeviceSize textureBudget = 256 * 1024 * 1024;
+
+	// Records the upload and the mipmap generation into the current uploader batch
+	Texture createTexture(const TextureData& data);
+
+	void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, MemoryAllocation& imageMemory, VkImageCreateFlags flags = 0);
+	// Single dispatch alternative to generateMipmaps for RGBA8 images
+	std::unique_ptr<VulkanDownsampler> downsampler;
+	MipmapMode mipmapMode = MipmapMode::Compute;
+	const uint32_t MIPMAP_BENCHMARK_RUNS = 10;
+
+	// Blits level 0 down the chain, leaves the whole image in SHADER_READ_ONLY layout
 	void generateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels);
-	
-	VkCommandBuffer beginSingleTimeCommands();
-	void endSingleTimeCommands(VkCommandBuffer commandBuffer);
+	bool canBlitMipmaps(VkFormat format);
+	// Blits filter in the format of the image, the sRGB alias of an 8 bit format makes them average in linear light. VK_FORMAT_UNDEFINED if there is none
+	static VkFormat getSrgbFormat(VkFormat format);
 	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels);
-	void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
+	void copyLevelsToImage(VkBuffer buffer, VkDeviceSize bufferOffset, VkImage image, const std::vector<TextureLevel>& levels);
 
 	/* Image view and sampler */
-	VkImageView textureImageView;
+	// Shared by all textures
 	VkSampler textureSampler;
 
 	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels);
 
 	/* Depth buffering */
 	VkImage depthImage;
-	VkDeviceMemory depthImageMemory;
+	MemoryAllocation depthImageMemory;
 	VkImageView depthImageView;
 
 	VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
@@ -264,10 +399,16 @@ private:
 
 	/* Multisampling */
 	VkImage colorImage;
-	VkDeviceMemory colorImageMemory;
+	MemoryAllocation colorImageMemory;
 	VkImageView colorImageView;
 
 	VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
 
 	VkSampleCountFlagBits getMaxUsableSampleCount();
+
+	/* Texture formats */
+	TextureFormatSupport textureFormatSupport;
+
+	void queryTextureFormatSupport();
+	static VkFormat getTextureFormat(TextureFormat format);
 };
\ No newline at end of file
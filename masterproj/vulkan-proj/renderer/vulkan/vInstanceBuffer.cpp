@@ -0,0 +1,150 @@
+#include "vInstanceBuffer.h"
+
+#include <cstring>
+#include <stdexcept>
+
+VulkanInstanceBuffer::VulkanInstanceBuffer(VkDevice device, VulkanAllocator& allocator, VulkanUploader& uploader, VulkanDeletionQueue& deletionQueue)
+	: device(device), allocator(allocator), uploader(uploader), deletionQueue(deletionQueue)
+{
+}
+
+VulkanInstanceBuffer::~VulkanInstanceBuffer()
+{
+	if (buffer != VK_NULL_HANDLE)
+	{
+		vkDestroyBuffer(device, buffer, nullptr);
+		allocator.free(memory);
+	}
+}
+
+void VulkanInstanceBuffer::update(VkCommandBuffer commandBuffer, VulkanFrameRing& frameRing, Scene& scene, uint64_t frameNumber)
+{
+	if (needsLayout(scene))
+	{
+		reallocate(scene, frameNumber);
+		return;
+	}
+
+	VkDeviceSize dirtySize = 0;
+	for (const InstanceBatch& batch : scene.batches)
+	{
+		if (batch.isDirty())
+		{
+			dirtySize += (batch.dirtyEnd - batch.dirtyBegin) * sizeof(InstanceData);
+		}
+	}
+
+	// Rewriting most of a large scene is cheaper as a fresh buffer than as a stall on the ring
+	if (dirtySize > frameRing.getFrameSize() - frameRing.getFrameUsed())
+	{
+		reallocate(scene, frameNumber);
+		return;
+	}
+
+	for (size_t i = 0; i < scene.batches.size(); i++)
+	{
+		InstanceBatch& batch = scene.batches[i];
+		if (!batch.isDirty())
+		{
+			continue;
+		}
+
+		VkDeviceSize size = (batch.dirtyEnd - batch.dirtyBegin) * sizeof(InstanceData);
+		FrameAllocation staging = frameRing.allocate(size);
+		memcpy(staging.data, batch.instances.data() + batch.dirtyBegin, static_cast<size_t>(size));
+
+		VkBufferCopy copyRegion = {};
+		copyRegion.srcOffset = staging.offset;
+		copyRegion.dstOffset = (regions[i].firstInstance + batch.dirtyBegin) * sizeof(InstanceData);
+		copyRegion.size = size;
+		vkCmdCopyBuffer(commandBuffer, frameRing.getBuffer(), buffer, 1, &copyRegion);
+
+		batch.clearDirty();
+	}
+}
+
+bool VulkanInstanceBuffer::needsLayout(const Scene& scene) const
+{
+	if (buffer == VK_NULL_HANDLE || regions.size() < scene.batches.size())
+	{
+		return true;
+	}
+
+	for (size_t i = 0; i < scene.batches.size(); i++)
+	{
+		if (scene.batches[i].instances.size() > regions[i].capacity)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void VulkanInstanceBuffer::reallocate(Scene& scene, uint64_t frameNumber)
+{
+	if (buffer != VK_NULL_HANDLE)
+	{
+		VkDevice device = this->device;
+		VulkanAllocator& allocator = this->allocator;
+		VkBuffer oldBuffer = buffer;
+		MemoryAllocation oldMemory = memory;
+		deletionQueue.push(frameNumber, [device, &allocator, oldBuffer, oldMemory]() mutable
+		{
+			vkDestroyBuffer(device, oldBuffer, nullptr);
+			allocator.free(oldMemory);
+		});
+	}
+
+	// Regions that still fit keep their size, full ones double, so growth stays amortized
+	regions.resize(scene.batches.size());
+	uint32_t total = 0;
+	for (size_t i = 0; i < scene.batches.size(); i++)
+	{
+		uint32_t count = static_cast<uint32_t>(scene.batches[i].instances.size());
+		uint32_t regionCapacity = regions[i].capacity > 0 ? regions[i].capacity : MIN_REGION_CAPACITY;
+		while (regionCapacity < count)
+		{
+			regionCapacity *= 2;
+		}
+
+		regions[i].firstInstance = total;
+		regions[i].capacity = regionCapacity;
+		total += regionCapacity;
+	}
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = (total > 0 ? total : 1) * sizeof(InstanceData);
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create instance buffer!");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+	memory = allocator.allocate(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, AllocationKind::Linear);
+
+	vkBindBufferMemory(device, buffer, memory.memory, memory.offset);
+
+	capacity = total;
+	generation++;
+
+	// Nothing references the new buffer yet, so it can be filled on the upload queue
+	for (size_t i = 0; i < scene.batches.size(); i++)
+	{
+		InstanceBatch& batch = scene.batches[i];
+		if (!batch.instances.empty())
+		{
+			uploader.uploadBuffer(buffer, regions[i].firstInstance * sizeof(InstanceData), batch.instances.data(), batch.instances.size() * sizeof(InstanceData));
+		}
+
+		batch.clearDirty();
+	}
+
+	uploadTicket = uploader.getCurrentTicket();
+}
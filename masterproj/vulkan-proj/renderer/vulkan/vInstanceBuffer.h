@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "vAllocator.h"
+#include "vDeletionQueue.h"
+#include "vFrameRing.h"
+#include "vUploader.h"
+#include "../../scene/Scene.h"
+
+// Slice of the instance buffer owned by one batch, in instances
+struct InstanceRegion
+{
+	uint32_t firstInstance = 0;
+	uint32_t capacity = 0;
+};
+
+/*
+Device local copy of every InstanceBatch of the scene, one region per batch in a single buffer.
+It is read by the culling pass as a storage buffer (and usable as a per-instance vertex stream).
+Only the dirty range of each batch is copied each frame, staged through the frame ring and
+recorded into the frame's command buffer. When a batch outgrows its region (or the dirty ranges
+do not fit into the frame ring) the regions are laid out again in a new buffer that is filled
+through the uploader; the old one goes to the deletion queue. The frame that reallocates reads
+the new buffer already, so it has to acquire the upload ticket before it is submitted.
+*/
+class VulkanInstanceBuffer
+{
+public:
+	VulkanInstanceBuffer(VkDevice device, VulkanAllocator& allocator, VulkanUploader& uploader, VulkanDeletionQueue& deletionQueue);
+	~VulkanInstanceBuffer();
+
+	/*
+	Must be recorded outside of a render pass, between a barrier that waits for readers of
+	earlier frames and one that makes the transfer writes visible to them.
+	Clears the dirty ranges of all batches.
+	*/
+	void update(VkCommandBuffer commandBuffer, VulkanFrameRing& frameRing, Scene& scene, uint64_t frameNumber);
+
+	VkBuffer getBuffer() const { return buffer; }
+	uint32_t getCapacity() const { return capacity; }
+	const InstanceRegion& getRegion(size_t batch) const { return regions[batch]; }
+
+	// Changes whenever the buffer is replaced, descriptors referencing it have to be rewritten
+	uint64_t getGeneration() const { return generation; }
+	// Batch that filled the current buffer
+	UploadTicket getUploadTicket() const { return uploadTicket; }
+
+private:
+	static const uint32_t MIN_REGION_CAPACITY = 64;
+
+	VkDevice device;
+	VulkanAllocator& allocator;
+	VulkanUploader& uploader;
+	VulkanDeletionQueue& deletionQueue;
+
+	VkBuffer buffer = VK_NULL_HANDLE;
+	MemoryAllocation memory;
+	uint32_t capacity = 0;
+	uint64_t generation = 0;
+	UploadTicket uploadTicket = 0;
+
+	std::vector<InstanceRegion> regions;
+
+	bool needsLayout(const Scene& scene) const;
+	void reallocate(Scene& scene, uint64_t frameNumber);
+};
@@ -0,0 +1,306 @@
+#include "vMeshArena.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+VulkanMeshArena::VulkanMeshArena(VkDevice device, VulkanAllocator& allocator, VulkanUploader& uploader, VulkanDeletionQueue& deletionQueue, VkDeviceSize vertexCapacity, VkDeviceSize index16Capacity, VkDeviceSize index32Capacity, VkDeviceSize clusterCapacity)
+	: device(device), allocator(allocator), uploader(uploader), deletionQueue(deletionQueue)
+{
+	this->vertexCapacity = static_cast<uint32_t>(vertexCapacity / RenderVertexLayout::STRIDE);
+	index16.capacity = static_cast<uint32_t>(index16Capacity / sizeof(uint16_t));
+	index32.capacity = static_cast<uint32_t>(index32Capacity / sizeof(uint32_t));
+	this->clusterCapacity = static_cast<uint32_t>(clusterCapacity / sizeof(ClusterData));
+
+	// Never empty, so growing can double them and the culling descriptor set always has a cluster buffer
+	this->vertexCapacity = std::max(this->vertexCapacity, 1u);
+	index16.capacity = std::max(index16.capacity, 1u);
+	index32.capacity = std::max(index32.capacity, 1u);
+	this->clusterCapacity = std::max(this->clusterCapacity, 1u);
+
+	vertexBuffer = createBuffer(VkDeviceSize(this->vertexCapacity) * RenderVertexLayout::STRIDE, VERTEX_USAGE, vertexMemory);
+	index16.buffer = createBuffer(VkDeviceSize(index16.capacity) * sizeof(uint16_t), INDEX_USAGE, index16.memory);
+	index32.buffer = createBuffer(VkDeviceSize(index32.capacity) * sizeof(uint32_t), INDEX_USAGE, index32.memory);
+	clusterBuffer = createBuffer(VkDeviceSize(this->clusterCapacity) * sizeof(ClusterData), CLUSTER_USAGE, clusterMemory);
+
+	drawnVertexBuffer = vertexBuffer;
+	drawnIndex16Buffer = index16.buffer;
+	drawnIndex32Buffer = index32.buffer;
+	drawnClusterBuffer = clusterBuffer;
+}
+
+VulkanMeshArena::~VulkanMeshArena()
+{
+	// The newest buffers are destroyed below, the ones they replace are still waiting here
+	for (PendingMove& move : pendingMoves)
+	{
+		vkDestroyBuffer(device, move.oldBuffer, nullptr);
+		allocator.free(move.oldMemory);
+	}
+
+	for (IndexArena* arena : { &index16, &index32 })
+	{
+		vkDestroyBuffer(device, arena->buffer, nullptr);
+		allocator.free(arena->memory);
+	}
+
+	vkDestroyBuffer(device, clusterBuffer, nullptr);
+	allocator.free(clusterMemory);
+
+	vkDestroyBuffer(device, vertexBuffer, nullptr);
+	allocator.free(vertexMemory);
+}
+
+void VulkanMeshArena::addMesh(uint32_t id, const Model& model)
+{
+	bool pending = std::any_of(pendingMeshes.begin(), pendingMeshes.end(), [id](const PendingMesh& mesh) { return !mesh.placeholder && mesh.id == id; });
+	if (isLoaded(id) || pending)
+	{
+		throw std::runtime_error("mesh id is already in use!");
+	}
+
+	MeshRange mesh = upload(model);
+
+	// Taken after recording, the staging allocations may have flushed earlier batches
+	pendingMeshes.push_back({ uploader.getCurrentTicket(), id, false, mesh });
+}
+
+void VulkanMeshArena::setPlaceholder(const Model& model)
+{
+	MeshRange mesh = upload(model);
+	pendingMeshes.push_back({ uploader.getCurrentTicket(), 0, true, mesh });
+}
+
+void VulkanMeshArena::update(uint64_t frameNumber)
+{
+	// Moves first, a completed mesh may already live in the new buffers
+	size_t moveCount = 0;
+	while (moveCount < pendingMoves.size() && uploader.isComplete(pendingMoves[moveCount].ticket))
+	{
+		PendingMove& move = pendingMoves[moveCount++];
+		*move.drawn = move.newBuffer;
+
+		// Frames in flight still bind it
+		VkDevice device = this->device;
+		VulkanAllocator& allocator = this->allocator;
+		VkBuffer oldBuffer = move.oldBuffer;
+		MemoryAllocation oldMemory = move.oldMemory;
+		deletionQueue.push(frameNumber, [device, &allocator, oldBuffer, oldMemory]() mutable
+		{
+			vkDestroyBuffer(device, oldBuffer, nullptr);
+			allocator.free(oldMemory);
+		});
+	}
+	pendingMoves.erase(pendingMoves.begin(), pendingMoves.begin() + moveCount);
+
+	size_t meshCount = 0;
+	while (meshCount < pendingMeshes.size() && uploader.isComplete(pendingMeshes[meshCount].ticket))
+	{
+		PendingMesh& pending = pendingMeshes[meshCount++];
+
+		if (pending.placeholder)
+		{
+			placeholder = pending.mesh;
+			hasPlaceholder = true;
+			continue;
+		}
+
+		if (pending.id >= meshes.size())
+		{
+			meshes.resize(pending.id + 1);
+			loaded.resize(pending.id + 1, false);
+		}
+
+		meshes[pending.id] = pending.mesh;
+		loaded[pending.id] = true;
+	}
+	pendingMeshes.erase(pendingMeshes.begin(), pendingMeshes.begin() + meshCount);
+}
+
+const MeshRange* VulkanMeshArena::findMesh(uint32_t id) const
+{
+	if (isLoaded(id))
+	{
+		return &meshes[id];
+	}
+
+	return hasPlaceholder ? &placeholder : nullptr;
+}
+
+MeshRange VulkanMeshArena::upload(const Model& model)
+{
+	uint32_t modelVertexCount = model.getVertexCount();
+	uint32_t modelIndexCount = model.getIndexCount();
+	uint32_t modelClusterCount = static_cast<uint32_t>(model.clusters.size());
+
+	VkIndexType indexType = chooseIndexType(modelVertexCount);
+	IndexArena& indices = indexType == VK_INDEX_TYPE_UINT16 ? index16 : index32;
+
+	MeshRange mesh;
+	mesh.quantization = RenderVertexLayout::getQuantization(model);
+
+	// Packed and narrowed straight into the upload ring, the copies execute with the next flush.
+	// Models from the mesh cache are read out of the mapped file here. Packing may throw, so it
+	// goes before anything in the arena changes.
+	VkDeviceSize vertexBytes = VkDeviceSize(modelVertexCount) * RenderVertexLayout::STRIDE;
+	StagingRegion vertexStaging = uploader.allocateStaging(vertexBytes);
+	RenderVertexLayout::pack(model.getVertices(), modelVertexCount, mesh.quantization, vertexStaging.data);
+
+	// The moves of grown buffers are recorded ahead of the copies below
+	reserve(vertexBuffer, vertexMemory, drawnVertexBuffer, vertexCapacity, vertexCount, modelVertexCount, RenderVertexLayout::STRIDE, VERTEX_USAGE);
+	if (indexType == VK_INDEX_TYPE_UINT16)
+	{
+		reserve(indices.buffer, indices.memory, drawnIndex16Buffer, indices.capacity, indices.count, modelIndexCount, sizeof(uint16_t), INDEX_USAGE);
+	}
+	else
+	{
+		reserve(indices.buffer, indices.memory, drawnIndex32Buffer, indices.capacity, indices.count, modelIndexCount, sizeof(uint32_t), INDEX_USAGE);
+	}
+	reserve(clusterBuffer, clusterMemory, drawnClusterBuffer, clusterCapacity, static_cast<uint32_t>(clusters.size()), modelClusterCount, sizeof(ClusterData), CLUSTER_USAGE);
+
+	mesh.indexType = indexType;
+	if (model.lods.empty())
+	{
+		mesh.lods[0].firstIndex = indices.count;
+		mesh.lods[0].indexCount = modelIndexCount;
+	}
+	else
+	{
+		mesh.lodCount = static_cast<uint32_t>(std::min<size_t>(model.lods.size(), Model::MAX_LOD_COUNT));
+		for (uint32_t i = 0; i < mesh.lodCount; i++)
+		{
+			mesh.lods[i] = model.lods[i];
+			mesh.lods[i].firstIndex += indices.count;
+		}
+	}
+	mesh.firstCluster = static_cast<uint32_t>(clusters.size());
+	mesh.clusterCount = modelClusterCount;
+	for (const MeshCluster& cluster : model.clusters)
+	{
+		ClusterData data = {};
+		data.boundingSphere = cluster.boundingSphere;
+		data.cone = cluster.cone;
+		data.firstIndex = cluster.firstIndex + indices.count;
+		data.indexCount = cluster.indexCount;
+		clusters.push_back(data);
+	}
+	mesh.vertexOffset = static_cast<int32_t>(vertexCount);
+	mesh.vertexCount = modelVertexCount;
+	mesh.boundingSphere = model.boundingSphere;
+
+	uploader.copyBuffer(vertexStaging, vertexBuffer, VkDeviceSize(vertexCount) * RenderVertexLayout::STRIDE, vertexBytes);
+
+	if (indexType == VK_INDEX_TYPE_UINT16)
+	{
+		VkDeviceSize indexBytes = VkDeviceSize(modelIndexCount) * sizeof(uint16_t);
+		StagingRegion indexStaging = uploader.allocateStaging(indexBytes);
+
+		const uint32_t* source = model.getIndices();
+		uint16_t* destination = static_cast<uint16_t*>(indexStaging.data);
+		for (uint32_t i = 0; i < modelIndexCount; i++)
+		{
+			destination[i] = static_cast<uint16_t>(source[i]);
+		}
+
+		uploader.copyBuffer(indexStaging, indices.buffer, VkDeviceSize(indices.count) * sizeof(uint16_t), indexBytes);
+	}
+	else
+	{
+		uploader.uploadBuffer(indices.buffer, VkDeviceSize(indices.count) * sizeof(uint32_t), model.getIndices(), VkDeviceSize(modelIndexCount) * sizeof(uint32_t));
+	}
+
+	if (modelClusterCount > 0)
+	{
+		uploader.uploadBuffer(clusterBuffer, VkDeviceSize(mesh.firstCluster) * sizeof(ClusterData), clusters.data() + mesh.firstCluster, VkDeviceSize(modelClusterCount) * sizeof(ClusterData));
+	}
+
+	vertexCount += mesh.vertexCount;
+	indices.count += modelIndexCount;
+
+	return mesh;
+}
+
+void VulkanMeshArena::bind(VkCommandBuffer commandBuffer) const
+{
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &drawnVertexBuffer, &offset);
+}
+
+void VulkanMeshArena::bindIndices(VkCommandBuffer commandBuffer, VkIndexType indexType) const
+{
+	vkCmdBindIndexBuffer(commandBuffer, indexType == VK_INDEX_TYPE_UINT16 ? drawnIndex16Buffer : drawnIndex32Buffer, 0, indexType);
+}
+
+void VulkanMeshArena::reserve(VkBuffer& buffer, MemoryAllocation& memory, VkBuffer& drawn, uint32_t& capacity, uint32_t used, uint32_t count, VkDeviceSize elementSize, VkBufferUsageFlags usage)
+{
+	uint64_t required = uint64_t(used) + count;
+	if (required <= capacity)
+	{
+		return;
+	}
+
+	uint64_t newCapacity = capacity;
+	while (newCapacity < required)
+	{
+		newCapacity *= 2;
+	}
+	if (newCapacity > UINT32_MAX)
+	{
+		throw std::runtime_error("mesh arena is out of space!");
+	}
+
+	MemoryAllocation newMemory;
+	VkBuffer newBuffer = createBuffer(newCapacity * elementSize, usage, newMemory);
+
+	if (used > 0)
+	{
+		VkCommandBuffer commandBuffer = uploader.getGraphicsCommandBuffer();
+
+		// Uploads into the old buffer may still be in this batch, on a transfer queue they were
+		// acquired by the graphics queue just before
+		VkMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			1, &barrier,
+			0, nullptr,
+			0, nullptr);
+
+		VkBufferCopy copyRegion = {};
+		copyRegion.size = VkDeviceSize(used) * elementSize;
+		vkCmdCopyBuffer(commandBuffer, buffer, newBuffer, 1, &copyRegion);
+	}
+
+	// Frames bind the old buffer until the copy is complete, update() retires it then
+	pendingMoves.push_back({ uploader.getCurrentTicket(), &drawn, newBuffer, buffer, memory });
+
+	buffer = newBuffer;
+	memory = newMemory;
+	capacity = static_cast<uint32_t>(newCapacity);
+}
+
+VkBuffer VulkanMeshArena::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, MemoryAllocation& memory)
+{
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkBuffer buffer;
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create mesh arena buffer!");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+	memory = allocator.allocate(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, AllocationKind::Linear);
+
+	vkBindBufferMemory(device, buffer, memory.memory, memory.offset);
+
+	return buffer;
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "vAllocator.h"
+#include "vDeletionQueue.h"
+#include "vUploader.h"
+#include "../../model/ModelLoader.h"
+#include "../../model/VertexLayout.h"
+
+// One cluster of LOD 0 as the culling shader reads it, has to match ClusterData in cull.comp
+struct ClusterData
+{
+	glm::vec4 boundingSphere;
+	glm::vec4 cone;
+	// In the index buffer of the mesh
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	uint32_t pad[2];
+};
+
+// Where a mesh lives inside the arena, in elements rather than bytes
+struct MeshRange
+{
+	// Index ranges are in the index buffer of indexType
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+	// LOD 0 is the full mesh, all levels share the vertices
+	uint32_t lodCount = 1;
+	MeshLod lods[Model::MAX_LOD_COUNT];
+	// Clusters of LOD 0 in the cluster buffer, none for meshes imported without
+	uint32_t firstCluster = 0;
+	uint32_t clusterCount = 0;
+	int32_t vertexOffset = 0;
+	uint32_t vertexCount = 0;
+	// Model space, xyz center and w radius, used for culling
+	glm::vec4 boundingSphere = glm::vec4(0.0f);
+	// Turns the stored positions back into model space
+	MeshQuantization quantization;
+};
+
+/*
+One device local vertex buffer and two index buffers, 16 and 32 bit, shared by every mesh.
+Meshes are appended back to back and addressed by (firstIndex, vertexOffset, indexCount) of one of
+their levels of detail, so the whole scene is drawn after binding the arena once per index type.
+Indices stay relative to their own mesh; vertexOffset rebases them at draw time, which is what
+lets every mesh with at most 65536 vertices use 16 bit indices.
+
+Vertices are stored in RenderVertexLayout, packed from the imported vertices straight into
+staging memory. The clusters of every mesh go to a storage buffer for the culling shader, with a
+copy kept on the CPU for CPU culling.
+
+Mesh ids are given by the caller and may be added in any order, e.g. as background loads finish.
+Ids without a mesh resolve to the placeholder mesh if one is set.
+
+Uploads land on the uploader's own timeline. A mesh is only drawn, and its id only stops resolving
+to the placeholder, from the update() after the uploader reports its batch complete.
+
+A buffer a mesh does not fit into is replaced by one of twice the size, or more if needed. The
+meshes already in it are copied over on the GPU at the start of the graphics side of the upload
+batch. Frames keep binding the old buffer until that batch is complete, then it goes to the
+deletion queue while the frames in flight finish with it.
+*/
+class VulkanMeshArena
+{
+public:
+	// Initial capacities in bytes
+	VulkanMeshArena(VkDevice device, VulkanAllocator& allocator, VulkanUploader& uploader, VulkanDeletionQueue& deletionQueue, VkDeviceSize vertexCapacity, VkDeviceSize index16Capacity, VkDeviceSize index32Capacity, VkDeviceSize clusterCapacity);
+	~VulkanMeshArena();
+
+	// The upload is recorded into the current uploader batch, the mesh is drawn once it is complete
+	void addMesh(uint32_t id, const Model& model);
+	// Drawn for every id without a mesh
+	void setPlaceholder(const Model& model);
+
+	// Once per frame before recording, switches to the meshes and buffers of completed uploads
+	void update(uint64_t frameNumber);
+
+	// The mesh, the placeholder if it has not been added, null if there is neither
+	const MeshRange* findMesh(uint32_t id) const;
+	bool isLoaded(uint32_t id) const { return id < loaded.size() && loaded[id]; }
+
+	VkBuffer getClusterBuffer() const { return drawnClusterBuffer; }
+	const std::vector<ClusterData>& getClusters() const { return clusters; }
+
+	// Binds the vertex arena to binding 0
+	void bind(VkCommandBuffer commandBuffer) const;
+	// Binds the index arena of the given type
+	void bindIndices(VkCommandBuffer commandBuffer, VkIndexType indexType) const;
+
+	static VkIndexType chooseIndexType(uint32_t vertexCount) { return vertexCount <= 65536 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32; }
+
+private:
+	VkDevice device;
+	VulkanAllocator& allocator;
+	VulkanUploader& uploader;
+	VulkanDeletionQueue& deletionQueue;
+
+	static const VkBufferUsageFlags VERTEX_USAGE = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	static const VkBufferUsageFlags INDEX_USAGE = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	static const VkBufferUsageFlags CLUSTER_USAGE = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+	VkBuffer vertexBuffer;
+	MemoryAllocation vertexMemory;
+	struct IndexArena
+	{
+		VkBuffer buffer = VK_NULL_HANDLE;
+		MemoryAllocation memory;
+		// In elements
+		uint32_t capacity = 0;
+		uint32_t count = 0;
+	};
+
+	IndexArena index16;
+	IndexArena index32;
+
+	VkBuffer clusterBuffer;
+	MemoryAllocation clusterMemory;
+	uint32_t clusterCapacity;
+	std::vector<ClusterData> clusters;
+
+	// In elements
+	uint32_t vertexCapacity;
+	uint32_t vertexCount = 0;
+
+	// What frames bind, lags behind the buffers above while their moves are being uploaded
+	VkBuffer drawnVertexBuffer;
+	VkBuffer drawnIndex16Buffer;
+	VkBuffer drawnIndex32Buffer;
+	VkBuffer drawnClusterBuffer;
+
+	std::vector<MeshRange> meshes;
+	std::vector<bool> loaded;
+	MeshRange placeholder;
+	bool hasPlaceholder = false;
+
+	// Recorded but not complete yet, applied in order by update()
+	struct PendingMesh
+	{
+		UploadTicket ticket;
+		uint32_t id;
+		bool placeholder;
+		MeshRange mesh;
+	};
+	struct PendingMove
+	{
+		UploadTicket ticket;
+		VkBuffer* drawn;
+		VkBuffer newBuffer;
+		VkBuffer oldBuffer;
+		MemoryAllocation oldMemory;
+	};
+	std::vector<PendingMesh> pendingMeshes;
+	std::vector<PendingMove> pendingMoves;
+
+	MeshRange upload(const Model& model);
+	VkBuffer createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, MemoryAllocation& memory);
+	// Makes room for count more elements after the used ones, moving the buffer if it has to grow
+	void reserve(VkBuffer& buffer, MemoryAllocation& memory, VkBuffer& drawn, uint32_t& capacity, uint32_t used, uint32_t count, VkDeviceSize elementSize, VkBufferUsageFlags usage);
+};
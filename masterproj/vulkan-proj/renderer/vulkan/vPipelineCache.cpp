@@ -0,0 +1,202 @@
+#include "vPipelineCache.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+VulkanPipelineCache::VulkanPipelineCache(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& path)
+	: device(device), path(path)
+{
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	std::vector<char> data;
+
+	std::ifstream file(path, std::ios::ate | std::ios::binary);
+	if (!file.is_open())
+	{
+		rejectReason = "no cache file";
+	}
+	else
+	{
+		size_t fileSize = static_cast<size_t>(file.tellg());
+		file.seekg(0);
+
+		FileHeader header = {};
+		if (fileSize < sizeof(header) || !file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+		{
+			rejectReason = "truncated file";
+		}
+		else if (header.magic != FILE_MAGIC || header.version != FILE_VERSION || header.dataSize != fileSize - sizeof(header))
+		{
+			rejectReason = "unknown file format";
+		}
+		else
+		{
+			data.resize(static_cast<size_t>(header.dataSize));
+			if (!file.read(data.data(), data.size()))
+			{
+				rejectReason = "truncated file";
+				data.clear();
+			}
+			else if (!isCompatible(data.data(), data.size()))
+			{
+				data.clear();
+			}
+			else
+			{
+				coldMilliseconds = header.coldMilliseconds;
+			}
+		}
+	}
+
+	VkPipelineCacheCreateInfo cacheInfo = {};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.initialDataSize = data.size();
+	cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+	if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &cache) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create pipeline cache!");
+	}
+
+	loaded = !data.empty();
+	loadedSize = data.size();
+}
+
+VulkanPipelineCache::~VulkanPipelineCache()
+{
+	vkDestroyPipelineCache(device, cache, nullptr);
+}
+
+bool VulkanPipelineCache::isCompatible(const char* data, size_t size)
+{
+	// VkPipelineCacheHeaderVersionOne, the layout is fixed by the specification
+	const size_t headerSize = 16 + VK_UUID_SIZE;
+	if (size < headerSize)
+	{
+		rejectReason = "truncated cache header";
+		return false;
+	}
+
+	uint32_t length, version, vendorID, deviceID;
+	memcpy(&length, data, 4);
+	memcpy(&version, data + 4, 4);
+	memcpy(&vendorID, data + 8, 4);
+	memcpy(&deviceID, data + 12, 4);
+
+	if (length < headerSize || version != static_cast<uint32_t>(VK_PIPELINE_CACHE_HEADER_VERSION_ONE))
+	{
+		rejectReason = "unknown cache header";
+		return false;
+	}
+
+	if (vendorID != properties.vendorID || deviceID != properties.deviceID)
+	{
+		rejectReason = "written by another device";
+		return false;
+	}
+
+	if (memcmp(data + 16, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+	{
+		rejectReason = "written by another driver version";
+		return false;
+	}
+
+	return true;
+}
+
+VkPipeline VulkanPipelineCache::createGraphicsPipeline(const VkGraphicsPipelineCreateInfo& createInfo)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	VkPipeline pipeline;
+	if (vkCreateGraphicsPipelines(device, cache, 1, &createInfo, nullptr, &pipeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create graphics pipeline!");
+	}
+
+	compileMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	pipelineCount++;
+
+	return pipeline;
+}
+
+VkPipeline VulkanPipelineCache::createComputePipeline(const VkComputePipelineCreateInfo& createInfo)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	VkPipeline pipeline;
+	if (vkCreateComputePipelines(device, cache, 1, &createInfo, nullptr, &pipeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create compute pipeline!");
+	}
+
+	compileMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	pipelineCount++;
+
+	return pipeline;
+}
+
+void VulkanPipelineCache::save()
+{
+	size_t size = 0;
+	if (vkGetPipelineCacheData(device, cache, &size, nullptr) != VK_SUCCESS || size == 0)
+	{
+		return;
+	}
+
+	std::vector<char> data(size);
+	if (vkGetPipelineCacheData(device, cache, &size, data.data()) != VK_SUCCESS)
+	{
+		return;
+	}
+
+	FileHeader header = {};
+	header.magic = FILE_MAGIC;
+	header.version = FILE_VERSION;
+	header.dataSize = size;
+	// The baseline is the run that had to compile everything, warm runs keep it
+	header.coldMilliseconds = loaded ? coldMilliseconds : compileMilliseconds;
+
+	// Written next to the old file and swapped in, so a crash never leaves half a cache behind
+	std::string temporaryPath = path + ".tmp";
+	{
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			return;
+		}
+
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(data.data(), size);
+		if (!file)
+		{
+			return;
+		}
+	}
+
+	std::remove(path.c_str());
+	std::rename(temporaryPath.c_str(), path.c_str());
+}
+
+void VulkanPipelineCache::printReport(std::ostream& out) const
+{
+	if (loaded)
+	{
+		out << "Pipeline cache: loaded " << loadedSize << " bytes from " << path << std::endl;
+	}
+	else
+	{
+		out << "Pipeline cache: starting empty (" << rejectReason << ")" << std::endl;
+	}
+
+	out << "Pipeline creation: " << pipelineCount << " pipelines in " << compileMilliseconds << " ms" << std::endl;
+
+	if (loaded && coldMilliseconds > 0.0)
+	{
+		out << "Pipeline creation without cache: " << coldMilliseconds << " ms, saved " << (coldMilliseconds - compileMilliseconds) << " ms" << std::endl;
+	}
+}
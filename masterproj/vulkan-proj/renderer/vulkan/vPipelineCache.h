@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/*
+VkPipelineCache persisted between runs.
+The file holds a small header of our own followed by the blob from vkGetPipelineCacheData. The
+blob is only handed to the driver if its header matches the vendor ID, device ID and pipeline
+cache UUID of the current device; anything else (other GPU, driver update, truncated file)
+starts from an empty cache. All pipelines are created through this class, which also measures
+how long their creation takes, so the report can compare a warm start against the cold one.
+*/
+class VulkanPipelineCache
+{
+public:
+	VulkanPipelineCache(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& path);
+	~VulkanPipelineCache();
+
+	VkPipelineCache getCache() const { return cache; }
+
+	VkPipeline createGraphicsPipeline(const VkGraphicsPipelineCreateInfo& createInfo);
+	VkPipeline createComputePipeline(const VkComputePipelineCreateInfo& createInfo);
+
+	// Writes the current cache contents back to the file
+	void save();
+
+	void printReport(std::ostream& out) const;
+
+private:
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t dataSize;
+		// Pipeline creation time of the run that started without a cache
+		double coldMilliseconds;
+	};
+
+	static const uint32_t FILE_MAGIC = 0x48435056; // "VPCH"
+	static const uint32_t FILE_VERSION = 1;
+
+	VkDevice device;
+	VkPhysicalDeviceProperties properties;
+	std::string path;
+
+	VkPipelineCache cache = VK_NULL_HANDLE;
+
+	bool loaded = false;
+	size_t loadedSize = 0;
+	std::string rejectReason;
+	double coldMilliseconds = 0.0;
+
+	uint32_t pipelineCount = 0;
+	double compileMilliseconds = 0.0;
+
+	bool isCompatible(const char* data, size_t size);
+};
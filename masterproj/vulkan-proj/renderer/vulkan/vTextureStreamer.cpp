@@ -0,0 +1,563 @@
+#include "vTextureStreamer.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+VulkanTextureStreamer::VulkanTextureStreamer(VkDevice device, VulkanAllocator& allocator, VulkanUploader& uploader, VulkanDeletionQueue& deletionQueue, VulkanTextureTable& textureTable, VkDeviceSize budget)
+	: device(device), allocator(allocator), uploader(uploader), deletionQueue(deletionQueue), textureTable(textureTable), budget(budget)
+{
+	loadThread = std::thread(&VulkanTextureStreamer::loadLoop, this);
+}
+
+VulkanTextureStreamer::~VulkanTextureStreamer()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		requests.clear();
+	}
+	requestAvailable.notify_all();
+	loadThread.join();
+
+	for (RetiredImage& image : retired)
+	{
+		vkDestroyImageView(device, image.view, nullptr);
+		vkDestroyImage(device, image.image, nullptr);
+		allocator.free(image.memory);
+	}
+
+	for (StreamedTexture& texture : textures)
+	{
+		if (texture.image != VK_NULL_HANDLE)
+		{
+			vkDestroyImageView(device, texture.view, nullptr);
+			vkDestroyImage(device, texture.image, nullptr);
+			allocator.free(texture.memory);
+		}
+	}
+}
+
+bool VulkanTextureStreamer::canStream(const TextureData& texture)
+{
+	return texture.levels.size() == TextureLoader::getMipCount(texture.width, texture.height)
+		&& std::max(texture.width, texture.height) > RESIDENT_TAIL_SIZE;
+}
+
+VkDeviceSize VulkanTextureStreamer::addTexture(uint32_t id, TextureData texture, VkFormat format, uint64_t frameNumber)
+{
+	if (id >= textures.size())
+	{
+		textures.resize(id + 1);
+	}
+
+	// Ids come from the asset loader, each is added once
+	StreamedTexture& streamed = textures[id];
+	streamed.data = std::make_shared<const TextureData>(std::move(texture));
+	streamed.format = format;
+
+	const std::vector<TextureLevel>& levels = streamed.data->levels;
+	uint32_t tailLevel = 0;
+	while (std::max(levels[tailLevel].width, levels[tailLevel].height) > RESIDENT_TAIL_SIZE)
+	{
+		tailLevel++;
+	}
+
+	streamed.tailLevel = tailLevel;
+	streamed.wantedLevel = tailLevel;
+	streamed.lastSeen = frameNumber;
+	// Nothing is resident yet
+	streamed.residentLevel = static_cast<uint32_t>(levels.size());
+
+	setResidentLevel(id, tailLevel, streamed.data->getData(), levels);
+
+	if (!textureTable.setTexture(id, streamed.image, streamed.view, format, levels[tailLevel].width, levels[tailLevel].height, static_cast<uint32_t>(levels.size()) - tailLevel))
+	{
+		// Never sampled, only the uploads in the batch use it
+		residentSize -= getSize(streamed, streamed.residentLevel);
+
+		VkDevice device = this->device;
+		VulkanAllocator& allocator = this->allocator;
+		VkImage image = streamed.image;
+		MemoryAllocation memory = streamed.memory;
+		VkImageView view = streamed.view;
+		uploader.releaseWithBatch([device, &allocator, image, memory, view]() mutable
+		{
+			vkDestroyImageView(device, view, nullptr);
+			vkDestroyImage(device, image, nullptr);
+			allocator.free(memory);
+		});
+
+		textures[id] = {};
+		return 0;
+	}
+
+	return getSize(streamed, tailLevel);
+}
+
+void VulkanTextureStreamer::gatherFeedback(const Scene& scene, const VulkanMeshArena& meshes, const glm::mat4& view, const glm::mat4& proj, uint32_t viewportHeight, uint64_t frameNumber)
+{
+	for (StreamedTexture& texture : textures)
+	{
+		texture.wantedLevel = texture.tailLevel;
+	}
+
+	// Pixels per unit of size at distance 1, none before the camera is first set
+	float pixelScale = std::abs(proj[1][1]) * 0.5f * static_cast<float>(viewportHeight);
+	if (pixelScale == 0.0f)
+	{
+		return;
+	}
+
+	for (const InstanceBatch& batch : scene.batches)
+	{
+		const MeshRange* mesh = meshes.findMesh(batch.meshIndex);
+		if (mesh == nullptr)
+		{
+			continue;
+		}
+
+		for (const InstanceData& instance : batch.instances)
+		{
+			if (instance.material >= textures.size() || !textures[instance.material].data)
+			{
+				continue;
+			}
+
+			StreamedTexture& texture = textures[instance.material];
+
+			glm::mat4 world = batch.transform * instance.transform;
+			glm::vec3 center = glm::vec3(view * world * glm::vec4(glm::vec3(mesh->boundingSphere), 1.0f));
+			float scale = std::max(glm::length(glm::vec3(world[0])), std::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+			float radius = mesh->boundingSphere.w * scale;
+
+			// The camera looks down -z. Instances off screen to the side still count, so turning
+			// around finds their levels already loaded
+			float distance = -center.z;
+			if (distance + radius <= 0.0f)
+			{
+				continue;
+			}
+
+			texture.lastSeen = frameNumber;
+
+			// From the nearest point of the sphere, the finest level any part of it needs
+			uint32_t level = 0;
+			if (distance > radius)
+			{
+				float pixels = 2.0f * radius * pixelScale / (distance - radius);
+				const TextureLevel& base = texture.data->levels[0];
+				float texelsPerPixel = static_cast<float>(std::max(base.width, base.height)) / std::max(pixels, 1.0f);
+				level = texelsPerPixel > 1.0f ? static_cast<uint32_t>(std::floor(std::log2(texelsPerPixel))) : 0;
+			}
+
+			texture.wantedLevel = std::min(texture.wantedLevel, level);
+		}
+	}
+}
+
+void VulkanTextureStreamer::update(uint64_t frameNumber)
+{
+	// The table has switched to their replacements, frames in flight may still sample them
+	size_t retiredCount = 0;
+	while (retiredCount < retired.size() && uploader.isComplete(retired[retiredCount].ticket))
+	{
+		VkDevice device = this->device;
+		VulkanAllocator& allocator = this->allocator;
+		RetiredImage image = retired[retiredCount++];
+		deletionQueue.push(frameNumber, [device, &allocator, image]() mutable
+		{
+			vkDestroyImageView(device, image.view, nullptr);
+			vkDestroyImage(device, image.image, nullptr);
+			allocator.free(image.memory);
+		});
+	}
+	retired.erase(retired.begin(), retired.begin() + retiredCount);
+
+	// Finished loads
+	VkDeviceSize uploaded = 0;
+	while (uploaded < UPLOAD_BUDGET)
+	{
+		LoadedLevels levels;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (loaded.empty())
+			{
+				break;
+			}
+
+			levels = std::move(loaded.front());
+			loaded.pop_front();
+		}
+
+		StreamedTexture& texture = textures[levels.id];
+		texture.loading = false;
+
+		// Evicted meanwhile, the levels no longer join up with the image
+		if (levels.firstLevel + levels.levels.size() != texture.residentLevel)
+		{
+			continue;
+		}
+
+		// The view may have moved on while the levels were loading
+		uint32_t level = std::max(levels.firstLevel, texture.wantedLevel);
+		if (level >= texture.residentLevel)
+		{
+			continue;
+		}
+
+		// As many of them as fit
+		VkDeviceSize currentSize = getSize(texture, texture.residentLevel);
+		while (level < texture.residentLevel && !makeRoom(levels.id, getSize(texture, level) - currentSize))
+		{
+			level++;
+		}
+
+		if (level == texture.residentLevel)
+		{
+			continue;
+		}
+
+		// Levels are indexed from level 0 of the texture when uploaded
+		std::vector<TextureLevel> allLevels(texture.data->levels.size());
+		std::copy(levels.levels.begin(), levels.levels.end(), allLevels.begin() + levels.firstLevel);
+
+		uploaded += getSize(texture, level) - getSize(texture, texture.residentLevel);
+		setResidentLevel(levels.id, level, levels.payload.data(), allLevels);
+		textureTable.setTexture(levels.id, texture.image, texture.view, texture.format, allLevels[level].width, allLevels[level].height,
+			static_cast<uint32_t>(allLevels.size()) - level);
+	}
+
+	// New loads, the textures missing the most levels first
+	std::vector<uint32_t> wanting;
+	for (uint32_t id = 0; id < textures.size(); id++)
+	{
+		const StreamedTexture& texture = textures[id];
+		if (texture.data && !texture.loading && texture.wantedLevel < texture.residentLevel)
+		{
+			wanting.push_back(id);
+		}
+	}
+
+	std::sort(wanting.begin(), wanting.end(), [this](uint32_t a, uint32_t b)
+	{
+		return textures[a].residentLevel - textures[a].wantedLevel > textures[b].residentLevel - textures[b].wantedLevel;
+	});
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	uint32_t pendingCount = static_cast<uint32_t>(requests.size() + loaded.size());
+	for (uint32_t id : wanting)
+	{
+		if (pendingCount >= MAX_PENDING_LOADS)
+		{
+			break;
+		}
+
+		StreamedTexture& texture = textures[id];
+		texture.loading = true;
+		requests.push_back({ id, texture.data, texture.wantedLevel, texture.residentLevel });
+		pendingCount++;
+	}
+
+	requestAvailable.notify_one();
+}
+
+void VulkanTextureStreamer::loadLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true)
+	{
+		requestAvailable.wait(lock, [this]() { return stopping || !requests.empty(); });
+
+		if (stopping)
+		{
+			return;
+		}
+
+		LoadRequest request = std::move(requests.front());
+		requests.pop_front();
+
+		lock.unlock();
+		LoadedLevels levels = load(request);
+		lock.lock();
+
+		loaded.push_back(std::move(levels));
+	}
+}
+
+VulkanTextureStreamer::LoadedLevels VulkanTextureStreamer::load(const LoadRequest& request)
+{
+	const TextureData& data = *request.data;
+
+	LoadedLevels levels;
+	levels.id = request.id;
+	levels.firstLevel = request.firstLevel;
+
+	// Same 16 byte alignment as in the container, the copies need it for block compressed formats
+	uint64_t size = 0;
+	for (uint32_t i = request.firstLevel; i < request.endLevel; i++)
+	{
+		TextureLevel level = data.levels[i];
+		level.offset = size;
+		levels.levels.push_back(level);
+		size = (size + level.size + 15) & ~uint64_t(15);
+	}
+
+	// Faults the levels in from the mapped container, which is the point of doing it here
+	levels.payload.resize(static_cast<size_t>(size));
+	for (uint32_t i = request.firstLevel; i < request.endLevel; i++)
+	{
+		const TextureLevel& level = levels.levels[i - request.firstLevel];
+		std::memcpy(levels.payload.data() + level.offset, data.getData() + data.levels[i].offset, static_cast<size_t>(level.size));
+	}
+
+	return levels;
+}
+
+VkDeviceSize VulkanTextureStreamer::getSize(const StreamedTexture& texture, uint32_t level)
+{
+	VkDeviceSize size = 0;
+	for (uint32_t i = level; i < texture.data->levels.size(); i++)
+	{
+		size += texture.data->levels[i].size;
+	}
+
+	return size;
+}
+
+bool VulkanTextureStreamer::makeRoom(uint32_t id, VkDeviceSize size)
+{
+	if (residentSize + size <= budget)
+	{
+		return true;
+	}
+
+	// Textures holding levels they do not want, textures seen this frame never give up levels they want
+	std::vector<uint32_t> candidates;
+	VkDeviceSize freeable = 0;
+	for (uint32_t i = 0; i < textures.size(); i++)
+	{
+		const StreamedTexture& texture = textures[i];
+		if (i != id && texture.data && texture.residentLevel < texture.wantedLevel)
+		{
+			candidates.push_back(i);
+			freeable += getSize(texture, texture.residentLevel) - getSize(texture, texture.wantedLevel);
+		}
+	}
+
+	if (residentSize + size > budget + freeable)
+	{
+		return false;
+	}
+
+	// Least recently seen first
+	std::sort(candidates.begin(), candidates.end(), [this](uint32_t a, uint32_t b)
+	{
+		return textures[a].lastSeen < textures[b].lastSeen;
+	});
+
+	std::vector<TextureLevel> noLevels;
+	for (uint32_t i : candidates)
+	{
+		if (residentSize + size <= budget)
+		{
+			break;
+		}
+
+		// Only copies on the GPU, nothing to upload
+		StreamedTexture& texture = textures[i];
+		setResidentLevel(i, texture.wantedLevel, nullptr, noLevels);
+		textureTable.setTexture(i, texture.image, texture.view, texture.format, texture.data->levels[texture.residentLevel].width, texture.data->levels[texture.residentLevel].height,
+			static_cast<uint32_t>(texture.data->levels.size()) - texture.residentLevel);
+	}
+
+	return true;
+}
+
+void VulkanTextureStreamer::setResidentLevel(uint32_t id, uint32_t level, const uint8_t* payload, const std::vector<TextureLevel>& levels)
+{
+	StreamedTexture& texture = textures[id];
+	const TextureData& data = *texture.data;
+	uint32_t levelCount = static_cast<uint32_t>(data.levels.size()) - level;
+	// Before this level everything is uploaded, from it on copied from the old image
+	uint32_t keptLevel = std::max(level, texture.residentLevel);
+
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.extent.width = data.levels[level].width;
+	imageInfo.extent.height = data.levels[level].height;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = levelCount;
+	imageInfo.arrayLayers = 1;
+	imageInfo.format = texture.format;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkImage image;
+	if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create streamed texture image!");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+	MemoryAllocation memory = allocator.allocate(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, AllocationKind::Optimal);
+	vkBindImageMemory(device, image, memory.memory, memory.offset);
+
+	VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, levelCount, 0, 1 };
+
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange = range;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	// New levels go through staging on the transfer side, like every texture upload
+	bool uploads = level < texture.residentLevel;
+	if (uploads)
+	{
+		uint64_t begin = levels[level].offset;
+		uint64_t end = levels[keptLevel - 1].offset + levels[keptLevel - 1].size;
+
+		// Staging first, allocating may flush the batch and begin a new one
+		StagingRegion staging = uploader.allocateStaging(end - begin, 16);
+		memcpy(staging.data, payload + begin, static_cast<size_t>(end - begin));
+
+		VkCommandBuffer transferCommandBuffer = uploader.getTransferCommandBuffer();
+
+		vkCmdPipelineBarrier(transferCommandBuffer,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			0, nullptr,
+			0, nullptr,
+			1, &barrier);
+
+		std::vector<VkBufferImageCopy> regions(keptLevel - level);
+		for (uint32_t i = level; i < keptLevel; i++)
+		{
+			VkBufferImageCopy& region = regions[i - level];
+			region = {};
+			region.bufferOffset = staging.offset + levels[i].offset - begin;
+			region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, i - level, 0, 1 };
+			region.imageOffset = { 0, 0, 0 };
+			region.imageExtent = { levels[i].width, levels[i].height, 1 };
+		}
+
+		vkCmdCopyBufferToImage(transferCommandBuffer, staging.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+
+		uploader.releaseImage(image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, range, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+	}
+
+	VkCommandBuffer commandBuffer = uploader.getGraphicsCommandBuffer();
+
+	// The rest are copies from the old image, which frames in flight may still be sampling
+	std::array<VkImageMemoryBarrier, 2> barriers = { barrier, barrier };
+	uint32_t barrierCount = 0;
+	if (!uploads)
+	{
+		barriers[barrierCount++] = barrier;
+	}
+	if (texture.image != VK_NULL_HANDLE && keptLevel < data.levels.size())
+	{
+		VkImageMemoryBarrier& oldBarrier = barriers[barrierCount++];
+		oldBarrier.image = texture.image;
+		oldBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, static_cast<uint32_t>(data.levels.size()) - texture.residentLevel, 0, 1 };
+		oldBarrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		oldBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		oldBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	}
+
+	if (barrierCount > 0)
+	{
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			0, nullptr,
+			0, nullptr,
+			barrierCount, barriers.data());
+	}
+
+	if (texture.image != VK_NULL_HANDLE && keptLevel < data.levels.size())
+	{
+		std::vector<VkImageCopy> regions(data.levels.size() - keptLevel);
+		for (uint32_t i = keptLevel; i < data.levels.size(); i++)
+		{
+			VkImageCopy& region = regions[i - keptLevel];
+			region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, i - texture.residentLevel, 0, 1 };
+			region.srcOffset = { 0, 0, 0 };
+			region.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, i - level, 0, 1 };
+			region.dstOffset = { 0, 0, 0 };
+			region.extent = { data.levels[i].width, data.levels[i].height, 1 };
+		}
+
+		vkCmdCopyImage(commandBuffer,
+			texture.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			static_cast<uint32_t>(regions.size()), regions.data());
+	}
+
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	// The old image goes back to its shader layout, the table samples it until the batch is complete
+	barriers[0] = barrier;
+	barrierCount = 1;
+	if (texture.image != VK_NULL_HANDLE && keptLevel < data.levels.size())
+	{
+		VkImageMemoryBarrier& oldBarrier = barriers[barrierCount++];
+		oldBarrier = barrier;
+		oldBarrier.image = texture.image;
+		oldBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, static_cast<uint32_t>(data.levels.size()) - texture.residentLevel, 0, 1 };
+		oldBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		oldBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		oldBarrier.srcAccessMask = 0;
+		oldBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	}
+
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+		0, nullptr,
+		0, nullptr,
+		barrierCount, barriers.data());
+
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = texture.format;
+	viewInfo.subresourceRange = range;
+
+	VkImageView view;
+	if (vkCreateImageView(device, &viewInfo, nullptr, &view) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create streamed texture image view!");
+	}
+
+	if (texture.image != VK_NULL_HANDLE)
+	{
+		retired.push_back({ uploader.getCurrentTicket(), texture.image, texture.memory, texture.view });
+	}
+
+	residentSize += getSize(texture, level);
+	residentSize -= getSize(texture, texture.residentLevel);
+
+	texture.image = image;
+	texture.memory = memory;
+	texture.view = view;
+	texture.residentLevel = level;
+}
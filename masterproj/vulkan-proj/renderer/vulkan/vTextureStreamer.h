@@ -0,0 +1,154 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "vAllocator.h"
+#include "vDeletionQueue.h"
+#include "vMeshArena.h"
+#include "vTextureTable.h"
+#include "vUploader.h"
+#include "../../model/TextureLoader.h"
+#include "../../scene/Scene.h"
+
+/*
+Keeps only the mip levels of cooked textures that are needed on screen in device memory, so the
+textures of a scene may add up to more than the device has.
+
+A texture is registered with its mip tail, the levels up to RESIDENT_TAIL_SIZE, which stays
+resident for good. Every frame gatherFeedback() works out the level each texture is wanted at from
+the projected size of the instances that use it, assuming their texture coordinates span the
+texture once across the bounding sphere. update() then asks a background thread for the missing
+levels; the thread reads them from the mapped container into memory, so the render thread never
+touches pages that are not in memory yet. Levels that arrived are uploaded the next frame.
+
+Residency changes rebuild the image: a new image with exactly the resident levels is created and
+the levels both have in common are copied over on the GPU. Once the uploader batch is complete the
+texture table points at the new view, whose level 0 is the finest resident level, so sampling
+needs no LOD clamp and frames keep drawing whatever is resident meanwhile. The old image goes to
+the deletion queue at the same time.
+
+The texel data of all resident levels is kept under the budget. To make room the levels textures
+do not want are dropped, least recently seen texture first; a texture that is not seen in a frame
+wants its tail only. Tails are never dropped and may exceed the budget on their own. Replaced
+images live on until the frames using them are done, which the budget does not count.
+
+Only needed with descriptor indexing, the texture array fallback of the table keeps fixed size
+copies of every texture anyway.
+*/
+class VulkanTextureStreamer
+{
+public:
+	VulkanTextureStreamer(VkDevice device, VulkanAllocator& allocator, VulkanUploader& uploader, VulkanDeletionQueue& deletionQueue, VulkanTextureTable& textureTable, VkDeviceSize budget);
+	// Waits for the load in progress, queued loads are dropped
+	~VulkanTextureStreamer();
+
+	// Largest level that is always resident, also what AssetLoader pages in ahead
+	static const uint32_t RESIDENT_TAIL_SIZE = 64;
+	// Bytes of streamed levels uploaded per frame, the first load of a frame goes regardless
+	static const VkDeviceSize UPLOAD_BUDGET = 16 * 1024 * 1024;
+	// Loads queued on the background thread at once
+	static const uint32_t MAX_PENDING_LOADS = 4;
+
+	// Cooked textures with levels above the tail, anything else is uploaded whole
+	static bool canStream(const TextureData& texture);
+
+	// Uploads the tail into the current uploader batch and puts it into the table. Returns the bytes
+	// uploaded, 0 if the table has no room for the id
+	VkDeviceSize addTexture(uint32_t id, TextureData texture, VkFormat format, uint64_t frameNumber);
+
+	// Wanted level of every texture from the instances of the scene
+	void gatherFeedback(const Scene& scene, const VulkanMeshArena& meshes, const glm::mat4& view, const glm::mat4& proj, uint32_t viewportHeight, uint64_t frameNumber);
+	// Uploads finished loads, evicts what does not fit and queues new loads. Copies are recorded
+	// into the current uploader batch, images replaced by completed batches are retired
+	void update(uint64_t frameNumber);
+
+	VkDeviceSize getResidentSize() const { return residentSize; }
+
+private:
+	struct StreamedTexture
+	{
+		// Shared with the loads in progress, keeps the container mapped
+		std::shared_ptr<const TextureData> data;
+		VkFormat format = VK_FORMAT_UNDEFINED;
+
+		VkImage image = VK_NULL_HANDLE;
+		MemoryAllocation memory;
+		VkImageView view = VK_NULL_HANDLE;
+
+		// Finest level in the image, the image's level 0
+		uint32_t residentLevel = 0;
+		// First level of the tail, never evicted
+		uint32_t tailLevel = 0;
+		// Finest level the last feedback asked for
+		uint32_t wantedLevel = 0;
+		// Frame the texture was last seen in
+		uint64_t lastSeen = 0;
+		bool loading = false;
+	};
+
+	struct LoadRequest
+	{
+		uint32_t id;
+		std::shared_ptr<const TextureData> data;
+		uint32_t firstLevel;
+		uint32_t endLevel;
+	};
+
+	// Levels read by the background thread, offsets in levels are relative to payload
+	struct LoadedLevels
+	{
+		uint32_t id;
+		uint32_t firstLevel;
+		std::vector<TextureLevel> levels;
+		std::vector<uint8_t> payload;
+	};
+
+	VkDevice device;
+	VulkanAllocator& allocator;
+	VulkanUploader& uploader;
+	VulkanDeletionQueue& deletionQueue;
+	VulkanTextureTable& textureTable;
+	VkDeviceSize budget;
+	VkDeviceSize residentSize = 0;
+
+	// Indexed by texture id, without data for textures that are not streamed
+	std::vector<StreamedTexture> textures;
+
+	// Replaced images the table samples until the batch of their replacement is complete
+	struct RetiredImage
+	{
+		UploadTicket ticket;
+		VkImage image;
+		MemoryAllocation memory;
+		VkImageView view;
+	};
+	std::vector<RetiredImage> retired;
+
+	std::thread loadThread;
+	std::mutex mutex;
+	std::condition_variable requestAvailable;
+	// Guarded by mutex
+	std::deque<LoadRequest> requests;
+	std::deque<LoadedLevels> loaded;
+	bool stopping = false;
+
+	void loadLoop();
+	static LoadedLevels load(const LoadRequest& request);
+
+	// Texel data of the levels from level on
+	static VkDeviceSize getSize(const StreamedTexture& texture, uint32_t level);
+	// Drops unwanted levels of other textures, least recently seen first, until size more fits.
+	// Drops nothing if that is not enough
+	bool makeRoom(uint32_t id, VkDeviceSize size);
+	// Rebuilds the image of texture id from level on. Levels not in the old image are uploaded
+	// from payload, offsets in levels are relative to it
+	void setResidentLevel(uint32_t id, uint32_t level, const uint8_t* payload, const std::vector<TextureLevel>& levels);
+};
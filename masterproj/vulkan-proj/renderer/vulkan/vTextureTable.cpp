@@ -0,0 +1,374 @@
+#include "vTextureTable.h"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <stdexcept>
+
+#include "../../model/TextureLoader.h"
+
+VulkanTextureTable::VulkanTextureTable(VkPhysicalDevice physicalDevice, VkDevice device, VulkanAllocator& allocator, VulkanUploader& uploader, VulkanDeletionQueue& deletionQueue, const TextureTableSupport& support, VkImageView placeholderView)
+	: physicalDevice(physicalDevice), device(device), allocator(allocator), uploader(uploader), deletionQueue(deletionQueue), support(support), placeholderView(placeholderView)
+{
+	if (support.descriptorIndexing)
+	{
+		views.assign(getDescriptorCount(support), placeholderView);
+	}
+	else
+	{
+		layerLevels = TextureLoader::getMipCount(LAYER_SIZE, LAYER_SIZE);
+		resizeLayers(std::min(INITIAL_LAYER_COUNT, support.maxLayers));
+	}
+}
+
+VulkanTextureTable::~VulkanTextureTable()
+{
+	for (PendingLayers& layers : pendingLayers)
+	{
+		vkDestroyImageView(device, layers.oldView, nullptr);
+		vkDestroyImage(device, layers.oldImage, nullptr);
+		allocator.free(layers.oldMemory);
+	}
+
+	if (layerImage != VK_NULL_HANDLE)
+	{
+		vkDestroyImageView(device, layerView, nullptr);
+		vkDestroyImage(device, layerImage, nullptr);
+		allocator.free(layerMemory);
+	}
+}
+
+uint32_t VulkanTextureTable::getDescriptorCount(const TextureTableSupport& support)
+{
+	return support.descriptorIndexing ? std::min(MAX_TEXTURES, support.maxSampledImages) : 1;
+}
+
+VkDescriptorSetLayoutBinding VulkanTextureTable::getLayoutBinding(const TextureTableSupport& support, uint32_t binding)
+{
+	VkDescriptorSetLayoutBinding layoutBinding = {};
+	layoutBinding.binding = binding;
+	layoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	layoutBinding.descriptorCount = getDescriptorCount(support);
+	layoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	layoutBinding.pImmutableSamplers = nullptr;
+
+	return layoutBinding;
+}
+
+VkImageUsageFlags VulkanTextureTable::getTextureUsage(const TextureTableSupport& support)
+{
+	return support.descriptorIndexing ? 0 : VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+}
+
+bool VulkanTextureTable::setTexture(uint32_t index, VkImage image, VkImageView view, VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels)
+{
+	if (support.descriptorIndexing)
+	{
+		if (index >= views.size())
+		{
+			std::cerr << "texture " << index << " does not fit into the texture table of " << views.size() << std::endl;
+			return false;
+		}
+
+		pendingViews.push_back({ uploader.getCurrentTicket(), index, view });
+		return true;
+	}
+
+	uint32_t maxLayerCount = std::min(MAX_TEXTURES, support.maxLayers);
+	if (index >= maxLayerCount)
+	{
+		std::cerr << "texture " << index << " does not fit into the texture array of " << maxLayerCount << " layers" << std::endl;
+		return false;
+	}
+
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+
+	VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	if ((properties.optimalTilingFeatures & required) != required)
+	{
+		std::cerr << "texture " << index << " cannot be blitted into the texture array" << std::endl;
+		return false;
+	}
+
+	if (index >= layerCount)
+	{
+		resizeLayers(std::min(std::max(index + 1, layerCount * 2), maxLayerCount));
+	}
+
+	blitToLayer(index, image, width, height, mipLevels);
+	return false;
+}
+
+void VulkanTextureTable::update(uint64_t frameNumber)
+{
+	size_t layersCount = 0;
+	while (layersCount < pendingLayers.size() && uploader.isComplete(pendingLayers[layersCount].ticket))
+	{
+		PendingLayers& layers = pendingLayers[layersCount++];
+		drawnLayerView = layers.view;
+		generation++;
+
+		// Frames in flight still sample it
+		VkDevice device = this->device;
+		VulkanAllocator& allocator = this->allocator;
+		VkImage oldImage = layers.oldImage;
+		MemoryAllocation oldMemory = layers.oldMemory;
+		VkImageView oldView = layers.oldView;
+		deletionQueue.push(frameNumber, [device, &allocator, oldImage, oldMemory, oldView]() mutable
+		{
+			vkDestroyImageView(device, oldView, nullptr);
+			vkDestroyImage(device, oldImage, nullptr);
+			allocator.free(oldMemory);
+		});
+	}
+	pendingLayers.erase(pendingLayers.begin(), pendingLayers.begin() + layersCount);
+
+	size_t viewCount = 0;
+	while (viewCount < pendingViews.size() && uploader.isComplete(pendingViews[viewCount].ticket))
+	{
+		const PendingView& pending = pendingViews[viewCount++];
+		views[pending.index] = pending.view;
+		generation++;
+	}
+	pendingViews.erase(pendingViews.begin(), pendingViews.begin() + viewCount);
+}
+
+void VulkanTextureTable::writeDescriptorSet(VkDescriptorSet descriptorSet, uint32_t binding) const
+{
+	std::vector<VkDescriptorImageInfo> imageInfos(support.descriptorIndexing ? views.size() : 1);
+	for (size_t i = 0; i < imageInfos.size(); i++)
+	{
+		imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfos[i].imageView = support.descriptorIndexing ? views[i] : drawnLayerView;
+		imageInfos[i].sampler = VK_NULL_HANDLE;
+	}
+
+	VkWriteDescriptorSet descriptorWrite = {};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = descriptorSet;
+	descriptorWrite.dstBinding = binding;
+	descriptorWrite.dstArrayElement = 0;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	descriptorWrite.descriptorCount = static_cast<uint32_t>(imageInfos.size());
+	descriptorWrite.pImageInfo = imageInfos.data();
+
+	vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+}
+
+void VulkanTextureTable::resizeLayers(uint32_t count)
+{
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.extent.width = LAYER_SIZE;
+	imageInfo.extent.height = LAYER_SIZE;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = layerLevels;
+	imageInfo.arrayLayers = count;
+	imageInfo.format = LAYER_FORMAT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkImage image;
+	if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create texture array!");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+	MemoryAllocation memory = allocator.allocate(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, AllocationKind::Optimal);
+	vkBindImageMemory(device, image, memory.memory, memory.offset);
+
+	VkCommandBuffer commandBuffer = uploader.getGraphicsCommandBuffer();
+
+	std::vector<VkImageMemoryBarrier> barriers(layerImage != VK_NULL_HANDLE ? 2 : 1);
+	for (VkImageMemoryBarrier& barrier : barriers)
+	{
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = 0;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = layerLevels;
+		barrier.subresourceRange.baseArrayLayer = 0;
+	}
+
+	barriers[0].image = image;
+	barriers[0].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barriers[0].subresourceRange.layerCount = count;
+
+	// Frames still in flight may be sampling the old layers
+	if (layerImage != VK_NULL_HANDLE)
+	{
+		barriers[1].image = layerImage;
+		barriers[1].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barriers[1].subresourceRange.layerCount = layerCount;
+	}
+
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+		0, nullptr,
+		0, nullptr,
+		static_cast<uint32_t>(barriers.size()), barriers.data());
+
+	if (layerImage != VK_NULL_HANDLE)
+	{
+		std::vector<VkImageCopy> regions(layerLevels);
+		for (uint32_t level = 0; level < layerLevels; level++)
+		{
+			uint32_t size = std::max(LAYER_SIZE >> level, 1u);
+
+			regions[level].srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, layerCount };
+			regions[level].srcOffset = { 0, 0, 0 };
+			regions[level].dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, layerCount };
+			regions[level].dstOffset = { 0, 0, 0 };
+			regions[level].extent = { size, size, 1 };
+		}
+
+		vkCmdCopyImage(commandBuffer,
+			layerImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			static_cast<uint32_t>(regions.size()), regions.data());
+	}
+
+	// Average of the placeholder's checkerboard
+	VkClearColorValue grey = { { 0.63f, 0.63f, 0.63f, 1.0f } };
+	VkImageSubresourceRange newLayers = { VK_IMAGE_ASPECT_COLOR_BIT, 0, layerLevels, layerCount, count - layerCount };
+	vkCmdClearColorImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &grey, 1, &newLayers);
+
+	barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barriers[0].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	// The old layers go back to their shader layout, frames recorded before the switch sample them
+	if (layerImage != VK_NULL_HANDLE)
+	{
+		barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barriers[1].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barriers[1].srcAccessMask = 0;
+		barriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	}
+
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+		0, nullptr,
+		0, nullptr,
+		static_cast<uint32_t>(barriers.size()), barriers.data());
+
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+	viewInfo.format = LAYER_FORMAT;
+	viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, layerLevels, 0, count };
+
+	VkImageView view;
+	if (vkCreateImageView(device, &viewInfo, nullptr, &view) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create texture array view!");
+	}
+
+	// The first image is in the descriptor sets written at startup, later ones once their copies are complete
+	if (layerImage != VK_NULL_HANDLE)
+	{
+		pendingLayers.push_back({ uploader.getCurrentTicket(), view, layerImage, layerMemory, layerView });
+	}
+	else
+	{
+		drawnLayerView = view;
+		generation++;
+	}
+
+	layerImage = image;
+	layerMemory = memory;
+	layerView = view;
+	layerCount = count;
+}
+
+void VulkanTextureTable::blitToLayer(uint32_t layer, VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels)
+{
+	VkCommandBuffer commandBuffer = uploader.getGraphicsCommandBuffer();
+
+	std::array<VkImageMemoryBarrier, 2> barriers = {};
+	for (VkImageMemoryBarrier& barrier : barriers)
+	{
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = 0;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.layerCount = 1;
+	}
+
+	// The texture was just put in its shader layout, the layer may still be sampled by frames in flight
+	barriers[0].image = image;
+	barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	barriers[0].subresourceRange.levelCount = mipLevels;
+	barriers[0].subresourceRange.baseArrayLayer = 0;
+
+	barriers[1].image = layerImage;
+	barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barriers[1].subresourceRange.levelCount = layerLevels;
+	barriers[1].subresourceRange.baseArrayLayer = layer;
+
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+		0, nullptr,
+		0, nullptr,
+		static_cast<uint32_t>(barriers.size()), barriers.data());
+
+	// Every level of the layer from the smallest level of the texture that still covers it, so no
+	// blit shrinks by more than half and the linear filter does not skip texels
+	std::vector<VkImageBlit> blits(layerLevels);
+	for (uint32_t level = 0; level < layerLevels; level++)
+	{
+		int32_t size = static_cast<int32_t>(std::max(LAYER_SIZE >> level, 1u));
+
+		uint32_t source = 0;
+		while (source + 1 < mipLevels && static_cast<int32_t>(std::max(width >> (source + 1), 1u)) >= size && static_cast<int32_t>(std::max(height >> (source + 1), 1u)) >= size)
+		{
+			source++;
+		}
+
+		VkImageBlit& blit = blits[level];
+		blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, source, 0, 1 };
+		blit.srcOffsets[0] = { 0, 0, 0 };
+		blit.srcOffsets[1] = { static_cast<int32_t>(std::max(width >> source, 1u)), static_cast<int32_t>(std::max(height >> source, 1u)), 1 };
+		blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, layer, 1 };
+		blit.dstOffsets[0] = { 0, 0, 0 };
+		blit.dstOffsets[1] = { size, size, 1 };
+	}
+
+	vkCmdBlitImage(commandBuffer,
+		image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		layerImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		static_cast<uint32_t>(blits.size()), blits.data(),
+		VK_FILTER_LINEAR);
+
+	barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barriers[1].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+		0, nullptr,
+		0, nullptr,
+		1, &barriers[1]);
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "vAllocator.h"
+#include "vDeletionQueue.h"
+#include "vUploader.h"
+
+// How the device lets the fragment shader pick a texture per instance, filled in createLogicalDevice
+struct TextureTableSupport
+{
+	// VK_EXT_descriptor_indexing with shaderSampledImageArrayNonUniformIndexing
+	bool descriptorIndexing = false;
+	// Sampled images the fragment stage may have bound at once
+	uint32_t maxSampledImages = 0;
+	// maxImageArrayLayers, for the texture array fallback
+	uint32_t maxLayers = 0;
+};
+
+/*
+Every texture of the scene behind one descriptor, so all opaque geometry is drawn with the same
+descriptor set. Instances carry the index of their texture (InstanceData::material, the asset
+loader's texture id) and the fragment shader looks it up in the table.
+
+With descriptor indexing the table is an array of sampled images, one per texture, indexed
+non-uniformly since the instances of one draw may use different textures. Slots without a texture
+point at the placeholder. The array size is fixed at pipeline creation through a specialization
+constant of shader.frag.
+
+Without it the table is a single 2D array image in RGBA8, each layer LAYER_SIZE x LAYER_SIZE
+texels, and frag_array.spv samples the layer of the instance. Every texture is scaled into its
+layer by blits, each level from the smallest level of the texture that is at least as large, and
+the texture itself is destroyed afterwards. Layers without a texture are cleared to grey. The image
+starts with INITIAL_LAYER_COUNT layers and doubles its layer count when an index does not fit, up
+to MAX_TEXTURES or maxImageArrayLayers, the old layers are copied over.
+
+New views and grown layer images are only written to descriptor sets from the update() after the
+uploader batch that fills them is complete, until then frames sample what was there before.
+*/
+class VulkanTextureTable
+{
+public:
+	VulkanTextureTable(VkPhysicalDevice physicalDevice, VkDevice device, VulkanAllocator& allocator, VulkanUploader& uploader, VulkanDeletionQueue& deletionQueue, const TextureTableSupport& support, VkImageView placeholderView);
+	~VulkanTextureTable();
+
+	static constexpr uint32_t MAX_TEXTURES = 4096;
+	static constexpr uint32_t LAYER_SIZE = 512;
+	static constexpr uint32_t INITIAL_LAYER_COUNT = 16;
+	static constexpr VkFormat LAYER_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+
+	// Size of the descriptor array, 1 for the texture array
+	static uint32_t getDescriptorCount(const TextureTableSupport& support);
+	static VkDescriptorSetLayoutBinding getLayoutBinding(const TextureTableSupport& support, uint32_t binding);
+	// Usage the textures handed to setTexture() need
+	static VkImageUsageFlags getTextureUsage(const TextureTableSupport& support);
+
+	/*
+	Puts a texture in SHADER_READ_ONLY layout at index, copies are recorded into the current
+	uploader batch. True if the table samples the texture's own view once the batch is complete,
+	otherwise the caller releases the texture with the batch.
+	*/
+	bool setTexture(uint32_t index, VkImage image, VkImageView view, VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels);
+
+	// Once per frame before the descriptor sets are updated, takes over the views of completed uploads
+	void update(uint64_t frameNumber);
+
+	void writeDescriptorSet(VkDescriptorSet descriptorSet, uint32_t binding) const;
+
+	// Changes whenever the descriptors do
+	uint64_t getGeneration() const { return generation; }
+
+private:
+	VkPhysicalDevice physicalDevice;
+	VkDevice device;
+	VulkanAllocator& allocator;
+	VulkanUploader& uploader;
+	VulkanDeletionQueue& deletionQueue;
+	TextureTableSupport support;
+	uint64_t generation = 0;
+
+	// Descriptor array
+	VkImageView placeholderView;
+	std::vector<VkImageView> views;
+
+	// Texture array, blits go to the newest image while the descriptors may still use an older one
+	VkImage layerImage = VK_NULL_HANDLE;
+	MemoryAllocation layerMemory;
+	VkImageView layerView = VK_NULL_HANDLE;
+	VkImageView drawnLayerView = VK_NULL_HANDLE;
+	uint32_t layerCount = 0;
+	uint32_t layerLevels = 0;
+
+	// Recorded but not complete yet, applied in order by update()
+	struct PendingView
+	{
+		UploadTicket ticket;
+		uint32_t index;
+		VkImageView view;
+	};
+	struct PendingLayers
+	{
+		UploadTicket ticket;
+		VkImageView view;
+		VkImage oldImage;
+		MemoryAllocation oldMemory;
+		VkImageView oldView;
+	};
+	std::vector<PendingView> pendingViews;
+	std::vector<PendingLayers> pendingLayers;
+
+	void resizeLayers(uint32_t count);
+	void blitToLayer(uint32_t layer, VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels);
+};
@@ -0,0 +1,656 @@
+#include "vUploader.h"
+
+#include <cstring>
+#include <stdexcept>
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+VulkanUploader::VulkanUploader(VkDevice device, VkQueue graphicsQueue, uint32_t graphicsFamily, VkQueue transferQueue, uint32_t transferFamily, VulkanAllocator& allocator, VkDeviceSize ringSize)
+	: device(device), graphicsQueue(graphicsQueue), transferQueue(transferQueue), graphicsFamily(graphicsFamily), transferFamily(transferFamily), allocator(allocator), ringSize(ringSize)
+{
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = graphicsFamily;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &graphicsCommandPool) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create upload command pool!");
+	}
+
+	if (hasDedicatedTransferQueue())
+	{
+		poolInfo.queueFamilyIndex = transferFamily;
+
+		if (vkCreateCommandPool(device, &poolInfo, nullptr, &transferCommandPool) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to create transfer command pool!");
+		}
+	}
+
+	ringBuffer = createStagingBuffer(ringSize, ringMemory);
+}
+
+VulkanUploader::~VulkanUploader()
+{
+	waitIdle();
+
+	for (UploadBatch& batch : freeBatches)
+	{
+		destroyBatch(batch);
+	}
+	destroyBatch(current);
+
+	// Frees all command buffers allocated from them
+	vkDestroyCommandPool(device, graphicsCommandPool, nullptr);
+	if (transferCommandPool != VK_NULL_HANDLE)
+	{
+		vkDestroyCommandPool(device, transferCommandPool, nullptr);
+	}
+
+	vkDestroyBuffer(device, ringBuffer, nullptr);
+	allocator.free(ringMemory);
+}
+
+StagingRegion VulkanUploader::allocateStaging(VkDeviceSize size, VkDeviceSize alignment)
+{
+	beginBatch();
+
+	StagingRegion region = {};
+
+	// Large one-off uploads would starve the ring
+	if (size > ringSize / 2)
+	{
+		MemoryAllocation allocation;
+		region.buffer = createStagingBuffer(size, allocation);
+		region.offset = 0;
+		region.data = allocation.mappedData;
+
+		VkDevice device = this->device;
+		VulkanAllocator& allocator = this->allocator;
+		VkBuffer buffer = region.buffer;
+		current.releases.push_back([device, &allocator, buffer, allocation]() mutable
+		{
+			vkDestroyBuffer(device, buffer, nullptr);
+			allocator.free(allocation);
+		});
+		return region;
+	}
+
+	VkDeviceSize offset;
+	while (!tryAllocateRing(size, alignment, offset))
+	{
+		// Everything in the ring may belong to the batch that is still being recorded
+		if (inFlight.empty())
+		{
+			flush();
+			beginBatch();
+		}
+		waitOldest();
+	}
+
+	region.buffer = ringBuffer;
+	region.offset = offset;
+	region.data = static_cast<char*>(ringMemory.mappedData) + offset;
+	return region;
+}
+
+void VulkanUploader::uploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size)
+{
+	StagingRegion staging = allocateStaging(size);
+	memcpy(staging.data, data, static_cast<size_t>(size));
+
+	copyBuffer(staging, dstBuffer, dstOffset, size);
+}
+
+void VulkanUploader::copyBuffer(const StagingRegion& staging, VkBuffer dstBuffer, VkDeviceSize dstOffset, VkDeviceSize size)
+{
+	VkBufferCopy copyRegion = {};
+	copyRegion.srcOffset = staging.offset;
+	copyRegion.dstOffset = dstOffset;
+	copyRegion.size = size;
+	vkCmdCopyBuffer(current.transferCommandBuffer, staging.buffer, dstBuffer, 1, &copyRegion);
+
+	if (hasDedicatedTransferQueue())
+	{
+		VkBufferMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		// Graphics side copies read them too, e.g. when a mesh arena buffer grows
+		barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.srcQueueFamilyIndex = transferFamily;
+		barrier.dstQueueFamilyIndex = graphicsFamily;
+		barrier.buffer = dstBuffer;
+		barrier.offset = dstOffset;
+		barrier.size = size;
+		bufferReleases.push_back(barrier);
+
+		acquireStages |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+	}
+}
+
+VkCommandBuffer VulkanUploader::getTransferCommandBuffer()
+{
+	beginBatch();
+	return current.transferCommandBuffer;
+}
+
+VkCommandBuffer VulkanUploader::getGraphicsCommandBuffer()
+{
+	beginBatch();
+	return current.graphicsCommandBuffer;
+}
+
+void VulkanUploader::releaseImage(VkImage image, VkImageLayout layout, const VkImageSubresourceRange& range, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+{
+	// On a single queue the caller's own barriers already order the graphics side after the copies
+	if (!hasDedicatedTransferQueue())
+	{
+		return;
+	}
+
+	beginBatch();
+
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = dstAccess;
+	barrier.oldLayout = layout;
+	barrier.newLayout = layout;
+	barrier.srcQueueFamilyIndex = transferFamily;
+	barrier.dstQueueFamilyIndex = graphicsFamily;
+	barrier.image = image;
+	barrier.subresourceRange = range;
+	imageReleases.push_back(barrier);
+
+	acquireStages |= dstStage;
+}
+
+void VulkanUploader::releaseWithBatch(std::function<void()> release)
+{
+	beginBatch();
+	current.releases.push_back(std::move(release));
+}
+
+UploadTicket VulkanUploader::flush()
+{
+	if (!recording)
+	{
+		return currentTicket - 1;
+	}
+
+	if (hasDedicatedTransferQueue())
+	{
+		current.acquireStages = acquireStages;
+		recordOwnershipTransfers();
+	}
+
+	// Make all transfer writes visible to whatever is submitted to the graphics queue afterwards
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(
+		current.graphicsCommandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0,
+		1, &barrier,
+		0, nullptr,
+		0, nullptr
+	);
+
+	if (vkEndCommandBuffer(current.graphicsCommandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to record upload command buffer!");
+	}
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+
+	if (hasDedicatedTransferQueue())
+	{
+		if (vkEndCommandBuffer(current.transferCommandBuffer) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to record transfer command buffer!");
+		}
+
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &current.transferCommandBuffer;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &current.transferComplete;
+
+		// The graphics side is handed over later, nothing on the graphics queue waits for the copies yet
+		if (vkQueueSubmit(transferQueue, 1, &submitInfo, current.transferFence) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to submit transfer command buffer!");
+		}
+	}
+	else
+	{
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &current.graphicsCommandBuffer;
+
+		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, current.fence) != VK_SUCCESS)
+		{
+			throw std::runtime_error("failed to submit upload command buffer!");
+		}
+
+		current.handedOver = true;
+		handedOverTicket = current.ticket;
+	}
+
+	current.ringHead = ringHead;
+	UploadTicket ticket = current.ticket;
+
+	inFlight.push_back(std::move(current));
+	current = UploadBatch();
+	recording = false;
+	currentTicket++;
+
+	return ticket;
+}
+
+void VulkanUploader::update()
+{
+	retireCompleted();
+
+	// In order, so the graphics fences still signal in ticket order
+	for (UploadBatch& batch : inFlight)
+	{
+		if (batch.handedOver)
+		{
+			continue;
+		}
+		if (vkGetFenceStatus(device, batch.transferFence) != VK_SUCCESS)
+		{
+			break;
+		}
+		handOver(batch);
+	}
+}
+
+void VulkanUploader::acquire(UploadTicket ticket)
+{
+	if (recording && ticket >= current.ticket)
+	{
+		flush();
+	}
+
+	for (UploadBatch& batch : inFlight)
+	{
+		if (batch.ticket > ticket)
+		{
+			break;
+		}
+		if (!batch.handedOver)
+		{
+			handOver(batch);
+		}
+	}
+}
+
+bool VulkanUploader::isComplete(UploadTicket ticket)
+{
+	return ticket <= handedOverTicket;
+}
+
+void VulkanUploader::wait(UploadTicket ticket)
+{
+	acquire(ticket);
+
+	while (!inFlight.empty() && inFlight.front().ticket <= ticket)
+	{
+		waitOldest();
+	}
+}
+
+void VulkanUploader::waitIdle()
+{
+	flush();
+
+	while (!inFlight.empty())
+	{
+		waitOldest();
+	}
+}
+
+VkBuffer VulkanUploader::createStagingBuffer(VkDeviceSize size, MemoryAllocation& allocation)
+{
+	uint32_t queueFamilyIndices[] = { graphicsFamily, transferFamily };
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+	// Only ever written by the host, so sharing it between both families needs no ownership transfer
+	if (hasDedicatedTransferQueue())
+	{
+		bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferInfo.queueFamilyIndexCount = 2;
+		bufferInfo.pQueueFamilyIndices = queueFamilyIndices;
+	}
+	else
+	{
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	}
+
+	VkBuffer buffer;
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to create staging buffer!");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+	allocation = allocator.allocate(memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, AllocationKind::Linear);
+
+	vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+
+	return buffer;
+}
+
+bool VulkanUploader::tryAllocateRing(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+{
+	if (ringUsed == 0)
+	{
+		ringHead = 0;
+		ringTail = 0;
+	}
+	else if (ringHead == ringTail)
+	{
+		return false;
+	}
+
+	VkDeviceSize aligned = alignUp(ringHead, alignment);
+	VkDeviceSize reserved;
+
+	if (ringHead >= ringTail)
+	{
+		// Free space is [head, end) followed by [0, tail)
+		if (aligned + size <= ringSize)
+		{
+			offset = aligned;
+			reserved = aligned + size - ringHead;
+		}
+		else if (size <= ringTail)
+		{
+			// The bytes skipped at the end belong to this allocation until it is retired
+			offset = 0;
+			reserved = ringSize - ringHead + size;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	else
+	{
+		if (aligned + size > ringTail)
+		{
+			return false;
+		}
+		offset = aligned;
+		reserved = aligned + size - ringHead;
+	}
+
+	ringHead = offset + size;
+	ringUsed += reserved;
+	current.ringUsed += reserved;
+	return true;
+}
+
+VkCommandBuffer VulkanUploader::allocateCommandBuffer(VkCommandPool pool)
+{
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandPool = pool;
+	allocInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to allocate upload command buffer!");
+	}
+
+	return commandBuffer;
+}
+
+void VulkanUploader::beginBatch()
+{
+	if (recording)
+	{
+		return;
+	}
+
+	if (current.graphicsCommandBuffer == VK_NULL_HANDLE)
+	{
+		retireCompleted();
+
+		if (!freeBatches.empty())
+		{
+			current = std::move(freeBatches.back());
+			freeBatches.pop_back();
+		}
+		else
+		{
+			current.graphicsCommandBuffer = allocateCommandBuffer(graphicsCommandPool);
+
+			if (hasDedicatedTransferQueue())
+			{
+				current.transferCommandBuffer = allocateCommandBuffer(transferCommandPool);
+				current.acquireCommandBuffer = allocateCommandBuffer(graphicsCommandPool);
+
+				VkSemaphoreCreateInfo semaphoreInfo = {};
+				semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+				if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &current.transferComplete) != VK_SUCCESS)
+				{
+					throw std::runtime_error("failed to create upload semaphore!");
+				}
+			}
+			else
+			{
+				current.transferCommandBuffer = current.graphicsCommandBuffer;
+				current.acquireCommandBuffer = current.graphicsCommandBuffer;
+			}
+
+			VkFenceCreateInfo fenceInfo = {};
+			fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+			if (vkCreateFence(device, &fenceInfo, nullptr, &current.fence) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create upload fence!");
+			}
+
+			if (hasDedicatedTransferQueue() && vkCreateFence(device, &fenceInfo, nullptr, &current.transferFence) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to create transfer fence!");
+			}
+		}
+	}
+
+	current.ticket = currentTicket;
+	current.ringUsed = 0;
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	// The pools allow individual resets, so beginning implicitly resets a recycled buffer
+	if (vkBeginCommandBuffer(current.graphicsCommandBuffer, &beginInfo) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to begin recording upload command buffer!");
+	}
+
+	if (hasDedicatedTransferQueue() && vkBeginCommandBuffer(current.transferCommandBuffer, &beginInfo) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to begin recording transfer command buffer!");
+	}
+
+	recording = true;
+}
+
+void VulkanUploader::recordOwnershipTransfers()
+{
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	if (vkBeginCommandBuffer(current.acquireCommandBuffer, &beginInfo) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to begin recording acquire command buffer!");
+	}
+
+	if (!bufferReleases.empty() || !imageReleases.empty())
+	{
+		/*
+		The release half only makes the writes available, the acquire half makes them visible to
+		the stages that read the resource on the graphics queue. Both must use identical ranges,
+		queue family indices and layouts. The acquire starts at the stages the hand-over waits on
+		the transfer semaphore with.
+		*/
+		std::vector<VkBufferMemoryBarrier> bufferAcquires = bufferReleases;
+		std::vector<VkImageMemoryBarrier> imageAcquires = imageReleases;
+
+		for (VkBufferMemoryBarrier& barrier : bufferReleases)
+		{
+			barrier.dstAccessMask = 0;
+		}
+		for (VkImageMemoryBarrier& barrier : imageReleases)
+		{
+			barrier.dstAccessMask = 0;
+		}
+		for (VkBufferMemoryBarrier& barrier : bufferAcquires)
+		{
+			barrier.srcAccessMask = 0;
+		}
+		for (VkImageMemoryBarrier& barrier : imageAcquires)
+		{
+			barrier.srcAccessMask = 0;
+		}
+
+		vkCmdPipelineBarrier(
+			current.transferCommandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			0,
+			0, nullptr,
+			static_cast<uint32_t>(bufferReleases.size()), bufferReleases.data(),
+			static_cast<uint32_t>(imageReleases.size()), imageReleases.data()
+		);
+
+		vkCmdPipelineBarrier(
+			current.acquireCommandBuffer,
+			acquireStages, acquireStages,
+			0,
+			0, nullptr,
+			static_cast<uint32_t>(bufferAcquires.size()), bufferAcquires.data(),
+			static_cast<uint32_t>(imageAcquires.size()), imageAcquires.data()
+		);
+	}
+
+	if (vkEndCommandBuffer(current.acquireCommandBuffer) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to record acquire command buffer!");
+	}
+
+	bufferReleases.clear();
+	imageReleases.clear();
+	acquireStages = 0;
+}
+
+void VulkanUploader::handOver(UploadBatch& batch)
+{
+	// Only the stages reading the released resources wait, BOTTOM_OF_PIPE if the graphics side reads none
+	VkCommandBuffer graphicsCommandBuffers[] = { batch.acquireCommandBuffer, batch.graphicsCommandBuffer };
+	VkPipelineStageFlags waitStage = batch.acquireStages != 0 ? batch.acquireStages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.waitSemaphoreCount = 1;
+	submitInfo.pWaitSemaphores = &batch.transferComplete;
+	submitInfo.pWaitDstStageMask = &waitStage;
+	submitInfo.commandBufferCount = 2;
+	submitInfo.pCommandBuffers = graphicsCommandBuffers;
+
+	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, batch.fence) != VK_SUCCESS)
+	{
+		throw std::runtime_error("failed to submit upload command buffer!");
+	}
+
+	batch.handedOver = true;
+	handedOverTicket = batch.ticket;
+}
+
+void VulkanUploader::retire(UploadBatch& batch)
+{
+	// Batches complete in submission order, so the ring tail simply follows them
+	ringTail = batch.ringHead;
+	ringUsed -= batch.ringUsed;
+	completedTicket = batch.ticket;
+
+	for (std::function<void()>& release : batch.releases)
+	{
+		release();
+	}
+	batch.releases.clear();
+
+	vkResetFences(device, 1, &batch.fence);
+	if (batch.transferFence != VK_NULL_HANDLE)
+	{
+		vkResetFences(device, 1, &batch.transferFence);
+	}
+	batch.acquireStages = 0;
+	batch.handedOver = false;
+}
+
+void VulkanUploader::retireCompleted()
+{
+	while (!inFlight.empty() && inFlight.front().handedOver && vkGetFenceStatus(device, inFlight.front().fence) == VK_SUCCESS)
+	{
+		retire(inFlight.front());
+		freeBatches.push_back(std::move(inFlight.front()));
+		inFlight.pop_front();
+	}
+}
+
+void VulkanUploader::waitOldest()
+{
+	if (inFlight.empty())
+	{
+		return;
+	}
+
+	// Never handed over on its own, the ring needs the space back
+	if (!inFlight.front().handedOver)
+	{
+		handOver(inFlight.front());
+	}
+
+	vkWaitForFences(device, 1, &inFlight.front().fence, VK_TRUE, UINT64_MAX);
+	retire(inFlight.front());
+	freeBatches.push_back(std::move(inFlight.front()));
+	inFlight.pop_front();
+}
+
+void VulkanUploader::destroyBatch(UploadBatch& batch)
+{
+	if (batch.fence != VK_NULL_HANDLE)
+	{
+		vkDestroyFence(device, batch.fence, nullptr);
+	}
+	if (batch.transferFence != VK_NULL_HANDLE)
+	{
+		vkDestroyFence(device, batch.transferFence, nullptr);
+	}
+	if (batch.transferComplete != VK_NULL_HANDLE)
+	{
+		vkDestroySemaphore(device, batch.transferComplete, nullptr);
+	}
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include "vAllocator.h"
+
+typedef uint64_t UploadTicket;
+
+struct StagingRegion
+{
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	void* data = nullptr;
+};
+
+/*
+Batched upload queue replacing one command buffer, submit and vkQueueWaitIdle per copy.
+
+Source data is written into a persistently mapped staging ring and the copies are recorded into
+a setup command buffer. flush() submits everything recorded so far and returns a ticket; callers
+only block in wait() when they actually need the result on the CPU side. Ring space is reclaimed
+as the fences of older batches signal.
+
+If the device has a separate transfer queue family, copies run there on their own timeline.
+Resources written on the transfer queue are released to the graphics family at the end of the
+transfer command buffer. The graphics side of the batch, which starts with the matching acquires,
+is only handed over to the graphics queue by update() once the transfer fence has signaled, or by
+acquire() for data the next frame cannot do without. It waits on the transfer semaphore at the
+stages that read the released resources, so frames never wait on copies they do not use. Without
+a separate family both sides are the same command buffer, submitted to the graphics queue by
+flush(), and no ownership transfer is recorded.
+
+isComplete() tells when frames submitted from now on see a batch. Consumers keep drawing the old
+data until then and switch in their own per frame update.
+*/
+class VulkanUploader
+{
+public:
+	VulkanUploader(VkDevice device, VkQueue graphicsQueue, uint32_t graphicsFamily, VkQueue transferQueue, uint32_t transferFamily, VulkanAllocator& allocator, VkDeviceSize ringSize = DEFAULT_RING_SIZE);
+	~VulkanUploader();
+
+	static const VkDeviceSize DEFAULT_RING_SIZE = 64ull * 1024 * 1024;
+
+	bool hasDedicatedTransferQueue() const { return transferFamily != graphicsFamily; }
+
+	// Reserves staging memory that stays valid until the current batch has completed
+	StagingRegion allocateStaging(VkDeviceSize size, VkDeviceSize alignment = 16);
+
+	// dstBuffer must not be in use by the graphics queue, ownership moves to the graphics family
+	void uploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+	// Same for data the caller wrote into staging itself, e.g. converted while copying
+	void copyBuffer(const StagingRegion& staging, VkBuffer dstBuffer, VkDeviceSize dstOffset, VkDeviceSize size);
+
+	// Copies and transfer-only layout transitions of the current batch
+	VkCommandBuffer getTransferCommandBuffer();
+	// Blits and transitions that need a graphics queue, executed after the transfer side
+	VkCommandBuffer getGraphicsCommandBuffer();
+
+	// Hands an image written on the transfer side over to the graphics side in the given layout
+	void releaseImage(VkImage image, VkImageLayout layout, const VkImageSubresourceRange& range, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess);
+
+	// Runs release once the GPU is done with the current batch, for resources only its commands use
+	void releaseWithBatch(std::function<void()> release);
+
+	UploadTicket getCurrentTicket() const { return currentTicket; }
+	UploadTicket flush();
+	// Once per frame before recording, hands over the batches whose copies have finished
+	void update();
+	// Hands over the batches up to ticket without waiting for their copies on the CPU
+	void acquire(UploadTicket ticket);
+	// True once work submitted to the graphics queue from now on is ordered after the batch
+	bool isComplete(UploadTicket ticket);
+	void wait(UploadTicket ticket);
+	void waitIdle();
+
+private:
+	struct UploadBatch
+	{
+		// All three are the same command buffer without a dedicated transfer queue
+		VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
+		VkCommandBuffer acquireCommandBuffer = VK_NULL_HANDLE;
+		VkCommandBuffer graphicsCommandBuffer = VK_NULL_HANDLE;
+		VkSemaphore transferComplete = VK_NULL_HANDLE;
+		// Signaled by the transfer submission, the graphics side signals fence
+		VkFence transferFence = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+		UploadTicket ticket = 0;
+
+		// Stages of the graphics side that read what the transfer side released
+		VkPipelineStageFlags acquireStages = 0;
+		bool handedOver = false;
+
+		// Staging ring bytes reserved by this batch and the ring head when it was submitted
+		VkDeviceSize ringUsed = 0;
+		VkDeviceSize ringHead = 0;
+
+		// Temporary staging buffers and whatever else was handed to releaseWithBatch
+		std::vector<std::function<void()>> releases;
+	};
+
+	VkDevice device;
+	VkQueue graphicsQueue;
+	VkQueue transferQueue;
+	uint32_t graphicsFamily;
+	uint32_t transferFamily;
+	VulkanAllocator& allocator;
+
+	VkCommandPool graphicsCommandPool;
+	VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+
+	VkBuffer ringBuffer;
+	MemoryAllocation ringMemory;
+	VkDeviceSize ringSize;
+	VkDeviceSize ringHead = 0;
+	VkDeviceSize ringTail = 0;
+	VkDeviceSize ringUsed = 0;
+
+	UploadBatch current;
+	bool recording = false;
+	UploadTicket currentTicket = 1;
+	UploadTicket completedTicket = 0;
+	UploadTicket handedOverTicket = 0;
+
+	// Ownership transfers of the current batch, recorded when it is flushed
+	std::vector<VkBufferMemoryBarrier> bufferReleases;
+	std::vector<VkImageMemoryBarrier> imageReleases;
+	VkPipelineStageFlags acquireStages = 0;
+
+	// Submitted batches in order, the handed over ones first
+	std::deque<UploadBatch> inFlight;
+	std::vector<UploadBatch> freeBatches;
+
+	VkBuffer createStagingBuffer(VkDeviceSize size, MemoryAllocation& allocation);
+	bool tryAllocateRing(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+	VkCommandBuffer allocateCommandBuffer(VkCommandPool pool);
+	void beginBatch();
+	void recordOwnershipTransfers();
+	void handOver(UploadBatch& batch);
+	void retire(UploadBatch& batch);
+	void retireCompleted();
+	void waitOldest();
+	void destroyBatch(UploadBatch& batch);
+};
@@ -0,0 +1,126 @@
+#include "Scene.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+void InstanceBatch::markDirty(uint32_t index)
+{
+	dirtyBegin = std::min(dirtyBegin, index);
+	dirtyEnd = std::max(dirtyEnd, index + 1);
+}
+
+void InstanceBatch::clearDirty()
+{
+	dirtyBegin = UINT32_MAX;
+	dirtyEnd = 0;
+}
+
+Scene::Scene()
+{
+}
+
+
+Scene::~Scene()
+{
+}
+
+InstanceHandle Scene::addInstance(uint32_t meshIndex, const glm::mat4& transform, const glm::vec4& tint, uint32_t material)
+{
+	if (meshIndex >= batches.size())
+	{
+		batches.resize(meshIndex + 1);
+		for (uint32_t i = 0; i < batches.size(); i++)
+		{
+			batches[i].meshIndex = i;
+		}
+	}
+
+	InstanceBatch& batch = batches[meshIndex];
+
+	InstanceHandle handle;
+	if (!freeHandles.empty())
+	{
+		handle = freeHandles.back();
+		freeHandles.pop_back();
+	}
+	else
+	{
+		handle = static_cast<InstanceHandle>(slots.size());
+		slots.push_back({});
+	}
+
+	uint32_t index = static_cast<uint32_t>(batch.instances.size());
+	slots[handle] = { meshIndex, index };
+
+	InstanceData instance = {};
+	instance.transform = transform;
+	instance.tint = tint;
+	instance.material = material;
+	batch.instances.push_back(instance);
+	batch.handles.push_back(handle);
+	batch.markDirty(index);
+
+	return handle;
+}
+
+void Scene::removeInstance(InstanceHandle handle)
+{
+	InstanceSlot slot = slots[handle];
+	if (slot.batch == UINT32_MAX)
+	{
+		throw std::invalid_argument("instance was already removed!");
+	}
+
+	InstanceBatch& batch = batches[slot.batch];
+	uint32_t last = static_cast<uint32_t>(batch.instances.size() - 1);
+
+	// Keep the array dense: the last instance takes over the freed slot
+	if (slot.index != last)
+	{
+		batch.instances[slot.index] = batch.instances[last];
+		batch.handles[slot.index] = batch.handles[last];
+		slots[batch.handles[slot.index]].index = slot.index;
+		batch.markDirty(slot.index);
+	}
+
+	batch.instances.pop_back();
+	batch.handles.pop_back();
+
+	// Nothing past the end is drawn, so the dirty range never needs to reach beyond it
+	batch.dirtyEnd = std::min(batch.dirtyEnd, last);
+
+	slots[handle] = { UINT32_MAX, UINT32_MAX };
+	freeHandles.push_back(handle);
+}
+
+void Scene::setTransform(InstanceHandle handle, const glm::mat4& transform)
+{
+	InstanceSlot slot = slots[handle];
+	batches[slot.batch].instances[slot.index].transform = transform;
+	batches[slot.batch].markDirty(slot.index);
+}
+
+void Scene::setTint(InstanceHandle handle, const glm::vec4& tint)
+{
+	InstanceSlot slot = slots[handle];
+	batches[slot.batch].instances[slot.index].tint = tint;
+	batches[slot.batch].markDirty(slot.index);
+}
+
+void Scene::setMaterial(InstanceHandle handle, uint32_t material)
+{
+	InstanceSlot slot = slots[handle];
+	batches[slot.batch].instances[slot.index].material = material;
+	batches[slot.batch].markDirty(slot.index);
+}
+
+uint32_t Scene::getInstanceCount() const
+{
+	size_t count = 0;
+	for (const InstanceBatch& batch : batches)
+	{
+		count += batch.instances.size();
+	}
+
+	return static_cast<uint32_t>(count);
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Pushed once per pass, the indirect draws of a pass share it. Has to match DrawConstants in shader.vert
+struct DrawPushConstants
+{
+	glm::mat4 model;
+	uint32_t drawId;
+};
+
+// Per-instance attribute stream, has to match the instance inputs in shader.vert
+struct InstanceData
+{
+	glm::mat4 transform;
+	glm::vec4 tint;
+	// Texture coordinate dequantization of the mesh, xy scale and zw offset. Like the transform's
+	// position dequantization it is filled in by the culling pass, the scene leaves it alone
+	glm::vec4 texCoordTransform;
+	// Texture table index, the asset loader's texture id
+	uint32_t material;
+	// Keeps the stride a multiple of 16 bytes for the std430 arrays in cull.comp
+	uint32_t pad[3];
+
+	static const uint32_t BINDING = 1;
+
+	static VkVertexInputBindingDescription getBindingDescription()
+	{
+		VkVertexInputBindingDescription bindingDescription = {};
+		bindingDescription.binding = BINDING;
+		bindingDescription.stride = sizeof(InstanceData);
+		// Move to the next data entry after each instance
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+		return bindingDescription;
+	}
+
+	// A mat4 attribute occupies four consecutive locations, one per column
+	static std::array<VkVertexInputAttributeDescription, 7> getAttributeDescriptions()
+	{
+		std::array<VkVertexInputAttributeDescription, 7> attributeDescriptions = {};
+
+		for (uint32_t column = 0; column < 4; column++)
+		{
+			attributeDescriptions[column].binding = BINDING;
+			attributeDescriptions[column].location = 3 + column;
+			attributeDescriptions[column].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+			attributeDescriptions[column].offset = static_cast<uint32_t>(offsetof(InstanceData, transform) + sizeof(glm::vec4) * column);
+		}
+
+		attributeDescriptions[4].binding = BINDING;
+		attributeDescriptions[4].location = 7;
+		attributeDescriptions[4].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		attributeDescriptions[4].offset = offsetof(InstanceData, tint);
+
+		attributeDescriptions[5].binding = BINDING;
+		attributeDescriptions[5].location = 8;
+		attributeDescriptions[5].format = VK_FORMAT_R32_UINT;
+		attributeDescriptions[5].offset = offsetof(InstanceData, material);
+
+		attributeDescriptions[6].binding = BINDING;
+		attributeDescriptions[6].location = 9;
+		attributeDescriptions[6].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		attributeDescriptions[6].offset = offsetof(InstanceData, texCoordTransform);
+
+		return attributeDescriptions;
+	}
+};
+
+typedef uint32_t InstanceHandle;
+
+/*
+All instances of one mesh, drawn with a single (indirect) instanced draw call.
+Instances are kept densely packed so the GPU copy is one contiguous array; removing an instance
+moves the last one into its slot. Changes are accumulated into one dirty index range that the
+renderer uploads and clears once per frame.
+*/
+struct InstanceBatch
+{
+	uint32_t meshIndex = 0;
+	// Applied to every instance of the batch, folded into the instance transforms by the culling pass
+	glm::mat4 transform = glm::mat4(1.0f);
+
+	std::vector<InstanceData> instances;
+	std::vector<InstanceHandle> handles;
+
+	uint32_t dirtyBegin = UINT32_MAX;
+	uint32_t dirtyEnd = 0;
+
+	bool isDirty() const { return dirtyBegin < dirtyEnd; }
+	void markDirty(uint32_t index);
+	void clearDirty();
+};
+
+class Scene
+{
+public:
+	Scene();
+	~Scene();
+
+	InstanceHandle addInstance(uint32_t meshIndex, const glm::mat4& transform, const glm::vec4& tint = glm::vec4(1.0f), uint32_t material = 0);
+	void removeInstance(InstanceHandle handle);
+
+	void setTransform(InstanceHandle handle, const glm::mat4& transform);
+	void setTint(InstanceHandle handle, const glm::vec4& tint);
+	void setMaterial(InstanceHandle handle, uint32_t material);
+
+	uint32_t getInstanceCount() const;
+
+	// Indexed by mesh
+	std::vector<InstanceBatch> batches;
+
+private:
+	struct InstanceSlot
+	{
+		uint32_t batch;
+		uint32_t index;
+	};
+
+	std::vector<InstanceSlot> slots;
+	std::vector<InstanceHandle> freeHandles;
+};
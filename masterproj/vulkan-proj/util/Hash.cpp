@@ -0,0 +1,25 @@
+#include "Hash.h"
+#include "MappedFile.h"
+
+uint64_t Hash::hashFile(const std::string& path)
+{
+	MappedFile file(path);
+	if (!file.isOpen())
+	{
+		return 0;
+	}
+
+	return hashBytes(file.getData(), file.getSize());
+}
+
+uint64_t Hash::hashBytes(const void* data, size_t size, uint64_t hash)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 64 bit FNV-1a, used to tell whether cooked files are still up to date with their source
+class Hash
+{
+public:
+	static const uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ull;
+
+	// Hash of the whole file, 0 if it cannot be read
+	static uint64_t hashFile(const std::string& path);
+	// Continues a hash over more bytes, e.g. settings that change the cooked output
+	static uint64_t hashBytes(const void* data, size_t size, uint64_t hash = FNV_OFFSET_BASIS);
+};
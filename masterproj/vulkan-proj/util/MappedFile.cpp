@@ -0,0 +1,113 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path)
+{
+	HANDLE fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+	{
+		return;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize))
+	{
+		CloseHandle(fileHandle);
+		return;
+	}
+
+	file = fileHandle;
+	size = static_cast<size_t>(fileSize.QuadPart);
+	opened = true;
+
+	// Empty files cannot be mapped, they are open with no data
+	if (size == 0)
+	{
+		return;
+	}
+
+	mapping = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping != nullptr)
+	{
+		data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+
+	if (data == nullptr)
+	{
+		opened = false;
+		size = 0;
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	if (data != nullptr)
+	{
+		UnmapViewOfFile(data);
+	}
+	if (mapping != nullptr)
+	{
+		CloseHandle(mapping);
+	}
+	if (file != nullptr)
+	{
+		CloseHandle(file);
+	}
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path)
+{
+	int descriptor = open(path.c_str(), O_RDONLY);
+	if (descriptor < 0)
+	{
+		return;
+	}
+
+	struct stat status;
+	if (fstat(descriptor, &status) == 0)
+	{
+		size = static_cast<size_t>(status.st_size);
+		opened = true;
+
+		if (size > 0)
+		{
+			void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+			if (mapped != MAP_FAILED)
+			{
+				data = mapped;
+			}
+			else
+			{
+				opened = false;
+				size = 0;
+			}
+		}
+	}
+
+	// The mapping stays valid after the descriptor is closed
+	close(descriptor);
+}
+
+MappedFile::~MappedFile()
+{
+	if (data != nullptr)
+	{
+		munmap(data, size);
+	}
+}
+
+#endif
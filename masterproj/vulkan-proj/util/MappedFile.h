@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/*
+Read-only memory mapping of a whole file.
+The pages are loaded by the OS on first access, so nothing is read up front. A file that does not
+exist or cannot be mapped leaves the object closed instead of throwing; callers decide whether
+that is an error.
+*/
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string& path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool isOpen() const { return opened; }
+
+	const char* getData() const { return static_cast<const char*>(data); }
+	size_t getSize() const { return size; }
+
+private:
+	void* data = nullptr;
+	size_t size = 0;
+	bool opened = false;
+
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#endif
+};
@@ -0,0 +1,115 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint32_t workerCount)
+{
+	if (workerCount == 0)
+	{
+		uint32_t hardwareThreads = std::thread::hardware_concurrency();
+		workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+	}
+
+	for (uint32_t i = 0; i < workerCount; i++)
+	{
+		workers.emplace_back(&ThreadPool::workerLoop, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	workAvailable.notify_all();
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+void ThreadPool::parallelFor(uint32_t taskCount, const std::function<void(uint32_t)>& task)
+{
+	if (taskCount == 0)
+	{
+		return;
+	}
+
+	// Not worth waking anybody up
+	if (taskCount == 1)
+	{
+		task(0);
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	Job job = { &task, taskCount, 0, taskCount, nullptr };
+	jobs.push_back(&job);
+
+	workAvailable.notify_all();
+
+	while (job.nextTask < job.size)
+	{
+		runTask(job, lock);
+	}
+
+	// Workers may still be running the last tasks, the job has to outlive them
+	workDone.wait(lock, [&job]() { return job.pendingTasks == 0; });
+
+	if (job.error)
+	{
+		std::rethrow_exception(job.error);
+	}
+}
+
+void ThreadPool::workerLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true)
+	{
+		workAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+
+		if (stopping)
+		{
+			return;
+		}
+
+		runTask(*jobs.back(), lock);
+	}
+}
+
+void ThreadPool::runTask(Job& job, std::unique_lock<std::mutex>& lock)
+{
+	uint32_t index = job.nextTask++;
+	if (job.nextTask == job.size)
+	{
+		jobs.erase(std::find(jobs.begin(), jobs.end(), &job));
+	}
+
+	lock.unlock();
+	std::exception_ptr thrown;
+	try
+	{
+		(*job.task)(index);
+	}
+	catch (...)
+	{
+		thrown = std::current_exception();
+	}
+	lock.lock();
+
+	if (thrown && !job.error)
+	{
+		job.error = thrown;
+	}
+
+	// Every caller waits on the same condition for its own job
+	if (--job.pendingTasks == 0)
+	{
+		workDone.notify_all();
+	}
+}
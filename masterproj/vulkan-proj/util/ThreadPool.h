@@ -0,0 +1,55 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+Fixed set of worker threads for fork/join style work, meant to be the only one in the process.
+parallelFor() hands out task indices to the workers and to the calling thread, and returns once
+all of them ran. The first exception thrown by a task is rethrown on the calling thread.
+Several threads may run parallelFor() at once. A calling thread only runs tasks of its own job;
+workers take tasks from the newest job first, so a short job like recording a frame does not wait
+behind a long one like cooking a texture.
+*/
+class ThreadPool
+{
+public:
+	// 0 picks one worker per hardware thread besides the calling one
+	explicit ThreadPool(uint32_t workerCount = 0);
+	~ThreadPool();
+
+	// Threads that execute tasks, workers plus the calling thread
+	uint32_t getThreadCount() const { return static_cast<uint32_t>(workers.size()) + 1; }
+
+	void parallelFor(uint32_t taskCount, const std::function<void(uint32_t)>& task);
+
+private:
+	// Lives on the stack of its parallelFor() call
+	struct Job
+	{
+		const std::function<void(uint32_t)>* task;
+		uint32_t size;
+		uint32_t nextTask;
+		uint32_t pendingTasks;
+		std::exception_ptr error;
+	};
+
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable workAvailable;
+	std::condition_variable workDone;
+
+	// Jobs with tasks left to hand out, oldest first, guarded by mutex
+	std::vector<Job*> jobs;
+	bool stopping = false;
+
+	void workerLoop();
+	// Runs the next task of job, called with the lock held
+	void runTask(Job& job, std::unique_lock<std::mutex>& lock);
+};